@@ -0,0 +1,40 @@
+#include <fstream>
+#include <iostream>
+
+#include "engine.h"
+
+// Translates a MiniBasic program into a C++ translation unit that builds
+// into a standalone executable, e.g.
+//   mini_basic_cc primes.bas primes.cpp && c++ -O2 primes.cpp -o primes
+int main(int argc, char *argv[]) {
+  if (argc < 2 || argc > 3) {
+    std::cerr << "usage: " << argv[0] << " <program.bas> [<output.cpp>]\n";
+    return 2;
+  }
+
+  std::fstream in(argv[1], std::ios::in);
+  if (!in.good()) {
+    std::cerr << "cannot read " << argv[1] << '\n';
+    return 1;
+  }
+  auto engine = engine::MiniBasic();
+  engine.load_source(in);
+
+  auto cpp = engine.get_cpp_copy();
+  if (cpp.empty()) {
+    std::cerr << argv[1] << " uses statements that cannot be translated\n";
+    return 1;
+  }
+
+  if (argc == 2) {
+    std::cout << cpp;
+    return 0;
+  }
+  std::fstream out(argv[2], std::ios::out);
+  out << cpp;
+  if (!out.good()) {
+    std::cerr << "cannot write " << argv[2] << '\n';
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,102 @@
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "engine.h"
+
+// Runs a sieve of Eratosthenes on each execution tier twice: once with
+// bounds the analysis can follow, so every element access skips its bounds
+// check, and once with the bound hidden behind ** so every access is
+// checked. Reports the best wall time of each and the speedup.
+// Usage: bench_arrays [size] [repetitions]
+
+namespace {
+
+struct TierInfo {
+  const char* name;
+  engine::Tier tier;
+};
+
+const TierInfo tiers[] = {
+    {"tree walker", engine::Tier::TreeWalker},
+    {"closure", engine::Tier::Closure},
+    {"bytecode", engine::Tier::Bytecode},
+    {"bytecode/switch", engine::Tier::BytecodeSwitch},
+    {"jit", engine::Tier::Jit},
+};
+
+// `bound` is the sieve's size as the program spells it
+Str sieve(const Str& bound) {
+  std::stringstream source;
+  source << "10 LET n = " << bound << '\n'
+         << "20 DIM f(n)\n"
+            "30 LET c = 0\n"
+            "35 LET m = n / 2\n"
+            "40 FOR i = 2 TO n\n"
+            "50 IF f(i) = 1 THEN 110\n"
+            "60 LET c = c + 1\n"
+            "70 IF i > m THEN 110\n"
+            "80 FOR j = i + i TO n STEP i\n"
+            "90 LET f(j) = 1\n"
+            "100 NEXT j\n"
+            "110 NEXT i\n"
+            "120 PRINT c\n";
+  return source.str();
+}
+
+struct Result {
+  double milliseconds;
+  Str output;
+};
+
+Result measure(const Str& source, engine::Tier tier, int repetitions) {
+  auto engine = engine::MiniBasic();
+  std::stringstream in(source);
+  engine.load_source(in);
+  engine.set_tier(tier);
+
+  auto best = Result{1e300, {}};
+  for (int i{}; i < repetitions; ++i) {
+    Str output;
+    engine.reset_pc();
+    auto begin = std::chrono::steady_clock::now();
+    engine.run(output);
+    auto end = std::chrono::steady_clock::now();
+    auto ms = std::chrono::duration<double, std::milli>(end - begin).count();
+    if (ms < best.milliseconds) {
+      best = Result{ms, std::move(output)};
+    }
+  }
+  return best;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  auto size = argc > 1 ? std::stoll(argv[1]) : 4000000;
+  auto repetitions = argc > 2 ? std::stoi(argv[2]) : 3;
+
+  std::cout << std::left << std::setw(18) << "tier" << std::right
+            << std::setw(14) << "proven ms" << std::setw(14) << "checked ms"
+            << std::setw(10) << "speedup" << '\n';
+  std::cout << std::fixed << std::setprecision(2);
+
+  auto ok = true;
+  for (const auto& tier : tiers) {
+    auto proven = measure(sieve(std::to_string(size)), tier.tier, repetitions);
+    auto checked =
+        measure(sieve(std::to_string(size) + " ** 1"), tier.tier, repetitions);
+    if (proven.output != checked.output) {
+      std::cerr << tier.name << ": proven printed " << proven.output
+                << "but checked printed " << checked.output;
+      ok = false;
+    }
+    std::cout << std::left << std::setw(18) << tier.name << std::right
+              << std::setw(14) << proven.milliseconds << std::setw(14)
+              << checked.milliseconds << std::setw(9)
+              << checked.milliseconds / proven.milliseconds << "x\n";
+  }
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
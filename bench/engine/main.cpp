@@ -0,0 +1,94 @@
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+#include "engine.h"
+
+// Runs every program of the benchmark corpus on each execution tier and
+// reports the best wall time and the speedup over the tree walker.
+// Usage: bench_engine [program directory] [repetitions]
+
+namespace {
+
+struct TierInfo {
+  const char* name;
+  engine::Tier tier;
+};
+
+const TierInfo tiers[] = {
+    {"tree walker", engine::Tier::TreeWalker},
+    {"closure", engine::Tier::Closure},
+    {"bytecode", engine::Tier::Bytecode},
+    {"bytecode/switch", engine::Tier::BytecodeSwitch},
+    {"jit", engine::Tier::Jit},
+};
+
+struct Result {
+  double milliseconds;
+  Str output;
+};
+
+Result measure(const std::filesystem::path& path, engine::Tier tier,
+               int repetitions) {
+  auto engine = engine::MiniBasic();
+  std::fstream in(path, std::ios::in);
+  engine.load_source(in);
+  engine.set_tier(tier);
+
+  auto best = Result{1e300, {}};
+  for (int i{}; i < repetitions; ++i) {
+    Str output;
+    engine.reset_pc();
+    auto begin = std::chrono::steady_clock::now();
+    engine.run(output);
+    auto end = std::chrono::steady_clock::now();
+    auto ms = std::chrono::duration<double, std::milli>(end - begin).count();
+    if (ms < best.milliseconds) {
+      best = Result{ms, std::move(output)};
+    }
+  }
+  return best;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  auto directory = std::filesystem::path(argc > 1 ? argv[1] : BENCH_PROGRAM_DIR);
+  auto repetitions = argc > 2 ? std::stoi(argv[2]) : 3;
+
+  Vec<std::filesystem::path> programs;
+  for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+    if (entry.path().extension() == ".bas") {
+      programs.push_back(entry.path());
+    }
+  }
+  std::sort(programs.begin(), programs.end());
+
+  std::cout << std::left << std::setw(16) << "program" << std::setw(18)
+            << "tier" << std::right << std::setw(12) << "ms" << std::setw(10)
+            << "speedup" << '\n';
+
+  auto ok = true;
+  for (const auto& program : programs) {
+    auto baseline = measure(program, engine::Tier::TreeWalker, repetitions);
+    for (const auto& tier : tiers) {
+      auto result = tier.tier == engine::Tier::TreeWalker
+                        ? baseline
+                        : measure(program, tier.tier, repetitions);
+      std::cout << std::left << std::setw(16) << program.stem().string()
+                << std::setw(18) << tier.name << std::right << std::setw(12)
+                << std::fixed << std::setprecision(3) << result.milliseconds
+                << std::setw(9) << std::setprecision(2)
+                << baseline.milliseconds / result.milliseconds << 'x';
+      if (result.output != baseline.output) {
+        std::cout << "  output differs from the tree walker";
+        ok = false;
+      }
+      std::cout << '\n';
+    }
+  }
+  return ok ? 0 : 1;
+}
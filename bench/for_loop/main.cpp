@@ -0,0 +1,111 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "engine.h"
+
+// Sums 1..n with a FOR/NEXT loop and with the same loop written as LET and
+// IF ... THEN on each execution tier, and reports the best wall time and
+// iterations per second of each.
+// Usage: bench_for_loop [iterations] [repetitions]
+
+namespace {
+
+struct TierInfo {
+  const char* name;
+  engine::Tier tier;
+};
+
+const TierInfo tiers[] = {
+    {"tree walker", engine::Tier::TreeWalker},
+    {"closure", engine::Tier::Closure},
+    {"bytecode", engine::Tier::Bytecode},
+    {"bytecode/switch", engine::Tier::BytecodeSwitch},
+    {"jit", engine::Tier::Jit},
+};
+
+Str for_loop(int64_t iterations) {
+  std::stringstream source;
+  source << "10 LET n = " << iterations << '\n'
+         << "20 LET s = 0\n"
+            "30 FOR i = 1 TO n\n"
+            "40 LET s = s + i\n"
+            "50 NEXT i\n"
+            "60 PRINT s\n";
+  return source.str();
+}
+
+Str goto_loop(int64_t iterations) {
+  std::stringstream source;
+  source << "10 LET m = " << iterations + 1 << '\n'
+         << "20 LET s = 0\n"
+            "30 LET i = 1\n"
+            "40 LET s = s + i\n"
+            "50 LET i = i + 1\n"
+            "60 IF i < m THEN 40\n"
+            "70 PRINT s\n";
+  return source.str();
+}
+
+struct Result {
+  double milliseconds;
+  Str output;
+};
+
+Result measure(const Str& source, engine::Tier tier, int repetitions) {
+  auto engine = engine::MiniBasic();
+  std::stringstream in(source);
+  engine.load_source(in);
+  engine.set_tier(tier);
+
+  auto best = Result{1e300, {}};
+  for (int i{}; i < repetitions; ++i) {
+    Str output;
+    engine.reset_pc();
+    auto begin = std::chrono::steady_clock::now();
+    engine.run(output);
+    auto end = std::chrono::steady_clock::now();
+    auto ms = std::chrono::duration<double, std::milli>(end - begin).count();
+    if (ms < best.milliseconds) {
+      best = Result{ms, std::move(output)};
+    }
+  }
+  return best;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  auto iterations = argc > 1 ? std::stoll(argv[1]) : 10000000;
+  auto repetitions = argc > 2 ? std::stoi(argv[2]) : 3;
+
+  std::cout << std::left << std::setw(18) << "tier" << std::right
+            << std::setw(12) << "FOR ms" << std::setw(12) << "GOTO ms"
+            << std::setw(14) << "FOR Mit/s" << std::setw(14) << "GOTO Mit/s"
+            << std::setw(10) << "speedup" << '\n';
+  std::cout << std::fixed << std::setprecision(2);
+
+  auto ok = true;
+  for (const auto& tier : tiers) {
+    auto with_for = measure(for_loop(iterations), tier.tier, repetitions);
+    auto with_goto = measure(goto_loop(iterations), tier.tier, repetitions);
+    if (with_for.output != with_goto.output) {
+      std::cerr << tier.name << ": FOR printed " << with_for.output
+                << "but GOTO printed " << with_goto.output;
+      ok = false;
+    }
+    auto rate = [iterations](double ms) {
+      return static_cast<double>(iterations) / ms / 1000;
+    };
+    std::cout << std::left << std::setw(18) << tier.name << std::right
+              << std::setw(12) << with_for.milliseconds << std::setw(12)
+              << with_goto.milliseconds << std::setw(14)
+              << rate(with_for.milliseconds) << std::setw(14)
+              << rate(with_goto.milliseconds) << std::setw(9)
+              << with_goto.milliseconds / with_for.milliseconds << "x\n";
+  }
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
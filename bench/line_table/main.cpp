@@ -0,0 +1,210 @@
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+#include "engine.h"
+
+// Compares the engine's line table, and the flat table the tiers run, with
+// the std::map they replaced on a line table's work: loading lines, listing
+// them in order, jumping to random lines as GOTO does and stepping line by
+// line as the tree walker does. Then times LOAD, LIST and a run of the same
+// program in the engine.
+// Usage: bench_line_table [lines] [repetitions]
+
+namespace {
+
+template <typename Function>
+double best_of(int repetitions, Function function) {
+  auto best = 1e300;
+  for (int i{}; i < repetitions; ++i) {
+    auto begin = std::chrono::steady_clock::now();
+    function();
+    auto end = std::chrono::steady_clock::now();
+    best = std::min(
+        best, std::chrono::duration<double, std::milli>(end - begin).count());
+  }
+  return best;
+}
+
+// The operations both tables are timed on
+struct StdMapTable {
+  static constexpr bool kShuffledLoad = true;
+  Map<int64_t, engine::Line> lines;
+
+  void insert(int64_t line, engine::Line value) {
+    lines.insert_or_assign(line, std::move(value));
+  }
+  const engine::Line* find(int64_t line) const {
+    auto l = lines.find(line);
+    return l == lines.end() ? nullptr : &l->second;
+  }
+  // The line after `line`, -1 at the end
+  int64_t next(int64_t line) const {
+    auto l = lines.upper_bound(line);
+    return l == lines.end() ? -1 : l->first;
+  }
+};
+
+struct LineTableTable {
+  static constexpr bool kShuffledLoad = true;
+  engine::LineTable lines;
+
+  void insert(int64_t line, engine::Line value) {
+    lines.insert_or_assign(line, std::move(value));
+  }
+  const engine::Line* find(int64_t line) const { return lines.find(line); }
+  int64_t next(int64_t line) const {
+    auto l = lines.lower_bound(line + 1);
+    return l == lines.end() ? -1 : l->first;
+  }
+};
+
+// Only ever built in order, so a shuffled load is not timed
+struct FlatTable {
+  static constexpr bool kShuffledLoad = false;
+  engine::FlatMap<int64_t, engine::Line> lines;
+
+  void insert(int64_t line, engine::Line value) {
+    lines[line] = std::move(value);
+  }
+  const engine::Line* find(int64_t line) const {
+    auto l = lines.find(line);
+    return l == lines.end() ? nullptr : &l->second;
+  }
+  int64_t next(int64_t line) const {
+    auto l = lines.upper_bound(line);
+    return l == lines.end() ? -1 : l->first;
+  }
+};
+
+struct Timings {
+  double load_in_order;
+  double load_shuffled;
+  double list;
+  double jump;
+  double step;
+};
+
+template <typename Table>
+Timings measure(const Vec<int64_t>& numbers, int repetitions) {
+  auto shuffled = numbers;
+  std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937_64(7));
+  auto line = [](int64_t number) {
+    return engine::Line{std::to_string(number) + " PRINT " +
+                            std::to_string(number * 3),
+                        nullptr};
+  };
+
+  auto timings = Timings{};
+  Table table;
+  timings.load_in_order = best_of(repetitions, [&] {
+    table = Table();
+    for (auto number : numbers) {
+      table.insert(number, line(number));
+    }
+  });
+  if constexpr (Table::kShuffledLoad) {
+    timings.load_shuffled = best_of(repetitions, [&] {
+      auto scratch = Table();
+      for (auto number : shuffled) {
+        scratch.insert(number, line(number));
+      }
+    });
+  }
+
+  size_t listed{};
+  timings.list = best_of(repetitions, [&] {
+    Str out;
+    for (const auto& entry : table.lines) {
+      out.append(entry.second.source);
+      out.push_back('\n');
+    }
+    listed = out.size();
+  });
+
+  size_t found{};
+  timings.jump = best_of(repetitions, [&] {
+    for (auto number : shuffled) {
+      found += table.find(number) != nullptr;
+    }
+  });
+  timings.step = best_of(repetitions, [&] {
+    for (auto number = numbers.front(); number != -1;
+         number = table.next(number)) {
+      found += table.find(number)->source.size();
+    }
+  });
+  if (listed == 0 || found == 0) {
+    std::cerr << "nothing was measured\n";
+  }
+  return timings;
+}
+
+void print(const char* name, const Timings& timings, const Timings& base) {
+  auto column = [](double ms, double base_ms) {
+    if (ms == 0) {
+      std::cout << std::setw(18) << "-";
+      return;
+    }
+    std::cout << std::setw(10) << ms << std::setw(7) << base_ms / ms << "x";
+  };
+  std::cout << std::left << std::setw(12) << name << std::right;
+  column(timings.load_in_order, base.load_in_order);
+  column(timings.load_shuffled, base.load_shuffled);
+  column(timings.list, base.list);
+  column(timings.jump, base.jump);
+  column(timings.step, base.step);
+  std::cout << '\n';
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  auto count = argc > 1 ? std::stoll(argv[1]) : 100000;
+  auto repetitions = argc > 2 ? std::stoi(argv[2]) : 5;
+
+  auto numbers = Vec<int64_t>();
+  for (int64_t i{}; i < count; ++i) {
+    numbers.push_back((i + 1) * 10);
+  }
+
+  std::cout << std::fixed << std::setprecision(3);
+  std::cout << count << " lines, best of " << repetitions
+            << " in ms and speedup over std::map\n";
+  std::cout << std::left << std::setw(12) << "" << std::right;
+  for (const auto* heading : {"load", "shuffled", "list", "goto", "step"}) {
+    std::cout << std::setw(18) << heading;
+  }
+  std::cout << '\n';
+  auto base = measure<StdMapTable>(numbers, repetitions);
+  print("std::map", base, base);
+  print("line table", measure<LineTableTable>(numbers, repetitions), base);
+  print("flat table", measure<FlatTable>(numbers, repetitions), base);
+
+  // The same program through the engine: every line prints its number and
+  // the last one ends the run
+  std::stringstream source;
+  for (auto number : numbers) {
+    source << number << " PRINT " << number << '\n';
+  }
+  auto text = source.str();
+  auto engine = engine::MiniBasic();
+  auto load = best_of(repetitions, [&] {
+    std::stringstream in(text);
+    engine.load_source(in);
+  });
+  Str listing;
+  auto list =
+      best_of(repetitions, [&] { listing = engine.get_source_copy(); });
+  auto run = best_of(repetitions, [&] {
+    Str output;
+    engine.reset_pc();
+    engine.run(output);
+  });
+  std::cout << "engine LOAD " << load << " ms, LIST " << list
+            << " ms, tree walker run " << run << " ms\n";
+  return 0;
+}
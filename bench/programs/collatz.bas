@@ -0,0 +1,20 @@
+10 REM Longest Collatz chain for starting values below n
+20 LET n = 2000
+30 LET best = 0
+40 LET start = 1
+50 LET x = start
+60 LET len = 1
+70 IF x = 1 THEN 130
+80 IF x - x / 2 * 2 = 0 THEN 110
+90 LET x = 3 * x + 1
+100 GOTO 120
+110 LET x = x / 2
+120 LET len = len + 1
+125 GOTO 70
+130 IF len > best THEN 150
+140 GOTO 160
+150 LET best = len
+160 LET start = start + 1
+170 IF start < n THEN 50
+180 PRINT best
+190 END
@@ -0,0 +1,9 @@
+10 REM Sum of the first n integers with a counting loop
+20 LET n = 200000
+30 LET i = 0
+40 LET s = 0
+50 LET i = i + 1
+60 LET s = s + i
+70 IF i < n THEN 50
+80 PRINT s
+90 END
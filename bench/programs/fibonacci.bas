@@ -0,0 +1,15 @@
+10 REM Fibonacci numbers modulo a prime, recomputed r times
+20 LET r = 0
+30 LET a = 0
+40 LET b = 1
+50 LET k = 0
+60 LET t = a + b
+70 LET t = t - t / 1000007 * 1000007
+80 LET a = b
+90 LET b = t
+100 LET k = k + 1
+110 IF k < 1000 THEN 60
+120 LET r = r + 1
+130 IF r < 40 THEN 30
+140 PRINT a
+150 END
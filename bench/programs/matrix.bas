@@ -0,0 +1,25 @@
+10 REM Multiplies two 32 by 32 matrices and prints the trace of the product
+20 LET n = 31
+30 DIM a(n, n)
+40 DIM b(n, n)
+50 DIM c(n, n)
+60 FOR i = 0 TO n
+70 FOR j = 0 TO n
+80 LET a(i, j) = i + j
+90 LET b(i, j) = i - j
+100 NEXT j
+110 NEXT i
+120 FOR i = 0 TO n
+130 FOR j = 0 TO n
+140 LET s = 0
+150 FOR k = 0 TO n
+160 LET s = s + a(i, k) * b(k, j)
+170 NEXT k
+180 LET c(i, j) = s
+190 NEXT j
+200 NEXT i
+210 LET t = 0
+220 FOR i = 0 TO n
+230 LET t = t + c(i, i)
+240 NEXT i
+250 PRINT t
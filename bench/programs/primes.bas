@@ -0,0 +1,14 @@
+10 REM Count primes below n by trial division
+20 LET n = 4000
+30 LET c = 0
+40 LET p = 2
+50 LET d = 2
+60 IF d * d > p THEN 100
+70 IF p - p / d * d = 0 THEN 110
+80 LET d = d + 1
+90 GOTO 60
+100 LET c = c + 1
+110 LET p = p + 1
+120 IF p < n THEN 50
+130 PRINT c
+140 END
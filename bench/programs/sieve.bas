@@ -0,0 +1,12 @@
+10 REM Sieve of Eratosthenes: counts the primes up to 8190
+20 DIM f(8190)
+30 LET c = 0
+40 FOR i = 2 TO 8190
+50 IF f(i) = 1 THEN 110
+60 LET c = c + 1
+70 IF i > 4095 THEN 110
+80 FOR j = i + i TO 8190 STEP i
+90 LET f(j) = 1
+100 NEXT j
+110 NEXT i
+120 PRINT c
@@ -0,0 +1,16 @@
+10 REM Fills two arrays, combines them with MAT and prints reductions
+20 LET n = 4095
+30 DIM a(n)
+40 DIM b(n)
+50 FOR i = 0 TO n
+60 LET a(i) = (i * 7919) - (i * 7919 / 4096) * 4096
+70 LET b(i) = n - i
+80 NEXT i
+90 MAT c = a + b
+100 MAT c = c * 3
+110 MAT d = c - a
+120 PRINT SUM(c)
+130 PRINT MIN(d)
+140 PRINT MAX(d)
+150 SORT a
+160 PRINT a(0) + a(n)
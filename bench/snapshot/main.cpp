@@ -0,0 +1,95 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "engine.h"
+
+// Snapshots a run paused at INPUT after assigning many variables and
+// reports the encoded size and the best time to take, encode, decode and
+// restore it.
+// Usage: bench_snapshot [variables] [repetitions]
+
+namespace {
+
+Str program_with(int64_t variables) {
+  std::stringstream source;
+  int64_t line = 10;
+  for (int64_t i{}; i < variables; ++i, line += 10) {
+    source << line << " LET v" << i << " = " << i * 7919 << '\n';
+  }
+  source << line << " INPUT n\n";
+  source << line + 10 << " PRINT n\n";
+  return source.str();
+}
+
+template <typename Function>
+double best_of(int repetitions, Function function) {
+  auto best = 1e300;
+  for (int i{}; i < repetitions; ++i) {
+    auto begin = std::chrono::steady_clock::now();
+    function();
+    auto end = std::chrono::steady_clock::now();
+    best = std::min(
+        best, std::chrono::duration<double, std::milli>(end - begin).count());
+  }
+  return best;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  auto variables = argc > 1 ? std::stoll(argv[1]) : 10000;
+  auto repetitions = argc > 2 ? std::stoi(argv[2]) : 20;
+
+  auto source = program_with(variables);
+  auto engine = engine::MiniBasic();
+  std::stringstream in(source);
+  engine.load_source(in);
+  engine.set_tier(engine::Tier::Bytecode);
+  engine.reset_pc();
+  Str output;
+  if (engine.run(output) != UIBehavior::Input) {
+    std::cerr << "the program did not stop at INPUT\n";
+    return 1;
+  }
+
+  auto snapshot = engine::Snapshot();
+  auto taken = best_of(repetitions, [&] { snapshot = engine.snapshot(); });
+  Str data;
+  auto encoded = best_of(repetitions, [&] { data = snapshot.encode(); });
+  auto decoded_snapshot = engine::Snapshot();
+  auto decoded = best_of(repetitions, [&] {
+    engine::Snapshot::decode(data, decoded_snapshot);
+  });
+
+  auto resumed = engine::MiniBasic();
+  std::stringstream again(source);
+  resumed.load_source(again);
+  auto restored = best_of(repetitions, [&] {
+    if (!resumed.restore(decoded_snapshot)) {
+      std::cerr << "restore failed\n";
+      std::exit(1);
+    }
+  });
+  resumed.handle_input("42");
+  output.clear();
+  resumed.run(output);
+  if (output != "42\n") {
+    std::cerr << "resumed run printed " << output;
+    return 1;
+  }
+
+  std::cout << std::fixed << std::setprecision(3);
+  std::cout << variables << " variables, " << data.size() << " bytes ("
+            << static_cast<double>(data.size()) / variables
+            << " per variable)\n";
+  std::cout << std::left << std::setw(10) << "snapshot" << taken << " ms\n";
+  std::cout << std::left << std::setw(10) << "encode" << encoded << " ms\n";
+  std::cout << std::left << std::setw(10) << "decode" << decoded << " ms\n";
+  std::cout << std::left << std::setw(10) << "restore" << restored
+            << " ms\n";
+  return 0;
+}
@@ -0,0 +1,183 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <thread>
+
+#include "engine.h"
+
+// Compares MAT and SUM with the FOR loops they replace on each execution
+// tier, then times the kernels behind them on their own for every
+// instruction set and with and without threads. Reports the best wall time
+// of each.
+// Usage: bench_whole_arrays [size] [repetitions]
+
+namespace {
+
+struct TierInfo {
+  const char* name;
+  engine::Tier tier;
+};
+
+const TierInfo tiers[] = {
+    {"tree walker", engine::Tier::TreeWalker},
+    {"closure", engine::Tier::Closure},
+    {"bytecode", engine::Tier::Bytecode},
+    {"bytecode/switch", engine::Tier::BytecodeSwitch},
+    {"jit", engine::Tier::Jit},
+};
+
+// Sets up a and b element by element, then computes c = (a + b) * 3 and
+// its sum either whole or with loops
+Str program(int64_t size, bool whole) {
+  std::stringstream source;
+  source << "10 LET n = " << size - 1 << '\n'
+         << "20 DIM a(n)\n"
+            "30 DIM b(n)\n"
+            "40 FOR i = 0 TO n\n"
+            "50 LET a(i) = i\n"
+            "60 LET b(i) = n - i\n"
+            "70 NEXT i\n";
+  if (whole) {
+    source << "80 MAT c = a + b\n"
+              "90 MAT c = c * 3\n"
+              "100 PRINT SUM(c)\n";
+  } else {
+    source << "80 DIM c(n)\n"
+              "85 LET s = 0\n"
+              "90 FOR i = 0 TO n\n"
+              "92 LET c(i) = (a(i) + b(i)) * 3\n"
+              "94 LET s = s + c(i)\n"
+              "96 NEXT i\n"
+              "100 PRINT s\n";
+  }
+  return source.str();
+}
+
+struct Result {
+  double milliseconds;
+  Str output;
+};
+
+Result measure(const Str& source, engine::Tier tier, int repetitions) {
+  auto engine = engine::MiniBasic();
+  std::stringstream in(source);
+  engine.load_source(in);
+  engine.set_tier(tier);
+
+  auto best = Result{1e300, {}};
+  for (int i{}; i < repetitions; ++i) {
+    Str output;
+    engine.reset_pc();
+    auto begin = std::chrono::steady_clock::now();
+    engine.run(output);
+    auto end = std::chrono::steady_clock::now();
+    auto ms = std::chrono::duration<double, std::milli>(end - begin).count();
+    if (ms < best.milliseconds) {
+      best = Result{ms, std::move(output)};
+    }
+  }
+  return best;
+}
+
+template <typename Run>
+double best_of(int repetitions, const Run& run) {
+  auto best = 1e300;
+  for (int i{}; i < repetitions; ++i) {
+    auto begin = std::chrono::steady_clock::now();
+    run();
+    auto end = std::chrono::steady_clock::now();
+    best = std::min(
+        best, std::chrono::duration<double, std::milli>(end - begin).count());
+  }
+  return best;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  auto size = argc > 1 ? std::stoll(argv[1]) : 1 << 22;
+  auto repetitions = argc > 2 ? std::stoi(argv[2]) : 3;
+
+  std::cout << std::left << std::setw(18) << "tier" << std::right
+            << std::setw(14) << "whole ms" << std::setw(14) << "loop ms"
+            << std::setw(10) << "speedup" << '\n';
+  std::cout << std::fixed << std::setprecision(2);
+
+  auto ok = true;
+  for (const auto& tier : tiers) {
+    auto whole = measure(program(size, true), tier.tier, repetitions);
+    auto loop = measure(program(size, false), tier.tier, repetitions);
+    if (whole.output != loop.output) {
+      std::cerr << tier.name << ": MAT printed " << whole.output
+                << "but loops printed " << loop.output;
+      ok = false;
+    }
+    std::cout << std::left << std::setw(18) << tier.name << std::right
+              << std::setw(14) << whole.milliseconds << std::setw(14)
+              << loop.milliseconds << std::setw(9)
+              << loop.milliseconds / whole.milliseconds << "x\n";
+  }
+
+  auto random = std::mt19937_64(1);
+  auto left = Vec<int64_t>(static_cast<size_t>(size));
+  auto right = Vec<int64_t>(left.size());
+  for (size_t i{}; i < left.size(); ++i) {
+    left[i] = static_cast<int64_t>(random() % 1000000);
+    right[i] = static_cast<int64_t>(random() % 1000000);
+  }
+  auto out = Vec<int64_t>(left.size());
+
+  struct SimdInfo {
+    const char* name;
+    parser::Simd simd;
+  };
+  const SimdInfo levels[] = {{"scalar", parser::Simd::Scalar},
+                             {"sse2", parser::Simd::Sse2},
+                             {"avx2", parser::Simd::Avx2}};
+  auto thread_counts = Vec<unsigned>{1};
+  if (std::thread::hardware_concurrency() > 1) {
+    thread_counts.push_back(std::thread::hardware_concurrency());
+  }
+
+  std::cout << '\n'
+            << "best instruction set: "
+            << levels[static_cast<int>(parser::best_simd())].name << '\n'
+            << std::left << std::setw(18) << "kernels" << std::right
+            << std::setw(10) << "add ms" << std::setw(10) << "sum ms"
+            << std::setw(10) << "min ms" << std::setw(10) << "sort ms"
+            << '\n';
+  for (const auto& level : levels) {
+    for (auto threads : thread_counts) {
+      auto policy = parser::ArrayPolicy{level.simd, threads};
+      auto add = best_of(repetitions, [&] {
+        parser::kernels::mat(policy, parser::MatOp::Add, left.data(),
+                             right.data(), 0, out.data(), out.size());
+      });
+      auto sum = best_of(repetitions, [&] {
+        out[0] = parser::kernels::reduce(policy, parser::Reduction::Sum,
+                                         left.data(), left.size());
+      });
+      auto min = best_of(repetitions, [&] {
+        out[0] = parser::kernels::reduce(policy, parser::Reduction::Min,
+                                         left.data(), left.size());
+      });
+      auto sort = best_of(repetitions, [&] {
+        out = left;
+        parser::kernels::sort(policy, out.data(), out.size());
+      });
+      if (!std::is_sorted(out.begin(), out.end())) {
+        std::cerr << level.name << ": sort left elements out of order\n";
+        ok = false;
+      }
+      auto label = Str(level.name) + " x" + std::to_string(threads);
+      std::cout << std::left << std::setw(18) << label << std::right
+                << std::setw(10) << add << std::setw(10) << sum
+                << std::setw(10) << min << std::setw(10) << sort << '\n';
+    }
+  }
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
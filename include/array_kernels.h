@@ -0,0 +1,44 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace parser {
+
+// Instruction sets the whole-array kernels come in, narrowest first
+enum class Simd : uint8_t { Scalar, Sse2, Avx2 };
+
+// The widest instruction set this CPU runs, found once
+Simd best_simd();
+
+// How MAT, SORT and the reductions run. Arrays of at least `threshold`
+// elements are split across `threads`, 0 for one per hardware thread.
+struct ArrayPolicy {
+  static constexpr size_t kParallelThreshold = size_t{1} << 18;
+
+  // The widest instruction set to use, capped at best_simd()
+  Simd simd{Simd::Avx2};
+  unsigned threads{};
+  size_t threshold{kParallelThreshold};
+};
+
+enum class MatOp : uint8_t { Add, Subtract, Scale };
+enum class Reduction : uint8_t { Sum, Min, Max };
+
+// Kernels over `n` contiguous elements. Arithmetic wraps around like the
+// native tiers'; `out` may be one of the operands.
+namespace kernels {
+
+// out = left + right, left - right, or left * factor for MatOp::Scale
+void mat(const ArrayPolicy& policy, MatOp op, const int64_t* left,
+         const int64_t* right, int64_t factor, int64_t* out, size_t n);
+
+// Sum, least or greatest of `n` > 0 elements
+int64_t reduce(const ArrayPolicy& policy, Reduction reduction,
+               const int64_t* values, size_t n);
+
+// Ascending, in place
+void sort(const ArrayPolicy& policy, int64_t* values, size_t n);
+
+}  // namespace kernels
+
+}  // namespace parser
@@ -0,0 +1,41 @@
+#pragma once
+#include <atomic>
+#include <thread>
+
+#include "parser.h"
+#include "type.h"
+
+namespace engine {
+
+// Parses lines on a worker thread, in order, so a large LOAD does not hold
+// up the thread that owns the engine. Results go into a vector sized up
+// front and are published by a release store of how many are done, so the
+// owner reads every finished AST in place, without a lock or a copy, while
+// the worker goes on with the rest.
+class BackgroundParser {
+ public:
+  BackgroundParser(Vec<Str> lines, parser::ParseContext::FrontEnd front_end);
+
+  [[nodiscard]] size_t size() const { return lines_.size(); }
+  // Results below this index are final and may be read
+  [[nodiscard]] size_t parsed() const {
+    return parsed_.load(std::memory_order_acquire);
+  }
+  [[nodiscard]] const Str& line(size_t index) const { return lines_[index]; }
+  [[nodiscard]] const Rc<parser::AstNode>& result(size_t index) const {
+    return results_[index];
+  }
+
+  // Stops the worker after the line it is parsing; destruction does the
+  // same and waits for it
+  void cancel() { worker_.request_stop(); }
+
+ private:
+  Vec<Str> lines_;
+  Vec<Rc<parser::AstNode>> results_;
+  std::atomic<size_t> parsed_{};
+  // Last, so it starts once the rest exists and is joined before it goes
+  std::jthread worker_;
+};
+
+}  // namespace engine
@@ -0,0 +1,84 @@
+#pragma once
+#include <set>
+
+#include "flat_map.h"
+#include "parser.h"
+#include "type.h"
+
+namespace engine {
+
+// Forward interval analysis over the line-level control-flow graph: the
+// range of every variable, the bound and step of each FOR loop that may be
+// running and the shape of every array before a line runs. Element accesses
+// it proves in range can skip the bounds check. Only variables whose values
+// may reach an index or a DIM extent are followed, and a program without
+// arrays is not analyzed at all.
+class BoundsCheck {
+ public:
+  // Closed range of values; an end at the int64_t limit is unbounded
+  struct Range {
+    int64_t lo;
+    int64_t hi;
+
+    bool operator==(const Range& other) const = default;
+  };
+  // A loop over a variable that may be running, with its bound and step in
+  // these ranges
+  struct LoopRange {
+    Range limit{};
+    Range step{};
+
+    bool operator==(const LoopRange& other) const = default;
+  };
+  // What holds before a line runs, sorted by variable or array index: the
+  // variables with a bounded range, the loops that may be running and the
+  // arrays DIM'd with known extents. Anything not listed is unknown, so a
+  // line stores only what the analysis learned.
+  struct Facts {
+    bool reachable{};
+    Vec<std::pair<uint32_t, Range>> values;
+    Vec<std::pair<uint32_t, LoopRange>> loops;
+    Vec<std::pair<uint32_t, Vec<int64_t>>> shapes;
+
+    bool operator==(const Facts& other) const = default;
+  };
+
+  explicit BoundsCheck(
+      const FlatMap<int64_t, Rc<parser::ast_node::LineNoStmt>>& program);
+
+  // Whether the access on `line` always finds its array DIM'd with as many
+  // dimensions as it has indices and every index in range
+  [[nodiscard]] bool in_bounds(int64_t line,
+                               const parser::ast_node::ArrayExpr& access) const;
+
+  // Range of `name` before `line` runs, unbounded for lines and variables
+  // the analysis does not know
+  [[nodiscard]] Range range(int64_t line, const Str& name) const;
+
+  // Whether a run paused before `line` with these variables, loops, calls
+  // and arrays is one the analysis covers, so code relying on it may resume
+  // the run. A snapshot written by hand, say, may not be.
+  [[nodiscard]] bool admits(int64_t line, const Map<Str, int64_t>& variants,
+                            const parser::RunState& state) const;
+
+  // Whether the program DIMs or indexes any array
+  [[nodiscard]] bool uses_arrays() const { return uses_arrays_; }
+
+  // Number of variables the analysis follows
+  [[nodiscard]] size_t tracked() const { return variables_.size(); }
+
+ private:
+  // Variables that may reach an index or extent, and every array
+  Map<Str, uint32_t> variables_;
+  Map<Str, uint32_t> arrays_;
+  Map<int64_t, size_t> rows_;
+  Vec<Facts> in_;
+  // Accesses proven in range, by line as statements may be shared
+  std::set<std::pair<int64_t, const parser::ast_node::ArrayExpr*>> proven_;
+  // Lines a NEXT may loop back to by variable, and lines RETURN may go to
+  Map<Str, std::set<int64_t>> bodies_;
+  std::set<int64_t> returns_;
+  bool uses_arrays_{};
+};
+
+}  // namespace engine
@@ -0,0 +1,154 @@
+#pragma once
+#include "layout.h"
+#include "type.h"
+#include "ui_behavior.h"
+
+// Labels-as-values are a GCC/Clang extension; other compilers only get the
+// switch dispatch
+#if defined(__GNUC__) || defined(__clang__)
+#define ENGINE_BYTECODE_THREADED 1
+#else
+#define ENGINE_BYTECODE_THREADED 0
+#endif
+
+// Bytecode execution tier: the program is flattened into one instruction
+// array over variable slots. With direct threading every instruction carries
+// the address of its handler and each handler jumps straight to the next one,
+// so there is no central dispatch branch.
+namespace engine::bytecode {
+
+enum class Op : uint8_t {
+  PushConst,  // value
+  PushSlot,   // slot, unchecked
+  Neg,
+  Add,
+  Sub,
+  Mul,
+  Div,
+  Pow,
+  Less,
+  Greater,
+  Equal,
+  // Top of stack op value
+  AddConst,
+  SubConst,
+  MulConst,
+  DivConst,
+  Store,         // pop into slot
+  AddSlotConst,  // slot += value
+  Print,
+  Input,  // pause for slot, resume at line index target
+  Jump,
+  JumpIfTrue,  // pop, jump when nonzero
+  // Compare slot with value, or with slot other, and jump when it holds
+  JumpIfLessSlotConst,
+  JumpIfGreaterSlotConst,
+  JumpIfEqualSlotConst,
+  JumpIfLessSlotSlot,
+  JumpIfGreaterSlotSlot,
+  JumpIfEqualSlotSlot,
+  // Pop start, limit and step into slot and a loop whose body is line index
+  // target; stops when the loop stack is full
+  For,
+  // Step the loop over slot and jump to target while it runs, in one
+  // instruction. Only the innermost loop, starting at line index other, is
+  // stepped here; any other stops for Program::next.
+  Next,
+  // Push line index other as the return address and jump to target; stops
+  // when the call stack is full
+  Gosub,
+  // Pop a return address and jump to that line; stops when there is none
+  Return,
+  // DIM the array in slot with the `other` bounds on the stack; stops when
+  // one is out of range
+  Dim,
+  // Pop `other` indices and push that element of the array in slot; stops
+  // when it is out of reach
+  LoadElement,
+  // The same for an access the bounds analysis proved in range
+  LoadElementUnchecked,
+  // Pop the value, then `other` indices, into that element of the array in
+  // slot; stops when it is out of reach
+  StoreElement,
+  StoreElementUnchecked,
+  // MAT into the array in slot from the arrays in other and value, with the
+  // parser::MatOp in target; Scale pops its factor instead. Stops when the
+  // operands are not DIM'd or differ in shape.
+  Mat,
+  // SORT the array in slot; stops when it is not DIM'd
+  Sort,
+  // Push the parser::Reduction in other of the array in slot; stops when it
+  // is not DIM'd
+  Reduce,
+  // Warn when slot was never assigned; precedes reads the definite
+  // assignment analysis could not prove
+  Check,
+  // Loop header: count down Frame::loop_counters[slot], stop at zero
+  Profile,
+  End,
+};
+
+// Ops whose target is an instruction index
+inline bool is_jump(Op op) {
+  return op == Op::Jump || op == Op::JumpIfTrue ||
+         (Op::JumpIfLessSlotConst <= op && op <= Op::JumpIfEqualSlotSlot) ||
+         op == Op::Next || op == Op::Gosub;
+}
+
+struct Instr {
+  // Handler address, filled in when the program is threaded
+  const void* handler{};
+  Op op;
+  uint32_t slot{};
+  uint32_t other{};
+  int32_t target{};
+  int64_t value{};
+};
+
+enum class Dispatch {
+  Threaded,  // falls back to Switch where labels-as-values are unavailable
+  Switch,
+};
+
+class Program {
+ public:
+  static constexpr int32_t kEnd = Layout::kNoLine;
+
+  // nullptr if the program uses statements this tier cannot compile. With
+  // `profile`, every target of a backward jump starts with a Profile.
+  static Rc<Program> compile(Layout layout, bool profile = false);
+
+  // Runs from line index `pc` until END, INPUT or the end of the program and
+  // leaves `pc` at the line to resume from (kEnd when finished). A profiled
+  // program also pauses at a loop header visited Frame::sample_period times.
+  UIBehavior run(int32_t& pc, Frame& frame,
+                 Dispatch dispatch = Dispatch::Threaded) const;
+
+  // Runs from instruction `ip` and returns the End, Input, exhausted
+  // Profile, failed For, Gosub, Return, Dim, element access or whole-array
+  // op, or Next it stopped at
+  const Instr& execute(int32_t ip, Frame& frame,
+                       Dispatch dispatch = Dispatch::Threaded) const;
+  // Steps the loop of a Next that stopped and returns the instruction to go
+  // on at, or -1 after reporting a NEXT without FOR
+  int32_t next(const Instr& instr, Frame& frame) const;
+
+  [[nodiscard]] const Layout& layout() const { return layout_; }
+  [[nodiscard]] const Vec<Instr>& code() const { return code_; }
+  [[nodiscard]] const Vec<int32_t>& line_starts() const { return line_start_; }
+  [[nodiscard]] size_t loop_count() const { return loop_count_; }
+  [[nodiscard]] bool profiled() const { return profiled_; }
+
+  explicit Program(Layout layout) : layout_(std::move(layout)) {}
+
+ private:
+  Layout layout_;
+  Vec<Instr> code_;
+  // First instruction of every line, plus the final End
+  Vec<int32_t> line_start_;
+  size_t max_stack_{};
+  size_t loop_count_{};
+  bool profiled_{};
+};
+
+}  // namespace engine::bytecode
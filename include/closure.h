@@ -0,0 +1,41 @@
+#pragma once
+#include <functional>
+
+#include "layout.h"
+#include "type.h"
+#include "ui_behavior.h"
+
+// Closure-compiled execution tier: every statement and expression becomes a
+// pre-bound C++ callable specialized on its operand shapes (slot, constant,
+// subexpression), working on slot storage instead of the variable map.
+namespace engine::closure {
+
+using ExprFn = std::function<int64_t(Frame&)>;
+// Returns the index of the next line or one of the codes in Program
+using StmtFn = std::function<int32_t(Frame&)>;
+
+class Program {
+ public:
+  // Finished, or jumped to a line that does not exist
+  static constexpr int32_t kEnd = Layout::kNoLine;
+  // Paused on INPUT, resume at Frame::resume
+  static constexpr int32_t kInput = -2;
+
+  // nullptr if the program uses statements this tier cannot compile
+  static Rc<Program> compile(Layout layout);
+
+  // Runs from line index `pc` until END, INPUT, the end of the program or a
+  // sampling pause and leaves `pc` at the line to resume from (kEnd when
+  // finished)
+  UIBehavior run(int32_t& pc, Frame& frame) const;
+
+  [[nodiscard]] const Layout& layout() const { return layout_; }
+
+  explicit Program(Layout layout) : layout_(std::move(layout)) {}
+
+ private:
+  Layout layout_;
+  Vec<StmtFn> code_;
+};
+
+}  // namespace engine::closure
@@ -0,0 +1,59 @@
+#pragma once
+#include "flat_map.h"
+#include "parser.h"
+#include "type.h"
+
+namespace engine {
+
+// Line-level control-flow graph of a program. Jumps are forwarded through
+// REM lines and pure GOTOs, and lines execution cannot reach from the first
+// line are dropped from the program the tiers run. Borrows `ast` for its
+// lifetime.
+class ControlFlow {
+ public:
+  static constexpr int64_t kNoLine = -1;
+
+  explicit ControlFlow(
+      const FlatMap<int64_t, Rc<parser::ast_node::LineNoStmt>>& ast);
+
+  // Lines that can run right after `line`, with jumps forwarded
+  [[nodiscard]] Vec<int64_t> successors(int64_t line) const;
+  [[nodiscard]] bool reachable(int64_t line) const {
+    return program_.count(line);
+  }
+  // The line a jump to `line` ends up running; `line` itself when the chain
+  // leaves the program or never ends
+  [[nodiscard]] int64_t forward(int64_t line) const;
+
+  // Reachable lines, with GOTO, IF and GOSUB retargeted to the forwarded
+  // lines
+  [[nodiscard]] const FlatMap<int64_t, Rc<parser::ast_node::LineNoStmt>>&
+  program() const {
+    return program_;
+  }
+
+  // One finding per entry, e.g. "line 70: unreachable"
+  [[nodiscard]] const Vec<Str>& diagnostics() const { return diagnostics_; }
+
+ private:
+  const FlatMap<int64_t, Rc<parser::ast_node::LineNoStmt>>& ast_;
+  FlatMap<int64_t, Rc<parser::ast_node::LineNoStmt>> program_;
+  Vec<Str> diagnostics_;
+  // First body line of every FOR, by variable: where a NEXT over it may
+  // jump back to
+  Map<Str, Vec<int64_t>> loop_bodies_;
+  // Line after every GOSUB: where a RETURN may go back to
+  Vec<int64_t> return_sites_;
+
+  // Line after `line`, or kNoLine at the end of the program
+  [[nodiscard]] int64_t next(int64_t line) const;
+  // Follows REM lines and GOTOs from `line` to the first line that does
+  // something else; kNoLine when the chain leaves the program, with the flag
+  // set when it loops
+  [[nodiscard]] std::pair<int64_t, bool> chase(int64_t line) const;
+  // Target of a GOTO, IF or GOSUB, or kNoLine for other statements
+  [[nodiscard]] static int64_t target(
+      const Rc<parser::ast_node::Stmt>& stmt);
+};
+
+}  // namespace engine
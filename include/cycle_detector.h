@@ -0,0 +1,34 @@
+#pragma once
+#include "run_state.h"
+#include "type.h"
+
+namespace engine {
+
+// Spots a run that returns to an exact earlier state. States are sampled
+// at the run's pauses and compared against one saved checkpoint that moves
+// forward at every power of two samples (Brent's method), so a loop is
+// found within a few times its length in samples and memory stays constant.
+// A program without INPUT that repeats (line, variables, FOR loops, GOSUBs
+// and arrays) never finishes.
+class CycleDetector {
+ public:
+  void reset();
+
+  // Samples the state; true when it equals the saved checkpoint
+  bool repeats(int64_t line, const Map<Str, int64_t>& variants,
+               const parser::RunState& state);
+
+  static uint64_t hash(int64_t line, const Map<Str, int64_t>& variants,
+                       const parser::RunState& state);
+
+ private:
+  bool saved_{};
+  uint64_t saved_hash_{};
+  int64_t saved_line_{};
+  Map<Str, int64_t> saved_variants_;
+  parser::RunState saved_state_;
+  uint64_t power_{1};
+  uint64_t samples_{};
+};
+
+}  // namespace engine
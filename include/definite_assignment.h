@@ -0,0 +1,42 @@
+#pragma once
+#include "flat_map.h"
+#include "parser.h"
+#include "type.h"
+
+namespace engine {
+
+// Forward must-dataflow over the line-level control-flow graph: which
+// variables every path from the entry line has assigned with LET, INPUT, FOR
+// or NEXT before a line runs. Reads of those variables can skip the
+// unknown-variable check.
+class DefiniteAssignment {
+ public:
+  // `entry` defaults to the first line
+  explicit DefiniteAssignment(
+      const FlatMap<int64_t, Rc<parser::ast_node::LineNoStmt>>& program,
+      int64_t entry = -1);
+
+  // Whether `name` is assigned on every path reaching `line`
+  [[nodiscard]] bool assigned(int64_t line, const Str& name) const;
+  // Every such variable, in name order
+  [[nodiscard]] Vec<Str> assigned_at(int64_t line) const;
+
+  // One entry per read that may see an unassigned variable, e.g.
+  // "line 20: x may be read before it is assigned"
+  [[nodiscard]] const Vec<Str>& diagnostics() const { return diagnostics_; }
+
+  // Variables some read may find unassigned, in name order: the only ones
+  // whose values before a run can change what it does
+  [[nodiscard]] const Vec<Str>& live_in() const { return live_in_; }
+
+ private:
+  Map<Str, uint32_t> variables_;
+  Map<int64_t, size_t> rows_;
+  // Variables assigned on entry to each line, one bit per variable
+  Vec<uint64_t> in_;
+  size_t words_{};
+  Vec<Str> diagnostics_;
+  Vec<Str> live_in_;
+};
+
+}  // namespace engine
@@ -1,31 +1,265 @@
 #pragma once
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <set>
 #include <sstream>
 #include <string>
 #include <vector>
 
+#include "background_parser.h"
+#include "bounds_check.h"
+#include "bytecode.h"
+#include "closure.h"
+#include "control_flow.h"
+#include "cycle_detector.h"
+#include "definite_assignment.h"
+#include "jit.h"
+#include "parse_cache.h"
 #include "parser.h"
+#include "persistent_map.h"
+#include "run_cache.h"
+#include "snapshot.h"
+#include "transpiler.h"
 #include "type.h"
 #include "ui_behavior.h"
 namespace parser::ast_node {
 class LineNoStmt;
 }
 namespace engine {
+
+// One edit of the line table, as reported by MiniBasic::take_changes
+struct LineChange {
+  enum class Kind {
+    Inserted,
+    Replaced,
+    Deleted,
+    Reset,  // the whole program changed (LOAD, CLEAR)
+  };
+  Kind kind;
+  int64_t line;
+};
+
+// One program line: the text as typed and its parsed statement, null
+// until a lazily loaded line is first needed
+struct Line {
+  Str source;
+  Rc<parser::ast_node::LineNoStmt> stmt;
+};
+
+// The program by line number. Copying one is O(1) and later edits leave the
+// copy as it was, so a reader can hold on to a version while the program
+// goes on being edited.
+using LineTable = PersistentMap<int64_t, Line>;
+
+// How far a background LOAD has got
+struct LoadProgress {
+  size_t parsed;
+  size_t total;
+};
+
+// How run() executes the program
+enum class Tier {
+  TreeWalker,      // step through the AST statement by statement
+  Closure,         // pre-bound closures over variable slots
+  Bytecode,        // direct-threaded bytecode over variable slots
+  BytecodeSwitch,  // the same bytecode through a switch, for comparison
+  Jit,             // profiled bytecode with hot loops compiled to x86-64
+};
+
+// Limits on one run, from reset_pc() until it ends; 0 is unlimited. They
+// are checked every `check_period` loop iterations rather than per
+// statement, so a run may overshoot a limit by one batch before it stops.
+struct Quota {
+  uint64_t max_steps{};  // loop iterations, counted at backward jumps
+  size_t max_output{};   // bytes printed
+  size_t max_variables{};
+  std::chrono::nanoseconds max_time{};  // wall-clock time spent running
+  int64_t check_period{4096};
+
+  [[nodiscard]] bool limited() const {
+    return max_steps != 0 || max_output != 0 || max_variables != 0 ||
+           max_time.count() != 0;
+  }
+};
+
+// Why the last call to run() or run_for() returned
+enum class Termination {
+  None,  // nothing has run since reset_pc()
+  Finished,
+  WaitingForInput,
+  Yielded,  // the time slice ran out
+  StepQuota,
+  OutputQuota,
+  VariableQuota,
+  TimeQuota,
+  EndlessLoop,
+};
+
 class MiniBasic {
  public:
   void load_source(std::istream& in);
+  // With lazy loading, LOAD only splits the lines and records their
+  // numbers. A line is parsed when the tree walker first reaches it, and
+  // lines that fail to parse are then reported in the run's output and
+  // dropped, as LOAD would have dropped them. CHECK, and running on any
+  // other tier, parse all remaining lines at once. The views parse what
+  // they show without keeping it.
+  void set_lazy_load(bool lazy) { lazy_load_ = lazy; }
+
+  // LOAD for an interactive caller: the lines are in the table as soon as
+  // this returns, unparsed unless the parse cache has them, and a worker
+  // thread parses the rest meanwhile. Until then they behave as lazily
+  // loaded lines, so the views and RUN work during the load.
+  void begin_load(std::istream& in);
+  // Installs the statements the worker finished since the last call,
+  // reporting and dropping lines that failed in `output`. Lines edited
+  // since the load keep the edit. Returns the lines still to parse, 0 once
+  // the load is complete.
+  size_t poll_load(Str& output);
+  // Stops the worker; lines it did not reach stay unparsed and are parsed
+  // when needed
+  void cancel_load();
+  [[nodiscard]] bool loading() const { return loader_ != nullptr; }
+  [[nodiscard]] LoadProgress load_progress() const {
+    return loader_ ? LoadProgress{loader_->parsed(), loader_->size()}
+                   : LoadProgress{0, 0};
+  }
 
   UIBehavior handle_command(const Str& command, Str& output);
 
   void clear();
 
+  // Select how LOAD and commands are lexed and parsed; both produce the
+  // same AST, the fused front end skips the intermediate token vector
+  void set_front_end(parser::ParseContext::FrontEnd front_end) {
+    parse_context_.set_front_end(front_end);
+  }
+
   [[nodiscard]] std::string get_source_copy() const {
-    return string_lines_into_string(source);
+    return string_lines_into_string(lines_);
   }
   [[nodiscard]] std::string get_ast_copy() const;
+  // The program as a standalone C++ translation unit, empty if it cannot be
+  // translated
+  [[nodiscard]] Str get_cpp_copy() const {
+    return transpile_to_cpp(program());
+  }
+
+  [[nodiscard]] LineTable listing() const { return lines_; }
+
+  // Per-line views for incremental rendering
+  [[nodiscard]] bool has_line(int64_t line) const {
+    return lines_.count(line);
+  }
+  [[nodiscard]] Str get_source_line(int64_t line) const;
+  [[nodiscard]] Str get_line_ast_copy(int64_t line) const;
+  // The same tree one row per node with its depth, the line number at 0;
+  // empty when there is no such line
+  [[nodiscard]] Vec<parser::AstRow> get_line_ast_rows(int64_t line) const;
+  [[nodiscard]] Vec<int64_t> get_line_numbers() const;
+
+  // Applies numbered lines as one edit: "20 PRINT x" inserts or replaces
+  // line 20 and "20" deletes it, later edits of a line winning. Lines the
+  // parse cache lacks are parsed on up to `threads` threads (0 for one per
+  // core), the table is updated in one pass, the program is analyzed again
+  // once before the next run and one UNDO reverts the batch. Anything else
+  // is skipped with a warning in `output`. Returns the edits applied.
+  size_t apply_edits(const Vec<Str>& edits, Str& output, unsigned threads = 0);
+
+  // Line edits since the last call, oldest first
+  Vec<LineChange> take_changes();
+
+  // Statement ASTs survive CLEAR and LOAD, so re-loading a file only
+  // parses the lines that changed
+  [[nodiscard]] const ParseCache& parse_cache() const { return parse_cache_; }
+  void set_parse_cache_capacity(size_t capacity) {
+    parse_cache_.set_capacity(capacity);
+  }
+
+  // Every chunk the program prints is also written to the sink, one per
+  // line, so the full output can be streamed to a file regardless of how
+  // much the console keeps. Pass nullptr to detach.
+  void set_output_sink(std::ostream* sink) { output_sink_ = sink; }
+
+  // Control-flow findings (forwarded jumps, unreachable lines, reads that may
+  // find a variable unassigned) are written here, one per line, whenever the
+  // edited program is analyzed again before running. Pass nullptr to detach.
+  void set_analysis_report(std::ostream* report) { analysis_report_ = report; }
 
   void reset_pc();
 
   UIBehavior step_run(Str& output);
+
+  // Runs from the current pc until the program finishes or waits for INPUT,
+  // using the selected tier. Every printed chunk ends with a newline.
+  UIBehavior run(Str& output);
+
+  void set_tier(Tier tier) { tier_ = tier; }
+  [[nodiscard]] Tier tier() const { return tier_; }
+
+  // With cycle detection on, the tiers pause every `period` back-edges and
+  // a run that comes back to the same line with the same variables, FOR
+  // loops and GOSUBs is stopped with an error, since it can never finish.
+  // The JIT tier runs as bytecode meanwhile, as native loops do not pause.
+  void set_detect_cycles(bool detect, int64_t period = 4096) {
+    cycle_period_ = detect ? std::max<int64_t>(period, 1) : 0;
+  }
+
+  // With memoization on, a run that can no longer reach INPUT is looked up
+  // by the program and the current variables, and a run seen before returns
+  // its recorded output and variables without executing
+  void set_memoize(bool memoize) { memoize_ = memoize; }
+  [[nodiscard]] const RunCache& run_cache() const { return run_cache_; }
+  void set_run_cache_capacity(size_t capacity) {
+    run_cache_.set_capacity(capacity);
+  }
+
+  // Quotas apply to runs started after the next reset_pc()
+  void set_quota(const Quota& quota) { quota_ = quota; }
+  [[nodiscard]] const Quota& quota() const { return quota_; }
+  [[nodiscard]] Termination termination() const { return termination_; }
+
+  // GOSUBs nested deeper than `depth` stop the run with an error. Room for
+  // that many return addresses is allocated here, not as the run calls;
+  // depths past parser::CallStack::kMaxDepth are clamped to it.
+  void set_max_call_depth(size_t depth) {
+    run_state_.calls.set_max_depth(depth);
+  }
+  [[nodiscard]] size_t max_call_depth() const {
+    return run_state_.calls.max_depth();
+  }
+
+  // How MAT, SORT and SUM, MIN and MAX run on every tier: the widest
+  // instruction set to use and how large an array is split across threads
+  void set_array_policy(const parser::ArrayPolicy& policy) {
+    run_state_.array_policy = policy;
+  }
+  [[nodiscard]] const parser::ArrayPolicy& array_policy() const {
+    return run_state_.array_policy;
+  }
+
+  // Like run(), but yields with UIBehavior::Yield after about `steps` loop
+  // iterations so a caller can interleave many programs on one thread
+  UIBehavior run_for(Str& output, uint64_t steps);
+
+  // The paused run: its line, variables, pending INPUT, FOR loops, GOSUBs
+  // and arrays, tied to the program by the hash of its analyzed syntax tree
+  [[nodiscard]] Snapshot snapshot() const;
+  // Resumes a snapshot taken from the same program, possibly by another
+  // engine that loaded it; false and nothing changed otherwise, or when it
+  // holds more GOSUBs than max_call_depth() allows. A run that stopped at
+  // INPUT is answered with handle_input() before running on.
+  bool restore(const Snapshot& snapshot);
+
+  // Loops the JIT tier currently runs as native code; edits drop them
+  [[nodiscard]] size_t jit_compiled_loops() const {
+    return jit_program_ && jit_version_ == program_version_
+               ? jit_program_->compiled_loops()
+               : 0;
+  }
+
   bool handle_input(const Str& input) {
     if (variant_need_input_.empty()) {
       return true;
@@ -51,15 +285,169 @@ class MiniBasic {
   MiniBasic() = default;
 
  private:
-  Map<int64_t, Str> source;
-  Map<int64_t, Rc<parser::ast_node::LineNoStmt>> ast;
+  LineTable lines_;
+  // Edits of `lines_` that keep `unparsed_` right
+  void put_line(int64_t number, Line line);
+  bool erase_line(int64_t number);
+
+  bool lazy_load_{};
+  // Replaces the program with the lines of `in`, leaving numbered lines
+  // unparsed when `defer` is set
+  void read_source(std::istream& in, bool defer);
+
+  // The background LOAD, the line number of each line it parses and how
+  // many of its results are installed
+  std::unique_ptr<BackgroundParser> loader_;
+  Vec<int64_t> loader_lines_;
+  size_t loader_installed_{};
+  // Lines of `lines_` without a statement yet
+  size_t unparsed_{};
+  // Parses every such line, reporting and dropping the ones that fail;
+  // returns how many failed
+  size_t parse_pending(Str& output);
+  // Stores a parsed line, or reports and drops it when it failed; false
+  // if dropped
+  bool install(int64_t number, Str source, const Rc<parser::AstNode>& node,
+               Str& output);
+  // Reports a line that failed to parse, and drops it
+  void drop_invalid(int64_t number, const Rc<parser::AstNode>& node,
+                    Str& output);
+  // Dumps the syntax tree of a line, parsing it alone if it has not been
+  // yet; false when there is no such line
+  bool dump_line_ast(int64_t line, std::ostream& ostream) const;
+  // A run waiting on a line that failed to parse goes on where it would
+  // have had LOAD dropped the line: past it when it got there by falling
+  // through, and nowhere when it jumped there
+  void resume_past_dropped();
+  // The line the last lazy step jumped to, -1 if it fell through
+  int64_t jumped_to_{-1};
+
+  // Versions before (undo_) and after (redo_) the current one, each with
+  // the line changes that lead from it to the next newer version. They
+  // share all unchanged lines with the current program.
+  struct Edit {
+    LineTable lines;
+    Vec<LineChange> changes;
+    size_t unparsed;
+  };
+  static constexpr size_t kMaxUndo = 1024;
+  // Oldest first, dropped from the front once kMaxUndo are kept
+  std::deque<Edit> undo_;
+  Vec<Edit> redo_;
+  // Keeps the current version for UNDO before a change is made
+  void remember(LineChange::Kind kind, int64_t line);
+  void remember(Edit edit);
+  bool undo();
+  bool redo();
+
+  // Reused by every command and LOAD line
+  parser::ParseContext parse_context_;
+  ParseCache parse_cache_;
+
+  Rc<parser::AstNode> parse_line(const Str& line);
+  // Parses many lines, from the cache where it can and on up to `threads`
+  // threads otherwise (0 for one per core)
+  Vec<Rc<parser::AstNode>> parse_lines(const Vec<Str>& lines,
+                                       unsigned threads);
+  // The statement of a numbered line from the parse cache, nullptr when the
+  // line has to be parsed
+  Rc<parser::AstNode> find_parsed(const Str& line);
+  void cache_parsed(const Str& line, const Rc<parser::AstNode>& node);
+
+  // What the tiers run: the statements of `lines_` with jumps forwarded
+  // through REM lines and pure GOTOs and unreachable lines dropped, in a
+  // flat table rebuilt once per edit that GOTO and stepping search. LIST,
+  // the views and UNDO keep using `lines_`.
+  const FlatMap<int64_t, Rc<parser::ast_node::LineNoStmt>>& program() const;
+  mutable FlatMap<int64_t, Rc<parser::ast_node::LineNoStmt>> program_;
+  // Where each REM line or pure GOTO dropped from `program_` forwards to.
+  // Only a run that stepped `lines_` lazily can be waiting on one.
+  mutable Map<int64_t, int64_t> forwarded_;
+  // Moves a run waiting on such a line on to the line it forwards to, once
+  // the run steps `program_`
+  void forward_pc();
+  mutable Rc<const DefiniteAssignment> assigned_;
+  mutable Rc<const BoundsCheck> bounds_;
+  // Hash of the program's syntax tree, and the lines that can reach INPUT
+  mutable uint64_t program_hash_{};
+  mutable std::set<int64_t> reaches_input_;
+  mutable uint64_t program_analyzed_{};
+  // Version the current run started on. A run paused across an edit may
+  // have taken paths the edited program lacks, so the tiers only trust
+  // `assigned_` and `bounds_` when this matches. Direct commands that
+  // assign behind the run's back lose that trust too.
+  uint64_t run_version_{};
+  std::ostream* analysis_report_{};
+
+  static constexpr size_t kMaxChanges = 4096;
+  Vec<LineChange> changes_;
+  void record_change(LineChange::Kind kind, int64_t line);
 
   // Runner
   int64_t pc_{-1};
   Map<Str, int64_t> variant_env;
   Str variant_need_input_;
+  parser::RunState run_state_;
+
+  std::ostream* output_sink_{};
+  void write_to_sink(const Str& output, size_t from);
+
+  // Execution tiers
+  Tier tier_{Tier::TreeWalker};
+  // Bumped by every edit so compiled code can tell it is stale
+  uint64_t program_version_{};
+
+  bool memoize_{};
+  RunCache run_cache_;
+  // Back-edges between cycle checks, 0 when off
+  int64_t cycle_period_{};
+  CycleDetector cycles_;
+
+  Quota quota_;
+  Termination termination_{Termination::None};
+  // Spent by the current run
+  uint64_t run_steps_{};
+  size_t run_output_{};
+  std::chrono::nanoseconds run_time_{};
+
+  // Back-edges after which the tiers pause for the checks above, 0 for none
+  int64_t pause_period_{};
+
+  Rc<closure::Program> closure_program_;
+  uint64_t closure_version_{};
+  Rc<bytecode::Program> bytecode_program_;
+  uint64_t bytecode_version_{};
+  Rc<jit::Program> jit_program_;
+  uint64_t jit_version_{};
+
+  // Slot storage reused by compiled runs
+  Vec<int64_t> slots_;
+  Vec<uint8_t> defined_;
+  Vec<SlotLoop> slot_loops_;
+  Vec<int32_t> returns_;
+  Vec<parser::Array> array_storage_;
+  Vec<SlotArray> slot_arrays_;
+
+  UIBehavior step(Str& output);
+  // step() for a program with unparsed lines: walks `lines_` and parses
+  // each line as it is reached
+  UIBehavior step_lazy(Str& output);
+  // Runs with the checks that need pauses; yields after `slice` back-edges
+  // unless it is 0
+  UIBehavior run_tier(Str& output, uint64_t slice);
+  // Ends the run with an error line
+  UIBehavior stop(Str& output, Termination reason);
+  // Runs until the run finishes, waits for INPUT or pauses for a sample
+  // (UIBehavior::None)
+  UIBehavior run_slice(Str& output);
+  UIBehavior run_tree_walker(Str& output);
+  // Compiles `program` when stale and runs it, or falls back to the tree
+  // walker when the program cannot be compiled
+  template <typename Program, typename... Args>
+  UIBehavior run_compiled(Rc<Program>& program, uint64_t& version,
+                          Str& output, Args... args);
 
-  static Str string_lines_into_string(const Map<int64_t, Str>& in);
+  static Str string_lines_into_string(const LineTable& in);
 };
 
 }  // namespace engine
\ No newline at end of file
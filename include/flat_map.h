@@ -0,0 +1,153 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+
+#include "type.h"
+
+namespace engine {
+
+// Sorted map in two flat arrays, the keys in one and the values in the
+// other, for tables built in order once and then only read. Lookups
+// binary-search the contiguous keys, and stepping to the next entry is an
+// index increment. Inserting anywhere but at the end moves the tail.
+template <typename Key, typename Value>
+class FlatMap {
+ public:
+  using value_type = std::pair<Key, Value>;
+
+  // Dereferences to a pair of references into the arrays. Iterators are
+  // invalidated by any edit.
+  class const_iterator {
+   public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = FlatMap::value_type;
+    using difference_type = std::ptrdiff_t;
+    using reference = std::pair<const Key&, const Value&>;
+    struct pointer {
+      reference entry;
+      const reference* operator->() const { return &entry; }
+    };
+
+    const_iterator() = default;
+
+    reference operator*() const {
+      return {map_->keys_[index_], map_->values_[index_]};
+    }
+    pointer operator->() const { return pointer{**this}; }
+
+    const_iterator& operator++() {
+      ++index_;
+      return *this;
+    }
+    const_iterator operator++(int) {
+      auto before = *this;
+      ++index_;
+      return before;
+    }
+    const_iterator& operator--() {
+      --index_;
+      return *this;
+    }
+    const_iterator operator--(int) {
+      auto before = *this;
+      --index_;
+      return before;
+    }
+
+    bool operator==(const const_iterator& other) const {
+      return index_ == other.index_;
+    }
+    bool operator!=(const const_iterator& other) const {
+      return !(*this == other);
+    }
+
+   private:
+    friend class FlatMap;
+
+    const FlatMap* map_{};
+    size_t index_{};
+
+    const_iterator(const FlatMap* map, size_t index)
+        : map_(map), index_(index) {}
+  };
+
+  [[nodiscard]] size_t size() const { return keys_.size(); }
+  [[nodiscard]] bool empty() const { return keys_.empty(); }
+
+  [[nodiscard]] const_iterator begin() const { return {this, 0}; }
+  [[nodiscard]] const_iterator end() const { return {this, keys_.size()}; }
+
+  // The first entry whose key is not less, or greater, than `key`
+  [[nodiscard]] const_iterator lower_bound(const Key& key) const {
+    return {this, lower_index(key)};
+  }
+  [[nodiscard]] const_iterator upper_bound(const Key& key) const {
+    return {this, static_cast<size_t>(
+                      std::upper_bound(keys_.begin(), keys_.end(), key) -
+                      keys_.begin())};
+  }
+  [[nodiscard]] const_iterator find(const Key& key) const {
+    auto at = lower_index(key);
+    return at != keys_.size() && !(key < keys_[at]) ? const_iterator{this, at}
+                                                    : end();
+  }
+  [[nodiscard]] size_t count(const Key& key) const {
+    return find(key) != end() ? 1 : 0;
+  }
+  [[nodiscard]] const Value& at(const Key& key) const {
+    auto it = find(key);
+    if (it == end()) {
+      throw std::out_of_range("FlatMap::at");
+    }
+    return values_[it.index_];
+  }
+
+  // Leaves an existing entry alone; true if the key was not there before
+  bool emplace(const Key& key, Value value) {
+    auto at = lower_index(key);
+    if (at != keys_.size() && !(key < keys_[at])) {
+      return false;
+    }
+    keys_.insert(keys_.begin() + static_cast<std::ptrdiff_t>(at), key);
+    values_.insert(values_.begin() + static_cast<std::ptrdiff_t>(at),
+                   std::move(value));
+    return true;
+  }
+  bool insert(value_type entry) {
+    return emplace(entry.first, std::move(entry.second));
+  }
+  Value& operator[](const Key& key) {
+    emplace(key, Value());
+    return values_[lower_index(key)];
+  }
+
+  // True if the key was there
+  bool erase(const Key& key) {
+    auto it = find(key);
+    if (it == end()) {
+      return false;
+    }
+    keys_.erase(keys_.begin() + static_cast<std::ptrdiff_t>(it.index_));
+    values_.erase(values_.begin() + static_cast<std::ptrdiff_t>(it.index_));
+    return true;
+  }
+
+  void clear() {
+    keys_.clear();
+    values_.clear();
+  }
+
+ private:
+  Vec<Key> keys_;
+  Vec<Value> values_;
+
+  size_t lower_index(const Key& key) const {
+    return static_cast<size_t>(
+        std::lower_bound(keys_.begin(), keys_.end(), key) - keys_.begin());
+  }
+};
+
+}  // namespace engine
@@ -0,0 +1,80 @@
+#pragma once
+#include "bytecode.h"
+#include "layout.h"
+#include "type.h"
+#include "ui_behavior.h"
+
+// Native code is only emitted for x86-64 Linux; elsewhere the tier profiles
+// and interprets
+#if defined(__linux__) && defined(__x86_64__)
+#define ENGINE_JIT_AVAILABLE 1
+#else
+#define ENGINE_JIT_AVAILABLE 0
+#endif
+
+// Baseline JIT tier: runs profiling bytecode and, once a loop header has run
+// kHotThreshold times, compiles the lines of that loop to x86-64 over the
+// slot array. Lines with PRINT, INPUT, END, FOR, GOSUB, RETURN, DIM, **, or
+// whole arrays are left to the interpreter, whose kernels already run those
+// vectorized, as are jumps out of the loop. NEXT runs natively
+// while it steps the innermost loop, whose record stays put inside a region.
+// Element accesses run natively too, compared against the array's rank and
+// bounds unless the bounds analysis proved them in range.
+namespace engine::jit {
+
+// Native code for one loop, in its own mmap'ed buffer
+class Region {
+ public:
+  using Entry = int32_t (*)(int64_t* slots, uint8_t* defined,
+                            const SlotLoop* loop, const SlotArray* arrays);
+
+  Region(const Vec<uint8_t>& code, Vec<uint32_t> reads);
+  ~Region();
+  Region(const Region&) = delete;
+  Region& operator=(const Region&) = delete;
+
+  [[nodiscard]] bool ok() const { return entry_ != nullptr; }
+
+  // Runs the loop and returns the instruction to resume interpreting at, or
+  // -1 without running when a variable it checks is still undefined
+  int32_t enter(Frame& frame) const;
+
+ private:
+  void* memory_{};
+  size_t size_{};
+  Entry entry_{};
+  // Slots behind a Check in the region; reads proven to follow an assignment
+  // need no guard
+  Vec<uint32_t> reads_;
+};
+
+class Program {
+ public:
+  static constexpr int32_t kEnd = Layout::kNoLine;
+  static constexpr int64_t kHotThreshold = 1000;
+
+  // nullptr if the program uses statements the bytecode cannot compile
+  static Rc<Program> compile(Layout layout);
+
+  // Runs from line index `pc` until END, INPUT or the end of the program and
+  // leaves `pc` at the line to resume from (kEnd when finished)
+  UIBehavior run(int32_t& pc, Frame& frame);
+
+  [[nodiscard]] const Layout& layout() const { return bytecode_->layout(); }
+
+  // Loops running as native code
+  [[nodiscard]] size_t compiled_loops() const;
+
+  explicit Program(Rc<bytecode::Program> bytecode);
+
+ private:
+  Rc<bytecode::Program> bytecode_;
+  Vec<int64_t> counters_;
+  Vec<Rc<Region>> regions_;
+
+  // Instruction to continue at after the hot loop header at `ip`
+  int32_t enter(const bytecode::Instr& header, int32_t ip, Frame& frame);
+  Rc<Region> compile_loop(int32_t header) const;
+};
+
+}  // namespace engine::jit
@@ -0,0 +1,293 @@
+#pragma once
+#include "bounds_check.h"
+#include "definite_assignment.h"
+#include "flat_map.h"
+#include "parser.h"
+#include "type.h"
+
+namespace engine {
+
+// A FOR loop with its variable resolved to a slot and its body to a line
+// index (kNoLine past the last line)
+struct SlotLoop {
+  uint32_t slot;
+  int32_t body;
+  int64_t limit;
+  int64_t step;
+};
+
+// A DIM'd array as the compiled tiers index it. Rank 1 arrays have one
+// column; rank 0 is one not DIM'd yet.
+struct SlotArray {
+  int64_t* data;
+  int64_t rows;
+  int64_t columns;
+  uint32_t rank;
+};
+
+// Program lines in execution order and variables resolved to dense slots,
+// shared by the compiled execution tiers
+class Layout {
+ public:
+  static constexpr int32_t kNoLine = -1;
+
+  // Without an `assigned` analysis every variable read is checked, and
+  // without `bounds` every element access
+  explicit Layout(const FlatMap<int64_t, Rc<parser::ast_node::LineNoStmt>>& ast,
+                  Rc<const DefiniteAssignment> assigned = nullptr,
+                  Rc<const BoundsCheck> bounds = nullptr);
+
+  [[nodiscard]] const Vec<Rc<parser::ast_node::LineNoStmt>>& lines() const {
+    return lines_;
+  }
+  [[nodiscard]] const Vec<Str>& names() const { return names_; }
+
+  // Index of a line number, or kNoLine when the program has no such line
+  [[nodiscard]] int32_t index_of(int64_t line) const;
+  [[nodiscard]] int64_t line_at(int32_t index) const;
+
+  // Slot of a variable, assigned on first use
+  uint32_t slot(const Str& name);
+  [[nodiscard]] size_t slot_count() const { return names_.size(); }
+  // Slot of an array, assigned on first use
+  uint32_t array(const Str& name);
+  [[nodiscard]] const Vec<Str>& array_names() const { return array_names_; }
+
+  // Whether reads are checked against a definite assignment analysis
+  [[nodiscard]] bool analyzed() const { return assigned_ != nullptr; }
+  // Line whose reads `checked` answers for, set by the compilers as they go
+  void set_line(int32_t index) { line_ = index; }
+  // Whether a read of `name` on the current line may find it unassigned and
+  // so needs the unknown-variable check
+  [[nodiscard]] bool checked(const Str& name) const;
+  // Whether `access` on the current line may find its array not DIM'd, of
+  // another rank or an index out of range and so needs the bounds check
+  [[nodiscard]] bool checked(const parser::ast_node::ArrayExpr& access) const;
+
+  // Copy variables between the engine's environment and slot storage
+  void load(const Map<Str, int64_t>& variants, Vec<int64_t>& slots,
+            Vec<uint8_t>& defined) const;
+  void store(const Vec<int64_t>& slots, const Vec<uint8_t>& defined,
+             Map<Str, int64_t>& variants) const;
+  // The same for the active FOR loops, into storage sized for the deepest
+  // stack; returns how many were loaded. Loops over a variable or a body
+  // line this program lacks, left by a run paused across an edit, end.
+  size_t load(const parser::LoopStack& loops,
+              Vec<SlotLoop>& slot_loops) const;
+  void store(const SlotLoop* slot_loops, size_t depth,
+             parser::LoopStack& loops) const;
+  // The same for the pending GOSUBs, as line indices to return to. A return
+  // to a line this program lacks ends the run, as GOTO to it would.
+  size_t load(const parser::CallStack& calls, Vec<int32_t>& returns) const;
+  void store(const int32_t* returns, size_t depth,
+             parser::CallStack& calls) const;
+  // The same for arrays, moved into `storage` by slot with `views` of them.
+  // Arrays the program never names stay where they are.
+  void load(Map<Str, parser::Array>& arrays, Vec<parser::Array>& storage,
+            Vec<SlotArray>& views) const;
+  void store(Vec<parser::Array>& storage,
+             Map<Str, parser::Array>& arrays) const;
+
+ private:
+  Vec<Rc<parser::ast_node::LineNoStmt>> lines_;
+  Vec<int64_t> numbers_;
+  Rc<const DefiniteAssignment> assigned_;
+  Rc<const BoundsCheck> bounds_;
+  int32_t line_{kNoLine};
+
+  Map<Str, uint32_t> slots_;
+  Vec<Str> names_;
+  Map<Str, uint32_t> arrays_;
+  Vec<Str> array_names_;
+};
+
+// The view compiled code indexes for `array`
+inline SlotArray view(parser::Array& array) {
+  auto rank = static_cast<uint32_t>(array.extents.size());
+  return SlotArray{array.values.data(), rank > 0 ? array.extents[0] : 0,
+                   rank > 1 ? array.extents[1] : 1, rank};
+}
+
+// Slot storage a compiled program runs against
+struct Frame {
+  int64_t* slots;
+  uint8_t* defined;
+  const Vec<Str>* names;
+  Str* output;
+
+  // Set by INPUT before pausing
+  uint32_t input_slot{};
+  int32_t resume{};
+
+  // Per loop header countdowns, for tiers that profile loops
+  int64_t* loop_counters{};
+
+  // Back-edges between pauses that let the engine sample the run's state;
+  // 0 never pauses. A paused run returns UIBehavior::None.
+  int64_t sample_period{};
+
+  // Active FOR loops, innermost last, in storage for
+  // parser::LoopStack::kMaxDepth of them
+  SlotLoop* loops{};
+  size_t loop_depth{};
+
+  // Starts a loop like parser::LoopStack::push; false when the stack is full
+  bool push_loop(const SlotLoop& loop) {
+    for (size_t i{}; i < loop_depth; ++i) {
+      if (loops[i].slot == loop.slot) {
+        loop_depth = i;
+        break;
+      }
+    }
+    if (loop_depth == parser::LoopStack::kMaxDepth) {
+      return false;
+    }
+    loops[loop_depth++] = loop;
+    return true;
+  }
+  // The innermost loop over `slot` like parser::LoopStack::find
+  SlotLoop* find_loop(uint32_t slot) {
+    for (auto i = loop_depth; i-- > 0;) {
+      if (loops[i].slot == slot) {
+        loop_depth = i + 1;
+        return &loops[i];
+      }
+    }
+    return nullptr;
+  }
+
+  // Pending GOSUBs as line indices to return to, innermost last, in storage
+  // for max_call_depth of them
+  int32_t* returns{};
+  size_t call_depth{};
+  size_t max_call_depth{};
+
+  // Pushes a return address; false when max_call_depth calls are pending
+  bool call(int32_t line) {
+    if (call_depth == max_call_depth) {
+      return false;
+    }
+    returns[call_depth++] = line;
+    return true;
+  }
+  void call_overflow() {
+    output->append("ERROR: GOSUB nested deeper than " +
+                   std::to_string(max_call_depth) + "\n");
+  }
+
+  // Arrays by slot, with the storage behind each view
+  SlotArray* arrays{};
+  parser::Array* array_storage{};
+  const Vec<Str>* array_names{};
+
+  // How MAT, SORT and the reductions run
+  const parser::ArrayPolicy* array_policy{};
+
+  // Set when an element access, DIM or whole-array statement stopped the
+  // run, after reporting it
+  bool failed{};
+
+  // DIMs the array in `slot` like parser::ast_node::Dim; false when a
+  // bound is out of range
+  bool dim(uint32_t slot, const int64_t* bounds, size_t rank) {
+    auto& array = array_storage[slot];
+    if (!array.dim(bounds, rank)) {
+      output->append("ERROR: DIM " +
+                     parser::element_name((*array_names)[slot], bounds, rank) +
+                     " out of range\n");
+      failed = true;
+      return false;
+    }
+    arrays[slot] = view(array);
+    return true;
+  }
+  // The element of the array in `slot` at `indices`, or nullptr after
+  // reporting why there is none. Indices computed by an expression that
+  // already stopped the run are not reported again.
+  int64_t* element(uint32_t slot, const int64_t* indices, size_t rank) {
+    const auto& array = arrays[slot];
+    if (array.rank == rank && indices[0] >= 0 && indices[0] < array.rows &&
+        (rank == 1 || (indices[1] >= 0 && indices[1] < array.columns))) {
+      return array.data + indices[0] * array.columns +
+             (rank == 1 ? 0 : indices[1]);
+    }
+    if (!failed) {
+      output->append(parser::index_error((*array_names)[slot],
+                                         &array_storage[slot], indices, rank) +
+                     "\n");
+      failed = true;
+    }
+    return nullptr;
+  }
+  // The element at indices the analysis proved in range
+  int64_t* element_unchecked(uint32_t slot, const int64_t* indices,
+                             size_t rank) const {
+    const auto& array = arrays[slot];
+    return array.data + indices[0] * array.columns +
+           (rank == 1 ? 0 : indices[1]);
+  }
+
+  // MAT like parser::ast_node::Mat, `right` ignored when scaling; false
+  // after reporting an array not DIM'd or operands of different shapes
+  bool mat(parser::MatOp op, uint32_t target, uint32_t left, uint32_t right,
+           int64_t factor) {
+    const auto& names = *array_names;
+    auto error = op == parser::MatOp::Scale
+                     ? parser::whole_array_error(names[left],
+                                                 &array_storage[left])
+                     : parser::mat_error(names[left], &array_storage[left],
+                                         names[right], &array_storage[right]);
+    if (!error.empty()) {
+      output->append(error + "\n");
+      failed = true;
+      return false;
+    }
+    parser::mat(*array_policy, op, array_storage[target], array_storage[left],
+                array_storage[op == parser::MatOp::Scale ? left : right],
+                factor);
+    arrays[target] = view(array_storage[target]);
+    return true;
+  }
+  // SORT like parser::ast_node::Sort; false after reporting an array not
+  // DIM'd
+  bool sort(uint32_t slot) {
+    auto& array = array_storage[slot];
+    auto error = parser::whole_array_error((*array_names)[slot], &array);
+    if (!error.empty()) {
+      output->append(error + "\n");
+      failed = true;
+      return false;
+    }
+    parser::kernels::sort(*array_policy, array.values.data(),
+                          array.values.size());
+    return true;
+  }
+  // SUM, MIN or MAX like parser::ast_node::ReduceExpr, 0 after reporting an
+  // array not DIM'd unless the run already stopped
+  int64_t reduce(parser::Reduction reduction, uint32_t slot) {
+    const auto& array = array_storage[slot];
+    auto error = parser::whole_array_error((*array_names)[slot], &array);
+    if (!error.empty()) {
+      if (!failed) {
+        output->append(error + "\n");
+        failed = true;
+      }
+      return 0;
+    }
+    return parser::kernels::reduce(*array_policy, reduction,
+                                   array.values.data(), array.values.size());
+  }
+
+  // Reads a slot, warning like VariantExpr when it was never assigned
+  int64_t read(uint32_t slot) {
+    if (defined[slot]) {
+      return slots[slot];
+    }
+    if (!failed) {
+      output->append("WARNING: Unknown variable " + (*names)[slot] + "\n");
+    }
+    return 0;
+  }
+};
+
+}  // namespace engine
@@ -0,0 +1,63 @@
+#pragma once
+#include <list>
+#include <string_view>
+#include <unordered_map>
+
+#include "parser.h"
+#include "type.h"
+
+namespace engine {
+
+// FNV-1a, for ParseCache::hash and the hashes of run state built on it
+constexpr uint64_t kFnvOffset = 14695981039346656037ULL;
+constexpr uint64_t kFnvPrime = 1099511628211ULL;
+
+// Continues the FNV-1a hash `h` over the 8 bytes of `value`, low first
+inline void mix_u64(uint64_t& h, uint64_t value) {
+  for (auto i = 0; i < 8; ++i) {
+    h ^= value & 0xFF;
+    h *= kFnvPrime;
+    value >>= 8;
+  }
+}
+
+// Statement ASTs keyed by the text after the line number. Identical
+// statement bodies share one immutable AST; the least recently used
+// entries are evicted once the capacity is reached.
+class ParseCache {
+ public:
+  explicit ParseCache(size_t capacity = 1 << 16) : capacity_(capacity) {}
+
+  // Counts a hit or a miss
+  Rc<parser::ast_node::Stmt> find(std::string_view text);
+  void insert(std::string_view text, const Rc<parser::ast_node::Stmt>& stmt);
+
+  void set_capacity(size_t capacity);
+  void clear();
+
+  [[nodiscard]] size_t capacity() const { return capacity_; }
+  [[nodiscard]] size_t size() const { return lru_.size(); }
+  [[nodiscard]] uint64_t hits() const { return hits_; }
+  [[nodiscard]] uint64_t misses() const { return misses_; }
+
+  static uint64_t hash(std::string_view text);
+
+ private:
+  struct Entry {
+    uint64_t hash;
+    Str text;
+    Rc<parser::ast_node::Stmt> stmt;
+  };
+
+  size_t capacity_;
+  uint64_t hits_{};
+  uint64_t misses_{};
+
+  // Most recently used at the front
+  std::list<Entry> lru_;
+  std::unordered_multimap<uint64_t, std::list<Entry>::iterator> index_;
+
+  void evict();
+};
+
+}  // namespace engine
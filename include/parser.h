@@ -1,20 +1,65 @@
 #pragma once
 #include <cmath>
+#include <sstream>
 #include <stack>
 #include <utility>
 
-#include "engine.h"
+#include "run_state.h"
 #include "tokenizer.h"
 #include "type.h"
 #include "ui_behavior.h"
 
+namespace parser {
+
+// One node of a dump, at its depth below the dumped node
+struct AstRow {
+  uint32_t depth;
+  Str label;
+};
+
+// Collects a dump as rows with their depths instead of indented text, so
+// tabs and newlines inside a token, e.g. in REM, cannot be mistaken for
+// the tree's structure
+class AstRows : public std::ostream {
+ public:
+  AstRows() : std::ostream(nullptr) { rdbuf(&row_); }
+
+  void begin_row(uint32_t depth) {
+    depth_ = depth;
+    row_.str({});
+  }
+  void end_row() {
+    rows_.push_back(AstRow{depth_, row_.str()});
+    row_.str({});
+  }
+
+  [[nodiscard]] Vec<AstRow>& rows() { return rows_; }
+
+ private:
+  std::stringbuf row_;
+  uint32_t depth_{};
+  Vec<AstRow> rows_;
+};
+
+}  // namespace parser
+
 namespace {
 inline void dump_indent(uint32_t indent, std::ostream& ostream) {
+  if (auto* rows = dynamic_cast<parser::AstRows*>(&ostream)) {
+    rows->begin_row(indent);
+    return;
+  }
   for (uint32_t i{}; i < indent; ++i) {
     ostream << '\t';
   }
 }
-inline void dump_end_line(std::ostream& ostream) { ostream << std::endl; }
+inline void dump_end_line(std::ostream& ostream) {
+  if (auto* rows = dynamic_cast<parser::AstRows*>(&ostream)) {
+    rows->end_row();
+    return;
+  }
+  ostream << std::endl;
+}
 
 inline void dump_token(uint32_t indent, const Rc<tokenizer::Token>& token,
                        std::ostream& ostream) {
@@ -40,9 +85,17 @@ class Stmt : public AstNode {
  public:
   void dump(uint32_t indent, std::ostream& ostream) const override = 0;
   virtual UIBehavior run(Map<Str, int64_t>& variants, int64_t& next_pc,
-                         Str& output, Str& variant_need_input) = 0;
+                         Str& output, Str& variant_need_input,
+                         RunState& state) = 0;
 
   ~Stmt() override = default;
+
+ protected:
+  // Whether an expression just evaluated stopped the run, e.g. on an index
+  // out of range, after reporting it; clears it as the statement ends the run
+  static bool failed(RunState& state) {
+    return std::exchange(state.failed, false);
+  }
 };
 
 // Command
@@ -57,7 +110,8 @@ class Expr : public AstNode {
  public:
   void dump(uint32_t indent, std::ostream& ostream) const override = 0;
 
-  virtual int64_t evaluate(Map<Str, int64_t>& variants, Str& output) = 0;
+  virtual int64_t evaluate(Map<Str, int64_t>& variants, Str& output,
+                           RunState& state) = 0;
 
   ~Expr() override = default;
 };
@@ -84,6 +138,8 @@ class Invalid : public AstNode {
   explicit Invalid(Str error_message)
       : error_message_(std::move(error_message)) {}
 
+  [[nodiscard]] const Str& message() const { return error_message_; }
+
  private:
   Str error_message_;
 };
@@ -97,6 +153,9 @@ class Token : public AstNode {
 
   [[nodiscard]] Rc<tokenizer::Token> token() const { return token_; }
 
+  // Parser pools its stack wrappers and rebinds them between lines
+  void rebind(const Rc<tokenizer::Token>& token) { token_ = token; }
+
   explicit Token(Rc<tokenizer::Token> token) : token_(std::move(token)) {}
 
  private:
@@ -111,10 +170,11 @@ class LineNoStmt : public AstNode {
   }
 
   [[nodiscard]] Rc<tokenizer::token::Integer> number() const { return number_; }
+  [[nodiscard]] Rc<Stmt> stmt() const { return stmt_; }
 
   UIBehavior run(Map<Str, int64_t>& variants, int64_t& next_pc, Str& output,
-                 Str& variant_need_input) {
-    return stmt_->run(variants, next_pc, output, variant_need_input);
+                 Str& variant_need_input, RunState& state) {
+    return stmt_->run(variants, next_pc, output, variant_need_input, state);
   }
 
   LineNoStmt(const Rc<AstNode>& token, const Rc<AstNode>& stmt_)
@@ -122,6 +182,10 @@ class LineNoStmt : public AstNode {
             std::static_pointer_cast<ast_node::Token>(token)->token())),
         stmt_(std::static_pointer_cast<Stmt>(stmt_)) {}
 
+  // For statements shared between lines, e.g. by the parse cache
+  LineNoStmt(Rc<tokenizer::token::Integer> number, Rc<Stmt> stmt)
+      : number_(std::move(number)), stmt_(std::move(stmt)) {}
+
  private:
   Rc<tokenizer::token::Integer> number_;
   Rc<Stmt> stmt_;
@@ -136,7 +200,7 @@ class Rem : public Stmt {
   }
 
   UIBehavior run(Map<Str, int64_t>& variants, int64_t& next_pc, Str& output,
-                 Str& variant_need_input) override {
+                 Str& variant_need_input, RunState& state) override {
     return UIBehavior::None;
   }
 
@@ -161,8 +225,11 @@ class Let : public Stmt {
     expr_->dump(indent + 2, ostream);
   }
   UIBehavior run(Map<Str, int64_t>& variants, int64_t& next_pc, Str& output,
-                 Str& variant_need_input) override {
-    auto value = expr_->evaluate(variants, output);
+                 Str& variant_need_input, RunState& state) override {
+    auto value = expr_->evaluate(variants, output, state);
+    if (failed(state)) {
+      return UIBehavior::FinishRun;
+    }
     if (variants.count(variant_->value())) {
       variants.erase(variant_->value());
     }
@@ -170,6 +237,11 @@ class Let : public Stmt {
     return UIBehavior::None;
   }
 
+  [[nodiscard]] Rc<tokenizer::token::Variant> variant() const {
+    return variant_;
+  }
+  [[nodiscard]] Rc<Expr> expr() const { return expr_; }
+
   Let(const Rc<AstNode>& let, const Rc<AstNode>& variant,
       const Rc<AstNode>& equal, const Rc<AstNode>& expr)
       : let_(std::static_pointer_cast<tokenizer::token::Let>(
@@ -195,12 +267,18 @@ class Print : public Stmt {
     expr_->dump(indent + 1, ostream);
   }
   UIBehavior run(Map<Str, int64_t>& variants, int64_t& next_pc, Str& output,
-                 Str& variant_need_input) override {
-    auto o = std::to_string(expr_->evaluate(variants, output));
+                 Str& variant_need_input, RunState& state) override {
+    auto value = expr_->evaluate(variants, output, state);
+    if (failed(state)) {
+      return UIBehavior::FinishRun;
+    }
+    auto o = std::to_string(value);
     output.insert(output.end(), o.begin(), o.end());
     return UIBehavior::None;
   }
 
+  [[nodiscard]] Rc<Expr> expr() const { return expr_; }
+
   Print(const Rc<AstNode>& print, const Rc<AstNode>& expr)
       : print_(std::static_pointer_cast<tokenizer::token::Print>(
             std::static_pointer_cast<Token>(print)->token())),
@@ -220,12 +298,16 @@ class Input : public Stmt {
   }
 
   UIBehavior run(Map<Str, int64_t>& variants, int64_t& next_pc, Str& output,
-                 Str& variant_need_input) override {
+                 Str& variant_need_input, RunState& state) override {
     variant_need_input = variant_->value();
     auto i = Str("INPUT " + variant_->value());
     output.insert(output.end(), i.begin(), i.end());
     return UIBehavior::Input;
   }
+  [[nodiscard]] Rc<tokenizer::token::Variant> variant() const {
+    return variant_;
+  }
+
   Input(const Rc<AstNode>& input, const Rc<AstNode>& variant)
       : input_(std::static_pointer_cast<tokenizer::token::Input>(
             std::static_pointer_cast<Token>(input)->token())),
@@ -246,16 +328,22 @@ class Goto : public Stmt {
   }
 
   UIBehavior run(Map<Str, int64_t>& variants, int64_t& next_pc, Str& output,
-                 Str& variant_need_input) override {
+                 Str& variant_need_input, RunState& state) override {
     next_pc = number_->value();
     return UIBehavior::None;
   }
+  [[nodiscard]] Rc<tokenizer::token::Integer> number() const { return number_; }
+
   Goto(const Rc<AstNode>& go_to, const Rc<AstNode>& number)
       : goto_(std::static_pointer_cast<tokenizer::token::Goto>(
             std::static_pointer_cast<Token>(go_to)->token())),
         number_(std::static_pointer_cast<tokenizer::token::Integer>(
             std::static_pointer_cast<Token>(number)->token())) {}
 
+  // The same jump to another line
+  Goto(const Goto& jump, Rc<tokenizer::token::Integer> number)
+      : goto_(jump.goto_), number_(std::move(number)) {}
+
  private:
   Rc<tokenizer::token::Goto> goto_;
   Rc<tokenizer::token::Integer> number_;
@@ -272,13 +360,20 @@ class If : public Stmt {
   }
 
   UIBehavior run(Map<Str, int64_t>& variants, int64_t& next_pc, Str& output,
-                 Str& variant_need_input) override {
-    if (expr_->evaluate(variants, output) != 0) {
+                 Str& variant_need_input, RunState& state) override {
+    auto value = expr_->evaluate(variants, output, state);
+    if (failed(state)) {
+      return UIBehavior::FinishRun;
+    }
+    if (value != 0) {
       next_pc = number_->value();
     }
     return UIBehavior::None;
   }
 
+  [[nodiscard]] Rc<Expr> expr() const { return expr_; }
+  [[nodiscard]] Rc<tokenizer::token::Integer> number() const { return number_; }
+
   If(const Rc<AstNode>& _if, const Rc<AstNode>& expr, const Rc<AstNode>& then,
      const Rc<AstNode>& number)
       : if_(std::static_pointer_cast<tokenizer::token::If>(
@@ -289,6 +384,13 @@ class If : public Stmt {
         number_(std::static_pointer_cast<tokenizer::token::Integer>(
             std::static_pointer_cast<Token>(number)->token())) {}
 
+  // The same condition jumping to another line
+  If(const If& branch, Rc<tokenizer::token::Integer> number)
+      : if_(branch.if_),
+        expr_(branch.expr_),
+        then_(branch.then_),
+        number_(std::move(number)) {}
+
  private:
   Rc<tokenizer::token::If> if_;
   Rc<Expr> expr_;
@@ -305,7 +407,7 @@ class End : public Stmt {
     dump_end_line(ostream);
   }
   UIBehavior run(Map<Str, int64_t>& variants, int64_t& next_pc, Str& output,
-                 Str& variant_need_input) override {
+                 Str& variant_need_input, RunState& state) override {
     return UIBehavior::FinishRun;
   }
 
@@ -317,6 +419,182 @@ class End : public Stmt {
   Rc<tokenizer::Token> end_;
 };
 
+// Loop from FOR to the NEXT over the same variable. The body runs at least
+// once, as NEXT is matched to its FOR when the run gets there, and the
+// bound and step are evaluated once when the loop starts.
+class For : public Stmt {
+ public:
+  void dump(uint32_t indent, std::ostream& ostream) const override {
+    dump_token(indent, for_, ostream);
+    dump_token(indent + 1, equal_, ostream);
+    dump_token(indent + 2, variant_, ostream);
+    start_->dump(indent + 2, ostream);
+    dump_token(indent + 1, to_, ostream);
+    limit_->dump(indent + 2, ostream);
+    if (step_) {
+      dump_token(indent + 1, step_token_, ostream);
+      step_->dump(indent + 2, ostream);
+    }
+  }
+  UIBehavior run(Map<Str, int64_t>& variants, int64_t& next_pc, Str& output,
+                 Str& variant_need_input, RunState& state) override {
+    auto start = start_->evaluate(variants, output, state);
+    auto limit = limit_->evaluate(variants, output, state);
+    auto step = step_ ? step_->evaluate(variants, output, state) : 1;
+    if (failed(state)) {
+      return UIBehavior::FinishRun;
+    }
+    variants[variant_->value()] = start;
+    if (!state.loops.push(Loop{variant_->value(), limit, step, next_pc})) {
+      output.append("ERROR: FOR loops nested too deeply");
+      return UIBehavior::FinishRun;
+    }
+    return UIBehavior::None;
+  }
+
+  [[nodiscard]] Rc<tokenizer::token::Variant> variant() const {
+    return variant_;
+  }
+  [[nodiscard]] Rc<Expr> start() const { return start_; }
+  [[nodiscard]] Rc<Expr> limit() const { return limit_; }
+  // nullptr when the loop steps by 1
+  [[nodiscard]] Rc<Expr> step() const { return step_; }
+
+  For(const Rc<AstNode>& _for, const Rc<AstNode>& variant,
+      const Rc<AstNode>& equal, const Rc<AstNode>& start,
+      const Rc<AstNode>& to, const Rc<AstNode>& limit)
+      : for_(std::static_pointer_cast<tokenizer::token::For>(
+            std::static_pointer_cast<Token>(_for)->token())),
+        variant_(std::static_pointer_cast<tokenizer::token::Variant>(
+            std::static_pointer_cast<Token>(variant)->token())),
+        equal_(std::static_pointer_cast<tokenizer::token::Equal>(
+            std::static_pointer_cast<Token>(equal)->token())),
+        start_(std::static_pointer_cast<Expr>(start)),
+        to_(std::static_pointer_cast<tokenizer::token::To>(
+            std::static_pointer_cast<Token>(to)->token())),
+        limit_(std::static_pointer_cast<Expr>(limit)) {}
+
+  For(const Rc<AstNode>& _for, const Rc<AstNode>& variant,
+      const Rc<AstNode>& equal, const Rc<AstNode>& start,
+      const Rc<AstNode>& to, const Rc<AstNode>& limit,
+      const Rc<AstNode>& step_token, const Rc<AstNode>& step)
+      : For(_for, variant, equal, start, to, limit) {
+    step_token_ = std::static_pointer_cast<tokenizer::token::Step>(
+        std::static_pointer_cast<Token>(step_token)->token());
+    step_ = std::static_pointer_cast<Expr>(step);
+  }
+
+ private:
+  Rc<tokenizer::token::For> for_;
+  Rc<tokenizer::token::Variant> variant_;
+  Rc<tokenizer::token::Equal> equal_;
+  Rc<Expr> start_;
+  Rc<tokenizer::token::To> to_;
+  Rc<Expr> limit_;
+  Rc<tokenizer::token::Step> step_token_;
+  Rc<Expr> step_;
+};
+
+// Steps the innermost loop over its variable and jumps back to the body
+// until the variable passes the bound
+class Next : public Stmt {
+ public:
+  void dump(uint32_t indent, std::ostream& ostream) const override {
+    dump_token(indent, next_, ostream);
+    dump_token(indent + 1, variant_, ostream);
+  }
+  UIBehavior run(Map<Str, int64_t>& variants, int64_t& next_pc, Str& output,
+                 Str& variant_need_input, RunState& state) override {
+    auto* loop = state.loops.find(variant_->value());
+    if (loop == nullptr) {
+      output.append("ERROR: NEXT " + variant_->value() + " without FOR");
+      return UIBehavior::FinishRun;
+    }
+    auto& value = variants[variant_->value()];
+    value += loop->step;
+    if (loop->step >= 0 ? value <= loop->limit : value >= loop->limit) {
+      next_pc = loop->body;
+    } else {
+      state.loops.pop();
+    }
+    return UIBehavior::None;
+  }
+
+  [[nodiscard]] Rc<tokenizer::token::Variant> variant() const {
+    return variant_;
+  }
+
+  Next(const Rc<AstNode>& next, const Rc<AstNode>& variant)
+      : next_(std::static_pointer_cast<tokenizer::token::Next>(
+            std::static_pointer_cast<Token>(next)->token())),
+        variant_(std::static_pointer_cast<tokenizer::token::Variant>(
+            std::static_pointer_cast<Token>(variant)->token())) {}
+
+ private:
+  Rc<tokenizer::token::Next> next_;
+  Rc<tokenizer::token::Variant> variant_;
+};
+
+// Jumps to a subroutine; RETURN comes back to the line after it
+class Gosub : public Stmt {
+ public:
+  void dump(uint32_t indent, std::ostream& ostream) const override {
+    dump_token(indent, gosub_, ostream);
+    dump_token(indent + 1, number_, ostream);
+  }
+
+  UIBehavior run(Map<Str, int64_t>& variants, int64_t& next_pc, Str& output,
+                 Str& variant_need_input, RunState& state) override {
+    if (!state.calls.push(next_pc)) {
+      output.append("ERROR: GOSUB nested deeper than " +
+                    std::to_string(state.calls.max_depth()));
+      return UIBehavior::FinishRun;
+    }
+    next_pc = number_->value();
+    return UIBehavior::None;
+  }
+  [[nodiscard]] Rc<tokenizer::token::Integer> number() const { return number_; }
+
+  Gosub(const Rc<AstNode>& gosub, const Rc<AstNode>& number)
+      : gosub_(std::static_pointer_cast<tokenizer::token::Gosub>(
+            std::static_pointer_cast<Token>(gosub)->token())),
+        number_(std::static_pointer_cast<tokenizer::token::Integer>(
+            std::static_pointer_cast<Token>(number)->token())) {}
+
+  // The same call to another line
+  Gosub(const Gosub& call, Rc<tokenizer::token::Integer> number)
+      : gosub_(call.gosub_), number_(std::move(number)) {}
+
+ private:
+  Rc<tokenizer::token::Gosub> gosub_;
+  Rc<tokenizer::token::Integer> number_;
+};
+
+// Goes back to the line after the latest GOSUB still pending
+class Return : public Stmt {
+ public:
+  void dump(uint32_t indent, std::ostream& ostream) const override {
+    dump_indent(indent, ostream);
+    return_->dump(ostream);
+    dump_end_line(ostream);
+  }
+  UIBehavior run(Map<Str, int64_t>& variants, int64_t& next_pc, Str& output,
+                 Str& variant_need_input, RunState& state) override {
+    if (!state.calls.pop(next_pc)) {
+      output.append("ERROR: RETURN without GOSUB");
+      return UIBehavior::FinishRun;
+    }
+    return UIBehavior::None;
+  }
+
+  explicit Return(const Rc<AstNode>& _return)
+      : return_(std::static_pointer_cast<tokenizer::token::Return>(
+            std::static_pointer_cast<Token>(_return)->token())) {}
+
+ private:
+  Rc<tokenizer::Token> return_;
+};
+
 // Clear Line
 
 class ClearLine : public Command {
@@ -341,16 +619,25 @@ class VariantExpr : public Expr {
   void dump(uint32_t indent, std::ostream& ostream) const override {
     dump_token(indent, variant_, ostream);
   }
-  int64_t evaluate(Map<Str, int64_t>& variants, Str& output) override {
+  int64_t evaluate(Map<Str, int64_t>& variants, Str& output,
+                   RunState& state) override {
     if (variants.count(variant_->value()) == 0) {
-      auto warn = Str("WARNING: Unknown variable " + variant_->value()+"\n");
-      output.insert(output.end(), warn.begin(), warn.end());
+      // Once an access has stopped the run the rest of the statement is
+      // evaluated for nothing, as the compiled tiers stop right there
+      if (!state.failed) {
+        auto warn = Str("WARNING: Unknown variable " + variant_->value()+"\n");
+        output.insert(output.end(), warn.begin(), warn.end());
+      }
       return 0;
     } else {
       return variants[variant_->value()];
     }
   }
 
+  [[nodiscard]] Rc<tokenizer::token::Variant> variant() const {
+    return variant_;
+  }
+
   explicit VariantExpr(const Rc<AstNode>& variant)
       : variant_(std::static_pointer_cast<tokenizer::token::Variant>(
             std::static_pointer_cast<Token>(variant)->token())) {}
@@ -363,10 +650,15 @@ class IntegerExpr : public Expr {
   void dump(uint32_t indent, std::ostream& ostream) const override {
     dump_token(indent, integer_, ostream);
   }
-  int64_t evaluate(Map<Str, int64_t>& variants, Str& output) override {
+  int64_t evaluate(Map<Str, int64_t>& variants, Str& output,
+                   RunState& state) override {
     return integer_->value();
   }
 
+  [[nodiscard]] Rc<tokenizer::token::Integer> integer() const {
+    return integer_;
+  }
+
   explicit IntegerExpr(const Rc<AstNode>& variant)
       : integer_(std::static_pointer_cast<tokenizer::token::Integer>(
             std::static_pointer_cast<Token>(variant)->token())) {}
@@ -381,10 +673,13 @@ class NegExpr : public Expr {
     dump_token(indent, neg_, ostream);
     expr_->dump(indent + 1, ostream);
   }
-  int64_t evaluate(Map<Str, int64_t>& variants, Str& output) override {
-    return -expr_->evaluate(variants, output);
+  int64_t evaluate(Map<Str, int64_t>& variants, Str& output,
+                   RunState& state) override {
+    return -expr_->evaluate(variants, output, state);
   }
 
+  [[nodiscard]] Rc<Expr> expr() const { return expr_; }
+
   NegExpr(const Rc<AstNode>& neg, const Rc<AstNode>& expr)
       : neg_(std::static_pointer_cast<tokenizer::token::Minus>(
             std::static_pointer_cast<Token>(neg)->token())),
@@ -400,10 +695,13 @@ class PosExpr : public Expr {
     dump_token(indent, positive_, ostream);
     expr_->dump(indent + 1, ostream);
   }
-  int64_t evaluate(Map<Str, int64_t>& variants, Str& output) override {
-    return expr_->evaluate(variants, output);
+  int64_t evaluate(Map<Str, int64_t>& variants, Str& output,
+                   RunState& state) override {
+    return expr_->evaluate(variants, output, state);
   }
 
+  [[nodiscard]] Rc<Expr> expr() const { return expr_; }
+
   PosExpr(const Rc<AstNode>& positive, const Rc<AstNode>& expr)
       : positive_(std::static_pointer_cast<tokenizer::token::Plus>(
             std::static_pointer_cast<Token>(positive)->token())),
@@ -421,11 +719,15 @@ class GreaterExpr : public Expr {
     left_->dump(indent + 1, ostream);
     right_->dump(indent + 1, ostream);
   }
-  int64_t evaluate(Map<Str, int64_t>& variants, Str& output) override {
-    return left_->evaluate(variants, output) >
-           right_->evaluate(variants, output);
+  int64_t evaluate(Map<Str, int64_t>& variants, Str& output,
+                   RunState& state) override {
+    return left_->evaluate(variants, output, state) >
+           right_->evaluate(variants, output, state);
   }
 
+  [[nodiscard]] Rc<Expr> left() const { return left_; }
+  [[nodiscard]] Rc<Expr> right() const { return right_; }
+
   GreaterExpr(const Rc<AstNode>& left, const Rc<AstNode>& op,
               const Rc<AstNode>& right)
       : left_(std::static_pointer_cast<Expr>(left)),
@@ -445,11 +747,15 @@ class EqualExpr : public Expr {
     left_->dump(indent + 1, ostream);
     right_->dump(indent + 1, ostream);
   }
-  int64_t evaluate(Map<Str, int64_t>& variants, Str& output) override {
-    return left_->evaluate(variants, output) ==
-           right_->evaluate(variants, output);
+  int64_t evaluate(Map<Str, int64_t>& variants, Str& output,
+                   RunState& state) override {
+    return left_->evaluate(variants, output, state) ==
+           right_->evaluate(variants, output, state);
   }
 
+  [[nodiscard]] Rc<Expr> left() const { return left_; }
+  [[nodiscard]] Rc<Expr> right() const { return right_; }
+
   EqualExpr(const Rc<AstNode>& left, const Rc<AstNode>& op,
             const Rc<AstNode>& right)
       : left_(std::static_pointer_cast<Expr>(left)),
@@ -469,11 +775,15 @@ class LessExpr : public Expr {
     left_->dump(indent + 1, ostream);
     right_->dump(indent + 1, ostream);
   }
-  int64_t evaluate(Map<Str, int64_t>& variants, Str& output) override {
-    return left_->evaluate(variants, output) <
-           right_->evaluate(variants, output);
+  int64_t evaluate(Map<Str, int64_t>& variants, Str& output,
+                   RunState& state) override {
+    return left_->evaluate(variants, output, state) <
+           right_->evaluate(variants, output, state);
   }
 
+  [[nodiscard]] Rc<Expr> left() const { return left_; }
+  [[nodiscard]] Rc<Expr> right() const { return right_; }
+
   LessExpr(const Rc<AstNode>& left, const Rc<AstNode>& op,
            const Rc<AstNode>& right)
       : left_(std::static_pointer_cast<Expr>(left)),
@@ -494,11 +804,15 @@ class PlusExpr : public Expr {
     left_->dump(indent + 1, ostream);
     right_->dump(indent + 1, ostream);
   }
-  int64_t evaluate(Map<Str, int64_t>& variants, Str& output) override {
-    return left_->evaluate(variants, output) +
-           right_->evaluate(variants, output);
+  int64_t evaluate(Map<Str, int64_t>& variants, Str& output,
+                   RunState& state) override {
+    return left_->evaluate(variants, output, state) +
+           right_->evaluate(variants, output, state);
   }
 
+  [[nodiscard]] Rc<Expr> left() const { return left_; }
+  [[nodiscard]] Rc<Expr> right() const { return right_; }
+
   PlusExpr(const Rc<AstNode>& left, const Rc<AstNode>& op,
            const Rc<AstNode>& right)
       : left_(std::static_pointer_cast<Expr>(left)),
@@ -518,11 +832,15 @@ class MinusExpr : public Expr {
     left_->dump(indent + 1, ostream);
     right_->dump(indent + 1, ostream);
   }
-  int64_t evaluate(Map<Str, int64_t>& variants, Str& output) override {
-    return left_->evaluate(variants, output) -
-           right_->evaluate(variants, output);
+  int64_t evaluate(Map<Str, int64_t>& variants, Str& output,
+                   RunState& state) override {
+    return left_->evaluate(variants, output, state) -
+           right_->evaluate(variants, output, state);
   }
 
+  [[nodiscard]] Rc<Expr> left() const { return left_; }
+  [[nodiscard]] Rc<Expr> right() const { return right_; }
+
   MinusExpr(const Rc<AstNode>& left, const Rc<AstNode>& op,
             const Rc<AstNode>& right)
       : left_(std::static_pointer_cast<Expr>(left)),
@@ -543,11 +861,15 @@ class MultiplyExpr : public Expr {
     left_->dump(indent + 1, ostream);
     right_->dump(indent + 1, ostream);
   }
-  int64_t evaluate(Map<Str, int64_t>& variants, Str& output) override {
-    return left_->evaluate(variants, output) *
-           right_->evaluate(variants, output);
+  int64_t evaluate(Map<Str, int64_t>& variants, Str& output,
+                   RunState& state) override {
+    return left_->evaluate(variants, output, state) *
+           right_->evaluate(variants, output, state);
   }
 
+  [[nodiscard]] Rc<Expr> left() const { return left_; }
+  [[nodiscard]] Rc<Expr> right() const { return right_; }
+
   MultiplyExpr(const Rc<AstNode>& left, const Rc<AstNode>& op,
                const Rc<AstNode>& right)
       : left_(std::static_pointer_cast<Expr>(left)),
@@ -567,11 +889,15 @@ class DivideExpr : public Expr {
     left_->dump(indent + 1, ostream);
     right_->dump(indent + 1, ostream);
   }
-  int64_t evaluate(Map<Str, int64_t>& variants, Str& output) override {
-    return left_->evaluate(variants, output) /
-           right_->evaluate(variants, output);
+  int64_t evaluate(Map<Str, int64_t>& variants, Str& output,
+                   RunState& state) override {
+    return left_->evaluate(variants, output, state) /
+           right_->evaluate(variants, output, state);
   }
 
+  [[nodiscard]] Rc<Expr> left() const { return left_; }
+  [[nodiscard]] Rc<Expr> right() const { return right_; }
+
   DivideExpr(const Rc<AstNode>& left, const Rc<AstNode>& op,
              const Rc<AstNode>& right)
       : left_(std::static_pointer_cast<Expr>(left)),
@@ -594,12 +920,16 @@ class PowerExpr : public Expr {
   }
 #pragma clang diagnostic push
 #pragma ide diagnostic ignored "cppcoreguidelines-narrowing-conversions"
-  int64_t evaluate(Map<Str, int64_t>& variants, Str& output) override {
-    return pow(left_->evaluate(variants, output),
-               right_->evaluate(variants, output));
+  int64_t evaluate(Map<Str, int64_t>& variants, Str& output,
+                   RunState& state) override {
+    return pow(left_->evaluate(variants, output, state),
+               right_->evaluate(variants, output, state));
   }
 #pragma clang diagnostic pop
 
+  [[nodiscard]] Rc<Expr> left() const { return left_; }
+  [[nodiscard]] Rc<Expr> right() const { return right_; }
+
   PowerExpr(const Rc<AstNode>& left, const Rc<AstNode>& op,
             const Rc<AstNode>& right)
       : left_(std::static_pointer_cast<Expr>(left)),
@@ -613,6 +943,327 @@ class PowerExpr : public Expr {
   Rc<Expr> right_;
 };
 
+// Arrays
+
+// Element of a DIM'd array, e.g. a(i, j)
+class ArrayExpr : public Expr {
+ public:
+  void dump(uint32_t indent, std::ostream& ostream) const override {
+    dump_token(indent, variant_, ostream);
+    for (const auto& index : indices_) {
+      index->dump(indent + 1, ostream);
+    }
+  }
+  int64_t evaluate(Map<Str, int64_t>& variants, Str& output,
+                   RunState& state) override {
+    int64_t at[Array::kMaxRank]{};
+    evaluate_indices(variants, output, state, at);
+    auto* value = element(at, output, state);
+    return value == nullptr ? 0 : *value;
+  }
+
+  // Evaluates the indices into `at`, which has room for Array::kMaxRank
+  void evaluate_indices(Map<Str, int64_t>& variants, Str& output,
+                        RunState& state, int64_t* at) {
+    for (size_t i{}; i < indices_.size(); ++i) {
+      at[i] = indices_[i]->evaluate(variants, output, state);
+    }
+  }
+  // The element at `at`; nullptr once the run has failed, after reporting
+  // why when this access is the one that failed
+  int64_t* element(const int64_t* at, Str& output, RunState& state) const {
+    if (state.failed) {
+      return nullptr;
+    }
+    auto array = state.arrays.find(variant_->value());
+    auto offset = array == state.arrays.end()
+                      ? -1
+                      : array->second.offset(at, indices_.size());
+    if (offset < 0) {
+      output.append(index_error(
+          variant_->value(),
+          array == state.arrays.end() ? nullptr : &array->second, at,
+          indices_.size()));
+      state.failed = true;
+      return nullptr;
+    }
+    return &array->second.values[offset];
+  }
+
+  [[nodiscard]] Rc<tokenizer::token::Variant> variant() const {
+    return variant_;
+  }
+  [[nodiscard]] const Vec<Rc<Expr>>& indices() const { return indices_; }
+
+  ArrayExpr(const Rc<AstNode>& variant, Vec<Rc<Expr>> indices)
+      : variant_(std::static_pointer_cast<tokenizer::token::Variant>(
+            std::static_pointer_cast<Token>(variant)->token())),
+        indices_(std::move(indices)) {}
+
+ private:
+  Rc<tokenizer::token::Variant> variant_;
+  Vec<Rc<Expr>> indices_;
+};
+
+// SUM(a), MIN(a) or MAX(a) over every element of an array
+class ReduceExpr : public Expr {
+ public:
+  void dump(uint32_t indent, std::ostream& ostream) const override {
+    dump_token(indent, op_, ostream);
+    dump_token(indent + 1, variant_, ostream);
+  }
+  int64_t evaluate(Map<Str, int64_t>& variants, Str& output,
+                   RunState& state) override {
+    if (state.failed) {
+      return 0;
+    }
+    const auto* array = state.find_array(variant_->value());
+    auto error = whole_array_error(variant_->value(), array);
+    if (!error.empty()) {
+      output.append(error);
+      state.failed = true;
+      return 0;
+    }
+    return kernels::reduce(state.array_policy, reduction_,
+                           array->values.data(), array->values.size());
+  }
+
+  [[nodiscard]] Rc<tokenizer::token::Variant> variant() const {
+    return variant_;
+  }
+  [[nodiscard]] Reduction reduction() const { return reduction_; }
+
+  ReduceExpr(const Rc<AstNode>& op, const Rc<AstNode>& variant)
+      : op_(std::static_pointer_cast<Token>(op)->token()),
+        variant_(std::static_pointer_cast<tokenizer::token::Variant>(
+            std::static_pointer_cast<Token>(variant)->token())),
+        reduction_(typeid(*op_) == typeid(tokenizer::token::Sum)
+                       ? Reduction::Sum
+                   : typeid(*op_) == typeid(tokenizer::token::Min)
+                       ? Reduction::Min
+                       : Reduction::Max) {}
+
+ private:
+  Rc<tokenizer::Token> op_;
+  Rc<tokenizer::token::Variant> variant_;
+  Reduction reduction_;
+};
+
+// Gives an array its bounds, e.g. DIM a(9, 9) for 10 by 10 elements, all 0.
+// Arrays are named apart from variables and DIM again starts over.
+class Dim : public Stmt {
+ public:
+  void dump(uint32_t indent, std::ostream& ostream) const override {
+    dump_token(indent, dim_, ostream);
+    dump_token(indent + 1, variant_, ostream);
+    for (const auto& bound : bounds_) {
+      bound->dump(indent + 2, ostream);
+    }
+  }
+  UIBehavior run(Map<Str, int64_t>& variants, int64_t& next_pc, Str& output,
+                 Str& variant_need_input, RunState& state) override {
+    int64_t bounds[Array::kMaxRank]{};
+    for (size_t i{}; i < bounds_.size(); ++i) {
+      bounds[i] = bounds_[i]->evaluate(variants, output, state);
+    }
+    if (failed(state)) {
+      return UIBehavior::FinishRun;
+    }
+    auto array = Array();
+    if (!array.dim(bounds, bounds_.size())) {
+      output.append("ERROR: DIM " +
+                    element_name(variant_->value(), bounds, bounds_.size()) +
+                    " out of range");
+      return UIBehavior::FinishRun;
+    }
+    state.arrays[variant_->value()] = std::move(array);
+    return UIBehavior::None;
+  }
+
+  [[nodiscard]] Rc<tokenizer::token::Variant> variant() const {
+    return variant_;
+  }
+  [[nodiscard]] const Vec<Rc<Expr>>& bounds() const { return bounds_; }
+
+  Dim(const Rc<AstNode>& dim, const Rc<AstNode>& variant,
+      Vec<Rc<Expr>> bounds)
+      : dim_(std::static_pointer_cast<tokenizer::token::Dim>(
+            std::static_pointer_cast<Token>(dim)->token())),
+        variant_(std::static_pointer_cast<tokenizer::token::Variant>(
+            std::static_pointer_cast<Token>(variant)->token())),
+        bounds_(std::move(bounds)) {}
+
+ private:
+  Rc<tokenizer::token::Dim> dim_;
+  Rc<tokenizer::token::Variant> variant_;
+  Vec<Rc<Expr>> bounds_;
+};
+
+// Assignment to an array element. The indices are evaluated before the
+// value and checked after it.
+class LetElement : public Stmt {
+ public:
+  void dump(uint32_t indent, std::ostream& ostream) const override {
+    dump_token(indent, let_, ostream);
+    dump_token(indent + 1, equal_, ostream);
+    element_->dump(indent + 2, ostream);
+    expr_->dump(indent + 2, ostream);
+  }
+  UIBehavior run(Map<Str, int64_t>& variants, int64_t& next_pc, Str& output,
+                 Str& variant_need_input, RunState& state) override {
+    int64_t at[Array::kMaxRank]{};
+    element_->evaluate_indices(variants, output, state, at);
+    auto value = expr_->evaluate(variants, output, state);
+    auto* element = element_->element(at, output, state);
+    if (failed(state)) {
+      return UIBehavior::FinishRun;
+    }
+    *element = value;
+    return UIBehavior::None;
+  }
+
+  [[nodiscard]] Rc<ArrayExpr> element() const { return element_; }
+  [[nodiscard]] Rc<Expr> expr() const { return expr_; }
+
+  LetElement(const Rc<AstNode>& let, const Rc<AstNode>& element,
+             const Rc<AstNode>& equal, const Rc<AstNode>& expr)
+      : let_(std::static_pointer_cast<tokenizer::token::Let>(
+            std::static_pointer_cast<Token>(let)->token())),
+        element_(std::static_pointer_cast<ArrayExpr>(element)),
+        equal_(std::static_pointer_cast<tokenizer::token::Equal>(
+            std::static_pointer_cast<Token>(equal)->token())),
+        expr_(std::static_pointer_cast<ast_node::Expr>(expr)) {}
+
+ private:
+  Rc<tokenizer::token::Let> let_;
+  Rc<ArrayExpr> element_;
+  Rc<tokenizer::token::Equal> equal_;
+  Rc<Expr> expr_;
+};
+
+// Whole-array arithmetic: MAT a = b + c and MAT a = b - c element by
+// element, MAT a = b * k scaling by an expression. `a` takes the shape of
+// the operands and may be one of them.
+class Mat : public Stmt {
+ public:
+  void dump(uint32_t indent, std::ostream& ostream) const override {
+    dump_token(indent, mat_, ostream);
+    dump_token(indent + 1, equal_, ostream);
+    dump_token(indent + 2, target_, ostream);
+    dump_token(indent + 2, op_, ostream);
+    dump_token(indent + 3, left_, ostream);
+    if (right_) {
+      dump_token(indent + 3, right_, ostream);
+    } else {
+      factor_->dump(indent + 3, ostream);
+    }
+  }
+  UIBehavior run(Map<Str, int64_t>& variants, int64_t& next_pc, Str& output,
+                 Str& variant_need_input, RunState& state) override {
+    int64_t factor{};
+    if (factor_) {
+      factor = factor_->evaluate(variants, output, state);
+      if (failed(state)) {
+        return UIBehavior::FinishRun;
+      }
+    }
+    const auto* left = state.find_array(left_->value());
+    const auto* right = right_ ? state.find_array(right_->value()) : left;
+    auto error =
+        right_ ? mat_error(left_->value(), left, right_->value(), right)
+               : whole_array_error(left_->value(), left);
+    if (!error.empty()) {
+      output.append(error);
+      return UIBehavior::FinishRun;
+    }
+    parser::mat(state.array_policy, op_kind_, state.arrays[target_->value()],
+                *left, *right, factor);
+    return UIBehavior::None;
+  }
+
+  [[nodiscard]] Rc<tokenizer::token::Variant> target() const {
+    return target_;
+  }
+  [[nodiscard]] Rc<tokenizer::token::Variant> left() const { return left_; }
+  // The second array, nullptr when scaling
+  [[nodiscard]] Rc<tokenizer::token::Variant> right() const {
+    return right_;
+  }
+  // The scale factor, nullptr when combining two arrays
+  [[nodiscard]] Rc<Expr> factor() const { return factor_; }
+  [[nodiscard]] MatOp op() const { return op_kind_; }
+
+  Mat(const Rc<AstNode>& mat, const Rc<AstNode>& target,
+      const Rc<AstNode>& equal, const Rc<AstNode>& left, const Rc<AstNode>& op,
+      const Rc<AstNode>& operand)
+      : mat_(std::static_pointer_cast<tokenizer::token::Mat>(
+            std::static_pointer_cast<Token>(mat)->token())),
+        target_(std::static_pointer_cast<tokenizer::token::Variant>(
+            std::static_pointer_cast<Token>(target)->token())),
+        equal_(std::static_pointer_cast<tokenizer::token::Equal>(
+            std::static_pointer_cast<Token>(equal)->token())),
+        left_(std::static_pointer_cast<tokenizer::token::Variant>(
+            std::static_pointer_cast<Token>(left)->token())),
+        op_(std::static_pointer_cast<Token>(op)->token()) {
+    if (typeid(*op_) == typeid(tokenizer::token::Multiply)) {
+      op_kind_ = MatOp::Scale;
+      factor_ = std::static_pointer_cast<Expr>(operand);
+    } else {
+      op_kind_ = typeid(*op_) == typeid(tokenizer::token::Plus)
+                     ? MatOp::Add
+                     : MatOp::Subtract;
+      right_ = std::static_pointer_cast<tokenizer::token::Variant>(
+          std::static_pointer_cast<Token>(operand)->token());
+    }
+  }
+
+ private:
+  Rc<tokenizer::token::Mat> mat_;
+  Rc<tokenizer::token::Variant> target_;
+  Rc<tokenizer::token::Equal> equal_;
+  Rc<tokenizer::token::Variant> left_;
+  Rc<tokenizer::Token> op_;
+  Rc<tokenizer::token::Variant> right_;
+  Rc<Expr> factor_;
+  MatOp op_kind_{};
+};
+
+// Sorts the elements of an array in ascending order; a two-dimensional
+// one is sorted as a single sequence, row after row
+class Sort : public Stmt {
+ public:
+  void dump(uint32_t indent, std::ostream& ostream) const override {
+    dump_token(indent, sort_, ostream);
+    dump_token(indent + 1, variant_, ostream);
+  }
+  UIBehavior run(Map<Str, int64_t>& variants, int64_t& next_pc, Str& output,
+                 Str& variant_need_input, RunState& state) override {
+    auto* array = state.find_array(variant_->value());
+    auto error = whole_array_error(variant_->value(), array);
+    if (!error.empty()) {
+      output.append(error);
+      return UIBehavior::FinishRun;
+    }
+    kernels::sort(state.array_policy, array->values.data(),
+                  array->values.size());
+    return UIBehavior::None;
+  }
+
+  [[nodiscard]] Rc<tokenizer::token::Variant> variant() const {
+    return variant_;
+  }
+
+  Sort(const Rc<AstNode>& sort, const Rc<AstNode>& variant)
+      : sort_(std::static_pointer_cast<tokenizer::token::Sort>(
+            std::static_pointer_cast<Token>(sort)->token())),
+        variant_(std::static_pointer_cast<tokenizer::token::Variant>(
+            std::static_pointer_cast<Token>(variant)->token())) {}
+
+ private:
+  Rc<tokenizer::token::Sort> sort_;
+  Rc<tokenizer::token::Variant> variant_;
+};
+
 // User defined command
 
 class Run : public Command {
@@ -666,6 +1317,45 @@ class Clear : public Command {
  private:
   Rc<tokenizer::token::Clear> clear_;
 };
+class Undo : public Command {
+ public:
+  void dump(uint32_t indent, std::ostream& ostream) const override {
+    dump_token(indent, undo_, ostream);
+  }
+
+  explicit Undo(const Rc<AstNode>& undo)
+      : undo_(std::static_pointer_cast<tokenizer::token::Undo>(
+            std::static_pointer_cast<Token>(undo)->token())) {}
+
+ private:
+  Rc<tokenizer::token::Undo> undo_;
+};
+class Redo : public Command {
+ public:
+  void dump(uint32_t indent, std::ostream& ostream) const override {
+    dump_token(indent, redo_, ostream);
+  }
+
+  explicit Redo(const Rc<AstNode>& redo)
+      : redo_(std::static_pointer_cast<tokenizer::token::Redo>(
+            std::static_pointer_cast<Token>(redo)->token())) {}
+
+ private:
+  Rc<tokenizer::token::Redo> redo_;
+};
+class Check : public Command {
+ public:
+  void dump(uint32_t indent, std::ostream& ostream) const override {
+    dump_token(indent, check_, ostream);
+  }
+
+  explicit Check(const Rc<AstNode>& check)
+      : check_(std::static_pointer_cast<tokenizer::token::Check>(
+            std::static_pointer_cast<Token>(check)->token())) {}
+
+ private:
+  Rc<tokenizer::token::Check> check_;
+};
 class Help : public Command {
  public:
   void dump(uint32_t indent, std::ostream& ostream) const override {
@@ -699,14 +1389,29 @@ class Parser {
  public:
   Rc<AstNode> parse(const Vec<Rc<tokenizer::Token>>& tokens);
 
+  // Single pass: pulls tokens from the tokenizer while parsing, without
+  // building a token vector. Produces the same result as the overload above.
+  Rc<AstNode> parse(tokenizer::Tokenizer& tokenizer, const Str& source);
+
  private:
   bool ok_;
   Rc<ast_node::Invalid> error_msg_;
 
   uint32_t cursor_;
 
-  Vec<Rc<tokenizer::Token>> tokens_;
-  std::stack<Rc<AstNode>> stack_;
+  // Token source, borrowed for the duration of parse(), never copied
+  const Vec<Rc<tokenizer::Token>>* tokens_{};
+  tokenizer::Tokenizer* tokenizer_{};
+  Rc<tokenizer::Token> current_;
+  std::stack<Rc<AstNode>, Vec<Rc<AstNode>>> stack_;
+
+  // Token wrappers kept alive between calls to avoid reallocating them
+  Vec<Rc<ast_node::Token>> token_pool_;
+  uint32_t token_pool_used_{};
+
+  void begin(const Rc<tokenizer::Token>& first);
+  void end();
+  Rc<AstNode> parse_line();
 
   void parse_stmt();
   void parse_cmd();
@@ -718,12 +1423,27 @@ class Parser {
   void parse_goto();
   void parse_if();
   void parse_end();
+  void parse_for();
+  void parse_next();
+  void parse_gosub();
+  void parse_return();
+  void parse_dim();
+  void parse_mat();
+  void parse_sort();
   void parse_clear_line();
 
   void parse_expr();
 
   void parse_variant_expr();
+  // The indices after the array name on top of the stack, replacing it
+  // with the element
+  void parse_array_expr();
+  // "(e)" or "(e, e)" after an array name, leaving the expressions on the
+  // stack; returns how many
+  size_t parse_indices();
   void parse_integer_expr();
+  // SUM(a), MIN(a) or MAX(a)
+  void parse_reduce_expr();
   void parse_parenthesis_expr();
 
   void parse_unary_op_expr();
@@ -732,9 +1452,36 @@ class Parser {
   void parse_multiply_or_divide_expr();
   void parse_power_expr();
 
+  // Fails where a variable belongs: with `message`, or as a reserved word
+  // used as a variable when the token there is one
+  void fail_variant(const char* message);
+
+  [[nodiscard]] const Rc<tokenizer::Token>& peek() const;
+  void advance();
   void shift();
 
   Rc<AstNode> get_and_pop();
 };
 
+// Long-lived tokenizer and parser pair for line-by-line parsing.
+// Token buffer, parse stack and stack wrappers are reset between lines
+// without being freed, so steady-state parsing only allocates the AST.
+class ParseContext {
+ public:
+  enum class FrontEnd {
+    TwoPass,  // lex the whole line, then parse the token vector
+    Fused,    // pull tokens from the character stream while parsing
+  };
+
+  Rc<AstNode> parse(const Str& line);
+
+  void set_front_end(FrontEnd front_end) { front_end_ = front_end; }
+  [[nodiscard]] FrontEnd front_end() const { return front_end_; }
+
+ private:
+  tokenizer::Tokenizer tokenizer_;
+  Parser parser_;
+  FrontEnd front_end_{FrontEnd::TwoPass};
+};
+
 }  // namespace parser
\ No newline at end of file
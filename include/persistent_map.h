@@ -0,0 +1,323 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <iterator>
+#include <utility>
+
+#include "type.h"
+
+namespace engine {
+
+// Sorted map whose copies share structure: a B+ tree that never changes a
+// node another copy can reach. Copying is O(1), and an edit copies only the
+// O(log n) nodes on its path, so every earlier copy keeps its version.
+// Nodes no other copy or iterator holds are edited in place, which makes
+// building a map one entry at a time as cheap as in a plain B+ tree.
+// Each node keeps its keys in one contiguous array apart from the values,
+// so lookups binary-search a few cache lines per level and in-order walks
+// stream through arrays instead of chasing a pointer per entry.
+// Copies may be read from other threads, but a copy must not be edited
+// while another thread reads that same copy.
+template <typename Key, typename Value>
+class PersistentMap {
+  struct Node;
+
+ public:
+  using value_type = std::pair<Key, Value>;
+
+  // Dereferences to a pair of references into the tree. Iterators keep
+  // their version alive and are not disturbed by edits.
+  class const_iterator {
+   public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = PersistentMap::value_type;
+    using difference_type = std::ptrdiff_t;
+    using reference = std::pair<const Key&, const Value&>;
+    struct pointer {
+      reference entry;
+      const reference* operator->() const { return &entry; }
+    };
+
+    const_iterator() = default;
+
+    reference operator*() const {
+      return {leaf_->keys[index_], leaf_->values[index_]};
+    }
+    pointer operator->() const { return pointer{**this}; }
+
+    const_iterator& operator++() {
+      if (++index_ == leaf_->keys.size()) {
+        next_leaf();
+      }
+      return *this;
+    }
+    const_iterator operator++(int) {
+      auto before = *this;
+      ++*this;
+      return before;
+    }
+
+    bool operator==(const const_iterator& other) const {
+      return leaf_ == other.leaf_ && index_ == other.index_;
+    }
+    bool operator!=(const const_iterator& other) const {
+      return !(*this == other);
+    }
+
+   private:
+    friend class PersistentMap;
+
+    // B+ trees of this fanout cannot get deeper with 64-bit sizes
+    static constexpr size_t kMaxDepth = 16;
+
+    Rc<const Node> root_;
+    // Inner nodes from the root down, and which child was taken in each
+    std::array<std::pair<const Node*, size_t>, kMaxDepth> path_{};
+    size_t depth_{};
+    const Node* leaf_{};
+    size_t index_{};
+
+    void descend(const Node* node) {
+      while (!node->leaf()) {
+        path_[depth_++] = {node, 0};
+        node = node->children.front().get();
+      }
+      leaf_ = node;
+      index_ = 0;
+    }
+    void next_leaf() {
+      while (depth_ > 0) {
+        auto& [node, child] = path_[depth_ - 1];
+        if (++child < node->children.size()) {
+          descend(node->children[child].get());
+          return;
+        }
+        --depth_;
+      }
+      *this = const_iterator();
+    }
+  };
+
+  [[nodiscard]] size_t size() const { return size_; }
+  [[nodiscard]] bool empty() const { return size_ == 0; }
+
+  // nullptr if absent
+  [[nodiscard]] const Value* find(const Key& key) const {
+    if (!root_) {
+      return nullptr;
+    }
+    const auto* node = root_.get();
+    while (!node->leaf()) {
+      node = node->children[child_index(*node, key)].get();
+    }
+    auto at = lower_bound(*node, key);
+    if (at == node->keys.size() || key < node->keys[at]) {
+      return nullptr;
+    }
+    return &node->values[at];
+  }
+  [[nodiscard]] size_t count(const Key& key) const {
+    return find(key) != nullptr ? 1 : 0;
+  }
+
+  // True if the key was not there before
+  bool insert_or_assign(const Key& key, Value value) {
+    if (!root_) {
+      root_ = std::make_shared<Node>();
+    }
+    auto inserted = false;
+    if (auto right = insert(root_, key, value, inserted)) {
+      auto root = std::make_shared<Node>();
+      root->keys = {root_->keys.front(), right->keys.front()};
+      root->children = {std::move(root_), std::move(right)};
+      root_ = std::move(root);
+    }
+    size_ += inserted ? 1 : 0;
+    return inserted;
+  }
+
+  // True if the key was there
+  bool erase(const Key& key) {
+    if (find(key) == nullptr) {
+      return false;
+    }
+    remove(root_, key);
+    if (--size_ == 0) {
+      root_.reset();
+    } else if (root_->children.size() == 1) {
+      root_ = Rc<Node>(root_->children.front());
+    }
+    return true;
+  }
+
+  void clear() {
+    root_.reset();
+    size_ = 0;
+  }
+
+  // Whether both are the same version, without comparing entries
+  [[nodiscard]] bool shares(const PersistentMap& other) const {
+    return root_ == other.root_;
+  }
+
+  [[nodiscard]] const_iterator begin() const {
+    auto it = const_iterator();
+    if (root_) {
+      it.root_ = root_;
+      it.descend(root_.get());
+    }
+    return it;
+  }
+  [[nodiscard]] const_iterator end() const { return const_iterator(); }
+
+  // The first entry whose key is not less than `key`
+  [[nodiscard]] const_iterator lower_bound(const Key& key) const {
+    auto it = const_iterator();
+    if (!root_) {
+      return it;
+    }
+    it.root_ = root_;
+    const auto* node = root_.get();
+    while (!node->leaf()) {
+      auto child = child_index(*node, key);
+      it.path_[it.depth_++] = {node, child};
+      node = node->children[child].get();
+    }
+    it.leaf_ = node;
+    it.index_ = lower_bound(*node, key);
+    if (it.index_ == node->keys.size()) {
+      it.next_leaf();
+    }
+    return it;
+  }
+
+ private:
+  // At most kMax entries or children per node, and at least kMin below the
+  // root
+  static constexpr size_t kMax = 32;
+  static constexpr size_t kMin = kMax / 2;
+
+  struct Node {
+    // The keys of a leaf's entries, or the smallest key under each child
+    Vec<Key> keys;
+    // Leaves only
+    Vec<Value> values;
+    // Inner nodes only
+    Vec<Rc<Node>> children;
+
+    [[nodiscard]] bool leaf() const { return children.empty(); }
+  };
+
+  Rc<Node> root_;
+  size_t size_{};
+
+  static size_t lower_bound(const Node& node, const Key& key) {
+    return static_cast<size_t>(
+        std::lower_bound(node.keys.begin(), node.keys.end(), key) -
+        node.keys.begin());
+  }
+  static size_t child_index(const Node& node, const Key& key) {
+    auto at = std::upper_bound(node.keys.begin() + 1, node.keys.end(), key);
+    return static_cast<size_t>(at - node.keys.begin()) - 1;
+  }
+
+  // The node in `slot`, copied first unless nothing else holds it
+  static Node& own(Rc<Node>& slot) {
+    if (slot.use_count() != 1) {
+      slot = std::make_shared<Node>(*slot);
+    }
+    return *slot;
+  }
+
+  template <typename T>
+  static void move_tail(Vec<T>& from, size_t at, Vec<T>& to) {
+    to.insert(to.end(), std::make_move_iterator(from.begin() + at),
+              std::make_move_iterator(from.end()));
+    from.erase(from.begin() + at, from.end());
+  }
+
+  // Moves the upper half of an overfull node into a new right sibling
+  static Rc<Node> split(Node& node) {
+    auto right = std::make_shared<Node>();
+    auto half = node.keys.size() / 2;
+    move_tail(node.keys, half, right->keys);
+    if (node.leaf()) {
+      move_tail(node.values, half, right->values);
+    } else {
+      move_tail(node.children, half, right->children);
+    }
+    return right;
+  }
+
+  // Returns the new right sibling when the node had to split
+  static Rc<Node> insert(Rc<Node>& slot, const Key& key, Value& value,
+                         bool& inserted) {
+    auto& node = own(slot);
+    if (node.leaf()) {
+      auto at = lower_bound(node, key);
+      if (at != node.keys.size() && !(key < node.keys[at])) {
+        node.values[at] = std::move(value);
+        return nullptr;
+      }
+      node.keys.insert(node.keys.begin() + at, key);
+      node.values.insert(node.values.begin() + at, std::move(value));
+      inserted = true;
+    } else {
+      auto child = child_index(node, key);
+      if (key < node.keys[child]) {
+        node.keys[child] = key;
+      }
+      auto right = insert(node.children[child], key, value, inserted);
+      if (!right) {
+        return nullptr;
+      }
+      node.keys.insert(node.keys.begin() + child + 1, right->keys.front());
+      node.children.insert(node.children.begin() + child + 1,
+                           std::move(right));
+    }
+    return node.keys.size() > kMax ? split(node) : nullptr;
+  }
+
+  // `key` must be present
+  static void remove(Rc<Node>& slot, const Key& key) {
+    auto& node = own(slot);
+    if (node.leaf()) {
+      auto at = lower_bound(node, key);
+      node.keys.erase(node.keys.begin() + at);
+      node.values.erase(node.values.begin() + at);
+      return;
+    }
+    auto child = child_index(node, key);
+    remove(node.children[child], key);
+    node.keys[child] = node.children[child]->keys.front();
+    if (node.children[child]->keys.size() < kMin &&
+        node.children.size() > 1) {
+      rebalance(node, child);
+    }
+  }
+
+  // Merges an underfull child with a neighbour, splitting them evenly
+  // again if that overfills it
+  static void rebalance(Node& node, size_t child) {
+    auto left = child > 0 ? child - 1 : child;
+    auto right = left + 1;
+    auto& into = own(node.children[left]);
+    auto& from = own(node.children[right]);
+    move_tail(from.keys, 0, into.keys);
+    if (into.leaf()) {
+      move_tail(from.values, 0, into.values);
+    } else {
+      move_tail(from.children, 0, into.children);
+    }
+    if (into.keys.size() <= kMax) {
+      node.keys.erase(node.keys.begin() + right);
+      node.children.erase(node.children.begin() + right);
+      return;
+    }
+    node.children[right] = split(into);
+    node.keys[right] = node.children[right]->keys.front();
+  }
+};
+
+}  // namespace engine
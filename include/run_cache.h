@@ -0,0 +1,69 @@
+#pragma once
+#include <list>
+#include <unordered_map>
+
+#include "type.h"
+
+namespace engine {
+
+// Where a run starts: the program, identified by a hash of its syntax tree,
+// the line, and the variables the run may read before assigning them
+struct RunStart {
+  uint64_t program;
+  int64_t pc;
+  Map<Str, int64_t> variants;
+
+  bool operator==(const RunStart& other) const {
+    return program == other.program && pc == other.pc &&
+           variants == other.variants;
+  }
+};
+
+// What a run that needs no INPUT leaves behind
+struct RunResult {
+  Str output;
+  // Variables the run changed
+  Map<Str, int64_t> variants;
+};
+
+// Results of deterministic runs keyed by a hash of their start, so running
+// the same input-free program from the same state again replays the output
+// instead of executing it. The least recently used entries are evicted once
+// the capacity is reached.
+class RunCache {
+ public:
+  explicit RunCache(size_t capacity = 64) : capacity_(capacity) {}
+
+  // Counts a hit or a miss
+  const RunResult* find(const RunStart& start);
+  void insert(const RunStart& start, RunResult result);
+
+  void set_capacity(size_t capacity);
+  void clear();
+
+  [[nodiscard]] size_t capacity() const { return capacity_; }
+  [[nodiscard]] size_t size() const { return lru_.size(); }
+  [[nodiscard]] uint64_t hits() const { return hits_; }
+  [[nodiscard]] uint64_t misses() const { return misses_; }
+
+  static uint64_t hash(const RunStart& start);
+
+ private:
+  struct Entry {
+    uint64_t hash;
+    RunStart start;
+    RunResult result;
+  };
+
+  size_t capacity_;
+  uint64_t hits_{};
+  uint64_t misses_{};
+
+  // Most recently used at the front
+  std::list<Entry> lru_;
+  std::unordered_multimap<uint64_t, std::list<Entry>::iterator> index_;
+
+  void evict();
+};
+
+}  // namespace engine
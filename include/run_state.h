@@ -0,0 +1,264 @@
+#pragma once
+#include <algorithm>
+#include <string>
+
+#include "array_kernels.h"
+#include "type.h"
+
+namespace parser {
+
+// A FOR loop that has started and whose NEXT has not fallen through yet
+struct Loop {
+  Str variant;
+  int64_t limit{};
+  int64_t step{};
+  // Line NEXT jumps back to, -1 when the FOR was the last line
+  int64_t body{-1};
+
+  bool operator==(const Loop& other) const = default;
+};
+
+// The active FOR loops of a run, innermost last. Room for kMaxDepth loops
+// is allocated up front, so entering and leaving loops never allocates.
+class LoopStack {
+ public:
+  static constexpr size_t kMaxDepth = 256;
+
+  LoopStack() { loops_.reserve(kMaxDepth); }
+  LoopStack(const LoopStack& other) : LoopStack() { loops_ = other.loops_; }
+  LoopStack& operator=(const LoopStack& other) {
+    loops_ = other.loops_;
+    return *this;
+  }
+  LoopStack(LoopStack&&) = default;
+  LoopStack& operator=(LoopStack&&) = default;
+
+  // Starts a loop. A loop already running over the same variable ends,
+  // with the loops inside it, as GOTO back to a FOR restarts its loop.
+  // False when kMaxDepth loops are running.
+  bool push(Loop loop) {
+    for (size_t i{}; i < loops_.size(); ++i) {
+      if (loops_[i].variant == loop.variant) {
+        loops_.erase(loops_.begin() + static_cast<ptrdiff_t>(i),
+                     loops_.end());
+        break;
+      }
+    }
+    if (loops_.size() == kMaxDepth) {
+      return false;
+    }
+    loops_.push_back(std::move(loop));
+    return true;
+  }
+  // The innermost loop over `variant`, after ending the loops inside it;
+  // nullptr when none is running
+  Loop* find(const Str& variant) {
+    for (auto i = loops_.size(); i-- > 0;) {
+      if (loops_[i].variant == variant) {
+        loops_.erase(loops_.begin() + static_cast<ptrdiff_t>(i) + 1,
+                     loops_.end());
+        return &loops_[i];
+      }
+    }
+    return nullptr;
+  }
+  void pop() { loops_.pop_back(); }
+  void clear() { loops_.clear(); }
+
+  [[nodiscard]] bool empty() const { return loops_.empty(); }
+  [[nodiscard]] const Vec<Loop>& loops() const { return loops_; }
+
+ private:
+  Vec<Loop> loops_;
+};
+
+// The pending GOSUBs of a run as the lines their RETURN goes back to,
+// innermost last; -1 returns past the last line. Room for max_depth() calls
+// is allocated when the limit is set, so GOSUB and RETURN never allocate.
+// Copies, such as the checkpoints of a cycle check, only hold the pending
+// calls.
+class CallStack {
+ public:
+  static constexpr size_t kDefaultDepth = 1024;
+  // The deepest limit set_max_depth() accepts, 8 MiB of return addresses
+  static constexpr size_t kMaxDepth = size_t{1} << 20;
+
+  CallStack() { set_max_depth(kDefaultDepth); }
+
+  // Calls already deeper than `depth` are dropped, innermost first. Depths
+  // past kMaxDepth are clamped to it.
+  void set_max_depth(size_t depth) {
+    depth = std::min(depth, kMaxDepth);
+    max_depth_ = depth;
+    if (returns_.size() > depth) {
+      returns_.resize(depth);
+    }
+    returns_.reserve(depth);
+  }
+  [[nodiscard]] size_t max_depth() const { return max_depth_; }
+
+  // False when max_depth() calls are pending
+  bool push(int64_t line) {
+    if (returns_.size() == max_depth_) {
+      return false;
+    }
+    returns_.push_back(line);
+    return true;
+  }
+  // False when no call is pending
+  bool pop(int64_t& line) {
+    if (returns_.empty()) {
+      return false;
+    }
+    line = returns_.back();
+    returns_.pop_back();
+    return true;
+  }
+  void clear() { returns_.clear(); }
+
+  [[nodiscard]] bool empty() const { return returns_.empty(); }
+  [[nodiscard]] const Vec<int64_t>& returns() const { return returns_; }
+
+  bool operator==(const CallStack& other) const {
+    return returns_ == other.returns_;
+  }
+
+ private:
+  Vec<int64_t> returns_;
+  size_t max_depth_{};
+};
+
+// A DIM'd array of one or two dimensions. Indices run from 0 to each
+// bound inclusive and the elements are stored row by row, zeroed by DIM.
+struct Array {
+  static constexpr size_t kMaxRank = 2;
+  static constexpr int64_t kMaxElements = int64_t{1} << 24;
+
+  // Bound + 1 per dimension
+  Vec<int64_t> extents;
+  Vec<int64_t> values;
+
+  // Reshapes the array for `bounds`, zero-filled; false when a bound is
+  // negative or the array would hold more than kMaxElements
+  bool dim(const int64_t* bounds, size_t rank) {
+    int64_t size = 1;
+    for (size_t i{}; i < rank; ++i) {
+      if (bounds[i] < 0 || bounds[i] >= kMaxElements ||
+          size * (bounds[i] + 1) > kMaxElements) {
+        return false;
+      }
+      size *= bounds[i] + 1;
+    }
+    extents.assign(bounds, bounds + rank);
+    for (auto& extent : extents) {
+      ++extent;
+    }
+    values.assign(static_cast<size_t>(size), 0);
+    return true;
+  }
+
+  // Offset of the element at `indices`, -1 when their number does not match
+  // or one is out of range
+  [[nodiscard]] int64_t offset(const int64_t* indices, size_t rank) const {
+    if (rank != extents.size()) {
+      return -1;
+    }
+    int64_t at{};
+    for (size_t i{}; i < rank; ++i) {
+      if (indices[i] < 0 || indices[i] >= extents[i]) {
+        return -1;
+      }
+      at = at * extents[i] + indices[i];
+    }
+    return at;
+  }
+
+  bool operator==(const Array& other) const = default;
+};
+
+// How an element is written in errors, e.g. "a(3, 7)"
+inline Str element_name(const Str& name, const int64_t* indices,
+                        size_t rank) {
+  auto text = name + "(";
+  for (size_t i{}; i < rank; ++i) {
+    text += (i > 0 ? ", " : "") + std::to_string(indices[i]);
+  }
+  return text + ")";
+}
+
+// Why the element of `name` at `indices` is out of reach, with `array`
+// nullptr when there is no such array yet
+inline Str index_error(const Str& name, const Array* array,
+                       const int64_t* indices, size_t rank) {
+  if (array == nullptr || array->extents.empty()) {
+    return "ERROR: array " + name + " used before DIM";
+  }
+  if (array->extents.size() != rank) {
+    return "ERROR: wrong number of indices for " + name;
+  }
+  return "ERROR: index " + element_name(name, indices, rank) +
+         " out of range";
+}
+
+// Why the array `name` cannot be used whole, by MAT, SORT or a reduction,
+// empty when it can
+inline Str whole_array_error(const Str& name, const Array* array) {
+  if (array == nullptr || array->extents.empty()) {
+    return "ERROR: array " + name + " used before DIM";
+  }
+  return {};
+}
+
+// Why MAT cannot combine `left` and `right` element by element, empty when
+// it can
+inline Str mat_error(const Str& left_name, const Array* left,
+                     const Str& right_name, const Array* right) {
+  auto error = whole_array_error(left_name, left);
+  if (error.empty()) {
+    error = whole_array_error(right_name, right);
+  }
+  if (error.empty() && left->extents != right->extents) {
+    error = "ERROR: MAT " + left_name + " and " + right_name +
+            " differ in shape";
+  }
+  return error;
+}
+
+// MAT target = left op right, or left * factor, on operands mat_error
+// accepts. The target takes the operands' shape, so it only changes size
+// when it is neither of them.
+inline void mat(const ArrayPolicy& policy, MatOp op, Array& target,
+                const Array& left, const Array& right, int64_t factor) {
+  if (&target != &left) {
+    target.extents = left.extents;
+    target.values.resize(left.values.size());
+  }
+  kernels::mat(policy, op, left.values.data(), right.values.data(), factor,
+               target.values.data(), target.values.size());
+}
+
+// What a run keeps besides its variables and line
+struct RunState {
+  LoopStack loops;
+  CallStack calls;
+  Map<Str, Array> arrays;
+  // Set by an expression that stopped the run, e.g. on an index out of
+  // range, after reporting it; the statement evaluating it ends the run
+  // instead of finishing
+  bool failed{};
+  // How whole-array statements run; not part of the run's state
+  ArrayPolicy array_policy;
+
+  // The array `name`, nullptr when there is none
+  Array* find_array(const Str& name) {
+    auto array = arrays.find(name);
+    return array == arrays.end() ? nullptr : &array->second;
+  }
+
+  bool operator==(const RunState& other) const {
+    return loops.loops() == other.loops.loops() && calls == other.calls &&
+           arrays == other.arrays;
+  }
+};
+
+}  // namespace parser
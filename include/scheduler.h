@@ -0,0 +1,48 @@
+#pragma once
+#include <deque>
+
+#include "engine.h"
+#include "type.h"
+#include "ui_behavior.h"
+
+namespace engine {
+
+// Time-slices many engines on one thread. Each turn runs the next ready
+// engine for `slice` loop iterations and puts it back at the end of the
+// queue, so a long or endless program cannot starve the others.
+class Scheduler {
+ public:
+  explicit Scheduler(uint64_t slice = 1 << 12) : slice_(slice) {}
+
+  // Queues `engine` to run from its current line, printing into `output`.
+  // Both must outlive the job. Returns the job's id.
+  size_t add(MiniBasic& engine, Str& output);
+
+  // Runs one slice of the next ready job; false when no job is ready
+  bool turn();
+  // Takes turns until no job is ready
+  void run();
+
+  // What the job's last slice returned: Yield while it is queued, Input
+  // while it waits, FinishRun once it is done
+  [[nodiscard]] UIBehavior state(size_t job) const {
+    return jobs_[job].state;
+  }
+  // Queues a job again once its engine has the input it waited for
+  void resume(size_t job);
+
+  [[nodiscard]] size_t ready() const { return ready_.size(); }
+
+ private:
+  struct Job {
+    MiniBasic* engine;
+    Str* output;
+    UIBehavior state;
+  };
+
+  uint64_t slice_;
+  Vec<Job> jobs_;
+  std::deque<size_t> ready_;
+};
+
+}  // namespace engine
@@ -0,0 +1,44 @@
+#pragma once
+#include <istream>
+#include <ostream>
+#include <string_view>
+
+#include "run_state.h"
+#include "type.h"
+
+namespace engine {
+
+// Execution state of a paused run, enough to resume it in another process
+// that loaded the same program
+struct Snapshot {
+  // Hash of the analyzed program the run belongs to
+  uint64_t program{};
+  int64_t pc{-1};
+  // Variable an INPUT is waiting for, empty if none
+  Str need_input;
+  Map<Str, int64_t> variants;
+  // Active FOR loops, innermost last
+  Vec<parser::Loop> loops;
+  // Lines pending GOSUBs return to, innermost last
+  Vec<int64_t> calls;
+  // DIM'd arrays with their elements
+  Map<Str, parser::Array> arrays;
+
+  // Compact little-endian form: a magic word and format version, the fixed
+  // fields, then every string as a length and its bytes
+  [[nodiscard]] Str encode() const;
+  // False when `data` is not a complete snapshot of this format
+  static bool decode(std::string_view data, Snapshot& snapshot);
+
+  void write(std::ostream& out) const;
+  static bool read(std::istream& in, Snapshot& snapshot);
+
+  bool operator==(const Snapshot& other) const {
+    return program == other.program && pc == other.pc &&
+           need_input == other.need_input && variants == other.variants &&
+           loops == other.loops && calls == other.calls &&
+           arrays == other.arrays;
+  }
+};
+
+}  // namespace engine
@@ -98,48 +98,122 @@ class RightParenthesis : public Token {
   void dump(std::ostream &ostream) const override { ostream << ')'; }
 };
 
+// Separator between array bounds and indices
+
+class Comma : public Token {
+ public:
+  void dump(std::ostream &ostream) const override { ostream << ','; }
+};
+
+// Keywords, reductions and commands: reserved, so none of them can name a
+// variable
+
+class Word : public Token {};
+
 // Keyword
 
-class Rem : public Token {
+class Rem : public Word {
  public:
   void dump(std::ostream &ostream) const override { ostream << "REM"; }
 };
 
-class Let : public Token {
+class Let : public Word {
  public:
   void dump(std::ostream &ostream) const override { ostream << "LET"; }
 };
 
-class Print : public Token {
+class Print : public Word {
  public:
   void dump(std::ostream &ostream) const override { ostream << "PRINT"; }
 };
 
-class Input : public Token {
+class Input : public Word {
  public:
   void dump(std::ostream &ostream) const override { ostream << "INPUT"; }
 };
 
-class Goto : public Token {
+class Goto : public Word {
  public:
   void dump(std::ostream &ostream) const override { ostream << "GOTO"; }
 };
 
-class If : public Token {
+class If : public Word {
  public:
   void dump(std::ostream &ostream) const override { ostream << "IF"; }
 };
 
-class Then : public Token {
+class Then : public Word {
  public:
   void dump(std::ostream &ostream) const override { ostream << "THEN"; }
 };
 
-class End : public Token {
+class End : public Word {
  public:
   void dump(std::ostream &ostream) const override { ostream << "END"; }
 };
 
+class For : public Word {
+ public:
+  void dump(std::ostream &ostream) const override { ostream << "FOR"; }
+};
+
+class To : public Word {
+ public:
+  void dump(std::ostream &ostream) const override { ostream << "TO"; }
+};
+
+class Step : public Word {
+ public:
+  void dump(std::ostream &ostream) const override { ostream << "STEP"; }
+};
+
+class Next : public Word {
+ public:
+  void dump(std::ostream &ostream) const override { ostream << "NEXT"; }
+};
+
+class Gosub : public Word {
+ public:
+  void dump(std::ostream &ostream) const override { ostream << "GOSUB"; }
+};
+
+class Return : public Word {
+ public:
+  void dump(std::ostream &ostream) const override { ostream << "RETURN"; }
+};
+
+class Dim : public Word {
+ public:
+  void dump(std::ostream &ostream) const override { ostream << "DIM"; }
+};
+
+class Mat : public Word {
+ public:
+  void dump(std::ostream &ostream) const override { ostream << "MAT"; }
+};
+
+class Sort : public Word {
+ public:
+  void dump(std::ostream &ostream) const override { ostream << "SORT"; }
+};
+
+// Reductions over a whole array
+
+class Sum : public Word {
+ public:
+  void dump(std::ostream &ostream) const override { ostream << "SUM"; }
+};
+
+class Min : public Word {
+ public:
+  void dump(std::ostream &ostream) const override { ostream << "MIN"; }
+};
+
+class Max : public Word {
+ public:
+  void dump(std::ostream &ostream) const override { ostream << "MAX"; }
+};
+
 // String inside REM
 
 class RemString : public Token {
@@ -154,32 +228,47 @@ class RemString : public Token {
 
 // Command
 
-class Run : public Token {
+class Run : public Word {
  public:
   void dump(std::ostream &ostream) const override { ostream << "RUN"; }
 };
 
-class Load : public Token {
+class Load : public Word {
  public:
   void dump(std::ostream &ostream) const override { ostream << "LOAD"; }
 };
 
-class List : public Token {
+class List : public Word {
  public:
   void dump(std::ostream &ostream) const override { ostream << "LIST"; }
 };
 
-class Clear : public Token {
+class Clear : public Word {
  public:
   void dump(std::ostream &ostream) const override { ostream << "CLEAR"; }
 };
 
-class Help : public Token {
+class Undo : public Word {
+ public:
+  void dump(std::ostream &ostream) const override { ostream << "UNDO"; }
+};
+
+class Redo : public Word {
+ public:
+  void dump(std::ostream &ostream) const override { ostream << "REDO"; }
+};
+
+class Check : public Word {
+ public:
+  void dump(std::ostream &ostream) const override { ostream << "CHECK"; }
+};
+
+class Help : public Word {
  public:
   void dump(std::ostream &ostream) const override { ostream << "HELP"; }
 };
 
-class Quit : public Token {
+class Quit : public Word {
  public:
   void dump(std::ostream &ostream) const override { ostream << "QUIT"; }
 };
@@ -208,6 +297,15 @@ class Tokenizer {
  public:
   Vec<Rc<Token>> lex(const Str &source);
 
+  // Lex into the internal buffer, keeping its capacity between calls.
+  // The result is valid until the next call on this tokenizer.
+  const Vec<Rc<Token>> &lex_in_place(const Str &source);
+
+  // Pull interface for single-pass parsing: reset() to a line, then call
+  // next() until it yields EoL. The token is valid until the next call.
+  void reset(const Str &source);
+  const Rc<Token> &next();
+
  private:
   enum class Status {
     Normal,
@@ -224,7 +322,7 @@ class Tokenizer {
   uint32_t begin_;
   uint32_t current_;
 
-  Status status_;
+  Status status_{Status::Normal};
 
   [[nodiscard]] int32_t peek() const;
   char eat();
@@ -232,6 +330,7 @@ class Tokenizer {
   void align_begin();
   Str get_word();
 
+  void lex_step();
   void lex_normal();
   void lex_rem();
 
@@ -0,0 +1,19 @@
+#pragma once
+#include "flat_map.h"
+#include "parser.h"
+#include "type.h"
+
+namespace engine {
+
+// Translates a program into one standalone C++ translation unit. Lines become
+// labels, GOTO and IF become goto, variables become local int64_t with a
+// defined flag, and PRINT, INPUT, FOR, NEXT, DIM, MAT, SORT and the
+// reductions call a small runtime emitted alongside. Operands are evaluated left to right into temporaries,
+// so warnings come out in the interpreter's order; reads proven to follow an
+// assignment skip the defined flag and element accesses proven in range the
+// bounds check. Returns an empty string if the program uses a statement the
+// transpiler does not know.
+Str transpile_to_cpp(
+    const FlatMap<int64_t, Rc<parser::ast_node::LineNoStmt>>& ast);
+
+}  // namespace engine
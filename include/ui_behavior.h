@@ -9,5 +9,6 @@ enum class UIBehavior {
   Quit,
   Input,
   FinishRun,
+  Yield,  // a time slice ran out; run again to continue
   None,
 };
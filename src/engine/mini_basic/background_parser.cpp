@@ -0,0 +1,18 @@
+#include "background_parser.h"
+
+namespace engine {
+
+BackgroundParser::BackgroundParser(Vec<Str> lines,
+                                   parser::ParseContext::FrontEnd front_end)
+    : lines_(std::move(lines)), results_(lines_.size()) {
+  worker_ = std::jthread([this, front_end](std::stop_token stop) {
+    auto context = parser::ParseContext();
+    context.set_front_end(front_end);
+    for (size_t i{}; i < lines_.size() && !stop.stop_requested(); ++i) {
+      results_[i] = context.parse(lines_[i]);
+      parsed_.store(i + 1, std::memory_order_release);
+    }
+  });
+}
+
+}  // namespace engine
@@ -0,0 +1,822 @@
+#include "bounds_check.h"
+
+#include <algorithm>
+#include <limits>
+#include <optional>
+#include <queue>
+
+namespace engine {
+
+using namespace parser::ast_node;
+using Range = BoundsCheck::Range;
+using Facts = BoundsCheck::Facts;
+using LoopRange = BoundsCheck::LoopRange;
+
+namespace {
+
+constexpr int64_t kMin = std::numeric_limits<int64_t>::min();
+constexpr int64_t kMax = std::numeric_limits<int64_t>::max();
+// Arithmetic only trusts ends within this, so sums and products of them
+// cannot overflow the way the program's own arithmetic might
+constexpr int64_t kLimit = int64_t{1} << 62;
+// Updates of a line's facts before its ranges widen to the next threshold
+constexpr int kWidenAfter = 3;
+
+constexpr Range kAll{kMin, kMax};
+
+// How the left operand of a comparison relates to the right one
+enum class Relation { Less, Greater, Equal };
+
+bool bounded(const Range& r) {
+  return -kLimit <= r.lo && r.hi <= kLimit;
+}
+Range make(__int128 lo, __int128 hi) {
+  if (lo < -kLimit || hi > kLimit) {
+    return kAll;
+  }
+  return {static_cast<int64_t>(lo), static_cast<int64_t>(hi)};
+}
+bool contains(const Range& r, int64_t value) {
+  return r.lo <= value && value <= r.hi;
+}
+Range join(const Range& a, const Range& b) {
+  return {std::min(a.lo, b.lo), std::max(a.hi, b.hi)};
+}
+// One less and one more, leaving unbounded ends alone
+int64_t below(int64_t value) {
+  return value == kMin || value == kMax ? value : value - 1;
+}
+int64_t above(int64_t value) {
+  return value == kMin || value == kMax ? value : value + 1;
+}
+
+Range add(const Range& a, const Range& b) {
+  if (!bounded(a) || !bounded(b)) {
+    return kAll;
+  }
+  return make(__int128{a.lo} + b.lo, __int128{a.hi} + b.hi);
+}
+Range sub(const Range& a, const Range& b) {
+  if (!bounded(a) || !bounded(b)) {
+    return kAll;
+  }
+  return make(__int128{a.lo} - b.hi, __int128{a.hi} - b.lo);
+}
+Range mul(const Range& a, const Range& b) {
+  if (!bounded(a) || !bounded(b)) {
+    return kAll;
+  }
+  __int128 products[] = {__int128{a.lo} * b.lo, __int128{a.lo} * b.hi,
+                         __int128{a.hi} * b.lo, __int128{a.hi} * b.hi};
+  return make(*std::min_element(std::begin(products), std::end(products)),
+              *std::max_element(std::begin(products), std::end(products)));
+}
+// Only by a known nonzero divisor, for which truncating division is
+// monotonic
+Range div(const Range& a, const Range& b) {
+  if (!bounded(a) || b.lo != b.hi || b.lo == 0 || !bounded(b)) {
+    return kAll;
+  }
+  auto x = a.lo / b.lo;
+  auto y = a.hi / b.lo;
+  return {std::min(x, y), std::max(x, y)};
+}
+Range less(const Range& a, const Range& b) {
+  if (a.hi < b.lo) {
+    return {1, 1};
+  }
+  if (a.lo >= b.hi) {
+    return {0, 0};
+  }
+  return {0, 1};
+}
+Range equal(const Range& a, const Range& b) {
+  if (a.lo == a.hi && a == b) {
+    return {1, 1};
+  }
+  if (a.hi < b.lo || b.hi < a.lo) {
+    return {0, 0};
+  }
+  return {0, 1};
+}
+
+// Every expression a statement evaluates, in order
+Vec<Rc<Expr>> exprs_of(const Rc<Stmt>& stmt) {
+  const auto& type = typeid(*stmt);
+  if (type == typeid(Let)) {
+    return {std::static_pointer_cast<Let>(stmt)->expr()};
+  }
+  if (type == typeid(Print)) {
+    return {std::static_pointer_cast<Print>(stmt)->expr()};
+  }
+  if (type == typeid(If)) {
+    return {std::static_pointer_cast<If>(stmt)->expr()};
+  }
+  if (type == typeid(For)) {
+    auto node = std::static_pointer_cast<For>(stmt);
+    auto exprs = Vec<Rc<Expr>>{node->start(), node->limit()};
+    if (node->step()) {
+      exprs.push_back(node->step());
+    }
+    return exprs;
+  }
+  if (type == typeid(Dim)) {
+    return std::static_pointer_cast<Dim>(stmt)->bounds();
+  }
+  if (type == typeid(LetElement)) {
+    auto node = std::static_pointer_cast<LetElement>(stmt);
+    return {node->element(), node->expr()};
+  }
+  if (type == typeid(Mat)) {
+    if (auto factor = std::static_pointer_cast<Mat>(stmt)->factor()) {
+      return {factor};
+    }
+  }
+  return {};
+}
+
+template <typename Visit>
+void visit(const Rc<Expr>& expr, const Visit& on) {
+  on(expr);
+  const auto& type = typeid(*expr);
+  if (type == typeid(NegExpr)) {
+    visit(std::static_pointer_cast<NegExpr>(expr)->expr(), on);
+  } else if (type == typeid(PosExpr)) {
+    visit(std::static_pointer_cast<PosExpr>(expr)->expr(), on);
+  } else if (type == typeid(ArrayExpr)) {
+    for (const auto& index :
+         std::static_pointer_cast<ArrayExpr>(expr)->indices()) {
+      visit(index, on);
+    }
+  }
+#define BINARY(Node)                                  \
+  else if (type == typeid(Node)) {                    \
+    auto node = std::static_pointer_cast<Node>(expr); \
+    visit(node->left(), on);                          \
+    visit(node->right(), on);                         \
+  }
+  BINARY(PlusExpr)
+  BINARY(MinusExpr)
+  BINARY(MultiplyExpr)
+  BINARY(DivideExpr)
+  BINARY(PowerExpr)
+  BINARY(LessExpr)
+  BINARY(GreaterExpr)
+  BINARY(EqualExpr)
+#undef BINARY
+}
+
+// Names of the variables `expr` reads
+void reads(const Rc<Expr>& expr, Vec<Str>& names) {
+  visit(expr, [&](const Rc<Expr>& e) {
+    if (typeid(*e) == typeid(VariantExpr)) {
+      names.push_back(
+          std::static_pointer_cast<VariantExpr>(e)->variant()->value());
+    }
+  });
+}
+
+// Entries of sparse facts, sorted by index
+template <typename Entries>
+auto entry(Entries& entries, uint32_t index) {
+  return std::lower_bound(
+      entries.begin(), entries.end(), index,
+      [](const auto& entry, uint32_t i) { return entry.first < i; });
+}
+template <typename T>
+const T* find(const Vec<std::pair<uint32_t, T>>& entries, uint32_t index) {
+  auto at = entry(entries, index);
+  return at != entries.end() && at->first == index ? &at->second : nullptr;
+}
+template <typename T>
+void put(Vec<std::pair<uint32_t, T>>& entries, uint32_t index, T value) {
+  auto at = entry(entries, index);
+  if (at != entries.end() && at->first == index) {
+    at->second = std::move(value);
+  } else {
+    entries.emplace(at, index, std::move(value));
+  }
+}
+template <typename T>
+void erase(Vec<std::pair<uint32_t, T>>& entries, uint32_t index) {
+  auto at = entry(entries, index);
+  if (at != entries.end() && at->first == index) {
+    entries.erase(at);
+  }
+}
+
+Range value_of(const Facts& facts, uint32_t variable) {
+  const auto* value = find(facts.values, variable);
+  return value ? *value : kAll;
+}
+// Unbounded ranges are left out, so equal facts compare equal
+void set_value(Facts& facts, uint32_t variable, const Range& value) {
+  if (value == kAll) {
+    erase(facts.values, variable);
+  } else {
+    put(facts.values, variable, value);
+  }
+}
+
+class Analyzer {
+ public:
+  Analyzer(const Map<Str, uint32_t>& variables,
+           const Map<Str, uint32_t>& arrays)
+      : variables_(variables), arrays_(arrays) {}
+
+  Range eval(const Rc<Expr>& expr, const Facts& facts) const {
+    const auto& type = typeid(*expr);
+    if (type == typeid(IntegerExpr)) {
+      auto value =
+          std::static_pointer_cast<IntegerExpr>(expr)->integer()->value();
+      return {value, value};
+    }
+    if (type == typeid(VariantExpr)) {
+      auto v = variable(
+          std::static_pointer_cast<VariantExpr>(expr)->variant()->value());
+      return v ? value_of(facts, *v) : kAll;
+    }
+    if (type == typeid(NegExpr)) {
+      auto r = eval(std::static_pointer_cast<NegExpr>(expr)->expr(), facts);
+      return bounded(r) ? Range{-r.hi, -r.lo} : kAll;
+    }
+    if (type == typeid(PosExpr)) {
+      return eval(std::static_pointer_cast<PosExpr>(expr)->expr(), facts);
+    }
+#define BINARY(Node, Operation)                               \
+  if (type == typeid(Node)) {                                 \
+    auto node = std::static_pointer_cast<Node>(expr);         \
+    return Operation(eval(node->left(), facts),               \
+                     eval(node->right(), facts));             \
+  }
+    BINARY(PlusExpr, add)
+    BINARY(MinusExpr, sub)
+    BINARY(MultiplyExpr, mul)
+    BINARY(DivideExpr, div)
+    BINARY(LessExpr, less)
+    BINARY(EqualExpr, equal)
+#undef BINARY
+    if (type == typeid(GreaterExpr)) {
+      auto node = std::static_pointer_cast<GreaterExpr>(expr);
+      return less(eval(node->right(), facts), eval(node->left(), facts));
+    }
+    // **, array elements and reductions can be anything
+    return kAll;
+  }
+
+  // Narrows `facts` to the runs in which `expr` is nonzero, or zero when
+  // `holds` is false; false when there are none
+  bool assume(const Rc<Expr>& expr, bool holds, Facts& facts) const {
+    auto value = eval(expr, facts);
+    if (holds ? value == Range{0, 0} : !contains(value, 0)) {
+      return false;
+    }
+    const auto& type = typeid(*expr);
+    Rc<Expr> left;
+    Rc<Expr> right;
+    Relation relation{};
+    if (type == typeid(LessExpr)) {
+      auto node = std::static_pointer_cast<LessExpr>(expr);
+      left = node->left();
+      right = node->right();
+      relation = Relation::Less;
+    } else if (type == typeid(GreaterExpr)) {
+      auto node = std::static_pointer_cast<GreaterExpr>(expr);
+      left = node->left();
+      right = node->right();
+      relation = Relation::Greater;
+    } else if (type == typeid(EqualExpr)) {
+      auto node = std::static_pointer_cast<EqualExpr>(expr);
+      left = node->left();
+      right = node->right();
+      relation = Relation::Equal;
+    } else {
+      return true;
+    }
+    auto l = eval(left, facts);
+    auto r = eval(right, facts);
+    auto mirrored = relation == Relation::Less      ? Relation::Greater
+                    : relation == Relation::Greater ? Relation::Less
+                                                    : Relation::Equal;
+    return narrow(left, relation, r, holds, facts) &&
+           narrow(right, mirrored, l, holds, facts);
+  }
+
+  // Facts after `stmt` runs on `row`, for each line it may go on to
+  void flow(const Rc<Stmt>& stmt, size_t row, const Facts& in,
+            Vec<std::pair<size_t, Facts>>& out) const {
+    out.clear();
+    const auto& type = typeid(*stmt);
+    auto fall = [&](Facts facts) {
+      if (row + 1 < rows_) {
+        out.emplace_back(row + 1, std::move(facts));
+      }
+    };
+    auto jump = [&](int64_t line, Facts facts) {
+      if (auto to = lines_->find(line); to != lines_->end()) {
+        out.emplace_back(to->second, std::move(facts));
+      }
+    };
+
+    if (type == typeid(Let)) {
+      auto node = std::static_pointer_cast<Let>(stmt);
+      auto facts = in;
+      if (auto v = variable(node->variant()->value())) {
+        set_value(facts, *v, eval(node->expr(), in));
+      }
+      fall(std::move(facts));
+    } else if (type == typeid(Input)) {
+      auto facts = in;
+      if (auto v = variable(
+              std::static_pointer_cast<Input>(stmt)->variant()->value())) {
+        erase(facts.values, *v);
+      }
+      fall(std::move(facts));
+    } else if (type == typeid(Dim)) {
+      auto node = std::static_pointer_cast<Dim>(stmt);
+      auto bounds = Vec<int64_t>();
+      for (const auto& bound : node->bounds()) {
+        auto r = eval(bound, in);
+        if (r.lo == r.hi) {
+          bounds.push_back(r.lo);
+        }
+      }
+      auto facts = in;
+      auto a = arrays_.at(node->variant()->value());
+      erase(facts.shapes, a);
+      if (bounds.size() == node->bounds().size()) {
+        auto array = parser::Array();
+        if (!array.dim(bounds.data(), bounds.size())) {
+          // Always out of range, so the run ends here
+          return;
+        }
+        put(facts.shapes, a, std::move(array.extents));
+      }
+      fall(std::move(facts));
+    } else if (type == typeid(Mat)) {
+      // The target takes the operands' shape when they have one
+      auto node = std::static_pointer_cast<Mat>(stmt);
+      const auto* shape = find(in.shapes, arrays_.at(node->left()->value()));
+      if (node->right()) {
+        const auto* right =
+            find(in.shapes, arrays_.at(node->right()->value()));
+        if (shape && right && *shape != *right) {
+          // Always of different shapes, so the run ends here
+          return;
+        }
+        if (!shape) {
+          shape = right;
+        }
+      }
+      auto facts = in;
+      auto target = arrays_.at(node->target()->value());
+      if (shape) {
+        put(facts.shapes, target, *shape);
+      } else {
+        erase(facts.shapes, target);
+      }
+      fall(std::move(facts));
+    } else if (type == typeid(Goto)) {
+      jump(std::static_pointer_cast<Goto>(stmt)->number()->value(), in);
+    } else if (type == typeid(If)) {
+      auto node = std::static_pointer_cast<If>(stmt);
+      auto taken = in;
+      if (assume(node->expr(), true, taken)) {
+        jump(node->number()->value(), std::move(taken));
+      }
+      auto not_taken = in;
+      if (assume(node->expr(), false, not_taken)) {
+        fall(std::move(not_taken));
+      }
+    } else if (type == typeid(End)) {
+    } else if (type == typeid(For)) {
+      auto node = std::static_pointer_cast<For>(stmt);
+      auto facts = in;
+      if (auto v = variable(node->variant()->value())) {
+        set_value(facts, *v, eval(node->start(), in));
+        put(facts.loops, *v,
+            LoopRange{eval(node->limit(), in),
+                      node->step() ? eval(node->step(), in) : Range{1, 1}});
+      }
+      fall(std::move(facts));
+    } else if (type == typeid(Next)) {
+      auto name = std::static_pointer_cast<Next>(stmt)->variant()->value();
+      auto bodies = bodies_->find(name);
+      auto v = variable(name);
+      if (!v) {
+        // Nothing is known of the loop, so it may go either way
+        if (bodies != bodies_->end()) {
+          for (auto line : bodies->second) {
+            jump(line, in);
+          }
+        }
+        fall(in);
+        return;
+      }
+      const auto* loop = find(in.loops, *v);
+      if (!loop) {
+        return;
+      }
+      auto value = add(value_of(in, *v), loop->step);
+      // Going on means the stepped value has not passed the bound
+      auto again = value;
+      if (loop->step.lo >= 0) {
+        again.hi = std::min(again.hi, loop->limit.hi);
+      } else if (loop->step.hi < 0) {
+        again.lo = std::max(again.lo, loop->limit.lo);
+      }
+      if (again.lo <= again.hi && bodies != bodies_->end()) {
+        for (auto line : bodies->second) {
+          auto facts = in;
+          set_value(facts, *v, again);
+          jump(line, std::move(facts));
+        }
+      }
+      auto facts = in;
+      set_value(facts, *v, value);
+      erase(facts.loops, *v);
+      fall(std::move(facts));
+    } else if (type == typeid(Gosub)) {
+      jump(std::static_pointer_cast<Gosub>(stmt)->number()->value(), in);
+    } else if (type == typeid(Return)) {
+      for (auto line : *returns_) {
+        jump(line, in);
+      }
+    } else {
+      // PRINT, REM, SORT and element assignments change no variable or
+      // shape
+      fall(in);
+    }
+  }
+
+  void set_graph(const Map<int64_t, size_t>& lines, size_t rows,
+                 const Map<Str, std::set<int64_t>>& bodies,
+                 const std::set<int64_t>& returns) {
+    lines_ = &lines;
+    rows_ = rows;
+    bodies_ = &bodies;
+    returns_ = &returns;
+  }
+
+ private:
+  const Map<Str, uint32_t>& variables_;
+  const Map<Str, uint32_t>& arrays_;
+  const Map<int64_t, size_t>* lines_{};
+  size_t rows_{};
+  const Map<Str, std::set<int64_t>>* bodies_{};
+  const std::set<int64_t>* returns_{};
+
+  // Index of `name`, none for a variable the analysis does not follow
+  std::optional<uint32_t> variable(const Str& name) const {
+    auto v = variables_.find(name);
+    if (v == variables_.end()) {
+      return std::nullopt;
+    }
+    return v->second;
+  }
+
+  // Narrows the variable `expr` reads, if it is one, to the values that
+  // stand in `relation` to some value of `other`, or not when `holds` is
+  // false; false when none are left
+  bool narrow(const Rc<Expr>& expr, Relation relation, const Range& other,
+              bool holds, Facts& facts) const {
+    if (typeid(*expr) != typeid(VariantExpr)) {
+      return true;
+    }
+    auto v = variable(
+        std::static_pointer_cast<VariantExpr>(expr)->variant()->value());
+    if (!v) {
+      return true;
+    }
+    auto value = value_of(facts, *v);
+    auto narrowed = value;
+    if (relation == Relation::Equal) {
+      if (holds) {
+        narrowed = {std::max(value.lo, other.lo), std::min(value.hi, other.hi)};
+      } else if (other.lo == other.hi && value.lo == other.lo) {
+        narrowed.lo = above(value.lo);
+      } else if (other.lo == other.hi && value.hi == other.lo) {
+        narrowed.hi = below(value.hi);
+      }
+    } else if ((relation == Relation::Less) == holds) {
+      // Below some value of `other`, or not above any
+      narrowed.hi = std::min(value.hi, holds ? below(other.hi) : other.hi);
+    } else {
+      narrowed.lo = std::max(value.lo, holds ? above(other.lo) : other.lo);
+    }
+    if (narrowed.lo > narrowed.hi) {
+      return false;
+    }
+    set_value(facts, *v, narrowed);
+    return true;
+  }
+};
+
+// A variable or shape one side does not know is not known after either
+Facts join(const Facts& a, const Facts& b) {
+  auto facts = Facts{true, {}, {}, {}};
+  for (const auto& [v, value] : a.values) {
+    if (const auto* other = find(b.values, v)) {
+      set_value(facts, v, join(value, *other));
+    }
+  }
+  facts.loops = a.loops;
+  for (const auto& [v, other] : b.loops) {
+    auto loop = entry(facts.loops, v);
+    if (loop != facts.loops.end() && loop->first == v) {
+      loop->second.limit = join(loop->second.limit, other.limit);
+      loop->second.step = join(loop->second.step, other.step);
+    } else {
+      facts.loops.emplace(loop, v, other);
+    }
+  }
+  for (const auto& [array, shape] : a.shapes) {
+    if (const auto* other = find(b.shapes, array); other && *other == shape) {
+      facts.shapes.emplace_back(array, shape);
+    }
+  }
+  return facts;
+}
+
+// Moves each end of `next` that grew past `before` out to the nearest
+// threshold, so loops that count up or down settle in a few passes
+Range widen(const Range& before, const Range& next,
+            const Vec<int64_t>& thresholds) {
+  auto widened = next;
+  if (next.lo < before.lo) {
+    auto at = std::upper_bound(thresholds.begin(), thresholds.end(), next.lo);
+    widened.lo = at == thresholds.begin() ? kMin : *(at - 1);
+  }
+  if (next.hi > before.hi) {
+    auto at = std::lower_bound(thresholds.begin(), thresholds.end(), next.hi);
+    widened.hi = at == thresholds.end() ? kMax : *at;
+  }
+  return widened;
+}
+
+void widen(const Facts& before, Facts& next, const Vec<int64_t>& thresholds) {
+  // Joined with `before`, so `next` knows no variable it does not
+  auto values = std::move(next.values);
+  next.values.clear();
+  for (const auto& [v, value] : values) {
+    set_value(next, v, widen(value_of(before, v), value, thresholds));
+  }
+  for (auto& [v, loop] : next.loops) {
+    if (const auto* was = find(before.loops, v)) {
+      loop.limit = widen(was->limit, loop.limit, thresholds);
+      loop.step = widen(was->step, loop.step, thresholds);
+    }
+  }
+}
+
+}  // namespace
+
+BoundsCheck::BoundsCheck(const FlatMap<int64_t, Rc<LineNoStmt>>& program) {
+  auto stmts = Vec<Rc<Stmt>>();
+  auto lines = Vec<int64_t>();
+  auto thresholds = Vec<int64_t>{-1, 0, 1};
+  auto intern = [](Map<Str, uint32_t>& names, const Str& name) {
+    names.insert(std::make_pair(name, names.size()));
+  };
+  // Variables that reach an index or extent, and the ones each variable's
+  // value comes from
+  auto pending = Vec<Str>();
+  auto sources = Map<Str, Vec<Str>>();
+  for (const auto& [line, node] : program) {
+    rows_.insert(std::make_pair(line, stmts.size()));
+    stmts.push_back(node->stmt());
+    lines.push_back(line);
+
+    const auto& stmt = node->stmt();
+    const auto& type = typeid(*stmt);
+    if (type == typeid(Let)) {
+      auto node = std::static_pointer_cast<Let>(stmt);
+      reads(node->expr(), sources[node->variant()->value()]);
+    } else if (type == typeid(For)) {
+      auto node = std::static_pointer_cast<For>(stmt);
+      auto& from = sources[node->variant()->value()];
+      reads(node->start(), from);
+      reads(node->limit(), from);
+      if (node->step()) {
+        reads(node->step(), from);
+      }
+    } else if (type == typeid(If)) {
+      // A comparison narrows each variable in it by the others
+      auto names = Vec<Str>();
+      reads(std::static_pointer_cast<If>(stmt)->expr(), names);
+      for (const auto& name : names) {
+        auto& from = sources[name];
+        from.insert(from.end(), names.begin(), names.end());
+      }
+    } else if (type == typeid(Dim)) {
+      auto node = std::static_pointer_cast<Dim>(stmt);
+      intern(arrays_, node->variant()->value());
+      for (const auto& bound : node->bounds()) {
+        reads(bound, pending);
+      }
+      uses_arrays_ = true;
+    } else if (type == typeid(Mat)) {
+      auto node = std::static_pointer_cast<Mat>(stmt);
+      intern(arrays_, node->target()->value());
+      intern(arrays_, node->left()->value());
+      if (node->right()) {
+        intern(arrays_, node->right()->value());
+      }
+      uses_arrays_ = true;
+    } else if (type == typeid(Sort)) {
+      intern(arrays_,
+             std::static_pointer_cast<Sort>(stmt)->variant()->value());
+      uses_arrays_ = true;
+    }
+    for (const auto& expr : exprs_of(stmt)) {
+      visit(expr, [&](const Rc<Expr>& e) {
+        const auto& t = typeid(*e);
+        if (t == typeid(ArrayExpr)) {
+          auto access = std::static_pointer_cast<ArrayExpr>(e);
+          intern(arrays_, access->variant()->value());
+          for (const auto& index : access->indices()) {
+            reads(index, pending);
+          }
+          uses_arrays_ = true;
+        } else if (t == typeid(ReduceExpr)) {
+          intern(arrays_,
+                 std::static_pointer_cast<ReduceExpr>(e)->variant()->value());
+          uses_arrays_ = true;
+        } else if (t == typeid(IntegerExpr)) {
+          auto value =
+              std::static_pointer_cast<IntegerExpr>(e)->integer()->value();
+          if (-kLimit < value && value < kLimit) {
+            thresholds.insert(thresholds.end(),
+                              {value - 1, value, value + 1, -value});
+          }
+        }
+      });
+    }
+  }
+  // With no element access there is nothing to prove
+  if (!uses_arrays_) {
+    return;
+  }
+  while (!pending.empty()) {
+    auto name = std::move(pending.back());
+    pending.pop_back();
+    if (variables_.count(name)) {
+      continue;
+    }
+    intern(variables_, name);
+    if (auto from = sources.find(name); from != sources.end()) {
+      pending.insert(pending.end(), from->second.begin(), from->second.end());
+    }
+  }
+  std::sort(thresholds.begin(), thresholds.end());
+  thresholds.erase(std::unique(thresholds.begin(), thresholds.end()),
+                   thresholds.end());
+
+  for (size_t row{}; row + 1 < stmts.size(); ++row) {
+    const auto& type = typeid(*stmts[row]);
+    if (type == typeid(For)) {
+      bodies_[std::static_pointer_cast<For>(stmts[row])->variant()->value()]
+          .insert(lines[row + 1]);
+    } else if (type == typeid(Gosub)) {
+      returns_.insert(lines[row + 1]);
+    }
+  }
+
+  auto analyzer = Analyzer(variables_, arrays_);
+  analyzer.set_graph(rows_, stmts.size(), bodies_, returns_);
+
+  // Everything is unknown on entry to the first line, no loop is running
+  // and every other line is unreachable until a path gets there
+  in_.assign(stmts.size(), Facts{});
+  in_.front().reachable = true;
+
+  auto updates = Vec<int>(stmts.size());
+  std::queue<size_t> queue;
+  auto queued = Vec<uint8_t>(stmts.size());
+  queue.push(0);
+  queued[0] = 1;
+  auto out = Vec<std::pair<size_t, Facts>>();
+  while (!queue.empty()) {
+    auto row = queue.front();
+    queue.pop();
+    queued[row] = 0;
+
+    analyzer.flow(stmts[row], row, in_[row], out);
+    for (auto& [successor, facts] : out) {
+      auto& in = in_[successor];
+      if (in.reachable) {
+        auto next = join(in, facts);
+        if (++updates[successor] > kWidenAfter) {
+          widen(in, next, thresholds);
+        }
+        if (next == in) {
+          continue;
+        }
+        in = std::move(next);
+      } else {
+        in = std::move(facts);
+        in.reachable = true;
+      }
+      if (!queued[successor]) {
+        queue.push(successor);
+        queued[successor] = 1;
+      }
+    }
+  }
+
+  for (size_t row{}; row < stmts.size(); ++row) {
+    const auto& facts = in_[row];
+    if (!facts.reachable) {
+      continue;
+    }
+    for (const auto& expr : exprs_of(stmts[row])) {
+      visit(expr, [&](const Rc<Expr>& e) {
+        if (typeid(*e) != typeid(ArrayExpr)) {
+          return;
+        }
+        auto access = std::static_pointer_cast<ArrayExpr>(e);
+        const auto* shape =
+            find(facts.shapes, arrays_.at(access->variant()->value()));
+        const auto& indices = access->indices();
+        if (!shape || shape->size() != indices.size()) {
+          return;
+        }
+        for (size_t i{}; i < indices.size(); ++i) {
+          auto index = analyzer.eval(indices[i], facts);
+          if (index.lo < 0 || index.hi >= (*shape)[i]) {
+            return;
+          }
+        }
+        proven_.insert(std::make_pair(lines[row], access.get()));
+      });
+    }
+  }
+}
+
+bool BoundsCheck::in_bounds(int64_t line, const ArrayExpr& access) const {
+  return proven_.count(std::make_pair(line, &access)) != 0;
+}
+
+Range BoundsCheck::range(int64_t line, const Str& name) const {
+  auto row = rows_.find(line);
+  auto variable = variables_.find(name);
+  if (row == rows_.end() || variable == variables_.end() ||
+      !in_[row->second].reachable) {
+    return kAll;
+  }
+  return value_of(in_[row->second], variable->second);
+}
+
+bool BoundsCheck::admits(int64_t line, const Map<Str, int64_t>& variants,
+                         const parser::RunState& state) const {
+  // Nothing relies on the analysis of a program without arrays
+  if (line == -1 || !uses_arrays_) {
+    return true;
+  }
+  auto row = rows_.find(line);
+  if (row == rows_.end() || !in_[row->second].reachable) {
+    return false;
+  }
+  const auto& facts = in_[row->second];
+
+  // A variable never assigned reads as 0
+  for (const auto& [name, index] : variables_) {
+    auto v = variants.find(name);
+    if (!contains(value_of(facts, index),
+                  v == variants.end() ? 0 : v->second)) {
+      return false;
+    }
+  }
+  for (const auto& loop : state.loops.loops()) {
+    auto variable = variables_.find(loop.variant);
+    if (variable == variables_.end()) {
+      continue;
+    }
+    const auto* range = find(facts.loops, variable->second);
+    auto bodies = bodies_.find(loop.variant);
+    if (!range || !contains(range->limit, loop.limit) ||
+        !contains(range->step, loop.step) ||
+        (loop.body != -1 &&
+         (bodies == bodies_.end() || !bodies->second.count(loop.body)))) {
+      return false;
+    }
+  }
+  for (auto line : state.calls.returns()) {
+    if (line != -1 && !returns_.count(line)) {
+      return false;
+    }
+  }
+  for (const auto& [name, index] : arrays_) {
+    const auto* shape = find(facts.shapes, index);
+    if (!shape) {
+      continue;
+    }
+    auto array = state.arrays.find(name);
+    if (array == state.arrays.end() || array->second.extents != *shape) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace engine
@@ -0,0 +1,841 @@
+#include "bytecode.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <limits>
+#include <tuple>
+
+namespace engine::bytecode {
+namespace {
+
+using namespace parser::ast_node;
+
+template <typename Node>
+std::pair<Rc<Expr>, Rc<Expr>> operands(const Rc<Expr>& expr) {
+  auto node = std::static_pointer_cast<Node>(expr);
+  return {node->left(), node->right()};
+}
+
+// Line index a GOTO, IF or GOSUB may jump to, kEnd for other statements
+int32_t jump_target(const Rc<Stmt>& stmt, const Layout& layout) {
+  if (typeid(*stmt) == typeid(Goto)) {
+    return layout.index_of(
+        std::static_pointer_cast<Goto>(stmt)->number()->value());
+  }
+  if (typeid(*stmt) == typeid(If)) {
+    return layout.index_of(std::static_pointer_cast<If>(stmt)->number()->value());
+  }
+  if (typeid(*stmt) == typeid(Gosub)) {
+    return layout.index_of(
+        std::static_pointer_cast<Gosub>(stmt)->number()->value());
+  }
+  return Program::kEnd;
+}
+
+// Body line each NEXT loops back to when it ends the loop of the nearest FOR
+// over its variable above it, kEnd on other lines. Run time decides which
+// loop a NEXT steps; this is the one its fast path expects.
+Vec<int32_t> loop_bodies(const Layout& layout) {
+  const auto& lines = layout.lines();
+  auto bodies = Vec<int32_t>(lines.size(), Program::kEnd);
+  auto starts = Map<Str, int32_t>();
+  for (size_t i{}; i < lines.size(); ++i) {
+    auto stmt = lines[i]->stmt();
+    auto next = i + 1 < lines.size() ? static_cast<int32_t>(i + 1)
+                                     : Program::kEnd;
+    if (typeid(*stmt) == typeid(For)) {
+      starts[std::static_pointer_cast<For>(stmt)->variant()->value()] = next;
+    } else if (typeid(*stmt) == typeid(Next)) {
+      auto start =
+          starts.find(std::static_pointer_cast<Next>(stmt)->variant()->value());
+      if (start != starts.end()) {
+        bodies[i] = start->second;
+      }
+    }
+  }
+  return bodies;
+}
+
+class Compiler {
+ public:
+  Compiler(Vec<Instr>& code, Layout& layout) : code_(code), layout_(layout) {}
+
+  // Emits one line; false if the statement is not supported. `body` is the
+  // line a NEXT is expected to loop back to.
+  bool stmt(const Rc<Stmt>& stmt, int32_t next, int32_t body);
+
+  [[nodiscard]] size_t max_depth() const {
+    return static_cast<size_t>(max_depth_);
+  }
+
+ private:
+  Vec<Instr>& code_;
+  Layout& layout_;
+  int depth_{};
+  int max_depth_{};
+
+  void emit(Op op, int delta, uint32_t slot = 0, int64_t value = 0,
+            int32_t target = 0, uint32_t other = 0) {
+    code_.push_back(Instr{nullptr, op, slot, other, target, value});
+    depth_ += delta;
+    max_depth_ = std::max(max_depth_, depth_);
+  }
+
+  // Slot of a variable about to be read, behind a Check unless the read is
+  // proven to follow an assignment
+  uint32_t read(const Str& name) {
+    auto slot = layout_.slot(name);
+    if (layout_.checked(name)) {
+      emit(Op::Check, 0, slot);
+    }
+    return slot;
+  }
+
+  bool expr(const Rc<Expr>& expr);
+  bool branch(const Rc<If>& node, int32_t target);
+};
+
+bool Compiler::expr(const Rc<Expr>& expr) {
+  const auto& type = typeid(*expr);
+  if (type == typeid(VariantExpr)) {
+    auto name = std::static_pointer_cast<VariantExpr>(expr)->variant()->value();
+    emit(Op::PushSlot, 1, read(name));
+    return true;
+  }
+  if (type == typeid(IntegerExpr)) {
+    auto value = std::static_pointer_cast<IntegerExpr>(expr)->integer()->value();
+    emit(Op::PushConst, 1, 0, value);
+    return true;
+  }
+  if (type == typeid(NegExpr)) {
+    if (!this->expr(std::static_pointer_cast<NegExpr>(expr)->expr())) {
+      return false;
+    }
+    emit(Op::Neg, 0);
+    return true;
+  }
+  if (type == typeid(PosExpr)) {
+    return this->expr(std::static_pointer_cast<PosExpr>(expr)->expr());
+  }
+  if (type == typeid(ArrayExpr)) {
+    auto access = std::static_pointer_cast<ArrayExpr>(expr);
+    for (const auto& index : access->indices()) {
+      if (!this->expr(index)) {
+        return false;
+      }
+    }
+    auto rank = static_cast<uint32_t>(access->indices().size());
+    emit(layout_.checked(*access) ? Op::LoadElement : Op::LoadElementUnchecked,
+         1 - static_cast<int>(rank), layout_.array(access->variant()->value()),
+         0, 0, rank);
+    return true;
+  }
+  if (type == typeid(ReduceExpr)) {
+    auto node = std::static_pointer_cast<ReduceExpr>(expr);
+    emit(Op::Reduce, 1, layout_.array(node->variant()->value()), 0, 0,
+         static_cast<uint32_t>(node->reduction()));
+    return true;
+  }
+
+  // Arithmetic on a constant right operand folds it into the instruction
+#define BINARY(Node, Operation, WithConst)                                   \
+  if (type == typeid(Node)) {                                                \
+    auto node = std::static_pointer_cast<Node>(expr);                        \
+    if (!this->expr(node->left())) {                                         \
+      return false;                                                          \
+    }                                                                        \
+    if ((WithConst) != (Operation) &&                                        \
+        typeid(*node->right()) == typeid(IntegerExpr)) {                     \
+      emit(WithConst, 0, 0,                                                  \
+           std::static_pointer_cast<IntegerExpr>(node->right())              \
+               ->integer()                                                   \
+               ->value());                                                   \
+      return true;                                                           \
+    }                                                                        \
+    if (!this->expr(node->right())) {                                        \
+      return false;                                                          \
+    }                                                                        \
+    emit(Operation, -1);                                                     \
+    return true;                                                             \
+  }
+  BINARY(PlusExpr, Op::Add, Op::AddConst)
+  BINARY(MinusExpr, Op::Sub, Op::SubConst)
+  BINARY(MultiplyExpr, Op::Mul, Op::MulConst)
+  BINARY(DivideExpr, Op::Div, Op::DivConst)
+  BINARY(PowerExpr, Op::Pow, Op::Pow)
+  BINARY(LessExpr, Op::Less, Op::Less)
+  BINARY(GreaterExpr, Op::Greater, Op::Greater)
+  BINARY(EqualExpr, Op::Equal, Op::Equal)
+#undef BINARY
+  return false;
+}
+
+// IF on a comparison of slots and constants compares and jumps in one
+// instruction
+bool Compiler::branch(const Rc<If>& node, int32_t target) {
+  auto expr = node->expr();
+  const auto& type = typeid(*expr);
+  Rc<Expr> left;
+  Rc<Expr> right;
+  Op with_const;
+  Op with_slot;
+  Op swapped;
+  // `swapped` handles a constant on the left
+  if (type == typeid(LessExpr)) {
+    std::tie(left, right) = operands<LessExpr>(expr);
+    with_const = Op::JumpIfLessSlotConst;
+    with_slot = Op::JumpIfLessSlotSlot;
+    swapped = Op::JumpIfGreaterSlotConst;
+  } else if (type == typeid(GreaterExpr)) {
+    std::tie(left, right) = operands<GreaterExpr>(expr);
+    with_const = Op::JumpIfGreaterSlotConst;
+    with_slot = Op::JumpIfGreaterSlotSlot;
+    swapped = Op::JumpIfLessSlotConst;
+  } else if (type == typeid(EqualExpr)) {
+    std::tie(left, right) = operands<EqualExpr>(expr);
+    with_const = Op::JumpIfEqualSlotConst;
+    with_slot = Op::JumpIfEqualSlotSlot;
+    swapped = Op::JumpIfEqualSlotConst;
+  } else {
+    return false;
+  }
+
+  const auto& l = typeid(*left);
+  const auto& r = typeid(*right);
+  auto slot = [this](const Rc<Expr>& e) {
+    return read(std::static_pointer_cast<VariantExpr>(e)->variant()->value());
+  };
+  auto value = [](const Rc<Expr>& e) {
+    return std::static_pointer_cast<IntegerExpr>(e)->integer()->value();
+  };
+  if (l == typeid(VariantExpr) && r == typeid(IntegerExpr)) {
+    emit(with_const, 0, slot(left), value(right), target);
+    return true;
+  }
+  if (l == typeid(IntegerExpr) && r == typeid(VariantExpr)) {
+    emit(swapped, 0, slot(right), value(left), target);
+    return true;
+  }
+  if (l == typeid(VariantExpr) && r == typeid(VariantExpr)) {
+    auto a = slot(left);
+    emit(with_slot, 0, a, 0, target, slot(right));
+    return true;
+  }
+  return false;
+}
+
+bool Compiler::stmt(const Rc<Stmt>& stmt, int32_t next, int32_t body) {
+  const auto& type = typeid(*stmt);
+  if (type == typeid(Let)) {
+    auto node = std::static_pointer_cast<Let>(stmt);
+    auto slot = layout_.slot(node->variant()->value());
+    auto e = node->expr();
+
+    // LET x = x + c
+    if (typeid(*e) == typeid(PlusExpr)) {
+      auto plus = std::static_pointer_cast<PlusExpr>(e);
+      if (typeid(*plus->left()) == typeid(VariantExpr) &&
+          typeid(*plus->right()) == typeid(IntegerExpr) &&
+          std::static_pointer_cast<VariantExpr>(plus->left())
+                  ->variant()
+                  ->value() == node->variant()->value()) {
+        read(node->variant()->value());
+        emit(Op::AddSlotConst, 0, slot,
+             std::static_pointer_cast<IntegerExpr>(plus->right())
+                 ->integer()
+                 ->value());
+        return true;
+      }
+    }
+
+    if (!expr(e)) {
+      return false;
+    }
+    emit(Op::Store, -1, slot);
+    return true;
+  }
+  if (type == typeid(Print)) {
+    if (!expr(std::static_pointer_cast<Print>(stmt)->expr())) {
+      return false;
+    }
+    emit(Op::Print, -1);
+    return true;
+  }
+  if (type == typeid(Input)) {
+    auto name = std::static_pointer_cast<Input>(stmt)->variant()->value();
+    emit(Op::Input, 0, layout_.slot(name), 0, next);
+    return true;
+  }
+  if (type == typeid(Goto)) {
+    emit(Op::Jump, 0, 0, 0,
+         layout_.index_of(
+             std::static_pointer_cast<Goto>(stmt)->number()->value()));
+    return true;
+  }
+  if (type == typeid(If)) {
+    auto node = std::static_pointer_cast<If>(stmt);
+    auto target = layout_.index_of(node->number()->value());
+    if (branch(node, target)) {
+      return true;
+    }
+    if (!expr(node->expr())) {
+      return false;
+    }
+    emit(Op::JumpIfTrue, -1, 0, 0, target);
+    return true;
+  }
+  if (type == typeid(End)) {
+    emit(Op::End, 0);
+    return true;
+  }
+  if (type == typeid(Rem)) {
+    return true;
+  }
+  if (type == typeid(For)) {
+    auto node = std::static_pointer_cast<For>(stmt);
+    if (!expr(node->start()) || !expr(node->limit())) {
+      return false;
+    }
+    if (node->step()) {
+      if (!expr(node->step())) {
+        return false;
+      }
+    } else {
+      emit(Op::PushConst, 1, 0, 1);
+    }
+    emit(Op::For, -3, layout_.slot(node->variant()->value()), 0, next);
+    return true;
+  }
+  if (type == typeid(Next)) {
+    auto name = std::static_pointer_cast<Next>(stmt)->variant()->value();
+    emit(Op::Next, 0, layout_.slot(name), 0, body,
+         static_cast<uint32_t>(body));
+    return true;
+  }
+  if (type == typeid(Gosub)) {
+    emit(Op::Gosub, 0, 0, 0,
+         layout_.index_of(
+             std::static_pointer_cast<Gosub>(stmt)->number()->value()),
+         static_cast<uint32_t>(next));
+    return true;
+  }
+  if (type == typeid(Return)) {
+    emit(Op::Return, 0);
+    return true;
+  }
+  if (type == typeid(Dim)) {
+    auto node = std::static_pointer_cast<Dim>(stmt);
+    for (const auto& bound : node->bounds()) {
+      if (!expr(bound)) {
+        return false;
+      }
+    }
+    auto rank = static_cast<uint32_t>(node->bounds().size());
+    emit(Op::Dim, -static_cast<int>(rank),
+         layout_.array(node->variant()->value()), 0, 0, rank);
+    return true;
+  }
+  if (type == typeid(LetElement)) {
+    auto node = std::static_pointer_cast<LetElement>(stmt);
+    auto access = node->element();
+    for (const auto& index : access->indices()) {
+      if (!expr(index)) {
+        return false;
+      }
+    }
+    if (!expr(node->expr())) {
+      return false;
+    }
+    auto rank = static_cast<uint32_t>(access->indices().size());
+    emit(layout_.checked(*access) ? Op::StoreElement
+                                  : Op::StoreElementUnchecked,
+         -1 - static_cast<int>(rank),
+         layout_.array(access->variant()->value()), 0, 0, rank);
+    return true;
+  }
+  if (type == typeid(Mat)) {
+    auto node = std::static_pointer_cast<Mat>(stmt);
+    if (node->factor() && !expr(node->factor())) {
+      return false;
+    }
+    auto left = layout_.array(node->left()->value());
+    auto right = node->right() ? layout_.array(node->right()->value()) : left;
+    emit(Op::Mat, node->factor() ? -1 : 0,
+         layout_.array(node->target()->value()), right,
+         static_cast<int32_t>(node->op()), left);
+    return true;
+  }
+  if (type == typeid(Sort)) {
+    emit(Op::Sort, 0,
+         layout_.array(
+             std::static_pointer_cast<Sort>(stmt)->variant()->value()));
+    return true;
+  }
+  return false;
+}
+
+#if ENGINE_BYTECODE_THREADED
+#define HANDLER(name) \
+  case Op::name:      \
+  L_##name:
+#define DISPATCH()            \
+  do {                        \
+    if constexpr (Threaded) { \
+      goto* ip->handler;      \
+    } else {                  \
+      goto dispatch;          \
+    }                         \
+  } while (0)
+#else
+#define HANDLER(name) case Op::name:
+#define DISPATCH() goto dispatch
+#endif
+#define NEXT()  \
+  do {          \
+    ++ip;       \
+    DISPATCH(); \
+  } while (0)
+
+// Runs `code` from `ip` and returns the instruction it stopped at. RETURN
+// finds its line in `starts`, whose last entry is the final End. With
+// `thread` set, fills in the handler addresses instead.
+template <bool Threaded>
+const Instr* interpret(const Instr* code, const int32_t* starts,
+                       size_t lines, const Instr* ip, Frame& f, int64_t* sp,
+                       Vec<Instr>* thread) {
+#if ENGINE_BYTECODE_THREADED
+  // In the order of Op
+  static const void* const labels[] = {
+      &&L_PushConst,
+      &&L_PushSlot,
+      &&L_Neg,
+      &&L_Add,
+      &&L_Sub,
+      &&L_Mul,
+      &&L_Div,
+      &&L_Pow,
+      &&L_Less,
+      &&L_Greater,
+      &&L_Equal,
+      &&L_AddConst,
+      &&L_SubConst,
+      &&L_MulConst,
+      &&L_DivConst,
+      &&L_Store,
+      &&L_AddSlotConst,
+      &&L_Print,
+      &&L_Input,
+      &&L_Jump,
+      &&L_JumpIfTrue,
+      &&L_JumpIfLessSlotConst,
+      &&L_JumpIfGreaterSlotConst,
+      &&L_JumpIfEqualSlotConst,
+      &&L_JumpIfLessSlotSlot,
+      &&L_JumpIfGreaterSlotSlot,
+      &&L_JumpIfEqualSlotSlot,
+      &&L_For,
+      &&L_Next,
+      &&L_Gosub,
+      &&L_Return,
+      &&L_Dim,
+      &&L_LoadElement,
+      &&L_LoadElementUnchecked,
+      &&L_StoreElement,
+      &&L_StoreElementUnchecked,
+      &&L_Mat,
+      &&L_Sort,
+      &&L_Reduce,
+      &&L_Check,
+      &&L_Profile,
+      &&L_End,
+  };
+  static_assert(std::size(labels) == static_cast<size_t>(Op::End) + 1);
+  if (thread != nullptr) {
+    for (auto& instr : *thread) {
+      instr.handler = labels[static_cast<size_t>(instr.op)];
+    }
+    return nullptr;
+  }
+#endif
+  DISPATCH();
+
+  // Only the switch instantiation jumps back here
+#if ENGINE_BYTECODE_THREADED
+dispatch:
+  __attribute__((unused));
+#else
+dispatch:
+#endif
+  switch (ip->op) {
+    HANDLER(PushConst) {
+      *sp++ = ip->value;
+      NEXT();
+    }
+    HANDLER(PushSlot) {
+      *sp++ = f.slots[ip->slot];
+      NEXT();
+    }
+    HANDLER(Neg) {
+      sp[-1] = -sp[-1];
+      NEXT();
+    }
+    HANDLER(Add) {
+      --sp;
+      sp[-1] += sp[0];
+      NEXT();
+    }
+    HANDLER(Sub) {
+      --sp;
+      sp[-1] -= sp[0];
+      NEXT();
+    }
+    HANDLER(Mul) {
+      --sp;
+      sp[-1] *= sp[0];
+      NEXT();
+    }
+    HANDLER(Div) {
+      --sp;
+      sp[-1] /= sp[0];
+      NEXT();
+    }
+    HANDLER(Pow) {
+      --sp;
+      sp[-1] = static_cast<int64_t>(pow(sp[-1], sp[0]));
+      NEXT();
+    }
+    HANDLER(Less) {
+      --sp;
+      sp[-1] = sp[-1] < sp[0];
+      NEXT();
+    }
+    HANDLER(Greater) {
+      --sp;
+      sp[-1] = sp[-1] > sp[0];
+      NEXT();
+    }
+    HANDLER(Equal) {
+      --sp;
+      sp[-1] = sp[-1] == sp[0];
+      NEXT();
+    }
+    HANDLER(AddConst) {
+      sp[-1] += ip->value;
+      NEXT();
+    }
+    HANDLER(SubConst) {
+      sp[-1] -= ip->value;
+      NEXT();
+    }
+    HANDLER(MulConst) {
+      sp[-1] *= ip->value;
+      NEXT();
+    }
+    HANDLER(DivConst) {
+      sp[-1] /= ip->value;
+      NEXT();
+    }
+    HANDLER(Store) {
+      f.slots[ip->slot] = *--sp;
+      f.defined[ip->slot] = 1;
+      NEXT();
+    }
+    HANDLER(AddSlotConst) {
+      f.slots[ip->slot] += ip->value;
+      f.defined[ip->slot] = 1;
+      NEXT();
+    }
+    HANDLER(Print) {
+      f.output->append(std::to_string(*--sp));
+      f.output->push_back('\n');
+      NEXT();
+    }
+    HANDLER(Input) {
+      f.input_slot = ip->slot;
+      f.output->append("INPUT " + (*f.names)[ip->slot] + "\n");
+      f.resume = ip->target;
+      return ip;
+    }
+    HANDLER(Jump) {
+      ip = code + ip->target;
+      DISPATCH();
+    }
+    HANDLER(JumpIfTrue) {
+      ip = *--sp != 0 ? code + ip->target : ip + 1;
+      DISPATCH();
+    }
+    HANDLER(JumpIfLessSlotConst) {
+      ip = f.slots[ip->slot] < ip->value ? code + ip->target : ip + 1;
+      DISPATCH();
+    }
+    HANDLER(JumpIfGreaterSlotConst) {
+      ip = f.slots[ip->slot] > ip->value ? code + ip->target : ip + 1;
+      DISPATCH();
+    }
+    HANDLER(JumpIfEqualSlotConst) {
+      ip = f.slots[ip->slot] == ip->value ? code + ip->target : ip + 1;
+      DISPATCH();
+    }
+    HANDLER(JumpIfLessSlotSlot) {
+      auto a = f.slots[ip->slot];
+      ip = a < f.slots[ip->other] ? code + ip->target : ip + 1;
+      DISPATCH();
+    }
+    HANDLER(JumpIfGreaterSlotSlot) {
+      auto a = f.slots[ip->slot];
+      ip = a > f.slots[ip->other] ? code + ip->target : ip + 1;
+      DISPATCH();
+    }
+    HANDLER(JumpIfEqualSlotSlot) {
+      auto a = f.slots[ip->slot];
+      ip = a == f.slots[ip->other] ? code + ip->target : ip + 1;
+      DISPATCH();
+    }
+    HANDLER(For) {
+      sp -= 3;
+      f.slots[ip->slot] = sp[0];
+      f.defined[ip->slot] = 1;
+      if (!f.push_loop(SlotLoop{ip->slot, ip->target, sp[1], sp[2]})) {
+        f.output->append("ERROR: FOR loops nested too deeply\n");
+        return ip;
+      }
+      NEXT();
+    }
+    HANDLER(Next) {
+      if (f.loop_depth == 0) {
+        return ip;
+      }
+      const auto& loop = f.loops[f.loop_depth - 1];
+      if (loop.slot != ip->slot ||
+          loop.body != static_cast<int32_t>(ip->other)) {
+        return ip;
+      }
+      auto value = f.slots[ip->slot] + loop.step;
+      f.slots[ip->slot] = value;
+      f.defined[ip->slot] = 1;
+      if (loop.step >= 0 ? value <= loop.limit : value >= loop.limit) {
+        ip = code + ip->target;
+        DISPATCH();
+      }
+      --f.loop_depth;
+      NEXT();
+    }
+    HANDLER(Gosub) {
+      if (!f.call(static_cast<int32_t>(ip->other))) {
+        f.call_overflow();
+        return ip;
+      }
+      ip = code + ip->target;
+      DISPATCH();
+    }
+    HANDLER(Return) {
+      if (f.call_depth == 0) {
+        f.output->append("ERROR: RETURN without GOSUB\n");
+        return ip;
+      }
+      auto line = f.returns[--f.call_depth];
+      ip = code + starts[line == Program::kEnd ? lines : line];
+      DISPATCH();
+    }
+    HANDLER(Dim) {
+      sp -= ip->other;
+      if (!f.dim(ip->slot, sp, ip->other)) {
+        return ip;
+      }
+      NEXT();
+    }
+    HANDLER(LoadElement) {
+      sp -= ip->other;
+      const auto* element = f.element(ip->slot, sp, ip->other);
+      if (element == nullptr) {
+        return ip;
+      }
+      *sp++ = *element;
+      NEXT();
+    }
+    HANDLER(LoadElementUnchecked) {
+      sp -= ip->other;
+      auto value = *f.element_unchecked(ip->slot, sp, ip->other);
+      *sp++ = value;
+      NEXT();
+    }
+    HANDLER(StoreElement) {
+      sp -= ip->other + 1;
+      auto* element = f.element(ip->slot, sp, ip->other);
+      if (element == nullptr) {
+        return ip;
+      }
+      *element = sp[ip->other];
+      NEXT();
+    }
+    HANDLER(StoreElementUnchecked) {
+      sp -= ip->other + 1;
+      *f.element_unchecked(ip->slot, sp, ip->other) = sp[ip->other];
+      NEXT();
+    }
+    HANDLER(Mat) {
+      auto op = static_cast<parser::MatOp>(ip->target);
+      auto factor = op == parser::MatOp::Scale ? *--sp : 0;
+      if (!f.mat(op, ip->slot, ip->other, static_cast<uint32_t>(ip->value),
+                 factor)) {
+        return ip;
+      }
+      NEXT();
+    }
+    HANDLER(Sort) {
+      if (!f.sort(ip->slot)) {
+        return ip;
+      }
+      NEXT();
+    }
+    HANDLER(Reduce) {
+      auto value =
+          f.reduce(static_cast<parser::Reduction>(ip->other), ip->slot);
+      if (f.failed) {
+        return ip;
+      }
+      *sp++ = value;
+      NEXT();
+    }
+    HANDLER(Check) {
+      f.read(ip->slot);
+      NEXT();
+    }
+    HANDLER(Profile) {
+      if (--f.loop_counters[ip->slot] <= 0) {
+        return ip;
+      }
+      NEXT();
+    }
+    HANDLER(End) { return ip; }
+  }
+  return ip;
+}
+
+#undef NEXT
+#undef DISPATCH
+#undef HANDLER
+
+}  // namespace
+
+Rc<Program> Program::compile(Layout layout, bool profile) {
+  auto program = std::make_shared<Program>(std::move(layout));
+  auto& lines = program->layout_.lines();
+  auto& code = program->code_;
+  auto compiler = Compiler(code, program->layout_);
+  program->profiled_ = profile;
+
+  auto bodies = loop_bodies(program->layout_);
+  auto headers = Vec<uint8_t>(lines.size());
+  if (profile) {
+    for (size_t i{}; i < lines.size(); ++i) {
+      auto target = bodies[i] != kEnd
+                        ? bodies[i]
+                        : jump_target(lines[i]->stmt(), program->layout_);
+      if (target != kEnd && static_cast<size_t>(target) <= i) {
+        headers[target] = 1;
+      }
+    }
+  }
+
+  program->line_start_.reserve(lines.size() + 1);
+  for (size_t i{}; i < lines.size(); ++i) {
+    program->line_start_.push_back(static_cast<int32_t>(code.size()));
+    if (headers[i]) {
+      code.push_back(Instr{nullptr, Op::Profile,
+                           static_cast<uint32_t>(program->loop_count_++)});
+    }
+    auto next = i + 1 < lines.size() ? static_cast<int32_t>(i + 1) : kEnd;
+    program->layout_.set_line(static_cast<int32_t>(i));
+    if (!compiler.stmt(lines[i]->stmt(), next, bodies[i])) {
+      return nullptr;
+    }
+  }
+  // Falling off the last line and jumping to a missing line both end here
+  auto end = static_cast<int32_t>(code.size());
+  program->line_start_.push_back(end);
+  code.push_back(Instr{nullptr, Op::End});
+  program->max_stack_ = compiler.max_depth();
+
+  // Jumps were emitted with line indices; code is addressed by instruction
+  for (auto& instr : code) {
+    if (is_jump(instr.op)) {
+      instr.target =
+          instr.target == kEnd ? end : program->line_start_[instr.target];
+    }
+  }
+
+#if ENGINE_BYTECODE_THREADED
+  auto unused = Frame{};
+  interpret<true>(nullptr, nullptr, 0, nullptr, unused, nullptr, &code);
+#endif
+  return program;
+}
+
+UIBehavior Program::run(int32_t& pc, Frame& frame, Dispatch dispatch) const {
+  if (pc < 0 || static_cast<size_t>(pc) >= line_start_.size()) {
+    pc = kEnd;
+    return UIBehavior::FinishRun;
+  }
+
+  auto counters = Vec<int64_t>(
+      loop_count_, frame.sample_period > 0
+                       ? frame.sample_period
+                       : std::numeric_limits<int64_t>::max());
+  frame.loop_counters = counters.data();
+  auto ip = line_start_[pc];
+  const auto* stop = &execute(ip, frame, dispatch);
+  while (stop->op == Op::Next && (ip = next(*stop, frame)) >= 0) {
+    stop = &execute(ip, frame, dispatch);
+  }
+  if (stop->op == Op::Profile) {
+    // Resuming runs the header line again, Profile included
+    ip = static_cast<int32_t>(stop - code_.data());
+    pc = static_cast<int32_t>(
+        std::upper_bound(line_start_.begin(), line_start_.end(), ip) -
+        line_start_.begin() - 1);
+    return UIBehavior::None;
+  }
+  if (stop->op == Op::Input) {
+    pc = frame.resume;
+    return UIBehavior::Input;
+  }
+  pc = kEnd;
+  return UIBehavior::FinishRun;
+}
+
+int32_t Program::next(const Instr& instr, Frame& frame) const {
+  auto* loop = frame.find_loop(instr.slot);
+  if (loop == nullptr) {
+    frame.output->append("ERROR: NEXT " + (*frame.names)[instr.slot] +
+                         " without FOR\n");
+    return -1;
+  }
+  auto value = frame.slots[instr.slot] + loop->step;
+  frame.slots[instr.slot] = value;
+  frame.defined[instr.slot] = 1;
+  if (loop->step >= 0 ? value <= loop->limit : value >= loop->limit) {
+    return loop->body == kEnd ? line_start_.back() : line_start_[loop->body];
+  }
+  --frame.loop_depth;
+  return static_cast<int32_t>(&instr - code_.data()) + 1;
+}
+
+const Instr& Program::execute(int32_t ip, Frame& frame,
+                              Dispatch dispatch) const {
+  auto stack = Vec<int64_t>(max_stack_ + 1);
+  const auto* code = code_.data();
+  const auto* starts = line_start_.data();
+  auto lines = line_start_.size() - 1;
+#if ENGINE_BYTECODE_THREADED
+  if (dispatch == Dispatch::Threaded) {
+    return *interpret<true>(code, starts, lines, code + ip, frame,
+                            stack.data(), nullptr);
+  }
+#endif
+  return *interpret<false>(code, starts, lines, code + ip, frame,
+                           stack.data(), nullptr);
+}
+
+}  // namespace engine::bytecode
@@ -0,0 +1,490 @@
+#include "closure.h"
+
+#include <cmath>
+
+namespace engine::closure {
+namespace {
+
+using namespace parser::ast_node;
+
+struct Add {
+  int64_t operator()(int64_t a, int64_t b) const { return a + b; }
+};
+struct Sub {
+  int64_t operator()(int64_t a, int64_t b) const { return a - b; }
+};
+struct Mul {
+  int64_t operator()(int64_t a, int64_t b) const { return a * b; }
+};
+struct Div {
+  int64_t operator()(int64_t a, int64_t b) const { return a / b; }
+};
+struct Pow {
+  int64_t operator()(int64_t a, int64_t b) const {
+    return static_cast<int64_t>(pow(a, b));
+  }
+};
+struct Less {
+  int64_t operator()(int64_t a, int64_t b) const { return a < b; }
+};
+struct Greater {
+  int64_t operator()(int64_t a, int64_t b) const { return a > b; }
+};
+struct Equal {
+  int64_t operator()(int64_t a, int64_t b) const { return a == b; }
+};
+
+// Operand shapes worth specializing on. Slot operands are reads proven to
+// follow an assignment, so they load the slot without the unknown-variable
+// check
+struct Operand {
+  enum class Kind { Slot, Constant, Other } kind;
+  uint32_t slot;
+  int64_t value;
+};
+
+Operand classify(const Rc<Expr>& expr, Layout& layout) {
+  if (typeid(*expr) == typeid(VariantExpr)) {
+    auto name = std::static_pointer_cast<VariantExpr>(expr)->variant()->value();
+    if (!layout.checked(name)) {
+      return {Operand::Kind::Slot, layout.slot(name), 0};
+    }
+  }
+  if (typeid(*expr) == typeid(IntegerExpr)) {
+    auto value = std::static_pointer_cast<IntegerExpr>(expr)->integer()->value();
+    return {Operand::Kind::Constant, 0, value};
+  }
+  return {Operand::Kind::Other, 0, 0};
+}
+
+ExprFn compile_expr(const Rc<Expr>& expr, Layout& layout);
+
+// Element reads. Accesses the analysis proves in range index the array
+// directly; the rest go through Frame::element, which reads 0 on failure.
+ExprFn compile_element(const Rc<ArrayExpr>& access, Layout& layout) {
+  auto slot = layout.array(access->variant()->value());
+  auto rank = access->indices().size();
+  auto i = compile_expr(access->indices()[0], layout);
+  auto j = rank > 1 ? compile_expr(access->indices()[1], layout) : nullptr;
+  if (!layout.checked(*access)) {
+    if (rank == 1) {
+      return [slot, i](Frame& f) { return f.arrays[slot].data[i(f)]; };
+    }
+    return [slot, i, j](Frame& f) {
+      auto row = i(f);
+      const auto& array = f.arrays[slot];
+      return array.data[row * array.columns + j(f)];
+    };
+  }
+  return [slot, i, j, rank](Frame& f) {
+    int64_t at[parser::Array::kMaxRank]{i(f), j ? j(f) : 0};
+    const auto* element = f.element(slot, at, rank);
+    return element == nullptr ? 0 : *element;
+  };
+}
+
+template <typename Op>
+ExprFn binary(const Rc<Expr>& left, const Rc<Expr>& right, Layout& layout) {
+  using Kind = Operand::Kind;
+  auto l = classify(left, layout);
+  auto r = classify(right, layout);
+
+  if (l.kind == Kind::Slot && r.kind == Kind::Constant) {
+    return [a = l.slot, c = r.value](Frame& f) { return Op{}(f.slots[a], c); };
+  }
+  if (l.kind == Kind::Slot && r.kind == Kind::Slot) {
+    return [a = l.slot, b = r.slot](Frame& f) {
+      auto x = f.slots[a];
+      return Op{}(x, f.slots[b]);
+    };
+  }
+  if (l.kind == Kind::Constant && r.kind == Kind::Slot) {
+    return [c = l.value, b = r.slot](Frame& f) { return Op{}(c, f.slots[b]); };
+  }
+  if (r.kind == Kind::Constant) {
+    return [e = compile_expr(left, layout), c = r.value](Frame& f) {
+      return Op{}(e(f), c);
+    };
+  }
+  return [el = compile_expr(left, layout),
+          er = compile_expr(right, layout)](Frame& f) {
+    auto x = el(f);
+    return Op{}(x, er(f));
+  };
+}
+
+ExprFn compile_expr(const Rc<Expr>& expr, Layout& layout) {
+  auto operand = classify(expr, layout);
+  if (operand.kind == Operand::Kind::Slot) {
+    return [a = operand.slot](Frame& f) { return f.slots[a]; };
+  }
+  if (typeid(*expr) == typeid(VariantExpr)) {
+    auto name = std::static_pointer_cast<VariantExpr>(expr)->variant()->value();
+    return [a = layout.slot(name)](Frame& f) { return f.read(a); };
+  }
+  if (operand.kind == Operand::Kind::Constant) {
+    return [c = operand.value](Frame&) { return c; };
+  }
+
+  const auto& type = typeid(*expr);
+  if (type == typeid(NegExpr)) {
+    return [e = compile_expr(std::static_pointer_cast<NegExpr>(expr)->expr(),
+                             layout)](Frame& f) { return -e(f); };
+  }
+  if (type == typeid(PosExpr)) {
+    return compile_expr(std::static_pointer_cast<PosExpr>(expr)->expr(),
+                        layout);
+  }
+  if (type == typeid(ArrayExpr)) {
+    return compile_element(std::static_pointer_cast<ArrayExpr>(expr), layout);
+  }
+  if (type == typeid(ReduceExpr)) {
+    auto node = std::static_pointer_cast<ReduceExpr>(expr);
+    return [slot = layout.array(node->variant()->value()),
+            reduction = node->reduction()](Frame& f) {
+      return f.reduce(reduction, slot);
+    };
+  }
+#define BINARY(Node, Op)                                                      \
+  if (type == typeid(Node)) {                                                 \
+    auto node = std::static_pointer_cast<Node>(expr);                         \
+    return binary<Op>(node->left(), node->right(), layout);                   \
+  }
+  BINARY(PlusExpr, Add)
+  BINARY(MinusExpr, Sub)
+  BINARY(MultiplyExpr, Mul)
+  BINARY(DivideExpr, Div)
+  BINARY(PowerExpr, Pow)
+  BINARY(LessExpr, Less)
+  BINARY(GreaterExpr, Greater)
+  BINARY(EqualExpr, Equal)
+#undef BINARY
+  return nullptr;
+}
+
+// IF on a comparison of slots and constants branches without an inner call
+template <typename Op>
+StmtFn branch(const Rc<Expr>& left, const Rc<Expr>& right, int32_t target,
+              int32_t next, Layout& layout) {
+  using Kind = Operand::Kind;
+  auto l = classify(left, layout);
+  auto r = classify(right, layout);
+
+  if (l.kind == Kind::Slot && r.kind == Kind::Constant) {
+    return [a = l.slot, c = r.value, target, next](Frame& f) {
+      return Op{}(f.slots[a], c) ? target : next;
+    };
+  }
+  if (l.kind == Kind::Slot && r.kind == Kind::Slot) {
+    return [a = l.slot, b = r.slot, target, next](Frame& f) {
+      auto x = f.slots[a];
+      return Op{}(x, f.slots[b]) ? target : next;
+    };
+  }
+  return nullptr;
+}
+
+StmtFn compile_if(const Rc<If>& node, int32_t target, int32_t next,
+                  Layout& layout) {
+  auto expr = node->expr();
+  const auto& type = typeid(*expr);
+  StmtFn fn;
+  if (type == typeid(LessExpr)) {
+    auto e = std::static_pointer_cast<LessExpr>(expr);
+    fn = branch<Less>(e->left(), e->right(), target, next, layout);
+  } else if (type == typeid(GreaterExpr)) {
+    auto e = std::static_pointer_cast<GreaterExpr>(expr);
+    fn = branch<Greater>(e->left(), e->right(), target, next, layout);
+  } else if (type == typeid(EqualExpr)) {
+    auto e = std::static_pointer_cast<EqualExpr>(expr);
+    fn = branch<Equal>(e->left(), e->right(), target, next, layout);
+  }
+  if (fn) {
+    return fn;
+  }
+  return [e = compile_expr(expr, layout), target, next](Frame& f) {
+    auto value = e(f);
+    if (f.failed) {
+      return Program::kEnd;
+    }
+    return value != 0 ? target : next;
+  };
+}
+
+StmtFn compile_let(const Rc<Let>& node, int32_t next, Layout& layout) {
+  auto slot = layout.slot(node->variant()->value());
+  auto expr = node->expr();
+
+  // LET x = x + c
+  if (typeid(*expr) == typeid(PlusExpr)) {
+    auto plus = std::static_pointer_cast<PlusExpr>(expr);
+    auto l = classify(plus->left(), layout);
+    auto r = classify(plus->right(), layout);
+    if (l.kind == Operand::Kind::Slot && l.slot == slot &&
+        r.kind == Operand::Kind::Constant) {
+      return [slot, c = r.value, next](Frame& f) {
+        f.slots[slot] += c;
+        f.defined[slot] = 1;
+        return next;
+      };
+    }
+  }
+
+  return [slot, e = compile_expr(expr, layout), next](Frame& f) {
+    auto value = e(f);
+    if (f.failed) {
+      return Program::kEnd;
+    }
+    f.slots[slot] = value;
+    f.defined[slot] = 1;
+    return next;
+  };
+}
+
+StmtFn compile_for(const Rc<For>& node, int32_t next, Layout& layout) {
+  auto slot = layout.slot(node->variant()->value());
+  auto start = compile_expr(node->start(), layout);
+  auto limit = compile_expr(node->limit(), layout);
+  auto step = node->step() ? compile_expr(node->step(), layout)
+                           : [](Frame&) { return int64_t{1}; };
+  return [slot, start, limit, step, next](Frame& f) {
+    auto value = start(f);
+    auto bound = limit(f);
+    auto by = step(f);
+    if (f.failed) {
+      return Program::kEnd;
+    }
+    f.slots[slot] = value;
+    f.defined[slot] = 1;
+    if (!f.push_loop(SlotLoop{slot, next, bound, by})) {
+      f.output->append("ERROR: FOR loops nested too deeply\n");
+      return Program::kEnd;
+    }
+    return next;
+  };
+}
+
+// Steps, compares and branches in one call. The loop is nearly always the
+// innermost one, which is checked before searching the stack.
+StmtFn compile_next(const Rc<Next>& node, int32_t next, Layout& layout) {
+  auto name = node->variant()->value();
+  auto slot = layout.slot(name);
+  return [slot, error = "ERROR: NEXT " + name + " without FOR\n",
+          next](Frame& f) {
+    auto* loop = f.loop_depth > 0 && f.loops[f.loop_depth - 1].slot == slot
+                     ? &f.loops[f.loop_depth - 1]
+                     : f.find_loop(slot);
+    if (loop == nullptr) {
+      f.output->append(error);
+      return Program::kEnd;
+    }
+    auto value = f.slots[slot] + loop->step;
+    f.slots[slot] = value;
+    f.defined[slot] = 1;
+    if (loop->step >= 0 ? value <= loop->limit : value >= loop->limit) {
+      return loop->body;
+    }
+    --f.loop_depth;
+    return next;
+  };
+}
+
+StmtFn compile_dim(const Rc<Dim>& node, int32_t next, Layout& layout) {
+  auto slot = layout.array(node->variant()->value());
+  auto bounds = Vec<ExprFn>();
+  for (const auto& bound : node->bounds()) {
+    bounds.push_back(compile_expr(bound, layout));
+  }
+  return [slot, bounds, next](Frame& f) {
+    int64_t at[parser::Array::kMaxRank]{};
+    for (size_t i{}; i < bounds.size(); ++i) {
+      at[i] = bounds[i](f);
+    }
+    if (f.failed || !f.dim(slot, at, bounds.size())) {
+      return Program::kEnd;
+    }
+    return next;
+  };
+}
+
+// Indices, then the value, then the bounds check, as the tree walker does
+StmtFn compile_let_element(const Rc<LetElement>& node, int32_t next,
+                           Layout& layout) {
+  auto access = node->element();
+  auto slot = layout.array(access->variant()->value());
+  auto rank = access->indices().size();
+  auto i = compile_expr(access->indices()[0], layout);
+  auto j = rank > 1 ? compile_expr(access->indices()[1], layout) : nullptr;
+  auto e = compile_expr(node->expr(), layout);
+  if (!layout.checked(*access) && rank == 1) {
+    return [slot, i, e, next](Frame& f) {
+      auto at = i(f);
+      auto value = e(f);
+      if (f.failed) {
+        return Program::kEnd;
+      }
+      f.arrays[slot].data[at] = value;
+      return next;
+    };
+  }
+  return [slot, i, j, e, rank, checked = layout.checked(*access),
+          next](Frame& f) {
+    int64_t at[parser::Array::kMaxRank]{i(f), j ? j(f) : 0};
+    auto value = e(f);
+    auto* element = checked ? f.element(slot, at, rank)
+                            : f.element_unchecked(slot, at, rank);
+    if (f.failed) {
+      return Program::kEnd;
+    }
+    *element = value;
+    return next;
+  };
+}
+
+// The factor first, then the operands' checks, as the tree walker does
+StmtFn compile_mat(const Rc<Mat>& node, int32_t next, Layout& layout) {
+  auto target = layout.array(node->target()->value());
+  auto left = layout.array(node->left()->value());
+  auto right = node->right() ? layout.array(node->right()->value()) : left;
+  auto factor = node->factor() ? compile_expr(node->factor(), layout)
+                               : [](Frame&) { return int64_t{}; };
+  return [op = node->op(), target, left, right, factor, next](Frame& f) {
+    auto by = factor(f);
+    if (f.failed || !f.mat(op, target, left, right, by)) {
+      return Program::kEnd;
+    }
+    return next;
+  };
+}
+
+StmtFn compile_stmt(const Rc<Stmt>& stmt, int32_t next, Layout& layout) {
+  const auto& type = typeid(*stmt);
+  if (type == typeid(Let)) {
+    return compile_let(std::static_pointer_cast<Let>(stmt), next, layout);
+  }
+  if (type == typeid(Print)) {
+    auto e = compile_expr(std::static_pointer_cast<Print>(stmt)->expr(), layout);
+    return [e, next](Frame& f) {
+      auto value = e(f);
+      if (f.failed) {
+        return Program::kEnd;
+      }
+      f.output->append(std::to_string(value));
+      f.output->push_back('\n');
+      return next;
+    };
+  }
+  if (type == typeid(Input)) {
+    auto name = std::static_pointer_cast<Input>(stmt)->variant()->value();
+    auto slot = layout.slot(name);
+    return [slot, prompt = "INPUT " + name + "\n", next](Frame& f) {
+      f.input_slot = slot;
+      f.output->append(prompt);
+      f.resume = next;
+      return Program::kInput;
+    };
+  }
+  if (type == typeid(Goto)) {
+    auto target = layout.index_of(
+        std::static_pointer_cast<Goto>(stmt)->number()->value());
+    return [target](Frame&) { return target; };
+  }
+  if (type == typeid(If)) {
+    auto node = std::static_pointer_cast<If>(stmt);
+    auto target = layout.index_of(node->number()->value());
+    return compile_if(node, target, next, layout);
+  }
+  if (type == typeid(End)) {
+    return [](Frame&) { return Program::kEnd; };
+  }
+  if (type == typeid(For)) {
+    return compile_for(std::static_pointer_cast<For>(stmt), next, layout);
+  }
+  if (type == typeid(Next)) {
+    return compile_next(std::static_pointer_cast<Next>(stmt), next, layout);
+  }
+  if (type == typeid(Gosub)) {
+    auto target = layout.index_of(
+        std::static_pointer_cast<Gosub>(stmt)->number()->value());
+    return [target, next](Frame& f) {
+      if (!f.call(next)) {
+        f.call_overflow();
+        return Program::kEnd;
+      }
+      return target;
+    };
+  }
+  if (type == typeid(Return)) {
+    return [](Frame& f) {
+      if (f.call_depth == 0) {
+        f.output->append("ERROR: RETURN without GOSUB\n");
+        return Program::kEnd;
+      }
+      return f.returns[--f.call_depth];
+    };
+  }
+  if (type == typeid(Rem)) {
+    return [next](Frame&) { return next; };
+  }
+  if (type == typeid(Dim)) {
+    return compile_dim(std::static_pointer_cast<Dim>(stmt), next, layout);
+  }
+  if (type == typeid(LetElement)) {
+    return compile_let_element(std::static_pointer_cast<LetElement>(stmt),
+                               next, layout);
+  }
+  if (type == typeid(Mat)) {
+    return compile_mat(std::static_pointer_cast<Mat>(stmt), next, layout);
+  }
+  if (type == typeid(Sort)) {
+    auto slot =
+        layout.array(std::static_pointer_cast<Sort>(stmt)->variant()->value());
+    return [slot, next](Frame& f) {
+      return f.sort(slot) ? next : Program::kEnd;
+    };
+  }
+  return nullptr;
+}
+
+}  // namespace
+
+Rc<Program> Program::compile(Layout layout) {
+  auto program = std::make_shared<Program>(std::move(layout));
+  auto& lines = program->layout_.lines();
+  program->code_.reserve(lines.size());
+  for (size_t i{}; i < lines.size(); ++i) {
+    auto next = i + 1 < lines.size() ? static_cast<int32_t>(i + 1) : kEnd;
+    program->layout_.set_line(static_cast<int32_t>(i));
+    auto fn = compile_stmt(lines[i]->stmt(), next, program->layout_);
+    if (!fn) {
+      return nullptr;
+    }
+    program->code_.push_back(std::move(fn));
+  }
+  return program;
+}
+
+UIBehavior Program::run(int32_t& pc, Frame& frame) const {
+  const auto* code = code_.data();
+  if (frame.sample_period > 0) {
+    auto countdown = frame.sample_period;
+    while (pc >= 0) {
+      auto next = code[pc](frame);
+      if (0 <= next && next <= pc && --countdown == 0) {
+        pc = next;
+        return UIBehavior::None;
+      }
+      pc = next;
+    }
+  }
+  while (pc >= 0) {
+    pc = code[pc](frame);
+  }
+  if (pc == kInput) {
+    pc = frame.resume;
+    return UIBehavior::Input;
+  }
+  return UIBehavior::FinishRun;
+}
+
+}  // namespace engine::closure
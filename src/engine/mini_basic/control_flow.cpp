@@ -0,0 +1,166 @@
+#include "control_flow.h"
+
+#include <queue>
+#include <set>
+
+namespace engine {
+
+using namespace parser::ast_node;
+
+ControlFlow::ControlFlow(const FlatMap<int64_t, Rc<LineNoStmt>>& ast) : ast_(ast) {
+  if (ast_.empty()) {
+    return;
+  }
+  for (const auto& [line, node] : ast_) {
+    auto stmt = node->stmt();
+    if (typeid(*stmt) == typeid(For)) {
+      if (auto body = next(line); body != kNoLine) {
+        loop_bodies_[std::static_pointer_cast<For>(stmt)->variant()->value()]
+            .push_back(body);
+      }
+    } else if (typeid(*stmt) == typeid(Gosub)) {
+      if (auto back = next(line); back != kNoLine) {
+        return_sites_.push_back(back);
+      }
+    }
+  }
+
+  // Everything a run starting at the first line can get to
+  std::set<int64_t> seen;
+  std::queue<int64_t> pending;
+  pending.push(ast_.begin()->first);
+  seen.insert(ast_.begin()->first);
+  while (!pending.empty()) {
+    auto line = pending.front();
+    pending.pop();
+    for (auto successor : successors(line)) {
+      if (seen.insert(successor).second) {
+        pending.push(successor);
+      }
+    }
+  }
+
+  for (const auto& [line, node] : ast_) {
+    auto prefix = "line " + std::to_string(line) + ": ";
+    if (!seen.count(line)) {
+      diagnostics_.push_back(prefix + "unreachable");
+      continue;
+    }
+
+    auto stmt = node->stmt();
+    auto to = target(stmt);
+    if (to == kNoLine) {
+      program_.insert(std::make_pair(line, node));
+      continue;
+    }
+    auto forwarded = forward(to);
+    if (!ast_.count(to)) {
+      diagnostics_.push_back(prefix + "jumps to missing line " +
+                             std::to_string(to));
+    } else if (chase(to).second) {
+      diagnostics_.push_back(prefix + "jumps into a GOTO loop at line " +
+                             std::to_string(to));
+    }
+    if (forwarded == to) {
+      program_.insert(std::make_pair(line, node));
+      continue;
+    }
+
+    diagnostics_.push_back(prefix + "jump to " + std::to_string(to) +
+                           " forwarded to " + std::to_string(forwarded));
+    auto number = std::make_shared<tokenizer::token::Integer>(forwarded);
+    Rc<Stmt> retargeted;
+    if (typeid(*stmt) == typeid(Goto)) {
+      retargeted =
+          std::make_shared<Goto>(*std::static_pointer_cast<Goto>(stmt), number);
+    } else if (typeid(*stmt) == typeid(Gosub)) {
+      retargeted = std::make_shared<Gosub>(
+          *std::static_pointer_cast<Gosub>(stmt), number);
+    } else {
+      retargeted =
+          std::make_shared<If>(*std::static_pointer_cast<If>(stmt), number);
+    }
+    program_.insert(std::make_pair(
+        line, std::make_shared<LineNoStmt>(node->number(), retargeted)));
+  }
+}
+
+int64_t ControlFlow::next(int64_t line) const {
+  auto at = ast_.upper_bound(line);
+  return at == ast_.end() ? kNoLine : at->first;
+}
+
+int64_t ControlFlow::target(const Rc<Stmt>& stmt) {
+  if (typeid(*stmt) == typeid(Goto)) {
+    return std::static_pointer_cast<Goto>(stmt)->number()->value();
+  }
+  if (typeid(*stmt) == typeid(If)) {
+    return std::static_pointer_cast<If>(stmt)->number()->value();
+  }
+  if (typeid(*stmt) == typeid(Gosub)) {
+    return std::static_pointer_cast<Gosub>(stmt)->number()->value();
+  }
+  return kNoLine;
+}
+
+std::pair<int64_t, bool> ControlFlow::chase(int64_t line) const {
+  std::set<int64_t> visited;
+  auto current = line;
+  while (true) {
+    auto at = ast_.find(current);
+    if (at == ast_.end()) {
+      return {kNoLine, false};
+    }
+    if (!visited.insert(current).second) {
+      return {kNoLine, true};
+    }
+    const auto& type = typeid(*at->second->stmt());
+    if (type == typeid(Rem)) {
+      current = next(current);
+    } else if (type == typeid(Goto)) {
+      current = target(at->second->stmt());
+    } else {
+      return {current, false};
+    }
+  }
+}
+
+int64_t ControlFlow::forward(int64_t line) const {
+  auto to = chase(line).first;
+  return to == kNoLine ? line : to;
+}
+
+Vec<int64_t> ControlFlow::successors(int64_t line) const {
+  auto at = ast_.find(line);
+  if (at == ast_.end()) {
+    return {};
+  }
+  auto stmt = at->second->stmt();
+  auto successors = Vec<int64_t>();
+  const auto& type = typeid(*stmt);
+  // The line after a GOSUB runs when a RETURN comes back to it
+  if (type != typeid(Goto) && type != typeid(End) && type != typeid(Gosub) &&
+      type != typeid(Return)) {
+    if (auto n = next(line); n != kNoLine) {
+      successors.push_back(n);
+    }
+  }
+  if (auto to = target(stmt); to != kNoLine && ast_.count(to)) {
+    successors.push_back(forward(to));
+  }
+  if (type == typeid(Next)) {
+    auto bodies = loop_bodies_.find(
+        std::static_pointer_cast<Next>(stmt)->variant()->value());
+    if (bodies != loop_bodies_.end()) {
+      successors.insert(successors.end(), bodies->second.begin(),
+                        bodies->second.end());
+    }
+  }
+  if (type == typeid(Return)) {
+    successors.insert(successors.end(), return_sites_.begin(),
+                      return_sites_.end());
+  }
+  return successors;
+}
+
+}  // namespace engine
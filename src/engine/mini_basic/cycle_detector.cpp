@@ -0,0 +1,64 @@
+#include "cycle_detector.h"
+
+#include "parse_cache.h"
+
+namespace engine {
+
+void CycleDetector::reset() {
+  saved_ = false;
+  saved_variants_.clear();
+  saved_state_ = {};
+  power_ = 1;
+  samples_ = 0;
+}
+
+uint64_t CycleDetector::hash(int64_t line, const Map<Str, int64_t>& variants,
+                             const parser::RunState& state) {
+  // FNV-1a over the line, every variable, loop, return address and element
+  auto h = kFnvOffset;
+  mix_u64(h, static_cast<uint64_t>(line));
+  for (const auto& [name, value] : variants) {
+    mix_u64(h, ParseCache::hash(name));
+    mix_u64(h, static_cast<uint64_t>(value));
+  }
+  for (const auto& loop : state.loops.loops()) {
+    mix_u64(h, ParseCache::hash(loop.variant));
+    mix_u64(h, static_cast<uint64_t>(loop.limit));
+    mix_u64(h, static_cast<uint64_t>(loop.step));
+    mix_u64(h, static_cast<uint64_t>(loop.body));
+  }
+  for (auto line : state.calls.returns()) {
+    mix_u64(h, static_cast<uint64_t>(line));
+  }
+  for (const auto& [name, array] : state.arrays) {
+    mix_u64(h, ParseCache::hash(name));
+    for (auto extent : array.extents) {
+      mix_u64(h, static_cast<uint64_t>(extent));
+    }
+    for (auto value : array.values) {
+      mix_u64(h, static_cast<uint64_t>(value));
+    }
+  }
+  return h;
+}
+
+bool CycleDetector::repeats(int64_t line, const Map<Str, int64_t>& variants,
+                            const parser::RunState& state) {
+  auto h = hash(line, variants, state);
+  if (saved_ && h == saved_hash_ && line == saved_line_ &&
+      variants == saved_variants_ && state == saved_state_) {
+    return true;
+  }
+  if (!saved_ || ++samples_ == power_) {
+    saved_ = true;
+    saved_hash_ = h;
+    saved_line_ = line;
+    saved_variants_ = variants;
+    saved_state_ = state;
+    power_ *= 2;
+    samples_ = 0;
+  }
+  return false;
+}
+
+}  // namespace engine
@@ -0,0 +1,255 @@
+#include "definite_assignment.h"
+
+#include <algorithm>
+#include <queue>
+
+namespace engine {
+
+using namespace parser::ast_node;
+
+namespace {
+
+// Variables an expression reads, left to right
+void collect_reads(const Rc<Expr>& expr, Vec<Str>& reads) {
+  const auto& type = typeid(*expr);
+  if (type == typeid(VariantExpr)) {
+    reads.push_back(
+        std::static_pointer_cast<VariantExpr>(expr)->variant()->value());
+  } else if (type == typeid(NegExpr)) {
+    collect_reads(std::static_pointer_cast<NegExpr>(expr)->expr(), reads);
+  } else if (type == typeid(PosExpr)) {
+    collect_reads(std::static_pointer_cast<PosExpr>(expr)->expr(), reads);
+  } else if (type == typeid(ArrayExpr)) {
+    for (const auto& index :
+         std::static_pointer_cast<ArrayExpr>(expr)->indices()) {
+      collect_reads(index, reads);
+    }
+  }
+#define BINARY(Node)                                   \
+  else if (type == typeid(Node)) {                     \
+    auto node = std::static_pointer_cast<Node>(expr);  \
+    collect_reads(node->left(), reads);                \
+    collect_reads(node->right(), reads);               \
+  }
+  BINARY(PlusExpr)
+  BINARY(MinusExpr)
+  BINARY(MultiplyExpr)
+  BINARY(DivideExpr)
+  BINARY(PowerExpr)
+  BINARY(LessExpr)
+  BINARY(GreaterExpr)
+  BINARY(EqualExpr)
+#undef BINARY
+}
+
+Vec<Str> reads_of(const Rc<Stmt>& stmt) {
+  auto reads = Vec<Str>();
+  const auto& type = typeid(*stmt);
+  if (type == typeid(Let)) {
+    collect_reads(std::static_pointer_cast<Let>(stmt)->expr(), reads);
+  } else if (type == typeid(Print)) {
+    collect_reads(std::static_pointer_cast<Print>(stmt)->expr(), reads);
+  } else if (type == typeid(If)) {
+    collect_reads(std::static_pointer_cast<If>(stmt)->expr(), reads);
+  } else if (type == typeid(For)) {
+    auto node = std::static_pointer_cast<For>(stmt);
+    collect_reads(node->start(), reads);
+    collect_reads(node->limit(), reads);
+    if (node->step()) {
+      collect_reads(node->step(), reads);
+    }
+  } else if (type == typeid(Dim)) {
+    for (const auto& bound : std::static_pointer_cast<Dim>(stmt)->bounds()) {
+      collect_reads(bound, reads);
+    }
+  } else if (type == typeid(LetElement)) {
+    auto node = std::static_pointer_cast<LetElement>(stmt);
+    collect_reads(node->element(), reads);
+    collect_reads(node->expr(), reads);
+  } else if (type == typeid(Mat)) {
+    if (auto factor = std::static_pointer_cast<Mat>(stmt)->factor()) {
+      collect_reads(factor, reads);
+    }
+  }
+  return reads;
+}
+
+// The variable a statement assigns, empty if none
+Str write_of(const Rc<Stmt>& stmt) {
+  if (typeid(*stmt) == typeid(Let)) {
+    return std::static_pointer_cast<Let>(stmt)->variant()->value();
+  }
+  if (typeid(*stmt) == typeid(Input)) {
+    return std::static_pointer_cast<Input>(stmt)->variant()->value();
+  }
+  if (typeid(*stmt) == typeid(For)) {
+    return std::static_pointer_cast<For>(stmt)->variant()->value();
+  }
+  // A NEXT that goes on found its loop and stepped the variable
+  if (typeid(*stmt) == typeid(Next)) {
+    return std::static_pointer_cast<Next>(stmt)->variant()->value();
+  }
+  return {};
+}
+
+}  // namespace
+
+DefiniteAssignment::DefiniteAssignment(
+    const FlatMap<int64_t, Rc<LineNoStmt>>& program, int64_t entry) {
+  auto lines = Vec<int64_t>();
+  auto reads = Vec<Vec<uint32_t>>();
+  auto writes = Vec<int64_t>();
+  auto intern = [this](const Str& name) {
+    return variables_.insert(std::make_pair(name, variables_.size()))
+        .first->second;
+  };
+  for (const auto& [line, node] : program) {
+    rows_.insert(std::make_pair(line, lines.size()));
+    lines.push_back(line);
+    auto& row = reads.emplace_back();
+    for (const auto& name : reads_of(node->stmt())) {
+      row.push_back(intern(name));
+    }
+    auto write = write_of(node->stmt());
+    writes.push_back(write.empty() ? int64_t{-1} : int64_t{intern(write)});
+  }
+  if (lines.empty()) {
+    return;
+  }
+
+  // Rows a NEXT may loop back to, by variable: the one after every FOR.
+  // Rows a RETURN may go back to: the one after every GOSUB.
+  auto bodies = Map<Str, Vec<size_t>>();
+  auto returns = Vec<size_t>();
+  for (size_t row{}; row + 1 < lines.size(); ++row) {
+    auto stmt = program.at(lines[row])->stmt();
+    if (typeid(*stmt) == typeid(For)) {
+      bodies[std::static_pointer_cast<For>(stmt)->variant()->value()]
+          .push_back(row + 1);
+    } else if (typeid(*stmt) == typeid(Gosub)) {
+      returns.push_back(row + 1);
+    }
+  }
+
+  // Successors by row: the next line unless the statement always jumps or
+  // ends, the jump target when it is in the program, the loop bodies of a
+  // NEXT and the lines after the GOSUBs for a RETURN
+  auto successors = Vec<Vec<size_t>>(lines.size());
+  for (size_t row{}; row < lines.size(); ++row) {
+    auto stmt = program.at(lines[row])->stmt();
+    const auto& type = typeid(*stmt);
+    if (type != typeid(Goto) && type != typeid(End) && type != typeid(Gosub) &&
+        type != typeid(Return) && row + 1 < lines.size()) {
+      successors[row].push_back(row + 1);
+    }
+    int64_t target = -1;
+    if (type == typeid(Goto)) {
+      target = std::static_pointer_cast<Goto>(stmt)->number()->value();
+    } else if (type == typeid(If)) {
+      target = std::static_pointer_cast<If>(stmt)->number()->value();
+    } else if (type == typeid(Gosub)) {
+      target = std::static_pointer_cast<Gosub>(stmt)->number()->value();
+    }
+    if (auto to = rows_.find(target); to != rows_.end()) {
+      successors[row].push_back(to->second);
+    }
+    if (type == typeid(Next)) {
+      auto body = bodies.find(
+          std::static_pointer_cast<Next>(stmt)->variant()->value());
+      if (body != bodies.end()) {
+        successors[row].insert(successors[row].end(), body->second.begin(),
+                               body->second.end());
+      }
+    }
+    if (type == typeid(Return)) {
+      successors[row] = returns;
+    }
+  }
+
+  // Everything starts assigned except on entry to the entry line, and the
+  // intersection over predecessors only ever clears bits. Lines the entry
+  // cannot reach keep everything and so never clear anything.
+  auto start = rows_.count(entry) ? rows_.at(entry) : 0;
+  words_ = (variables_.size() + 63) / 64;
+  in_.assign(lines.size() * words_, ~uint64_t{});
+  std::fill(in_.begin() + start * words_, in_.begin() + (start + 1) * words_,
+            0);
+  auto out = Vec<uint64_t>(words_);
+  std::queue<size_t> pending;
+  auto queued = Vec<uint8_t>(lines.size(), 1);
+  for (size_t row{}; row < lines.size(); ++row) {
+    pending.push(row);
+  }
+  while (!pending.empty()) {
+    auto row = pending.front();
+    pending.pop();
+    queued[row] = 0;
+
+    std::copy(in_.begin() + row * words_, in_.begin() + (row + 1) * words_,
+              out.begin());
+    if (writes[row] >= 0) {
+      out[writes[row] / 64] |= uint64_t{1} << (writes[row] % 64);
+    }
+    for (auto successor : successors[row]) {
+      auto changed = false;
+      for (size_t w{}; w < words_; ++w) {
+        auto& word = in_[successor * words_ + w];
+        auto met = word & out[w];
+        changed |= met != word;
+        word = met;
+      }
+      if (changed && !queued[successor]) {
+        pending.push(successor);
+        queued[successor] = 1;
+      }
+    }
+  }
+
+  auto names = Vec<Str>(variables_.size());
+  for (const auto& [name, index] : variables_) {
+    names[index] = name;
+  }
+  for (size_t row{}; row < lines.size(); ++row) {
+    auto reported = Vec<uint32_t>();
+    for (auto variable : reads[row]) {
+      auto word = in_[row * words_ + variable / 64];
+      if ((word >> (variable % 64) & 1) == 0 &&
+          std::find(reported.begin(), reported.end(), variable) ==
+              reported.end()) {
+        reported.push_back(variable);
+        diagnostics_.push_back("line " + std::to_string(lines[row]) + ": " +
+                               names[variable] +
+                               " may be read before it is assigned");
+        live_in_.push_back(names[variable]);
+      }
+    }
+  }
+  std::sort(live_in_.begin(), live_in_.end());
+  live_in_.erase(std::unique(live_in_.begin(), live_in_.end()), live_in_.end());
+}
+
+bool DefiniteAssignment::assigned(int64_t line, const Str& name) const {
+  auto row = rows_.find(line);
+  auto variable = variables_.find(name);
+  if (row == rows_.end() || variable == variables_.end()) {
+    return false;
+  }
+  auto word = in_[row->second * words_ + variable->second / 64];
+  return (word >> (variable->second % 64) & 1) != 0;
+}
+
+Vec<Str> DefiniteAssignment::assigned_at(int64_t line) const {
+  auto names = Vec<Str>();
+  auto row = rows_.find(line);
+  if (row == rows_.end()) {
+    return names;
+  }
+  for (const auto& [name, index] : variables_) {
+    if ((in_[row->second * words_ + index / 64] >> (index % 64) & 1) != 0) {
+      names.push_back(name);
+    }
+  }
+  return names;
+}
+
+}  // namespace engine
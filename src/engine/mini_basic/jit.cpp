@@ -0,0 +1,691 @@
+#include "jit.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+#include <limits>
+
+#if ENGINE_JIT_AVAILABLE
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace engine::jit {
+namespace {
+
+using bytecode::Instr;
+using bytecode::Op;
+
+#if ENGINE_JIT_AVAILABLE
+
+// Just enough x86-64 for loop bodies. rbx holds the slot array, r12 the
+// defined flags, r13 the innermost FOR loop and r14 the arrays; rax caches
+// the top of the expression stack and the machine stack holds the rest.
+class Assembler {
+ public:
+  enum class Cond : uint8_t {
+    Less = 0x8C,
+    Greater = 0x8F,
+    Equal = 0x84,
+    NotZero = 0x85,
+    Sign = 0x88,
+    AboveOrEqual = 0x83,
+  };
+
+  [[nodiscard]] const Vec<uint8_t>& code() const { return code_; }
+  [[nodiscard]] size_t size() const { return code_.size(); }
+
+  void prologue() {
+    emit({0x53});              // push rbx
+    emit({0x41, 0x54});        // push r12
+    emit({0x41, 0x55});        // push r13
+    emit({0x41, 0x56});        // push r14
+    emit({0x48, 0x89, 0xFB});  // mov rbx, rdi
+    emit({0x49, 0x89, 0xF4});  // mov r12, rsi
+    emit({0x49, 0x89, 0xD5});  // mov r13, rdx
+    emit({0x49, 0x89, 0xCE});  // mov r14, rcx
+  }
+  // Returns `ip` to the caller
+  void exit(int32_t ip) {
+    emit({0xB8});  // mov eax, ip
+    imm32(ip);
+    emit({0x41, 0x5E});  // pop r14
+    emit({0x41, 0x5D});  // pop r13
+    emit({0x41, 0x5C});  // pop r12
+    emit({0x5B});        // pop rbx
+    emit({0xC3});        // ret
+  }
+
+  void push_rax() { emit({0x50}); }
+  void pop_rax() { emit({0x58}); }
+  void pop_rcx() { emit({0x59}); }
+  void pop_rdx() { emit({0x5A}); }
+  // Drops `entries` from the machine stack
+  void drop(int entries) {
+    emit({0x48, 0x81, 0xC4});  // add rsp, 8 * entries
+    imm32(entries * 8);
+  }
+  void mov_rax(int64_t value) {
+    emit({0x48, 0xB8});
+    imm64(value);
+  }
+  void mov_rcx(int64_t value) {
+    emit({0x48, 0xB9});
+    imm64(value);
+  }
+  void mov_rcx_rax() { emit({0x48, 0x89, 0xC1}); }
+  void mov_rax_rcx() { emit({0x48, 0x89, 0xC8}); }
+
+  // mov rax, [rbx + 8 * slot]
+  void load(uint32_t slot) {
+    emit({0x48, 0x8B, 0x83});
+    imm32(static_cast<int32_t>(slot * 8));
+  }
+  // mov [rbx + 8 * slot], rax
+  void store(uint32_t slot) {
+    emit({0x48, 0x89, 0x83});
+    imm32(static_cast<int32_t>(slot * 8));
+    define(slot);
+  }
+  // add [rbx + 8 * slot], rax
+  void add_to(uint32_t slot) {
+    emit({0x48, 0x01, 0x83});
+    imm32(static_cast<int32_t>(slot * 8));
+    define(slot);
+  }
+  // cmp rax, [rbx + 8 * slot]
+  void cmp_rax_slot(uint32_t slot) {
+    emit({0x48, 0x3B, 0x83});
+    imm32(static_cast<int32_t>(slot * 8));
+  }
+
+  // cmp dword [r13 + offset], value
+  void cmp_loop(size_t offset, int32_t value) {
+    emit({0x41, 0x81, 0xBD});
+    imm32(static_cast<int32_t>(offset));
+    imm32(value);
+  }
+  // mov rcx, [r13 + offset]
+  void load_loop_rcx(size_t offset) {
+    emit({0x49, 0x8B, 0x8D});
+    imm32(static_cast<int32_t>(offset));
+  }
+  // cmp rax, [r13 + offset]
+  void cmp_rax_loop(size_t offset) {
+    emit({0x49, 0x3B, 0x85});
+    imm32(static_cast<int32_t>(offset));
+  }
+  void test_rcx() { emit({0x48, 0x85, 0xC9}); }
+
+  // cmp dword [r14 + offset], value
+  void cmp_array(size_t offset, int32_t value) {
+    emit({0x41, 0x81, 0xBE});
+    imm32(static_cast<int32_t>(offset));
+    imm32(value);
+  }
+  // mov rcx, [r14 + offset]
+  void load_array_rcx(size_t offset) {
+    emit({0x49, 0x8B, 0x8E});
+    imm32(static_cast<int32_t>(offset));
+  }
+  // mov rdx, [r14 + offset]
+  void load_array_rdx(size_t offset) {
+    emit({0x49, 0x8B, 0x96});
+    imm32(static_cast<int32_t>(offset));
+  }
+  // cmp rax, [r14 + offset]
+  void cmp_rax_array(size_t offset) {
+    emit({0x49, 0x3B, 0x86});
+    imm32(static_cast<int32_t>(offset));
+  }
+  // cmp rcx, [r14 + offset]
+  void cmp_rcx_array(size_t offset) {
+    emit({0x49, 0x3B, 0x8E});
+    imm32(static_cast<int32_t>(offset));
+  }
+  // cmp rdx, [r14 + offset]
+  void cmp_rdx_array(size_t offset) {
+    emit({0x49, 0x3B, 0x96});
+    imm32(static_cast<int32_t>(offset));
+  }
+  // imul rcx, [r14 + offset]
+  void imul_rcx_array(size_t offset) {
+    emit({0x49, 0x0F, 0xAF, 0x8E});
+    imm32(static_cast<int32_t>(offset));
+  }
+  // imul rdx, [r14 + offset]
+  void imul_rdx_array(size_t offset) {
+    emit({0x49, 0x0F, 0xAF, 0x96});
+    imm32(static_cast<int32_t>(offset));
+  }
+  void add_rcx_rdx() { emit({0x48, 0x01, 0xD1}); }
+  // mov rax, [rcx + 8 * rax]
+  void load_element() { emit({0x48, 0x8B, 0x04, 0xC1}); }
+  // mov [rdx + 8 * rcx], rax
+  void store_element() { emit({0x48, 0x89, 0x04, 0xCA}); }
+
+  void add_rax_rcx() { emit({0x48, 0x01, 0xC8}); }
+  void sub_rax_rcx() { emit({0x48, 0x29, 0xC8}); }
+  void sub_rcx_rax() { emit({0x48, 0x29, 0xC1}); }
+  void imul_rax_rcx() { emit({0x48, 0x0F, 0xAF, 0xC1}); }
+  // rax = rax / rcx
+  void idiv_rcx() {
+    emit({0x48, 0x99});        // cqo
+    emit({0x48, 0xF7, 0xF9});  // idiv rcx
+  }
+  void neg_rax() { emit({0x48, 0xF7, 0xD8}); }
+  void cmp_rax_rcx() { emit({0x48, 0x39, 0xC8}); }
+  void cmp_rcx_rax() { emit({0x48, 0x39, 0xC1}); }
+  void test_rax() { emit({0x48, 0x85, 0xC0}); }
+  // rax = flags satisfy `cond`
+  void set_rax(Cond cond) {
+    // setcc al
+    emit({0x0F, static_cast<uint8_t>(static_cast<uint8_t>(cond) + 0x10),
+          0xC0});
+    emit({0x0F, 0xB6, 0xC0});  // movzx eax, al
+  }
+
+  // Jumps return the offset of their rel32 for patch()
+  size_t jump() {
+    emit({0xE9});
+    return placeholder();
+  }
+  size_t jump(Cond cond) {
+    emit({0x0F, static_cast<uint8_t>(cond)});
+    return placeholder();
+  }
+  void patch(size_t at, size_t target) {
+    auto rel = static_cast<int32_t>(static_cast<int64_t>(target) -
+                                    static_cast<int64_t>(at + 4));
+    std::memcpy(code_.data() + at, &rel, sizeof(rel));
+  }
+
+ private:
+  Vec<uint8_t> code_;
+
+  void emit(std::initializer_list<uint8_t> bytes) {
+    code_.insert(code_.end(), bytes);
+  }
+  void imm32(int32_t value) {
+    auto at = code_.size();
+    code_.resize(at + sizeof(value));
+    std::memcpy(code_.data() + at, &value, sizeof(value));
+  }
+  void imm64(int64_t value) {
+    auto at = code_.size();
+    code_.resize(at + sizeof(value));
+    std::memcpy(code_.data() + at, &value, sizeof(value));
+  }
+  size_t placeholder() {
+    auto at = code_.size();
+    imm32(0);
+    return at;
+  }
+  // mov byte [r12 + slot], 1
+  void define(uint32_t slot) {
+    emit({0x41, 0xC6, 0x84, 0x24});
+    imm32(static_cast<int32_t>(slot));
+    emit({0x01});
+  }
+};
+
+// Ops native code handles; lines with any other are left to the interpreter
+bool supported(Op op) {
+  switch (op) {
+    case Op::Pow:
+    case Op::Print:
+    case Op::Input:
+    case Op::End:
+    case Op::For:
+    case Op::Gosub:
+    case Op::Return:
+    case Op::Dim:
+    case Op::Mat:
+    case Op::Sort:
+    case Op::Reduce:
+      return false;
+    default:
+      return true;
+  }
+}
+
+bool supported(const Vec<Instr>& code, int32_t from, int32_t to) {
+  return std::all_of(code.begin() + from, code.begin() + to,
+                     [](const Instr& instr) { return supported(instr.op); });
+}
+
+#endif
+
+}  // namespace
+
+Region::Region(const Vec<uint8_t>& code, Vec<uint32_t> reads)
+    : reads_(std::move(reads)) {
+#if ENGINE_JIT_AVAILABLE
+  auto page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  size_ = (code.size() + page - 1) / page * page;
+  auto* memory = mmap(nullptr, size_, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    size_ = 0;
+    return;
+  }
+  memory_ = memory;
+  std::memcpy(memory_, code.data(), code.size());
+  if (mprotect(memory_, size_, PROT_READ | PROT_EXEC) != 0) {
+    return;
+  }
+  entry_ = reinterpret_cast<Entry>(memory_);
+#endif
+}
+
+Region::~Region() {
+#if ENGINE_JIT_AVAILABLE
+  if (memory_ != nullptr) {
+    munmap(memory_, size_);
+  }
+#endif
+}
+
+int32_t Region::enter(Frame& frame) const {
+  for (auto slot : reads_) {
+    if (!frame.defined[slot]) {
+      return -1;
+    }
+  }
+  // Matches no NEXT, so every one exits to the interpreter
+  static constexpr auto kNoLoop =
+      SlotLoop{std::numeric_limits<uint32_t>::max(), Layout::kNoLine, 0, 0};
+  const auto* loop =
+      frame.loop_depth > 0 ? &frame.loops[frame.loop_depth - 1] : &kNoLoop;
+  return entry_(frame.slots, frame.defined, loop, frame.arrays);
+}
+
+Rc<Program> Program::compile(Layout layout) {
+  auto bytecode = bytecode::Program::compile(std::move(layout), true);
+  if (!bytecode) {
+    return nullptr;
+  }
+  return std::make_shared<Program>(std::move(bytecode));
+}
+
+Program::Program(Rc<bytecode::Program> bytecode)
+    : bytecode_(std::move(bytecode)),
+      counters_(bytecode_->loop_count(), kHotThreshold),
+      regions_(bytecode_->loop_count()) {}
+
+size_t Program::compiled_loops() const {
+  return std::count_if(
+      regions_.begin(), regions_.end(),
+      [](const Rc<Region>& region) { return region != nullptr; });
+}
+
+UIBehavior Program::run(int32_t& pc, Frame& frame) {
+  const auto& starts = bytecode_->line_starts();
+  if (pc < 0 || static_cast<size_t>(pc) >= starts.size()) {
+    pc = kEnd;
+    return UIBehavior::FinishRun;
+  }
+
+  frame.loop_counters = counters_.data();
+  auto ip = starts[pc];
+  while (true) {
+    const auto& stop = bytecode_->execute(ip, frame);
+    ip = static_cast<int32_t>(&stop - bytecode_->code().data());
+    if (stop.op == Op::Profile) {
+      ip = enter(stop, ip, frame);
+      continue;
+    }
+    if (stop.op == Op::Next) {
+      ip = bytecode_->next(stop, frame);
+      if (ip >= 0) {
+        continue;
+      }
+    }
+    if (stop.op == Op::Input) {
+      pc = frame.resume;
+      return UIBehavior::Input;
+    }
+    pc = kEnd;
+    return UIBehavior::FinishRun;
+  }
+}
+
+int32_t Program::enter(const Instr& header, int32_t ip, Frame& frame) {
+  auto& region = regions_[header.slot];
+  if (!region) {
+    region = compile_loop(ip);
+    if (!region) {
+      // Keep interpreting without stopping here again
+      counters_[header.slot] = std::numeric_limits<int64_t>::max();
+      return ip + 1;
+    }
+  }
+  auto next = region->enter(frame);
+  return next < 0 ? ip + 1 : next;
+}
+
+Rc<Region> Program::compile_loop(int32_t header) const {
+#if ENGINE_JIT_AVAILABLE
+  const auto& code = bytecode_->code();
+  const auto& starts = bytecode_->line_starts();
+  if (layout().slot_count() >= (1U << 28) ||
+      layout().array_names().size() >= (1U << 26)) {
+    return nullptr;
+  }
+
+  // The loop runs from the header to the last line jumping back to it
+  auto first = static_cast<size_t>(
+      std::lower_bound(starts.begin(), starts.end() - 1, header) -
+      starts.begin());
+  auto last = first;
+  for (auto line = first; line + 1 < starts.size(); ++line) {
+    for (auto i = starts[line]; i < starts[line + 1]; ++i) {
+      if (bytecode::is_jump(code[i].op) && code[i].target == header) {
+        last = line;
+      }
+    }
+  }
+  auto begin = starts[first];
+  auto end = starts[last + 1];
+
+  Assembler a;
+  a.prologue();
+  auto offsets = Vec<size_t>(end - begin);
+  auto jumps = Vec<std::pair<size_t, int32_t>>();
+  // Failed bounds checks, with the machine stack entries to drop and the
+  // instruction to interpret again from
+  struct Failure {
+    size_t at;
+    int entries;
+    int32_t ip;
+  };
+  auto failures = Vec<Failure>();
+  auto reads = Vec<uint32_t>();
+  auto native = false;
+  for (auto line = first; line <= last; ++line) {
+    auto from = starts[line];
+    auto to = starts[line + 1];
+    if (!supported(code, from, to)) {
+      if (from <= header && header < to) {
+        return nullptr;
+      }
+      std::fill(offsets.begin() + (from - begin), offsets.begin() + (to - begin),
+                a.size());
+      a.exit(from);
+      continue;
+    }
+    native = true;
+
+    auto depth = 0;
+    // Pops the operand below the top into rcx
+    auto pop = [&a, &depth]() {
+      a.pop_rcx();
+      --depth;
+    };
+    // An access out of reach runs the line again in the interpreter, which
+    // reports it; nothing the line did before it is visible. A Profile
+    // starting the line is skipped, as that would enter this region again.
+    auto restart = code[from].op == Op::Profile ? from + 1 : from;
+    auto fail = [&](Assembler::Cond cond) {
+      failures.push_back(Failure{a.jump(cond), depth - 1, restart});
+    };
+    auto field = [](uint32_t slot, size_t offset) {
+      return slot * sizeof(SlotArray) + offset;
+    };
+    for (auto i = from; i < to; ++i) {
+      offsets[i - begin] = a.size();
+      const auto& instr = code[i];
+      switch (instr.op) {
+        case Op::PushConst:
+          if (depth++ > 0) {
+            a.push_rax();
+          }
+          a.mov_rax(instr.value);
+          break;
+        case Op::PushSlot:
+          if (depth++ > 0) {
+            a.push_rax();
+          }
+          a.load(instr.slot);
+          break;
+        case Op::Neg:
+          a.neg_rax();
+          break;
+        case Op::Add:
+          pop();
+          a.add_rax_rcx();
+          break;
+        case Op::Sub:
+          pop();
+          a.sub_rcx_rax();
+          a.mov_rax_rcx();
+          break;
+        case Op::Mul:
+          pop();
+          a.imul_rax_rcx();
+          break;
+        case Op::Div:
+          a.mov_rcx_rax();
+          a.pop_rax();
+          --depth;
+          a.idiv_rcx();
+          break;
+        case Op::Less:
+          pop();
+          a.cmp_rcx_rax();
+          a.set_rax(Assembler::Cond::Less);
+          break;
+        case Op::Greater:
+          pop();
+          a.cmp_rcx_rax();
+          a.set_rax(Assembler::Cond::Greater);
+          break;
+        case Op::Equal:
+          pop();
+          a.cmp_rcx_rax();
+          a.set_rax(Assembler::Cond::Equal);
+          break;
+        case Op::AddConst:
+          a.mov_rcx(instr.value);
+          a.add_rax_rcx();
+          break;
+        case Op::SubConst:
+          a.mov_rcx(instr.value);
+          a.sub_rax_rcx();
+          break;
+        case Op::MulConst:
+          a.mov_rcx(instr.value);
+          a.imul_rax_rcx();
+          break;
+        case Op::DivConst:
+          a.mov_rcx(instr.value);
+          a.idiv_rcx();
+          break;
+        case Op::Store:
+          a.store(instr.slot);
+          if (--depth > 0) {
+            a.pop_rax();
+          }
+          break;
+        case Op::AddSlotConst:
+          a.mov_rax(instr.value);
+          a.add_to(instr.slot);
+          break;
+        case Op::Jump:
+          jumps.emplace_back(a.jump(), instr.target);
+          break;
+        case Op::JumpIfTrue:
+          a.test_rax();
+          if (--depth > 0) {
+            a.pop_rax();
+          }
+          jumps.emplace_back(a.jump(Assembler::Cond::NotZero), instr.target);
+          break;
+        case Op::JumpIfLessSlotConst:
+        case Op::JumpIfGreaterSlotConst:
+        case Op::JumpIfEqualSlotConst: {
+          a.load(instr.slot);
+          a.mov_rcx(instr.value);
+          a.cmp_rax_rcx();
+          auto cond = instr.op == Op::JumpIfLessSlotConst
+                          ? Assembler::Cond::Less
+                      : instr.op == Op::JumpIfGreaterSlotConst
+                          ? Assembler::Cond::Greater
+                          : Assembler::Cond::Equal;
+          jumps.emplace_back(a.jump(cond), instr.target);
+        } break;
+        case Op::JumpIfLessSlotSlot:
+        case Op::JumpIfGreaterSlotSlot:
+        case Op::JumpIfEqualSlotSlot: {
+          a.load(instr.slot);
+          a.cmp_rax_slot(instr.other);
+          auto cond = instr.op == Op::JumpIfLessSlotSlot
+                          ? Assembler::Cond::Less
+                      : instr.op == Op::JumpIfGreaterSlotSlot
+                          ? Assembler::Cond::Greater
+                          : Assembler::Cond::Equal;
+          jumps.emplace_back(a.jump(cond), instr.target);
+        } break;
+        // Steps the loop r13 points at when it is the one this NEXT
+        // expects and stays in it; anything else, leaving the loop
+        // included, goes back to the interpreter's Next before any store
+        case Op::Next: {
+          auto exits = Vec<size_t>();
+          a.cmp_loop(offsetof(SlotLoop, slot),
+                     static_cast<int32_t>(instr.slot));
+          exits.push_back(a.jump(Assembler::Cond::NotZero));
+          a.cmp_loop(offsetof(SlotLoop, body),
+                     static_cast<int32_t>(instr.other));
+          exits.push_back(a.jump(Assembler::Cond::NotZero));
+          a.load_loop_rcx(offsetof(SlotLoop, step));
+          a.load(instr.slot);
+          a.add_rax_rcx();
+          a.test_rcx();
+          auto down = a.jump(Assembler::Cond::Sign);
+          a.cmp_rax_loop(offsetof(SlotLoop, limit));
+          exits.push_back(a.jump(Assembler::Cond::Greater));
+          auto up = a.jump();
+          a.patch(down, a.size());
+          a.cmp_rax_loop(offsetof(SlotLoop, limit));
+          exits.push_back(a.jump(Assembler::Cond::Less));
+          a.patch(up, a.size());
+          a.store(instr.slot);
+          jumps.emplace_back(a.jump(), instr.target);
+          for (auto at : exits) {
+            a.patch(at, a.size());
+          }
+          a.exit(i);
+        } break;
+        // Index in rax, and for two dimensions the row below it
+        case Op::LoadElement:
+        case Op::LoadElementUnchecked: {
+          auto checked = instr.op == Op::LoadElement;
+          if (instr.other == 1) {
+            if (checked) {
+              a.cmp_array(field(instr.slot, offsetof(SlotArray, rank)), 1);
+              fail(Assembler::Cond::NotZero);
+              a.cmp_rax_array(field(instr.slot, offsetof(SlotArray, rows)));
+              fail(Assembler::Cond::AboveOrEqual);
+            }
+          } else {
+            pop();
+            if (checked) {
+              a.cmp_array(field(instr.slot, offsetof(SlotArray, rank)), 2);
+              fail(Assembler::Cond::NotZero);
+              a.cmp_rcx_array(field(instr.slot, offsetof(SlotArray, rows)));
+              fail(Assembler::Cond::AboveOrEqual);
+              a.cmp_rax_array(field(instr.slot, offsetof(SlotArray, columns)));
+              fail(Assembler::Cond::AboveOrEqual);
+            }
+            a.imul_rcx_array(field(instr.slot, offsetof(SlotArray, columns)));
+            a.add_rax_rcx();
+          }
+          a.load_array_rcx(field(instr.slot, offsetof(SlotArray, data)));
+          a.load_element();
+        } break;
+        // Value in rax with the indices below it
+        case Op::StoreElement:
+        case Op::StoreElementUnchecked: {
+          auto checked = instr.op == Op::StoreElement;
+          pop();
+          if (instr.other == 1) {
+            if (checked) {
+              a.cmp_array(field(instr.slot, offsetof(SlotArray, rank)), 1);
+              fail(Assembler::Cond::NotZero);
+              a.cmp_rcx_array(field(instr.slot, offsetof(SlotArray, rows)));
+              fail(Assembler::Cond::AboveOrEqual);
+            }
+          } else {
+            a.pop_rdx();
+            --depth;
+            if (checked) {
+              a.cmp_array(field(instr.slot, offsetof(SlotArray, rank)), 2);
+              fail(Assembler::Cond::NotZero);
+              a.cmp_rdx_array(field(instr.slot, offsetof(SlotArray, rows)));
+              fail(Assembler::Cond::AboveOrEqual);
+              a.cmp_rcx_array(field(instr.slot, offsetof(SlotArray, columns)));
+              fail(Assembler::Cond::AboveOrEqual);
+            }
+            a.imul_rdx_array(field(instr.slot, offsetof(SlotArray, columns)));
+            a.add_rcx_rdx();
+          }
+          a.load_array_rdx(field(instr.slot, offsetof(SlotArray, data)));
+          a.store_element();
+          if (--depth > 0) {
+            a.pop_rax();
+          }
+        } break;
+        // Entering the region requires the slot to be assigned, so the
+        // check can never warn inside it
+        case Op::Check:
+          reads.push_back(instr.slot);
+          break;
+        case Op::Profile:
+        default:
+          break;
+      }
+    }
+  }
+  if (!native) {
+    return nullptr;
+  }
+  // Falling out of the last line
+  a.exit(end);
+
+  // Jumps out of the loop return to the interpreter through one stub per
+  // target
+  for (const auto& failure : failures) {
+    a.patch(failure.at, a.size());
+    if (failure.entries > 0) {
+      a.drop(failure.entries);
+    }
+    a.exit(failure.ip);
+  }
+  auto stubs = Map<int32_t, size_t>();
+  for (const auto& [at, target] : jumps) {
+    if (begin <= target && target < end) {
+      a.patch(at, offsets[target - begin]);
+      continue;
+    }
+    auto stub = stubs.find(target);
+    if (stub == stubs.end()) {
+      stub = stubs.insert(std::make_pair(target, a.size())).first;
+      a.exit(target);
+    }
+    a.patch(at, stub->second);
+  }
+
+  std::sort(reads.begin(), reads.end());
+  reads.erase(std::unique(reads.begin(), reads.end()), reads.end());
+  auto region = std::make_shared<Region>(a.code(), std::move(reads));
+  if (!region->ok()) {
+    return nullptr;
+  }
+  return region;
+#else
+  return nullptr;
+#endif
+}
+
+}  // namespace engine::jit
@@ -0,0 +1,153 @@
+#include "layout.h"
+
+#include <algorithm>
+
+namespace engine {
+
+Layout::Layout(const FlatMap<int64_t, Rc<parser::ast_node::LineNoStmt>>& ast,
+               Rc<const DefiniteAssignment> assigned,
+               Rc<const BoundsCheck> bounds)
+    : assigned_(std::move(assigned)), bounds_(std::move(bounds)) {
+  lines_.reserve(ast.size());
+  numbers_.reserve(ast.size());
+  for (const auto& a : ast) {
+    lines_.push_back(a.second);
+    numbers_.push_back(a.first);
+  }
+}
+
+int32_t Layout::index_of(int64_t line) const {
+  auto at = std::lower_bound(numbers_.begin(), numbers_.end(), line);
+  if (at == numbers_.end() || *at != line) {
+    return kNoLine;
+  }
+  return static_cast<int32_t>(at - numbers_.begin());
+}
+
+int64_t Layout::line_at(int32_t index) const {
+  if (index < 0 || static_cast<size_t>(index) >= numbers_.size()) {
+    return -1;
+  }
+  return numbers_[index];
+}
+
+uint32_t Layout::slot(const Str& name) {
+  auto s = slots_.find(name);
+  if (s != slots_.end()) {
+    return s->second;
+  }
+  auto slot = static_cast<uint32_t>(names_.size());
+  slots_.insert(std::make_pair(name, slot));
+  names_.push_back(name);
+  return slot;
+}
+
+uint32_t Layout::array(const Str& name) {
+  auto a = arrays_.find(name);
+  if (a != arrays_.end()) {
+    return a->second;
+  }
+  auto slot = static_cast<uint32_t>(array_names_.size());
+  arrays_.insert(std::make_pair(name, slot));
+  array_names_.push_back(name);
+  return slot;
+}
+
+bool Layout::checked(const Str& name) const {
+  return !assigned_ || !assigned_->assigned(line_at(line_), name);
+}
+
+bool Layout::checked(const parser::ast_node::ArrayExpr& access) const {
+  return !bounds_ || !bounds_->in_bounds(line_at(line_), access);
+}
+
+void Layout::load(const Map<Str, int64_t>& variants, Vec<int64_t>& slots,
+                  Vec<uint8_t>& defined) const {
+  slots.assign(names_.size(), 0);
+  defined.assign(names_.size(), 0);
+  for (uint32_t i{}; i < names_.size(); ++i) {
+    auto v = variants.find(names_[i]);
+    if (v != variants.end()) {
+      slots[i] = v->second;
+      defined[i] = 1;
+    }
+  }
+}
+
+void Layout::store(const Vec<int64_t>& slots, const Vec<uint8_t>& defined,
+                   Map<Str, int64_t>& variants) const {
+  for (uint32_t i{}; i < names_.size(); ++i) {
+    if (defined[i]) {
+      variants[names_[i]] = slots[i];
+    }
+  }
+}
+
+size_t Layout::load(const parser::LoopStack& loops,
+                    Vec<SlotLoop>& slot_loops) const {
+  slot_loops.resize(parser::LoopStack::kMaxDepth);
+  size_t depth{};
+  for (const auto& loop : loops.loops()) {
+    auto slot = slots_.find(loop.variant);
+    auto body = loop.body == -1 ? kNoLine : index_of(loop.body);
+    if (slot == slots_.end() || (loop.body != -1 && body == kNoLine)) {
+      continue;
+    }
+    slot_loops[depth++] = SlotLoop{slot->second, body, loop.limit, loop.step};
+  }
+  return depth;
+}
+
+void Layout::store(const SlotLoop* slot_loops, size_t depth,
+                   parser::LoopStack& loops) const {
+  loops.clear();
+  for (size_t i{}; i < depth; ++i) {
+    const auto& loop = slot_loops[i];
+    loops.push(parser::Loop{names_[loop.slot], loop.limit, loop.step,
+                            loop.body == kNoLine ? -1 : line_at(loop.body)});
+  }
+}
+
+size_t Layout::load(const parser::CallStack& calls,
+                    Vec<int32_t>& returns) const {
+  returns.resize(calls.max_depth());
+  size_t depth{};
+  for (auto line : calls.returns()) {
+    returns[depth++] = line == -1 ? kNoLine : index_of(line);
+  }
+  return depth;
+}
+
+void Layout::store(const int32_t* returns, size_t depth,
+                   parser::CallStack& calls) const {
+  calls.clear();
+  for (size_t i{}; i < depth; ++i) {
+    calls.push(line_at(returns[i]));
+  }
+}
+
+void Layout::load(Map<Str, parser::Array>& arrays,
+                  Vec<parser::Array>& storage, Vec<SlotArray>& views) const {
+  storage.resize(array_names_.size());
+  views.resize(array_names_.size());
+  for (uint32_t i{}; i < array_names_.size(); ++i) {
+    auto a = arrays.find(array_names_[i]);
+    if (a != arrays.end()) {
+      storage[i] = std::move(a->second);
+    } else {
+      storage[i] = parser::Array();
+    }
+    views[i] = view(storage[i]);
+  }
+}
+
+void Layout::store(Vec<parser::Array>& storage,
+                   Map<Str, parser::Array>& arrays) const {
+  for (uint32_t i{}; i < array_names_.size(); ++i) {
+    if (!storage[i].extents.empty()) {
+      arrays[array_names_[i]] = std::move(storage[i]);
+    }
+  }
+}
+
+}  // namespace engine
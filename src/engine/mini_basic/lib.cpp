@@ -1,83 +1,845 @@
 #include "engine.h"
+
+#include <limits>
+#include <string_view>
+#include <thread>
 namespace engine {
+namespace {
+// Splits "<number> <statement>" so identical statements share one AST;
+// false unless the line is a number followed by a statement
+bool split_numbered(const Str& line, std::string_view& number,
+                    std::string_view& body) {
+  constexpr auto whitespace = " \t\n";
+  auto number_begin = line.find_first_not_of(whitespace);
+  if (number_begin == Str::npos || line[number_begin] < '0' ||
+      line[number_begin] > '9') {
+    return false;
+  }
+  auto number_end = number_begin;
+  while (number_end < line.size() && '0' <= line[number_end] &&
+         line[number_end] <= '9') {
+    ++number_end;
+  }
+  auto body_begin = line.find_first_not_of(whitespace, number_end);
+  if (body_begin == Str::npos) {
+    return false;
+  }
+  number = std::string_view(line).substr(number_begin,
+                                         number_end - number_begin);
+  body = std::string_view(line).substr(body_begin);
+  return true;
+}
+// Batches parse this many lines per thread at least, as starting a thread
+// costs about as much as parsing a few hundred lines
+constexpr size_t kLinesPerThread = 256;
+
+// Parses a line without the engine's context or cache, for const views
+Rc<parser::AstNode> parse_alone(const Str& line,
+                                parser::ParseContext::FrontEnd front_end) {
+  auto context = parser::ParseContext();
+  context.set_front_end(front_end);
+  return context.parse(line);
+}
+}  // namespace
 void MiniBasic::clear() {
-  source.clear();
-  ast.clear();
+  cancel_load();
+  remember(LineChange::Kind::Reset, 0);
+  lines_.clear();
+  unparsed_ = 0;
+  record_change(LineChange::Kind::Reset, 0);
 
   variant_env.clear();
   variant_need_input_.clear();
+  run_state_.loops.clear();
+  run_state_.calls.clear();
+  run_state_.arrays.clear();
 }
-Str MiniBasic::string_lines_into_string(const Map<int64_t, Str>& in) {
+Str MiniBasic::string_lines_into_string(const LineTable& in) {
   auto out = std::string();
   for (const auto& i : in) {
-    out.insert(out.end(), i.second.begin(), i.second.end());
+    out.append(i.second.source);
     out.push_back('\n');
   }
   return out;
 }
 void MiniBasic::load_source(std::istream& in) {
-  source.clear();
-  ast.clear();
+  read_source(in, lazy_load_);
+}
+void MiniBasic::begin_load(std::istream& in) {
+  read_source(in, true);
+  // Cache hits are installed now, as the worker has no cache
+  auto numbers = Vec<int64_t>();
+  auto sources = Vec<Str>();
+  auto hits = Vec<std::pair<int64_t, Rc<parser::AstNode>>>();
+  for (const auto& [number, line] : lines_) {
+    if (auto node = find_parsed(line.source)) {
+      hits.emplace_back(number, std::move(node));
+    } else {
+      numbers.push_back(number);
+      sources.push_back(line.source);
+    }
+  }
+  for (auto& [number, node] : hits) {
+    put_line(number,
+             Line{lines_.find(number)->source,
+                  std::static_pointer_cast<parser::ast_node::LineNoStmt>(
+                      std::move(node))});
+  }
+  if (!sources.empty()) {
+    loader_lines_ = std::move(numbers);
+    loader_ = std::make_unique<BackgroundParser>(std::move(sources),
+                                                 parse_context_.front_end());
+  }
+}
+size_t MiniBasic::poll_load(Str& output) {
+  if (!loader_) {
+    return 0;
+  }
+  auto parsed = loader_->parsed();
+  auto dropped_pc = false;
+  for (; loader_installed_ < parsed; ++loader_installed_) {
+    auto number = loader_lines_[loader_installed_];
+    const auto& source = loader_->line(loader_installed_);
+    const auto& node = loader_->result(loader_installed_);
+    cache_parsed(source, node);
+    // Skip lines edited, undone or parsed by a run since the load
+    const auto* line = lines_.find(number);
+    if (line == nullptr || line->stmt || line->source != source) {
+      continue;
+    }
+    dropped_pc |= !install(number, source, node, output) && number == pc_;
+  }
+  if (dropped_pc) {
+    resume_past_dropped();
+  }
+  auto left = loader_->size() - parsed;
+  if (left == 0) {
+    cancel_load();
+  }
+  return left;
+}
+void MiniBasic::cancel_load() {
+  loader_.reset();
+  loader_lines_.clear();
+  loader_installed_ = 0;
+}
+void MiniBasic::read_source(std::istream& in, bool defer) {
+  cancel_load();
+  remember(LineChange::Kind::Reset, 0);
+  lines_.clear();
+  unparsed_ = 0;
+  record_change(LineChange::Kind::Reset, 0);
   auto line = std::string();
   while (std::getline(in, line)) {
-    auto node = parser::Parser().parse(tokenizer::Tokenizer().lex(line));
+    std::string_view number;
+    std::string_view body;
+    // Any number of up to 18 digits fits, longer ones are left to the
+    // parser to reject
+    if (defer && split_numbered(line, number, body) && number.size() <= 18) {
+      put_line(std::stoll(Str(number)), Line{line, nullptr});
+      continue;
+    }
+    auto node = parse_line(line);
     if (typeid(*node) == typeid(parser::ast_node::LineNoStmt)) {
       auto l = std::static_pointer_cast<parser::ast_node::LineNoStmt>(node);
-      ast.insert(std::make_pair(l->number()->value(), l));
-      source.insert(std::make_pair(l->number()->value(), line));
+      put_line(l->number()->value(), Line{line, l});
     }
   }
 }
+void MiniBasic::put_line(int64_t number, Line line) {
+  if (const auto* old = lines_.find(number); old && !old->stmt) {
+    --unparsed_;
+  }
+  if (!line.stmt) {
+    ++unparsed_;
+  }
+  lines_.insert_or_assign(number, std::move(line));
+}
+bool MiniBasic::erase_line(int64_t number) {
+  if (const auto* old = lines_.find(number); old && !old->stmt) {
+    --unparsed_;
+  }
+  return lines_.erase(number);
+}
+Rc<parser::AstNode> MiniBasic::parse_line(const Str& line) {
+  if (auto node = find_parsed(line)) {
+    return node;
+  }
+  auto node = parse_context_.parse(line);
+  cache_parsed(line, node);
+  return node;
+}
+Rc<parser::AstNode> MiniBasic::find_parsed(const Str& line) {
+  std::string_view number;
+  std::string_view body;
+  if (!split_numbered(line, number, body)) {
+    return nullptr;
+  }
+  auto stmt = parse_cache_.find(body);
+  if (!stmt) {
+    return nullptr;
+  }
+  return std::make_shared<parser::ast_node::LineNoStmt>(
+      std::make_shared<tokenizer::token::Integer>(std::stoll(Str(number))),
+      stmt);
+}
+void MiniBasic::cache_parsed(const Str& line, const Rc<parser::AstNode>& node) {
+  std::string_view number;
+  std::string_view body;
+  if (typeid(*node) == typeid(parser::ast_node::LineNoStmt) &&
+      split_numbered(line, number, body)) {
+    parse_cache_.insert(
+        body, std::static_pointer_cast<parser::ast_node::LineNoStmt>(node)
+                  ->stmt());
+  }
+}
+Vec<Rc<parser::AstNode>> MiniBasic::parse_lines(const Vec<Str>& lines,
+                                                unsigned threads) {
+  // Cache hits first, as the workers do not share the cache
+  auto parsed = Vec<Rc<parser::AstNode>>(lines.size());
+  auto pending = Vec<size_t>();
+  for (size_t i{}; i < lines.size(); ++i) {
+    parsed[i] = find_parsed(lines[i]);
+    if (!parsed[i]) {
+      pending.push_back(i);
+    }
+  }
+
+  if (threads == 0) {
+    threads = std::max(1U, std::thread::hardware_concurrency());
+  }
+  threads = static_cast<unsigned>(std::max<size_t>(
+      1, std::min<size_t>(threads, pending.size() / kLinesPerThread)));
+  auto chunk = (pending.size() + threads - 1) / threads;
+  auto parse = [&](size_t begin) {
+    auto context = parser::ParseContext();
+    context.set_front_end(parse_context_.front_end());
+    auto end = std::min(begin + chunk, pending.size());
+    for (auto j = begin; j < end; ++j) {
+      parsed[pending[j]] = context.parse(lines[pending[j]]);
+    }
+  };
+  auto workers = Vec<std::thread>();
+  for (unsigned t = 1; t < threads; ++t) {
+    workers.emplace_back(parse, t * chunk);
+  }
+  parse(0);
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  for (auto i : pending) {
+    cache_parsed(lines[i], parsed[i]);
+  }
+  return parsed;
+}
+size_t MiniBasic::apply_edits(const Vec<Str>& edits, Str& output,
+                              unsigned threads) {
+  auto parsed = parse_lines(edits, threads);
+
+  // Only the first edit under each node copies it; the rest of the batch
+  // edits the copy in place
+  auto edit = Edit{lines_, {}, unparsed_};
+  for (size_t i{}; i < edits.size(); ++i) {
+    const auto& node = parsed[i];
+    if (typeid(*node) == typeid(parser::ast_node::LineNoStmt)) {
+      auto l = std::static_pointer_cast<parser::ast_node::LineNoStmt>(node);
+      auto line = l->number()->value();
+      auto kind = lines_.count(line) ? LineChange::Kind::Replaced
+                                     : LineChange::Kind::Inserted;
+      put_line(line, Line{edits[i], l});
+      edit.changes.push_back(LineChange{kind, line});
+    } else if (typeid(*node) == typeid(parser::ast_node::ClearLine)) {
+      auto line = std::static_pointer_cast<parser::ast_node::ClearLine>(node)
+                      ->number()
+                      ->value();
+      if (erase_line(line)) {
+        edit.changes.push_back(LineChange{LineChange::Kind::Deleted, line});
+      }
+    } else {
+      output.append("WARNING: not a line edit: " + edits[i] + "\n");
+    }
+  }
+
+  auto applied = edit.changes.size();
+  for (const auto& change : edit.changes) {
+    record_change(change.kind, change.line);
+  }
+  if (applied != 0) {
+    remember(std::move(edit));
+  }
+  return applied;
+}
+Str MiniBasic::get_source_line(int64_t line) const {
+  const auto* l = lines_.find(line);
+  return l == nullptr ? Str() : l->source;
+}
+Str MiniBasic::get_line_ast_copy(int64_t line) const {
+  std::stringstream ss;
+  dump_line_ast(line, ss);
+  return ss.str();
+}
+Vec<parser::AstRow> MiniBasic::get_line_ast_rows(int64_t line) const {
+  auto rows = parser::AstRows();
+  dump_line_ast(line, rows);
+  return std::move(rows.rows());
+}
+bool MiniBasic::dump_line_ast(int64_t line, std::ostream& ostream) const {
+  const auto* l = lines_.find(line);
+  if (l == nullptr) {
+    return false;
+  }
+  if (l->stmt) {
+    l->stmt->dump(0, ostream);
+  } else {
+    parse_alone(l->source, parse_context_.front_end())->dump(0, ostream);
+  }
+  return true;
+}
+Vec<int64_t> MiniBasic::get_line_numbers() const {
+  auto lines = Vec<int64_t>();
+  lines.reserve(lines_.size());
+  for (const auto& l : lines_) {
+    lines.push_back(l.first);
+  }
+  return lines;
+}
+Vec<LineChange> MiniBasic::take_changes() {
+  auto changes = Vec<LineChange>();
+  changes.swap(changes_);
+  return changes;
+}
+void MiniBasic::record_change(LineChange::Kind kind, int64_t line) {
+  ++program_version_;
+  // A reset supersedes everything before it, and a long backlog nobody
+  // collects is cheaper to replay as a reset
+  if (kind == LineChange::Kind::Reset || changes_.size() >= kMaxChanges) {
+    changes_.clear();
+    changes_.push_back(LineChange{LineChange::Kind::Reset, 0});
+    return;
+  }
+  changes_.push_back(LineChange{kind, line});
+}
 std::string MiniBasic::get_ast_copy() const {
   std::stringstream ss;
-  for (const auto& node : ast) {
-    node.second->dump(0, ss);
+  for (const auto& [line, l] : lines_) {
+    if (l.stmt) {
+      l.stmt->dump(0, ss);
+    } else {
+      parse_alone(l.source, parse_context_.front_end())->dump(0, ss);
+    }
   }
   return ss.str();
 }
 UIBehavior MiniBasic::step_run(Str& output) {
+  auto written = output.size();
+  auto behavior = step(output);
+  write_to_sink(output, written);
+  return behavior;
+}
+const FlatMap<int64_t, Rc<parser::ast_node::LineNoStmt>>& MiniBasic::program()
+    const {
+  if (program_analyzed_ != program_version_) {
+    // Lines not parsed yet are parsed for the analysis but not kept, as
+    // this may not edit the table; the runs parse them for good first
+    auto lines = FlatMap<int64_t, Rc<parser::ast_node::LineNoStmt>>();
+    for (const auto& [line, l] : lines_) {
+      auto stmt = l.stmt;
+      if (!stmt) {
+        auto node = parse_alone(l.source, parse_context_.front_end());
+        if (typeid(*node) != typeid(parser::ast_node::LineNoStmt)) {
+          continue;
+        }
+        stmt = std::static_pointer_cast<parser::ast_node::LineNoStmt>(node);
+      }
+      lines.emplace(line, stmt);
+    }
+    auto control_flow = ControlFlow(lines);
+    program_ = control_flow.program();
+    forwarded_.clear();
+    for (const auto& [line, node] : lines) {
+      if (auto to = control_flow.forward(line);
+          to != line && !program_.count(line)) {
+        forwarded_.emplace_hint(forwarded_.end(), line, to);
+      }
+    }
+    assigned_ = std::make_shared<DefiniteAssignment>(program_);
+    bounds_ = std::make_shared<BoundsCheck>(program_);
+
+    std::stringstream tree;
+    auto predecessors = Map<int64_t, Vec<int64_t>>();
+    Vec<int64_t> pending;
+    for (const auto& [line, node] : program_) {
+      node->dump(0, tree);
+      for (auto successor : control_flow.successors(line)) {
+        predecessors[successor].push_back(line);
+      }
+      if (typeid(*node->stmt()) == typeid(parser::ast_node::Input)) {
+        pending.push_back(line);
+      }
+    }
+    program_hash_ = ParseCache::hash(tree.str());
+    reaches_input_ = std::set<int64_t>(pending.begin(), pending.end());
+    while (!pending.empty()) {
+      auto line = pending.back();
+      pending.pop_back();
+      for (auto predecessor : predecessors[line]) {
+        if (reaches_input_.insert(predecessor).second) {
+          pending.push_back(predecessor);
+        }
+      }
+    }
+    program_analyzed_ = program_version_;
+    if (analysis_report_ != nullptr) {
+      for (const auto& diagnostic : control_flow.diagnostics()) {
+        *analysis_report_ << diagnostic << '\n';
+      }
+      for (const auto& diagnostic : assigned_->diagnostics()) {
+        *analysis_report_ << diagnostic << '\n';
+      }
+    }
+  }
+  return program_;
+}
+void MiniBasic::forward_pc() {
+  if (pc_ == -1 || unparsed_ > 0) {
+    return;
+  }
+  program();
+  if (auto to = forwarded_.find(pc_); to != forwarded_.end()) {
+    pc_ = to->second;
+  }
+}
+UIBehavior MiniBasic::step(Str& output) {
   if (pc_ == -1) {
     return UIBehavior::FinishRun;
   }
-  auto stmt = ast.find(pc_);
-  if (stmt == ast.end()) {
+  if (unparsed_ > 0) {
+    return step_lazy(output);
+  }
+  forward_pc();
+  const auto& program = this->program();
+  auto stmt = program.find(pc_);
+  if (stmt == program.end()) {
     auto warn = Str("WARNING: unknown statement at " + std::to_string(pc_));
     return UIBehavior::FinishRun;
   }
   auto next_stmt = stmt;
   ++next_stmt;
-  if (next_stmt == ast.end()) {
+  if (next_stmt == program.end()) {
     pc_ = -1;
   } else {
     pc_ = next_stmt->first;
   }
-  return stmt->second->run(variant_env, pc_, output, variant_need_input_);
+  return stmt->second->run(variant_env, pc_, output, variant_need_input_,
+                           run_state_);
+}
+UIBehavior MiniBasic::step_lazy(Str& output) {
+  const auto* line = lines_.find(pc_);
+  if (line == nullptr) {
+    return UIBehavior::FinishRun;
+  }
+  auto stmt = line->stmt;
+  if (!stmt) {
+    auto source = line->source;
+    auto node = parse_line(source);
+    if (typeid(*node) != typeid(parser::ast_node::LineNoStmt)) {
+      // After LOAD the line would be missing, so a jump to it ends the run
+      auto number = pc_;
+      if (pc_ != jumped_to_) {
+        auto next = lines_.lower_bound(pc_ + 1);
+        pc_ = next == lines_.end() ? -1 : next->first;
+      }
+      drop_invalid(number, node, output);
+      return pc_ == -1 || pc_ == number ? UIBehavior::FinishRun
+                                        : UIBehavior::None;
+    }
+    stmt = std::static_pointer_cast<parser::ast_node::LineNoStmt>(node);
+    put_line(pc_, Line{std::move(source), stmt});
+  }
+  auto next = lines_.lower_bound(pc_ + 1);
+  auto fall = next == lines_.end() ? -1 : next->first;
+  pc_ = fall;
+  auto behavior =
+      stmt->run(variant_env, pc_, output, variant_need_input_, run_state_);
+  // A GOTO or GOSUB to the next line jumps there all the same
+  const auto& type = typeid(*stmt->stmt());
+  jumped_to_ = pc_ != fall || type == typeid(parser::ast_node::Goto) ||
+                       type == typeid(parser::ast_node::Gosub)
+                   ? pc_
+                   : -1;
+  return behavior;
+}
+size_t MiniBasic::parse_pending(Str& output) {
+  if (unparsed_ == 0) {
+    return 0;
+  }
+  // What the background load has finished is taken, and the rest parsed
+  // here on every core rather than waited for
+  poll_load(output);
+  cancel_load();
+  if (unparsed_ == 0) {
+    return 0;
+  }
+  auto numbers = Vec<int64_t>();
+  auto sources = Vec<Str>();
+  for (const auto& [number, line] : lines_) {
+    if (!line.stmt) {
+      numbers.push_back(number);
+      sources.push_back(line.source);
+    }
+  }
+  auto parsed = parse_lines(sources, 0);
+  size_t failed{};
+  auto dropped_pc = false;
+  for (size_t i{}; i < numbers.size(); ++i) {
+    if (!install(numbers[i], std::move(sources[i]), parsed[i], output)) {
+      dropped_pc |= numbers[i] == pc_;
+      ++failed;
+    }
+  }
+  if (dropped_pc) {
+    resume_past_dropped();
+  }
+  return failed;
+}
+void MiniBasic::resume_past_dropped() {
+  if (pc_ == jumped_to_) {
+    return;
+  }
+  auto next = lines_.lower_bound(pc_);
+  pc_ = next == lines_.end() ? -1 : next->first;
+}
+bool MiniBasic::install(int64_t number, Str source,
+                        const Rc<parser::AstNode>& node, Str& output) {
+  if (typeid(*node) != typeid(parser::ast_node::LineNoStmt)) {
+    drop_invalid(number, node, output);
+    return false;
+  }
+  put_line(number,
+           Line{std::move(source),
+                std::static_pointer_cast<parser::ast_node::LineNoStmt>(node)});
+  return true;
+}
+void MiniBasic::drop_invalid(int64_t number, const Rc<parser::AstNode>& node,
+                             Str& output) {
+  auto message = typeid(*node) == typeid(parser::ast_node::Invalid)
+                     ? std::static_pointer_cast<parser::ast_node::Invalid>(node)
+                           ->message()
+                     : Str("not a statement");
+  output.append("ERROR: line " + std::to_string(number) + ": " + message +
+                "\n");
+  erase_line(number);
+  record_change(LineChange::Kind::Deleted, number);
+}
+namespace {
+// Bytecode pauses for samples at its Profile instructions, so sampling
+// needs a build that has them; the other tiers pause on their own
+template <typename Program>
+Rc<Program> compile(Layout layout, bool) {
+  return Program::compile(std::move(layout));
+}
+template <>
+Rc<bytecode::Program> compile<bytecode::Program>(Layout layout, bool sampled) {
+  return bytecode::Program::compile(std::move(layout), sampled);
+}
+template <typename Program>
+bool needs_rebuild(const Program&, bool) {
+  return false;
+}
+bool needs_rebuild(const bytecode::Program& program, bool sampled) {
+  return program.profiled() != sampled;
+}
+}  // namespace
+template <typename Program, typename... Args>
+UIBehavior MiniBasic::run_compiled(Rc<Program>& program, uint64_t& version,
+                                   Str& output, Args... args) {
+  forward_pc();
+  const auto& lines = this->program();
+  auto trusted = run_version_ == program_version_;
+  auto assigned = trusted ? assigned_ : nullptr;
+  auto bounds = trusted ? bounds_ : nullptr;
+  auto sampled = pause_period_ > 0;
+  if (version != program_version_ || !program ||
+      program->layout().analyzed() != trusted ||
+      needs_rebuild(*program, sampled)) {
+    program = compile<Program>(Layout(lines, assigned, bounds), sampled);
+    version = program_version_;
+  }
+  if (!program) {
+    return run_tree_walker(output);
+  }
+  if (pc_ == -1) {
+    return UIBehavior::FinishRun;
+  }
+
+  const auto& layout = program->layout();
+  auto pc = layout.index_of(pc_);
+  if (pc == Layout::kNoLine) {
+    return UIBehavior::FinishRun;
+  }
+
+  layout.load(variant_env, slots_, defined_);
+  auto frame = Frame{slots_.data(), defined_.data(), &layout.names(), &output};
+  frame.sample_period = pause_period_;
+  frame.loop_depth = layout.load(run_state_.loops, slot_loops_);
+  frame.loops = slot_loops_.data();
+  frame.call_depth = layout.load(run_state_.calls, returns_);
+  frame.returns = returns_.data();
+  frame.max_call_depth = run_state_.calls.max_depth();
+  layout.load(run_state_.arrays, array_storage_, slot_arrays_);
+  frame.arrays = slot_arrays_.data();
+  frame.array_storage = array_storage_.data();
+  frame.array_names = &layout.array_names();
+  frame.array_policy = &run_state_.array_policy;
+  auto behavior = program->run(pc, frame, args...);
+  layout.store(slots_, defined_, variant_env);
+  layout.store(frame.loops, frame.loop_depth, run_state_.loops);
+  layout.store(frame.returns, frame.call_depth, run_state_.calls);
+  layout.store(array_storage_, run_state_.arrays);
+
+  pc_ = layout.line_at(pc);
+  if (behavior == UIBehavior::Input) {
+    variant_need_input_ = layout.names()[frame.input_slot];
+  }
+  return behavior;
+}
+UIBehavior MiniBasic::run(Str& output) {
+  auto written = output.size();
+  if (tier_ != Tier::TreeWalker || memoize_) {
+    parse_pending(output);
+  }
+  forward_pc();
+  // A run inside FOR loops or subroutines depends on them too, and one
+  // using arrays on their elements, so it is not memoized. Neither is one
+  // under a quota, which a replayed result would skip.
+  if (!memoize_ || quota_.limited() || pc_ == -1 || this->program().empty() ||
+      reaches_input_.count(pc_) || !run_state_.loops.empty() ||
+      !run_state_.calls.empty() || bounds_->uses_arrays()) {
+    auto behavior = run_tier(output, 0);
+    write_to_sink(output, written);
+    return behavior;
+  }
+
+  // Only variables the run may read before assigning them take part in the
+  // key; a run resuming mid-program needs that worked out from its own line
+  auto resumed = pc_ == program_.begin()->first
+                     ? nullptr
+                     : std::make_unique<DefiniteAssignment>(program_, pc_);
+  auto start = RunStart{program_hash_, pc_, {}};
+  for (const auto& name :
+       resumed ? resumed->live_in() : assigned_->live_in()) {
+    if (auto v = variant_env.find(name); v != variant_env.end()) {
+      start.variants.insert(*v);
+    }
+  }
+  if (const auto* result = run_cache_.find(start)) {
+    output.append(result->output);
+    for (const auto& [name, value] : result->variants) {
+      variant_env[name] = value;
+    }
+    pc_ = -1;
+    termination_ = Termination::Finished;
+    write_to_sink(output, written);
+    return UIBehavior::FinishRun;
+  }
+
+  auto before = variant_env;
+  auto behavior = run_tier(output, 0);
+  if (termination_ == Termination::Finished) {
+    // Record what the run assigned so replaying it applies the same writes
+    auto result = RunResult{output.substr(written), {}};
+    for (const auto& [name, value] : variant_env) {
+      auto v = before.find(name);
+      if (v == before.end() || v->second != value) {
+        result.variants.insert(std::make_pair(name, value));
+      }
+    }
+    run_cache_.insert(start, std::move(result));
+  }
+  write_to_sink(output, written);
+  return behavior;
+}
+UIBehavior MiniBasic::run_for(Str& output, uint64_t steps) {
+  auto written = output.size();
+  if (tier_ != Tier::TreeWalker) {
+    parse_pending(output);
+  }
+  auto behavior = run_tier(output, steps);
+  write_to_sink(output, written);
+  return behavior;
+}
+UIBehavior MiniBasic::run_tier(Str& output, uint64_t slice) {
+  pause_period_ = 0;
+  auto lower = [this](int64_t period) {
+    pause_period_ =
+        pause_period_ == 0 ? period : std::min(pause_period_, period);
+  };
+  if (cycle_period_ > 0) {
+    lower(cycle_period_);
+  }
+  if (quota_.limited()) {
+    lower(std::max<int64_t>(quota_.check_period, 1));
+  }
+  if (slice > 0) {
+    lower(static_cast<int64_t>(
+        std::min<uint64_t>(slice, std::numeric_limits<int64_t>::max())));
+  }
+  // A repeat across INPUT proves nothing, but one across slices does
+  if (termination_ != Termination::Yielded) {
+    cycles_.reset();
+  }
+
+  uint64_t sliced{};
+  while (true) {
+    auto began = std::chrono::steady_clock::now();
+    auto chunk = output.size();
+    auto behavior = run_slice(output);
+    run_time_ += std::chrono::steady_clock::now() - began;
+    run_output_ += output.size() - chunk;
+    if (behavior == UIBehavior::None) {
+      run_steps_ += pause_period_;
+    }
+
+    if (quota_.max_output != 0 && run_output_ > quota_.max_output) {
+      output.resize(output.size() - (run_output_ - quota_.max_output));
+      run_output_ = quota_.max_output;
+      return stop(output, Termination::OutputQuota);
+    }
+    if (quota_.max_variables != 0 &&
+        variant_env.size() > quota_.max_variables) {
+      return stop(output, Termination::VariableQuota);
+    }
+    if (behavior != UIBehavior::None) {
+      termination_ = behavior == UIBehavior::Input
+                         ? Termination::WaitingForInput
+                         : Termination::Finished;
+      return behavior;
+    }
+    if (quota_.max_steps != 0 && run_steps_ >= quota_.max_steps) {
+      return stop(output, Termination::StepQuota);
+    }
+    if (quota_.max_time.count() != 0 && run_time_ >= quota_.max_time) {
+      return stop(output, Termination::TimeQuota);
+    }
+    if (cycle_period_ > 0 && cycles_.repeats(pc_, variant_env, run_state_)) {
+      return stop(output, Termination::EndlessLoop);
+    }
+    if (slice > 0 && (sliced += pause_period_) >= slice) {
+      termination_ = Termination::Yielded;
+      return UIBehavior::Yield;
+    }
+  }
+}
+UIBehavior MiniBasic::stop(Str& output, Termination reason) {
+  switch (reason) {
+    case Termination::StepQuota:
+      output.append("ERROR: step quota exceeded\n");
+      break;
+    case Termination::OutputQuota:
+      if (!output.empty() && output.back() != '\n') {
+        output.push_back('\n');
+      }
+      output.append("ERROR: output quota exceeded\n");
+      break;
+    case Termination::VariableQuota:
+      output.append("ERROR: variable quota exceeded\n");
+      break;
+    case Termination::TimeQuota:
+      output.append("ERROR: time quota exceeded\n");
+      break;
+    case Termination::EndlessLoop:
+      output.append("ERROR: endless loop at line " + std::to_string(pc_) +
+                    ", the same state repeats\n");
+      break;
+    default:
+      break;
+  }
+  pc_ = -1;
+  termination_ = reason;
+  return UIBehavior::FinishRun;
+}
+UIBehavior MiniBasic::run_slice(Str& output) {
+  UIBehavior behavior;
+  auto tier = tier_ == Tier::Jit && pause_period_ > 0 ? Tier::Bytecode : tier_;
+  switch (tier) {
+    case Tier::Closure:
+      behavior = run_compiled(closure_program_, closure_version_, output);
+      break;
+    case Tier::Bytecode:
+      behavior = run_compiled(bytecode_program_, bytecode_version_, output,
+                              bytecode::Dispatch::Threaded);
+      break;
+    case Tier::BytecodeSwitch:
+      behavior = run_compiled(bytecode_program_, bytecode_version_, output,
+                              bytecode::Dispatch::Switch);
+      break;
+    case Tier::Jit:
+      behavior = run_compiled(jit_program_, jit_version_, output);
+      break;
+    case Tier::TreeWalker:
+    default:
+      behavior = run_tree_walker(output);
+      break;
+  }
+  return behavior;
+}
+UIBehavior MiniBasic::run_tree_walker(Str& output) {
+  auto countdown = pause_period_;
+  while (true) {
+    auto chunk = output.size();
+    auto line = pc_;
+    auto behavior = step(output);
+    if (output.size() > chunk && output.back() != '\n') {
+      output.push_back('\n');
+    }
+    if (behavior == UIBehavior::Input || behavior == UIBehavior::FinishRun) {
+      return behavior;
+    }
+    if (countdown > 0 && pc_ != -1 && pc_ <= line && --countdown == 0) {
+      return UIBehavior::None;
+    }
+  }
+}
+void MiniBasic::write_to_sink(const Str& output, size_t from) {
+  if (output_sink_ != nullptr && output.size() > from) {
+    output_sink_->write(output.data() + from,
+                        static_cast<std::streamsize>(output.size() - from));
+    if (output.back() != '\n') {
+      output_sink_->put('\n');
+    }
+  }
 }
 UIBehavior MiniBasic::handle_command(const Str& command, Str& output) {
-  auto node = parser::Parser().parse(tokenizer::Tokenizer().lex(command));
+  auto node = parse_line(command);
   if (typeid(*node) == typeid(parser::ast_node::LineNoStmt)) {
     auto l = std::static_pointer_cast<parser::ast_node::LineNoStmt>(node);
-    auto a = ast.find(l->number()->value());
-    if (a != ast.end()) {
-      a->second = l;
-    } else {
-      ast.insert(std::make_pair(l->number()->value(), l));
-    }
-    auto s = source.find(l->number()->value());
-    if (s != source.end()) {
-      s->second = command;
-    } else {
-      source.insert(std::make_pair(l->number()->value(), command));
-    }
+    auto line = l->number()->value();
+    auto kind = lines_.count(line) ? LineChange::Kind::Replaced
+                                : LineChange::Kind::Inserted;
+    remember(kind, line);
+    put_line(line, Line{command, l});
+    record_change(kind, line);
     return UIBehavior::None;
   }
 
   else if (typeid(*node) == typeid(parser::ast_node::Input) ||
            typeid(*node) == typeid(parser::ast_node::Print) ||
-           typeid(*node) == typeid(parser::ast_node::Let)) {
+           typeid(*node) == typeid(parser::ast_node::Let) ||
+           typeid(*node) == typeid(parser::ast_node::LetElement) ||
+           typeid(*node) == typeid(parser::ast_node::Dim) ||
+           typeid(*node) == typeid(parser::ast_node::Mat) ||
+           typeid(*node) == typeid(parser::ast_node::Sort)) {
     auto s = std::static_pointer_cast<parser::ast_node::Stmt>(node);
+    // A paused run goes on with values its analyses never saw
+    if (typeid(*node) != typeid(parser::ast_node::Print)) {
+      run_version_ = program_version_ - 1;
+    }
     int64_t ignore;
-    return s->run(variant_env, ignore, output, variant_need_input_);
+    auto written = output.size();
+    auto behavior =
+        s->run(variant_env, ignore, output, variant_need_input_, run_state_);
+    write_to_sink(output, written);
+    return behavior;
 
   } else if (typeid(*node) == typeid(parser::ast_node::Run)) {
     return UIBehavior::Run;
@@ -87,21 +849,144 @@ UIBehavior MiniBasic::handle_command(const Str& command, Str& output) {
     return UIBehavior::List;
   } else if (typeid(*node) == typeid(parser::ast_node::Clear)) {
     return UIBehavior::Clear;
+  } else if (typeid(*node) == typeid(parser::ast_node::Undo)) {
+    if (!undo()) {
+      auto written = output.size();
+      output.append("WARNING: nothing to undo\n");
+      write_to_sink(output, written);
+    }
+    return UIBehavior::None;
+  } else if (typeid(*node) == typeid(parser::ast_node::Redo)) {
+    if (!redo()) {
+      auto written = output.size();
+      output.append("WARNING: nothing to redo\n");
+      write_to_sink(output, written);
+    }
+    return UIBehavior::None;
+  } else if (typeid(*node) == typeid(parser::ast_node::Check)) {
+    auto written = output.size();
+    parse_pending(output);
+    write_to_sink(output, written);
+    return UIBehavior::None;
   } else if (typeid(*node) == typeid(parser::ast_node::Help)) {
     return UIBehavior::Help;
   } else if (typeid(*node) == typeid(parser::ast_node::Quit)) {
     return UIBehavior::Quit;
   } else if (typeid(*node) == typeid(parser::ast_node::ClearLine)) {
-    auto l = static_cast<parser::ast_node::ClearLine>(node).number()->value();
-    source.erase(l);
-    ast.erase(l);
+    auto l = std::static_pointer_cast<parser::ast_node::ClearLine>(node)
+                 ->number()
+                 ->value();
+    if (lines_.count(l)) {
+      remember(LineChange::Kind::Deleted, l);
+      erase_line(l);
+      record_change(LineChange::Kind::Deleted, l);
+    }
     return UIBehavior::None;
   }
   return UIBehavior::None;
 }
+Snapshot MiniBasic::snapshot() const {
+  program();
+  return Snapshot{program_hash_, pc_, variant_need_input_, variant_env,
+                  run_state_.loops.loops(), run_state_.calls.returns(),
+                  run_state_.arrays};
+}
+bool MiniBasic::restore(const Snapshot& snapshot) {
+  const auto& lines = program();
+  if (snapshot.program != program_hash_ ||
+      (snapshot.pc != -1 && !lines.count(snapshot.pc) &&
+       !lines_.count(snapshot.pc)) ||
+      snapshot.calls.size() > run_state_.calls.max_depth()) {
+    return false;
+  }
+  pc_ = snapshot.pc;
+  jumped_to_ = -1;
+  variant_env = snapshot.variants;
+  variant_need_input_ = snapshot.need_input;
+  run_state_.loops.clear();
+  for (const auto& loop : snapshot.loops) {
+    run_state_.loops.push(loop);
+  }
+  run_state_.calls.clear();
+  for (auto line : snapshot.calls) {
+    run_state_.calls.push(line);
+  }
+  run_state_.arrays = snapshot.arrays;
+  termination_ = Termination::None;
+  run_steps_ = 0;
+  run_output_ = 0;
+  run_time_ = {};
+
+  // A snapshot from a run of this program has every variable the analysis
+  // proves assigned at its line and values, loops and arrays the bounds
+  // analysis allows there. One that does not, say written by hand, runs
+  // with every read and element access checked instead.
+  auto proven = assigned_->assigned_at(pc_);
+  auto complete =
+      std::all_of(
+          proven.begin(), proven.end(),
+          [this](const Str& name) { return variant_env.count(name) != 0; }) &&
+      bounds_->admits(pc_, variant_env, run_state_);
+  run_version_ = complete ? program_version_ : program_version_ - 1;
+  return true;
+}
+void MiniBasic::remember(LineChange::Kind kind, int64_t line) {
+  remember(Edit{lines_, {LineChange{kind, line}}, unparsed_});
+}
+void MiniBasic::remember(Edit edit) {
+  if (undo_.size() == kMaxUndo) {
+    undo_.pop_front();
+  }
+  undo_.push_back(std::move(edit));
+  redo_.clear();
+}
+bool MiniBasic::undo() {
+  if (undo_.empty()) {
+    return false;
+  }
+  auto edit = std::move(undo_.back());
+  undo_.pop_back();
+  redo_.push_back(Edit{lines_, edit.changes, unparsed_});
+  lines_ = std::move(edit.lines);
+  unparsed_ = edit.unparsed;
+  // Undoing an insert deletes the line and the other way round
+  for (auto change = edit.changes.rbegin(); change != edit.changes.rend();
+       ++change) {
+    auto kind = change->kind;
+    if (kind == LineChange::Kind::Inserted) {
+      kind = LineChange::Kind::Deleted;
+    } else if (kind == LineChange::Kind::Deleted) {
+      kind = LineChange::Kind::Inserted;
+    }
+    record_change(kind, change->line);
+  }
+  return true;
+}
+bool MiniBasic::redo() {
+  if (redo_.empty()) {
+    return false;
+  }
+  auto edit = std::move(redo_.back());
+  redo_.pop_back();
+  undo_.push_back(Edit{lines_, edit.changes, unparsed_});
+  lines_ = std::move(edit.lines);
+  unparsed_ = edit.unparsed;
+  for (const auto& change : edit.changes) {
+    record_change(change.kind, change.line);
+  }
+  return true;
+}
 void MiniBasic::reset_pc() {
-  if (!ast.empty()) {
-    pc_ = ast.begin()->first;
+  run_version_ = program_version_;
+  run_state_.loops.clear();
+  run_state_.calls.clear();
+  termination_ = Termination::None;
+  run_steps_ = 0;
+  run_output_ = 0;
+  run_time_ = {};
+  jumped_to_ = -1;
+  if (!lines_.empty()) {
+    pc_ = lines_.begin()->first;
   } else {
     pc_ = -1;
   }
@@ -0,0 +1,72 @@
+#include "parse_cache.h"
+
+namespace engine {
+
+uint64_t ParseCache::hash(std::string_view text) {
+  auto h = kFnvOffset;
+  for (auto c : text) {
+    h ^= static_cast<uint8_t>(c);
+    h *= kFnvPrime;
+  }
+  return h;
+}
+
+Rc<parser::ast_node::Stmt> ParseCache::find(std::string_view text) {
+  auto h = hash(text);
+  auto [begin, end] = index_.equal_range(h);
+  for (auto i = begin; i != end; ++i) {
+    if (i->second->text == text) {
+      lru_.splice(lru_.begin(), lru_, i->second);
+      ++hits_;
+      return lru_.front().stmt;
+    }
+  }
+  ++misses_;
+  return nullptr;
+}
+
+void ParseCache::insert(std::string_view text,
+                        const Rc<parser::ast_node::Stmt>& stmt) {
+  if (capacity_ == 0) {
+    return;
+  }
+  auto h = hash(text);
+  auto [begin, end] = index_.equal_range(h);
+  for (auto i = begin; i != end; ++i) {
+    if (i->second->text == text) {
+      i->second->stmt = stmt;
+      lru_.splice(lru_.begin(), lru_, i->second);
+      return;
+    }
+  }
+  lru_.push_front(Entry{h, Str(text), stmt});
+  index_.insert(std::make_pair(h, lru_.begin()));
+  evict();
+}
+
+void ParseCache::set_capacity(size_t capacity) {
+  capacity_ = capacity;
+  evict();
+}
+
+void ParseCache::clear() {
+  lru_.clear();
+  index_.clear();
+  hits_ = 0;
+  misses_ = 0;
+}
+
+void ParseCache::evict() {
+  while (lru_.size() > capacity_) {
+    auto [begin, end] = index_.equal_range(lru_.back().hash);
+    for (auto i = begin; i != end; ++i) {
+      if (i->second == std::prev(lru_.end())) {
+        index_.erase(i);
+        break;
+      }
+    }
+    lru_.pop_back();
+  }
+}
+
+}  // namespace engine
@@ -0,0 +1,76 @@
+#include "run_cache.h"
+
+#include "parse_cache.h"
+
+namespace engine {
+
+uint64_t RunCache::hash(const RunStart& start) {
+  // FNV-1a continued from the program hash over the line and every
+  // variable; names are hashed on their own so their boundaries count
+  auto h = start.program;
+  mix_u64(h, static_cast<uint64_t>(start.pc));
+  for (const auto& [name, value] : start.variants) {
+    mix_u64(h, ParseCache::hash(name));
+    mix_u64(h, static_cast<uint64_t>(value));
+  }
+  return h;
+}
+
+const RunResult* RunCache::find(const RunStart& start) {
+  auto h = hash(start);
+  auto [begin, end] = index_.equal_range(h);
+  for (auto i = begin; i != end; ++i) {
+    if (i->second->start == start) {
+      lru_.splice(lru_.begin(), lru_, i->second);
+      ++hits_;
+      return &lru_.front().result;
+    }
+  }
+  ++misses_;
+  return nullptr;
+}
+
+void RunCache::insert(const RunStart& start, RunResult result) {
+  if (capacity_ == 0) {
+    return;
+  }
+  auto h = hash(start);
+  auto [begin, end] = index_.equal_range(h);
+  for (auto i = begin; i != end; ++i) {
+    if (i->second->start == start) {
+      i->second->result = std::move(result);
+      lru_.splice(lru_.begin(), lru_, i->second);
+      return;
+    }
+  }
+  lru_.push_front(Entry{h, start, std::move(result)});
+  index_.insert(std::make_pair(h, lru_.begin()));
+  evict();
+}
+
+void RunCache::set_capacity(size_t capacity) {
+  capacity_ = capacity;
+  evict();
+}
+
+void RunCache::clear() {
+  lru_.clear();
+  index_.clear();
+  hits_ = 0;
+  misses_ = 0;
+}
+
+void RunCache::evict() {
+  while (lru_.size() > capacity_) {
+    auto [begin, end] = index_.equal_range(lru_.back().hash);
+    for (auto i = begin; i != end; ++i) {
+      if (i->second == std::prev(lru_.end())) {
+        index_.erase(i);
+        break;
+      }
+    }
+    lru_.pop_back();
+  }
+}
+
+}  // namespace engine
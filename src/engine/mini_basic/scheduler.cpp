@@ -0,0 +1,37 @@
+#include "scheduler.h"
+
+namespace engine {
+
+size_t Scheduler::add(MiniBasic& engine, Str& output) {
+  jobs_.push_back(Job{&engine, &output, UIBehavior::Yield});
+  ready_.push_back(jobs_.size() - 1);
+  return jobs_.size() - 1;
+}
+
+bool Scheduler::turn() {
+  if (ready_.empty()) {
+    return false;
+  }
+  auto id = ready_.front();
+  ready_.pop_front();
+  auto& job = jobs_[id];
+  job.state = job.engine->run_for(*job.output, slice_);
+  if (job.state == UIBehavior::Yield) {
+    ready_.push_back(id);
+  }
+  return true;
+}
+
+void Scheduler::run() {
+  while (turn()) {
+  }
+}
+
+void Scheduler::resume(size_t job) {
+  if (jobs_[job].state == UIBehavior::Input) {
+    jobs_[job].state = UIBehavior::Yield;
+    ready_.push_back(job);
+  }
+}
+
+}  // namespace engine
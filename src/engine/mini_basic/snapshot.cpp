@@ -0,0 +1,226 @@
+#include "snapshot.h"
+
+#include <iterator>
+
+namespace engine {
+namespace {
+
+constexpr uint32_t kMagic = 0x4E53424D;  // "MBSN"
+// Version 2 added the FOR loops, version 3 the GOSUBs and version 4 the
+// arrays; older snapshots still decode, with none
+constexpr uint32_t kVersion = 4;
+
+template <typename T>
+void put(Str& out, T value) {
+  auto bits = static_cast<uint64_t>(value);
+  for (size_t i{}; i < sizeof(T); ++i) {
+    out.push_back(static_cast<char>(bits & 0xFF));
+    bits >>= 8;
+  }
+}
+
+void put(Str& out, const Str& text) {
+  put(out, static_cast<uint32_t>(text.size()));
+  out.append(text);
+}
+
+// Reads from the front of `data`, failing once anything runs short
+class Reader {
+ public:
+  explicit Reader(std::string_view data) : data_(data) {}
+
+  template <typename T>
+  bool get(T& value) {
+    if (data_.size() < sizeof(T)) {
+      return false;
+    }
+    uint64_t bits{};
+    for (size_t i{}; i < sizeof(T); ++i) {
+      bits |= static_cast<uint64_t>(static_cast<uint8_t>(data_[i])) << (8 * i);
+    }
+    value = static_cast<T>(bits);
+    data_.remove_prefix(sizeof(T));
+    return true;
+  }
+
+  bool get(Str& text) {
+    uint32_t size{};
+    if (!get(size) || data_.size() < size) {
+      return false;
+    }
+    text.assign(data_.data(), size);
+    data_.remove_prefix(size);
+    return true;
+  }
+
+  [[nodiscard]] bool done() const { return data_.empty(); }
+  [[nodiscard]] size_t remaining() const { return data_.size(); }
+
+ private:
+  std::string_view data_;
+};
+
+}  // namespace
+
+Str Snapshot::encode() const {
+  Str out;
+  auto names = size_t{};
+  for (const auto& variant : variants) {
+    names += variant.first.size();
+  }
+  for (const auto& loop : loops) {
+    names += loop.variant.size();
+  }
+  auto elements = size_t{};
+  for (const auto& [name, array] : arrays) {
+    names += name.size();
+    elements += array.extents.size() + array.values.size();
+  }
+  out.reserve(52 + need_input.size() + names + variants.size() * 12 +
+              loops.size() * 28 + calls.size() * 8 + arrays.size() * 8 +
+              elements * 8);
+  put(out, kMagic);
+  put(out, kVersion);
+  put(out, program);
+  put(out, pc);
+  put(out, need_input);
+  put(out, static_cast<uint32_t>(variants.size()));
+  for (const auto& [name, value] : variants) {
+    put(out, name);
+    put(out, value);
+  }
+  put(out, static_cast<uint32_t>(loops.size()));
+  for (const auto& loop : loops) {
+    put(out, loop.variant);
+    put(out, loop.limit);
+    put(out, loop.step);
+    put(out, loop.body);
+  }
+  put(out, static_cast<uint32_t>(calls.size()));
+  for (auto line : calls) {
+    put(out, line);
+  }
+  // Each array's bounds, then its elements row by row
+  put(out, static_cast<uint32_t>(arrays.size()));
+  for (const auto& [name, array] : arrays) {
+    put(out, name);
+    put(out, static_cast<uint32_t>(array.extents.size()));
+    for (auto extent : array.extents) {
+      put(out, extent - 1);
+    }
+    for (auto value : array.values) {
+      put(out, value);
+    }
+  }
+  return out;
+}
+
+bool Snapshot::decode(std::string_view data, Snapshot& snapshot) {
+  auto reader = Reader(data);
+  uint32_t magic{};
+  uint32_t version{};
+  uint32_t count{};
+  auto decoded = Snapshot();
+  if (!reader.get(magic) || magic != kMagic || !reader.get(version) ||
+      version < 1 || version > kVersion || !reader.get(decoded.program) ||
+      !reader.get(decoded.pc) || !reader.get(decoded.need_input) ||
+      !reader.get(count)) {
+    return false;
+  }
+  // Names come out of the map sorted, so each insert lands at the end
+  for (uint32_t i{}; i < count; ++i) {
+    Str name;
+    int64_t value{};
+    if (!reader.get(name) || !reader.get(value)) {
+      return false;
+    }
+    decoded.variants.emplace_hint(decoded.variants.end(), std::move(name),
+                                  value);
+  }
+  if (decoded.variants.size() != count) {
+    return false;
+  }
+  if (version >= 2) {
+    if (!reader.get(count)) {
+      return false;
+    }
+    for (uint32_t i{}; i < count; ++i) {
+      auto loop = parser::Loop();
+      if (!reader.get(loop.variant) || !reader.get(loop.limit) ||
+          !reader.get(loop.step) || !reader.get(loop.body)) {
+        return false;
+      }
+      decoded.loops.push_back(std::move(loop));
+    }
+  }
+  if (version >= 3) {
+    if (!reader.get(count)) {
+      return false;
+    }
+    for (uint32_t i{}; i < count; ++i) {
+      int64_t line{};
+      if (!reader.get(line)) {
+        return false;
+      }
+      decoded.calls.push_back(line);
+    }
+  }
+  if (version >= 4) {
+    if (!reader.get(count)) {
+      return false;
+    }
+    for (uint32_t i{}; i < count; ++i) {
+      Str name;
+      uint32_t rank{};
+      int64_t bounds[parser::Array::kMaxRank]{};
+      if (!reader.get(name) || !reader.get(rank) || rank == 0 ||
+          rank > parser::Array::kMaxRank) {
+        return false;
+      }
+      // The elements must all be there before DIM allocates room for them
+      auto elements = uint64_t{1};
+      for (uint32_t d{}; d < rank; ++d) {
+        if (!reader.get(bounds[d]) || bounds[d] < 0 ||
+            bounds[d] >= parser::Array::kMaxElements) {
+          return false;
+        }
+        elements *= static_cast<uint64_t>(bounds[d]) + 1;
+      }
+      if (reader.remaining() / sizeof(int64_t) < elements) {
+        return false;
+      }
+      auto array = parser::Array();
+      if (!array.dim(bounds, rank)) {
+        return false;
+      }
+      for (auto& value : array.values) {
+        if (!reader.get(value)) {
+          return false;
+        }
+      }
+      decoded.arrays.emplace_hint(decoded.arrays.end(), std::move(name),
+                                  std::move(array));
+    }
+    if (decoded.arrays.size() != count) {
+      return false;
+    }
+  }
+  if (!reader.done()) {
+    return false;
+  }
+  snapshot = std::move(decoded);
+  return true;
+}
+
+void Snapshot::write(std::ostream& out) const {
+  auto data = encode();
+  out.write(data.data(), static_cast<std::streamsize>(data.size()));
+}
+
+bool Snapshot::read(std::istream& in, Snapshot& snapshot) {
+  auto data = Str(std::istreambuf_iterator<char>(in),
+                  std::istreambuf_iterator<char>());
+  return decode(data, snapshot);
+}
+
+}  // namespace engine
@@ -0,0 +1,575 @@
+#include "transpiler.h"
+
+#include <set>
+#include <sstream>
+
+#include "bounds_check.h"
+#include "definite_assignment.h"
+
+namespace engine {
+namespace {
+
+using namespace parser::ast_node;
+
+constexpr auto kRuntime = R"(#include <algorithm>
+#include <cinttypes>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <initializer_list>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+[[maybe_unused]] int64_t read(int64_t value, bool defined, const char* name) {
+  if (defined) {
+    return value;
+  }
+  std::printf("WARNING: Unknown variable %s\n", name);
+  return 0;
+}
+
+[[maybe_unused]] int64_t power(int64_t base, int64_t exponent) {
+  return static_cast<int64_t>(std::pow(base, exponent));
+}
+
+[[maybe_unused]] void print(int64_t value) {
+  std::printf("%" PRId64 "\n", value);
+}
+
+// Keeps asking until a line holds a number; false at the end of input
+[[maybe_unused]] bool input(int64_t& value, bool& defined, const char* name) {
+  std::printf("INPUT %s\n", name);
+  std::fflush(stdout);
+  std::string line;
+  while (std::getline(std::cin, line)) {
+    try {
+      value = std::stoll(line);
+      defined = true;
+      return true;
+    } catch (std::exception const&) {
+    }
+  }
+  return false;
+}
+
+// An active FOR loop over variable number `variable`; `body` numbers the
+// line NEXT jumps back to
+struct Loop {
+  int variable;
+  int64_t limit;
+  int64_t step;
+  int body;
+};
+std::vector<Loop> loops;
+
+// Starts a loop, ending one already running over the same variable with the
+// loops inside it; false when 256 loops are running
+[[maybe_unused]] bool push_loop(const Loop& loop) {
+  for (size_t i = 0; i < loops.size(); ++i) {
+    if (loops[i].variable == loop.variable) {
+      loops.resize(i);
+      break;
+    }
+  }
+  if (loops.size() == 256) {
+    return false;
+  }
+  loops.push_back(loop);
+  return true;
+}
+
+// The innermost loop over `variable` after ending the loops inside it
+[[maybe_unused]] Loop* find_loop(int variable) {
+  for (size_t i = loops.size(); i-- > 0;) {
+    if (loops[i].variable == variable) {
+      loops.resize(i + 1);
+      return &loops[i];
+    }
+  }
+  return nullptr;
+}
+
+// Bound + 1 per dimension, and the elements row by row
+struct Array {
+  std::vector<int64_t> extents;
+  std::vector<int64_t> values;
+};
+
+[[maybe_unused]] std::string element_name(
+    const char* name, std::initializer_list<int64_t> indices) {
+  std::string text = std::string(name) + "(";
+  for (auto index : indices) {
+    text += (text.back() == '(' ? "" : ", ") + std::to_string(index);
+  }
+  return text + ')';
+}
+
+[[maybe_unused]] bool dim(Array& array, const char* name,
+                          std::initializer_list<int64_t> bounds) {
+  int64_t size = 1;
+  for (auto bound : bounds) {
+    if (bound < 0 || bound >= (INT64_C(1) << 24) ||
+        size * (bound + 1) > (INT64_C(1) << 24)) {
+      std::printf("ERROR: DIM %s out of range\n",
+                  element_name(name, bounds).c_str());
+      return false;
+    }
+    size *= bound + 1;
+  }
+  array.extents.clear();
+  for (auto bound : bounds) {
+    array.extents.push_back(bound + 1);
+  }
+  array.values.assign(static_cast<size_t>(size), 0);
+  return true;
+}
+
+// nullptr after reporting why there is no element at `indices`
+[[maybe_unused]] int64_t* element(Array& array, const char* name,
+                                  std::initializer_list<int64_t> indices) {
+  if (array.extents.empty()) {
+    std::printf("ERROR: array %s used before DIM\n", name);
+    return nullptr;
+  }
+  if (array.extents.size() != indices.size()) {
+    std::printf("ERROR: wrong number of indices for %s\n", name);
+    return nullptr;
+  }
+  int64_t at = 0;
+  size_t i = 0;
+  for (auto index : indices) {
+    if (index < 0 || index >= array.extents[i]) {
+      std::printf("ERROR: index %s out of range\n",
+                  element_name(name, indices).c_str());
+      return nullptr;
+    }
+    at = at * array.extents[i++] + index;
+  }
+  return &array.values[at];
+}
+
+// False after reporting that `array` cannot be used whole
+[[maybe_unused]] bool whole(const Array& array, const char* name) {
+  if (array.extents.empty()) {
+    std::printf("ERROR: array %s used before DIM\n", name);
+    return false;
+  }
+  return true;
+}
+
+enum class MatOp { Add, Subtract, Scale };
+
+// target = left op right, or left * factor; false after reporting operands
+// that are not DIM'd or differ in shape. Arithmetic wraps like the engine's.
+[[maybe_unused]] bool mat(Array& target, MatOp op, const Array& left,
+                          const char* left_name, const Array& right,
+                          const char* right_name, int64_t factor) {
+  if (!whole(left, left_name) || !whole(right, right_name)) {
+    return false;
+  }
+  if (op != MatOp::Scale && left.extents != right.extents) {
+    std::printf("ERROR: MAT %s and %s differ in shape\n", left_name,
+                right_name);
+    return false;
+  }
+  if (&target != &left) {
+    target.extents = left.extents;
+    target.values.resize(left.values.size());
+  }
+  for (size_t i = 0; i < target.values.size(); ++i) {
+    auto a = static_cast<uint64_t>(left.values[i]);
+    auto b = static_cast<uint64_t>(op == MatOp::Scale ? factor
+                                                      : right.values[i]);
+    target.values[i] = static_cast<int64_t>(
+        op == MatOp::Add ? a + b : op == MatOp::Subtract ? a - b : a * b);
+  }
+  return true;
+}
+
+enum class Reduction { Sum, Min, Max };
+
+// Sets `value` to the sum, least or greatest element; false after reporting
+// that `array` was never DIM'd
+[[maybe_unused]] bool reduce(const Array& array, const char* name,
+                             Reduction reduction, int64_t& value) {
+  if (!whole(array, name)) {
+    return false;
+  }
+  if (reduction == Reduction::Min) {
+    value = *std::min_element(array.values.begin(), array.values.end());
+  } else if (reduction == Reduction::Max) {
+    value = *std::max_element(array.values.begin(), array.values.end());
+  } else {
+    uint64_t sum = 0;
+    for (auto element : array.values) {
+      sum += static_cast<uint64_t>(element);
+    }
+    value = static_cast<int64_t>(sum);
+  }
+  return true;
+}
+
+}  // namespace
+)";
+
+class Emitter {
+ public:
+  Emitter(const FlatMap<int64_t, Rc<LineNoStmt>>& ast, std::ostream& body)
+      : ast_(ast), assigned_(ast), bounds_(ast), body_(body) {}
+
+  // Emits one line as a block; false if the statement is not supported
+  bool stmt(int64_t line, const Rc<Stmt>& stmt);
+
+  [[nodiscard]] const std::set<Str>& variables() const { return variables_; }
+  [[nodiscard]] const std::set<int64_t>& targets() const { return targets_; }
+  [[nodiscard]] const std::set<Str>& arrays() const { return arrays_; }
+  // Lines NEXT jumps back to, by the number FOR gives them
+  [[nodiscard]] const Vec<int64_t>& bodies() const { return bodies_; }
+
+ private:
+  const FlatMap<int64_t, Rc<LineNoStmt>>& ast_;
+  // The generated program always starts with no variables, so reads proven
+  // to follow an assignment use the variable directly
+  DefiniteAssignment assigned_;
+  BoundsCheck bounds_;
+  std::ostream& body_;
+  int64_t line_{};
+  std::set<Str> variables_;
+  std::set<int64_t> targets_;
+  std::set<Str> arrays_;
+  Map<Str, int> loop_variables_;
+  Vec<int64_t> bodies_;
+  uint32_t temps_{};
+
+  // Returns a constant, a variable or a temporary holding the value of
+  // `expr`; the temporaries are written to the body first, so call it before
+  // streaming
+  Str expr(const Rc<Expr>& expr);
+  Str temp(const Str& value);
+  Str jump(int64_t line);
+  Str variable(const Str& name) {
+    variables_.insert(name);
+    return "v_" + name;
+  }
+  Str defined(const Str& name) {
+    variables_.insert(name);
+    return "d_" + name;
+  }
+  Str array(const Str& name) {
+    arrays_.insert(name);
+    return "a_" + name;
+  }
+  int loop_variable(const Str& name) {
+    return loop_variables_
+        .insert(std::make_pair(name, static_cast<int>(loop_variables_.size())))
+        .first->second;
+  }
+  // The indices of `access` as a braced list, or its element when the
+  // analysis proves it in range
+  Str indices(const Rc<ArrayExpr>& access);
+  // Address of the element `access` names, ending the program when it has
+  // none
+  Str element(const Rc<ArrayExpr>& access, const Str& indices);
+};
+
+Str Emitter::temp(const Str& value) {
+  auto name = "t" + std::to_string(temps_++);
+  body_ << "    const int64_t " << name << " = " << value << ";\n";
+  return name;
+}
+
+Str Emitter::indices(const Rc<ArrayExpr>& access) {
+  auto list = Str("{");
+  for (const auto& index : access->indices()) {
+    list += (list.size() > 1 ? ", " : "") + expr(index);
+  }
+  return list + "}";
+}
+
+Str Emitter::element(const Rc<ArrayExpr>& access, const Str& indices) {
+  auto name = access->variant()->value();
+  auto values = array(name) + ".values";
+  if (bounds_.in_bounds(line_, *access)) {
+    // `indices` is "{i}" or "{i, j}"
+    auto list = indices.substr(1, indices.size() - 2);
+    auto comma = list.find(", ");
+    if (comma == Str::npos) {
+      return "&" + values + "[" + list + "]";
+    }
+    return "&" + values + "[" + list.substr(0, comma) + " * " + array(name) +
+           ".extents[1] + " + list.substr(comma + 2) + "]";
+  }
+  auto at = "t" + std::to_string(temps_++);
+  body_ << "    int64_t* const " << at << " = element(" << array(name) << ", \""
+        << name << "\", " << indices << ");\n"
+        << "    if (" << at << " == nullptr) {\n"
+        << "      goto end;\n"
+        << "    }\n";
+  return at;
+}
+
+Str Emitter::jump(int64_t line) {
+  if (!ast_.count(line)) {
+    return "goto end;";
+  }
+  targets_.insert(line);
+  return "goto line_" + std::to_string(line) + ";";
+}
+
+Str Emitter::expr(const Rc<Expr>& expr) {
+  const auto& type = typeid(*expr);
+  if (type == typeid(IntegerExpr)) {
+    return "INT64_C(" +
+           std::to_string(
+               std::static_pointer_cast<IntegerExpr>(expr)->integer()->value()) +
+           ")";
+  }
+  if (type == typeid(VariantExpr)) {
+    auto name = std::static_pointer_cast<VariantExpr>(expr)->variant()->value();
+    if (assigned_.assigned(line_, name)) {
+      return variable(name);
+    }
+    return temp("read(" + variable(name) + ", " + defined(name) + ", \"" +
+                name + "\")");
+  }
+  if (type == typeid(NegExpr)) {
+    auto operand = this->expr(std::static_pointer_cast<NegExpr>(expr)->expr());
+    return temp("-" + operand);
+  }
+  if (type == typeid(PosExpr)) {
+    return this->expr(std::static_pointer_cast<PosExpr>(expr)->expr());
+  }
+  if (type == typeid(ArrayExpr)) {
+    auto access = std::static_pointer_cast<ArrayExpr>(expr);
+    return temp("*" + element(access, indices(access)));
+  }
+  if (type == typeid(ReduceExpr)) {
+    auto node = std::static_pointer_cast<ReduceExpr>(expr);
+    auto name = node->variant()->value();
+    auto reduction = node->reduction() == parser::Reduction::Sum ? "Sum"
+                     : node->reduction() == parser::Reduction::Min ? "Min"
+                                                                   : "Max";
+    auto value = "t" + std::to_string(temps_++);
+    body_ << "    int64_t " << value << " = 0;\n"
+          << "    if (!reduce(" << array(name) << ", \"" << name
+          << "\", Reduction::" << reduction << ", " << value << ")) {\n"
+          << "      goto end;\n"
+          << "    }\n";
+    return value;
+  }
+  if (type == typeid(PowerExpr)) {
+    auto node = std::static_pointer_cast<PowerExpr>(expr);
+    auto left = this->expr(node->left());
+    return temp("power(" + left + ", " + this->expr(node->right()) + ")");
+  }
+#define BINARY(Node, format)                          \
+  if (type == typeid(Node)) {                         \
+    auto node = std::static_pointer_cast<Node>(expr); \
+    auto left = this->expr(node->left());             \
+    auto right = this->expr(node->right());           \
+    return temp(format);                              \
+  }
+  BINARY(PlusExpr, left + " + " + right)
+  BINARY(MinusExpr, left + " - " + right)
+  BINARY(MultiplyExpr, left + " * " + right)
+  BINARY(DivideExpr, left + " / " + right)
+  BINARY(LessExpr, "int64_t(" + left + " < " + right + ")")
+  BINARY(GreaterExpr, "int64_t(" + left + " > " + right + ")")
+  BINARY(EqualExpr, "int64_t(" + left + " == " + right + ")")
+#undef BINARY
+  return {};
+}
+
+bool Emitter::stmt(int64_t line, const Rc<Stmt>& stmt) {
+  line_ = line;
+  temps_ = 0;
+  const auto& type = typeid(*stmt);
+  if (type == typeid(Let)) {
+    auto node = std::static_pointer_cast<Let>(stmt);
+    auto value = expr(node->expr());
+    auto name = node->variant()->value();
+    body_ << "    " << variable(name) << " = " << value << ";\n";
+    body_ << "    " << defined(name) << " = true;\n";
+    return true;
+  }
+  if (type == typeid(Print)) {
+    auto value = expr(std::static_pointer_cast<Print>(stmt)->expr());
+    body_ << "    print(" << value << ");\n";
+    return true;
+  }
+  if (type == typeid(Input)) {
+    auto name = std::static_pointer_cast<Input>(stmt)->variant()->value();
+    body_ << "    if (!input(" << variable(name) << ", " << defined(name)
+          << ", \"" << name << "\")) {\n"
+          << "      goto end;\n"
+          << "    }\n";
+    return true;
+  }
+  if (type == typeid(Goto)) {
+    body_ << "    "
+          << jump(std::static_pointer_cast<Goto>(stmt)->number()->value())
+          << "\n";
+    return true;
+  }
+  if (type == typeid(If)) {
+    auto node = std::static_pointer_cast<If>(stmt);
+    auto condition = expr(node->expr());
+    body_ << "    if (" << condition << " != 0) {\n"
+          << "      " << jump(node->number()->value()) << "\n"
+          << "    }\n";
+    return true;
+  }
+  if (type == typeid(End)) {
+    body_ << "    goto end;\n";
+    return true;
+  }
+  if (type == typeid(Rem)) {
+    return true;
+  }
+  if (type == typeid(For)) {
+    auto node = std::static_pointer_cast<For>(stmt);
+    auto start = expr(node->start());
+    auto limit = expr(node->limit());
+    auto step = node->step() ? expr(node->step()) : Str("INT64_C(1)");
+    auto name = node->variant()->value();
+    auto body = ast_.upper_bound(line);
+    bodies_.push_back(body == ast_.end() ? -1 : body->first);
+    if (body != ast_.end()) {
+      targets_.insert(body->first);
+    }
+    body_ << "    " << variable(name) << " = " << start << ";\n"
+          << "    " << defined(name) << " = true;\n"
+          << "    if (!push_loop({" << loop_variable(name) << ", " << limit
+          << ", " << step << ", " << bodies_.size() - 1 << "})) {\n"
+          << "      std::printf(\"ERROR: FOR loops nested too deeply\\n\");\n"
+          << "      goto end;\n"
+          << "    }\n";
+    return true;
+  }
+  if (type == typeid(Next)) {
+    auto name = std::static_pointer_cast<Next>(stmt)->variant()->value();
+    body_ << "    Loop* const loop = find_loop(" << loop_variable(name)
+          << ");\n"
+          << "    if (loop == nullptr) {\n"
+          << "      std::printf(\"ERROR: NEXT " << name
+          << " without FOR\\n\");\n"
+          << "      goto end;\n"
+          << "    }\n"
+          << "    " << variable(name) << " += loop->step;\n"
+          << "    " << defined(name) << " = true;\n"
+          << "    if (loop->step >= 0 ? " << variable(name)
+          << " <= loop->limit : " << variable(name) << " >= loop->limit) {\n"
+          << "      body = loop->body;\n"
+          << "      goto loop_body;\n"
+          << "    }\n"
+          << "    loops.pop_back();\n";
+    return true;
+  }
+  if (type == typeid(Dim)) {
+    auto node = std::static_pointer_cast<Dim>(stmt);
+    auto bounds = Str("{");
+    for (const auto& bound : node->bounds()) {
+      bounds += (bounds.size() > 1 ? ", " : "") + expr(bound);
+    }
+    auto name = node->variant()->value();
+    body_ << "    if (!dim(" << array(name) << ", \"" << name << "\", "
+          << bounds << "})) {\n"
+          << "      goto end;\n"
+          << "    }\n";
+    return true;
+  }
+  if (type == typeid(LetElement)) {
+    auto node = std::static_pointer_cast<LetElement>(stmt);
+    // Indices, then the value, then the bounds check
+    auto at = indices(node->element());
+    auto value = expr(node->expr());
+    body_ << "    *" << element(node->element(), at) << " = " << value
+          << ";\n";
+    return true;
+  }
+  if (type == typeid(Mat)) {
+    auto node = std::static_pointer_cast<Mat>(stmt);
+    auto factor = node->factor() ? expr(node->factor()) : Str("0");
+    auto left = node->left()->value();
+    auto right = node->right() ? node->right()->value() : left;
+    auto op = node->op() == parser::MatOp::Add        ? "Add"
+              : node->op() == parser::MatOp::Subtract ? "Subtract"
+                                                      : "Scale";
+    body_ << "    if (!mat(" << array(node->target()->value())
+          << ", MatOp::" << op << ", " << array(left) << ", \"" << left
+          << "\", " << array(right) << ", \"" << right << "\", " << factor
+          << ")) {\n"
+          << "      goto end;\n"
+          << "    }\n";
+    return true;
+  }
+  if (type == typeid(Sort)) {
+    auto name = std::static_pointer_cast<Sort>(stmt)->variant()->value();
+    body_ << "    if (!whole(" << array(name) << ", \"" << name << "\")) {\n"
+          << "      goto end;\n"
+          << "    }\n"
+          << "    std::sort(" << array(name) << ".values.begin(), "
+          << array(name) << ".values.end());\n";
+    return true;
+  }
+  return false;
+}
+
+}  // namespace
+
+Str transpile_to_cpp(const FlatMap<int64_t, Rc<LineNoStmt>>& ast) {
+  // Lines go into their own blocks so jumps never cross an initialization
+  std::stringstream body;
+  auto emitter = Emitter(ast, body);
+  auto blocks = Vec<std::pair<int64_t, Str>>();
+  for (const auto& [line, node] : ast) {
+    body.str({});
+    if (!emitter.stmt(line, node->stmt())) {
+      return {};
+    }
+    blocks.emplace_back(line, body.str());
+  }
+
+  std::stringstream out;
+  out << "// Generated from a MiniBasic program\n" << kRuntime << "\n";
+  out << "int main() {\n";
+  for (const auto& name : emitter.variables()) {
+    out << "  int64_t v_" << name << " = 0;\n";
+    out << "  bool d_" << name << " = false;\n";
+  }
+  for (const auto& name : emitter.arrays()) {
+    out << "  Array a_" << name << ";\n";
+  }
+  if (!emitter.bodies().empty()) {
+    out << "  int body = 0;\n";
+  }
+  for (const auto& [line, block] : blocks) {
+    if (emitter.targets().count(line)) {
+      out << "line_" << line << ":\n";
+    }
+    out << "  {  // " << line << "\n" << block << "  }\n";
+  }
+  // NEXT jumps back through here, as labels are not values in C++
+  if (!emitter.bodies().empty()) {
+    out << "  goto end;\n";
+    out << "loop_body:\n";
+    out << "  switch (body) {\n";
+    for (size_t i{}; i < emitter.bodies().size(); ++i) {
+      out << "    case " << i << ":\n";
+      auto line = emitter.bodies()[i];
+      out << "      goto " << (line == -1 ? Str("end")
+                                          : "line_" + std::to_string(line))
+          << ";\n";
+    }
+    out << "  }\n";
+  }
+  out << "end:\n";
+  out << "  return 0;\n";
+  out << "}\n";
+  return out.str();
+}
+
+}  // namespace engine
@@ -0,0 +1,346 @@
+#include "array_kernels.h"
+
+#include <algorithm>
+#include <thread>
+
+#include "type.h"
+
+// Intrinsics and per-function target attributes need GCC or Clang on x86-64;
+// elsewhere every level runs the scalar loops
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#define PARSER_ARRAY_KERNELS_X86 1
+#include <immintrin.h>
+#else
+#define PARSER_ARRAY_KERNELS_X86 0
+#endif
+
+namespace parser {
+namespace {
+
+int64_t wrap_add(int64_t a, int64_t b) {
+  return static_cast<int64_t>(static_cast<uint64_t>(a) +
+                              static_cast<uint64_t>(b));
+}
+int64_t wrap_sub(int64_t a, int64_t b) {
+  return static_cast<int64_t>(static_cast<uint64_t>(a) -
+                              static_cast<uint64_t>(b));
+}
+int64_t wrap_mul(int64_t a, int64_t b) {
+  return static_cast<int64_t>(static_cast<uint64_t>(a) *
+                              static_cast<uint64_t>(b));
+}
+
+// One instruction set's kernels, each over a single range
+struct Table {
+  void (*add)(const int64_t*, const int64_t*, int64_t*, size_t);
+  void (*subtract)(const int64_t*, const int64_t*, int64_t*, size_t);
+  void (*scale)(const int64_t*, int64_t, int64_t*, size_t);
+  int64_t (*sum)(const int64_t*, size_t);
+  int64_t (*min)(const int64_t*, size_t);
+  int64_t (*max)(const int64_t*, size_t);
+};
+
+// Scalar, also the tails of the vector loops
+
+void add_scalar(const int64_t* a, const int64_t* b, int64_t* out, size_t n) {
+  for (size_t i{}; i < n; ++i) {
+    out[i] = wrap_add(a[i], b[i]);
+  }
+}
+void subtract_scalar(const int64_t* a, const int64_t* b, int64_t* out,
+                     size_t n) {
+  for (size_t i{}; i < n; ++i) {
+    out[i] = wrap_sub(a[i], b[i]);
+  }
+}
+void scale_scalar(const int64_t* a, int64_t k, int64_t* out, size_t n) {
+  for (size_t i{}; i < n; ++i) {
+    out[i] = wrap_mul(a[i], k);
+  }
+}
+int64_t sum_scalar(const int64_t* v, size_t n) {
+  int64_t sum{};
+  for (size_t i{}; i < n; ++i) {
+    sum = wrap_add(sum, v[i]);
+  }
+  return sum;
+}
+int64_t min_scalar(const int64_t* v, size_t n) {
+  return *std::min_element(v, v + n);
+}
+int64_t max_scalar(const int64_t* v, size_t n) {
+  return *std::max_element(v, v + n);
+}
+
+constexpr Table kScalar{add_scalar, subtract_scalar, scale_scalar,
+                        sum_scalar, min_scalar,      max_scalar};
+
+#if PARSER_ARRAY_KERNELS_X86
+
+// SSE2, which every x86-64 CPU has. It cannot compare 64-bit lanes, so MIN
+// and MAX stay scalar.
+
+__m128i load(const int64_t* p) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+}
+void store(int64_t* p, __m128i v) {
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v);
+}
+// The low 64 bits of a * b from 32-bit halves:
+// lo * lo + ((hi * lo + lo * hi) << 32)
+__m128i mul(__m128i a, __m128i b) {
+  auto cross = _mm_add_epi64(_mm_mul_epu32(_mm_srli_epi64(a, 32), b),
+                             _mm_mul_epu32(a, _mm_srli_epi64(b, 32)));
+  return _mm_add_epi64(_mm_mul_epu32(a, b), _mm_slli_epi64(cross, 32));
+}
+
+void add_sse2(const int64_t* a, const int64_t* b, int64_t* out, size_t n) {
+  size_t i{};
+  for (; i + 2 <= n; i += 2) {
+    store(out + i, _mm_add_epi64(load(a + i), load(b + i)));
+  }
+  add_scalar(a + i, b + i, out + i, n - i);
+}
+void subtract_sse2(const int64_t* a, const int64_t* b, int64_t* out,
+                   size_t n) {
+  size_t i{};
+  for (; i + 2 <= n; i += 2) {
+    store(out + i, _mm_sub_epi64(load(a + i), load(b + i)));
+  }
+  subtract_scalar(a + i, b + i, out + i, n - i);
+}
+void scale_sse2(const int64_t* a, int64_t k, int64_t* out, size_t n) {
+  auto factor = _mm_set1_epi64x(k);
+  size_t i{};
+  for (; i + 2 <= n; i += 2) {
+    store(out + i, mul(load(a + i), factor));
+  }
+  scale_scalar(a + i, k, out + i, n - i);
+}
+int64_t sum_sse2(const int64_t* v, size_t n) {
+  auto sum = _mm_setzero_si128();
+  size_t i{};
+  for (; i + 2 <= n; i += 2) {
+    sum = _mm_add_epi64(sum, load(v + i));
+  }
+  int64_t lanes[2];
+  store(lanes, sum);
+  return wrap_add(wrap_add(lanes[0], lanes[1]), sum_scalar(v + i, n - i));
+}
+
+constexpr Table kSse2{add_sse2, subtract_sse2, scale_sse2,
+                      sum_sse2, min_scalar,    max_scalar};
+
+// AVX2, for CPUs best_simd() finds it on
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 __m256i load256(const int64_t* p) {
+  return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+}
+AVX2 void store256(int64_t* p, __m256i v) {
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v);
+}
+AVX2 __m256i mul256(__m256i a, __m256i b) {
+  auto cross =
+      _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+                       _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+  return _mm256_add_epi64(_mm256_mul_epu32(a, b),
+                          _mm256_slli_epi64(cross, 32));
+}
+
+AVX2 void add_avx2(const int64_t* a, const int64_t* b, int64_t* out,
+                   size_t n) {
+  size_t i{};
+  for (; i + 4 <= n; i += 4) {
+    store256(out + i, _mm256_add_epi64(load256(a + i), load256(b + i)));
+  }
+  add_scalar(a + i, b + i, out + i, n - i);
+}
+AVX2 void subtract_avx2(const int64_t* a, const int64_t* b, int64_t* out,
+                        size_t n) {
+  size_t i{};
+  for (; i + 4 <= n; i += 4) {
+    store256(out + i, _mm256_sub_epi64(load256(a + i), load256(b + i)));
+  }
+  subtract_scalar(a + i, b + i, out + i, n - i);
+}
+AVX2 void scale_avx2(const int64_t* a, int64_t k, int64_t* out, size_t n) {
+  auto factor = _mm256_set1_epi64x(k);
+  size_t i{};
+  for (; i + 4 <= n; i += 4) {
+    store256(out + i, mul256(load256(a + i), factor));
+  }
+  scale_scalar(a + i, k, out + i, n - i);
+}
+AVX2 int64_t sum_avx2(const int64_t* v, size_t n) {
+  auto sum = _mm256_setzero_si256();
+  size_t i{};
+  for (; i + 4 <= n; i += 4) {
+    sum = _mm256_add_epi64(sum, load256(v + i));
+  }
+  int64_t lanes[4];
+  store256(lanes, sum);
+  return wrap_add(wrap_add(wrap_add(lanes[0], lanes[1]),
+                           wrap_add(lanes[2], lanes[3])),
+                  sum_scalar(v + i, n - i));
+}
+// Keeps the lesser lane of each pair, or the greater with `greatest`
+template <bool greatest>
+AVX2 int64_t extreme_avx2(const int64_t* v, size_t n) {
+  if (n < 4) {
+    return greatest ? max_scalar(v, n) : min_scalar(v, n);
+  }
+  auto best = load256(v);
+  size_t i = 4;
+  for (; i + 4 <= n; i += 4) {
+    auto x = load256(v + i);
+    auto replace = greatest ? _mm256_cmpgt_epi64(x, best)
+                            : _mm256_cmpgt_epi64(best, x);
+    best = _mm256_blendv_epi8(best, x, replace);
+  }
+  int64_t lanes[4];
+  store256(lanes, best);
+  auto result = greatest ? max_scalar(lanes, 4) : min_scalar(lanes, 4);
+  if (i < n) {
+    auto tail = greatest ? max_scalar(v + i, n - i) : min_scalar(v + i, n - i);
+    result = greatest ? std::max(result, tail) : std::min(result, tail);
+  }
+  return result;
+}
+AVX2 int64_t min_avx2(const int64_t* v, size_t n) {
+  return extreme_avx2<false>(v, n);
+}
+AVX2 int64_t max_avx2(const int64_t* v, size_t n) {
+  return extreme_avx2<true>(v, n);
+}
+
+#undef AVX2
+
+constexpr Table kAvx2{add_avx2, subtract_avx2, scale_avx2,
+                      sum_avx2, min_avx2,      max_avx2};
+
+#endif
+
+const Table& table(Simd simd) {
+#if PARSER_ARRAY_KERNELS_X86
+  static const Table tables[] = {kScalar, kSse2, kAvx2};
+#else
+  static const Table tables[] = {kScalar, kScalar, kScalar};
+#endif
+  return tables[static_cast<size_t>(std::min(simd, best_simd()))];
+}
+
+// Bounds of the ranges `n` elements are split into for `policy`: one range
+// below the threshold, otherwise one per thread
+Vec<size_t> ranges(const ArrayPolicy& policy, size_t n) {
+  size_t parts = 1;
+  if (n >= policy.threshold) {
+    auto threads = policy.threads != 0
+                       ? policy.threads
+                       : std::max(1U, std::thread::hardware_concurrency());
+    parts = std::max<size_t>(1, std::min<size_t>(threads, n));
+  }
+  auto bounds = Vec<size_t>(parts + 1);
+  for (size_t part{}; part <= parts; ++part) {
+    bounds[part] = n / parts * part + std::min(part, n % parts);
+  }
+  return bounds;
+}
+
+// Runs `fn(part, begin, end)` on every range, the first on this thread
+template <typename Fn>
+void split(const Vec<size_t>& bounds, const Fn& fn) {
+  auto workers = Vec<std::thread>();
+  for (size_t part = 1; part + 1 < bounds.size(); ++part) {
+    workers.emplace_back(fn, part, bounds[part], bounds[part + 1]);
+  }
+  fn(size_t{}, bounds[0], bounds[1]);
+  for (auto& worker : workers) {
+    worker.join();
+  }
+}
+
+}  // namespace
+
+Simd best_simd() {
+#if PARSER_ARRAY_KERNELS_X86
+  static const auto best =
+      __builtin_cpu_supports("avx2") ? Simd::Avx2 : Simd::Sse2;
+  return best;
+#else
+  return Simd::Scalar;
+#endif
+}
+
+namespace kernels {
+
+void mat(const ArrayPolicy& policy, MatOp op, const int64_t* left,
+         const int64_t* right, int64_t factor, int64_t* out, size_t n) {
+  const auto& kernels = table(policy.simd);
+  split(ranges(policy, n), [&](size_t, size_t begin, size_t end) {
+    switch (op) {
+      case MatOp::Add:
+        kernels.add(left + begin, right + begin, out + begin, end - begin);
+        break;
+      case MatOp::Subtract:
+        kernels.subtract(left + begin, right + begin, out + begin,
+                         end - begin);
+        break;
+      case MatOp::Scale:
+        kernels.scale(left + begin, factor, out + begin, end - begin);
+        break;
+    }
+  });
+}
+
+int64_t reduce(const ArrayPolicy& policy, Reduction reduction,
+               const int64_t* values, size_t n) {
+  const auto& kernels = table(policy.simd);
+  auto kernel = reduction == Reduction::Sum   ? kernels.sum
+                : reduction == Reduction::Min ? kernels.min
+                                              : kernels.max;
+  auto bounds = ranges(policy, n);
+  auto partial = Vec<int64_t>(bounds.size() - 1);
+  split(bounds, [&](size_t part, size_t begin, size_t end) {
+    partial[part] = kernel(values + begin, end - begin);
+  });
+  auto result = partial[0];
+  for (size_t i = 1; i < partial.size(); ++i) {
+    result = reduction == Reduction::Sum   ? wrap_add(result, partial[i])
+             : reduction == Reduction::Min ? std::min(result, partial[i])
+                                           : std::max(result, partial[i]);
+  }
+  return result;
+}
+
+void sort(const ArrayPolicy& policy, int64_t* values, size_t n) {
+  // Sorts each range, then merges neighbouring ranges pairwise, every
+  // round's merges in parallel
+  auto bounds = ranges(policy, n);
+  split(bounds, [values](size_t, size_t begin, size_t end) {
+    std::sort(values + begin, values + end);
+  });
+  while (bounds.size() > 2) {
+    auto merged = Vec<size_t>{0};
+    auto workers = Vec<std::thread>();
+    for (size_t i{}; i + 2 < bounds.size(); i += 2) {
+      workers.emplace_back([values, begin = bounds[i], middle = bounds[i + 1],
+                            end = bounds[i + 2]]() {
+        std::inplace_merge(values + begin, values + middle, values + end);
+      });
+      merged.push_back(bounds[i + 2]);
+    }
+    if (merged.back() != bounds.back()) {
+      merged.push_back(bounds.back());
+    }
+    for (auto& worker : workers) {
+      worker.join();
+    }
+    bounds = std::move(merged);
+  }
+}
+
+}  // namespace kernels
+
+}  // namespace parser
@@ -4,33 +4,103 @@
 #include "parser.h"
 
 namespace parser {
+namespace {
+bool is_reduction(const Rc<tokenizer::Token>& token) {
+  return typeid(*token) == typeid(tokenizer::token::Sum) ||
+         typeid(*token) == typeid(tokenizer::token::Min) ||
+         typeid(*token) == typeid(tokenizer::token::Max);
+}
+constexpr const char* kReservedWord = "reserved word used as variable";
+
+bool is_reserved(const Rc<tokenizer::Token>& token) {
+  return dynamic_cast<const tokenizer::token::Word*>(token.get()) != nullptr;
+}
+}  // namespace
+
 Rc<AstNode> Parser::parse(const Vec<Rc<tokenizer::Token>>& tokens) {
   for (const auto& token : tokens) {
     if (typeid(*token) == typeid(tokenizer::token::Invalid)) {
       return std::make_shared<ast_node::Invalid>("unknown token");
     }
   }
+  tokens_ = &tokens;
+  begin(tokens.front());
+
+  auto result = parse_line();
+
+  end();
+  tokens_ = nullptr;
+  return result;
+}
+
+Rc<AstNode> Parser::parse(tokenizer::Tokenizer& tokenizer, const Str& source) {
+  tokenizer.reset(source);
+  tokenizer_ = &tokenizer;
+  begin(tokenizer.next());
+
+  auto result = parse_line();
+
+  // An invalid character stops the parse where it is met, but the two-pass
+  // path reports it even when a syntax error comes first, so check the rest.
+  if (!ok_ || typeid(*result) == typeid(ast_node::Invalid)) {
+    while (typeid(*current_) != typeid(tokenizer::token::EoL)) {
+      if (typeid(*current_) == typeid(tokenizer::token::Invalid)) {
+        result = std::make_shared<ast_node::Invalid>("unknown token");
+        break;
+      }
+      current_ = tokenizer.next();
+    }
+  }
+
+  end();
+  tokenizer_ = nullptr;
+  return result;
+}
+
+void Parser::begin(const Rc<tokenizer::Token>& first) {
   ok_ = true;
   cursor_ = 0;
-  tokens_ = tokens;
-  stack_ = std::stack<Rc<AstNode>>();
+  current_ = first;
+  while (!stack_.empty()) {
+    stack_.pop();
+  }
+  token_pool_used_ = 0;
+}
+
+void Parser::end() {
+  // Drop references to the result so pooled wrappers become reusable
+  while (!stack_.empty()) {
+    stack_.pop();
+  }
+  current_ = nullptr;
+}
 
-  if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Integer)) {
+Rc<AstNode> Parser::parse_line() {
+  if (typeid(*peek()) == typeid(tokenizer::token::Integer)) {
     parse_stmt();
-  } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Input)) {
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Input)) {
     parse_input();
-  } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Print)) {
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Print)) {
     parse_print();
-  } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Let)) {
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Let)) {
     parse_let();
-  } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Run) ||
-             typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Load) ||
-             typeid(*tokens_[cursor_]) == typeid(tokenizer::token::List) ||
-             typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Clear) ||
-             typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Help) ||
-             typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Quit)) {
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Dim)) {
+    parse_dim();
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Mat)) {
+    parse_mat();
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Sort)) {
+    parse_sort();
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Run) ||
+             typeid(*peek()) == typeid(tokenizer::token::Load) ||
+             typeid(*peek()) == typeid(tokenizer::token::List) ||
+             typeid(*peek()) == typeid(tokenizer::token::Clear) ||
+             typeid(*peek()) == typeid(tokenizer::token::Undo) ||
+             typeid(*peek()) == typeid(tokenizer::token::Redo) ||
+             typeid(*peek()) == typeid(tokenizer::token::Check) ||
+             typeid(*peek()) == typeid(tokenizer::token::Help) ||
+             typeid(*peek()) == typeid(tokenizer::token::Quit)) {
     parse_cmd();
-  } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::EoL)) {
+  } else if (typeid(*peek()) == typeid(tokenizer::token::EoL)) {
     return std::make_shared<ast_node::Nop>();
   } else {
     return std::make_shared<ast_node::Invalid>(
@@ -44,9 +114,29 @@ Rc<AstNode> Parser::parse(const Vec<Rc<tokenizer::Token>>& tokens) {
   }
 }
 
-void Parser::shift() {
-  stack_.push(std::make_shared<ast_node::Token>(tokens_[cursor_]));
+const Rc<tokenizer::Token>& Parser::peek() const { return current_; }
+
+void Parser::advance() {
   ++cursor_;
+  if (tokenizer_ != nullptr) {
+    current_ = tokenizer_->next();
+  } else if (cursor_ < tokens_->size()) {
+    current_ = (*tokens_)[cursor_];
+  }
+}
+
+void Parser::shift() {
+  // Reuse a token wrapper from an earlier parse if nobody else holds it
+  if (token_pool_used_ < token_pool_.size() &&
+      token_pool_[token_pool_used_].use_count() == 1) {
+    token_pool_[token_pool_used_]->rebind(current_);
+  } else if (token_pool_used_ < token_pool_.size()) {
+    token_pool_[token_pool_used_] = std::make_shared<ast_node::Token>(current_);
+  } else {
+    token_pool_.push_back(std::make_shared<ast_node::Token>(current_));
+  }
+  stack_.push(token_pool_[token_pool_used_++]);
+  advance();
 }
 Rc<AstNode> Parser::get_and_pop() {
   auto ret = stack_.top();
@@ -56,21 +146,35 @@ Rc<AstNode> Parser::get_and_pop() {
 
 void Parser::parse_stmt() {
   shift();
-  if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Rem)) {
+  if (typeid(*peek()) == typeid(tokenizer::token::Rem)) {
     parse_rem();
-  } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Let)) {
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Let)) {
     parse_let();
-  } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Print)) {
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Print)) {
     parse_print();
-  } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Input)) {
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Input)) {
     parse_input();
-  } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Goto)) {
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Goto)) {
     parse_goto();
-  } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::If)) {
+  } else if (typeid(*peek()) == typeid(tokenizer::token::If)) {
     parse_if();
-  } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::End)) {
+  } else if (typeid(*peek()) == typeid(tokenizer::token::End)) {
     parse_end();
-  } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::EoL)) {
+  } else if (typeid(*peek()) == typeid(tokenizer::token::For)) {
+    parse_for();
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Next)) {
+    parse_next();
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Gosub)) {
+    parse_gosub();
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Return)) {
+    parse_return();
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Dim)) {
+    parse_dim();
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Mat)) {
+    parse_mat();
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Sort)) {
+    parse_sort();
+  } else if (typeid(*peek()) == typeid(tokenizer::token::EoL)) {
     shift();
     get_and_pop();
     auto lineno = get_and_pop();
@@ -93,7 +197,7 @@ void Parser::parse_stmt() {
 }
 void Parser::parse_cmd() {
   shift();
-  if (typeid(*tokens_[cursor_]) != typeid(tokenizer::token::EoL)) {
+  if (typeid(*peek()) != typeid(tokenizer::token::EoL)) {
     ok_ = false;
     error_msg_ =
         std::make_shared<ast_node::Invalid>("unexpected token after command");
@@ -112,6 +216,12 @@ void Parser::parse_cmd() {
     stack_.push(std::make_shared<ast_node::List>(cmd));
   } else if (typeid(*token) == typeid(tokenizer::token::Clear)) {
     stack_.push(std::make_shared<ast_node::Clear>(cmd));
+  } else if (typeid(*token) == typeid(tokenizer::token::Undo)) {
+    stack_.push(std::make_shared<ast_node::Undo>(cmd));
+  } else if (typeid(*token) == typeid(tokenizer::token::Redo)) {
+    stack_.push(std::make_shared<ast_node::Redo>(cmd));
+  } else if (typeid(*token) == typeid(tokenizer::token::Check)) {
+    stack_.push(std::make_shared<ast_node::Check>(cmd));
   } else if (typeid(*token) == typeid(tokenizer::token::Help)) {
     stack_.push(std::make_shared<ast_node::Help>(cmd));
   } else if (typeid(*token) == typeid(tokenizer::token::Quit)) {
@@ -126,7 +236,7 @@ void Parser::parse_cmd() {
 void Parser::parse_rem() {
   shift();
 
-  if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::EoL)) {
+  if (typeid(*peek()) == typeid(tokenizer::token::EoL)) {
     shift();
     get_and_pop();
     auto rem = get_and_pop();
@@ -136,7 +246,7 @@ void Parser::parse_rem() {
     return;
   }
 
-  if (typeid(*tokens_[cursor_]) != typeid(tokenizer::token::RemString)) {
+  if (typeid(*peek()) != typeid(tokenizer::token::RemString)) {
     ok_ = false;
     error_msg_ =
         std::make_shared<ast_node::Invalid>("unexpected token after rem");
@@ -144,7 +254,7 @@ void Parser::parse_rem() {
   }
   shift();
 
-  if (typeid(*tokens_[cursor_]) != typeid(tokenizer::token::EoL)) {
+  if (typeid(*peek()) != typeid(tokenizer::token::EoL)) {
     ok_ = false;
     error_msg_ = std::make_shared<ast_node::Invalid>(
         "unexpected token after rem string");
@@ -161,14 +271,22 @@ void Parser::parse_rem() {
 void Parser::parse_let() {
   shift();
 
-  if (typeid(*tokens_[cursor_]) != typeid(tokenizer::token::Variant)) {
-    ok_ = false;
-    error_msg_ = std::make_shared<ast_node::Invalid>("let requires variant");
+  if (typeid(*peek()) != typeid(tokenizer::token::Variant)) {
+    fail_variant("let requires variant");
     return;
   }
   shift();
 
-  if (typeid(*tokens_[cursor_]) != typeid(tokenizer::token::Equal)) {
+  // LET a(i) = e assigns an element
+  auto element = typeid(*peek()) == typeid(tokenizer::token::LeftParenthesis);
+  if (element) {
+    parse_array_expr();
+    if (!ok_) {
+      return;
+    }
+  }
+
+  if (typeid(*peek()) != typeid(tokenizer::token::Equal)) {
     ok_ = false;
     error_msg_ = std::make_shared<ast_node::Invalid>("let requires \'=\'");
     return;
@@ -180,7 +298,7 @@ void Parser::parse_let() {
     return;
   }
 
-  if (typeid(*tokens_[cursor_]) != typeid(tokenizer::token::EoL)) {
+  if (typeid(*peek()) != typeid(tokenizer::token::EoL)) {
     ok_ = false;
     error_msg_ = std::make_shared<ast_node::Invalid>(
         "unexpected token after expression");
@@ -194,7 +312,12 @@ void Parser::parse_let() {
   auto variant = get_and_pop();
   auto let = get_and_pop();
 
-  stack_.push(std::make_shared<ast_node::Let>(let, variant, equal, expr));
+  if (element) {
+    stack_.push(
+        std::make_shared<ast_node::LetElement>(let, variant, equal, expr));
+  } else {
+    stack_.push(std::make_shared<ast_node::Let>(let, variant, equal, expr));
+  }
 }
 void Parser::parse_print() {
   shift();
@@ -204,7 +327,7 @@ void Parser::parse_print() {
     return;
   }
 
-  if (typeid(*tokens_[cursor_]) != typeid(tokenizer::token::EoL)) {
+  if (typeid(*peek()) != typeid(tokenizer::token::EoL)) {
     ok_ = false;
     error_msg_ = std::make_shared<ast_node::Invalid>(
         "unexpected token after expression");
@@ -221,15 +344,13 @@ void Parser::parse_print() {
 void Parser::parse_input() {
   shift();
 
-  if (typeid(*tokens_[cursor_]) != typeid(tokenizer::token::Variant)) {
-    ok_ = false;
-    error_msg_ =
-        std::make_shared<ast_node::Invalid>("unexpected token after input");
+  if (typeid(*peek()) != typeid(tokenizer::token::Variant)) {
+    fail_variant("unexpected token after input");
     return;
   }
   shift();
 
-  if (typeid(*tokens_[cursor_]) != typeid(tokenizer::token::EoL)) {
+  if (typeid(*peek()) != typeid(tokenizer::token::EoL)) {
     ok_ = false;
     error_msg_ =
         std::make_shared<ast_node::Invalid>("unexpected token after variant");
@@ -246,7 +367,7 @@ void Parser::parse_input() {
 void Parser::parse_goto() {
   shift();
 
-  if (typeid(*tokens_[cursor_]) != typeid(tokenizer::token::Integer)) {
+  if (typeid(*peek()) != typeid(tokenizer::token::Integer)) {
     ok_ = false;
     error_msg_ =
         std::make_shared<ast_node::Invalid>("unexpected token after goto");
@@ -254,7 +375,7 @@ void Parser::parse_goto() {
   }
   shift();
 
-  if (typeid(*tokens_[cursor_]) != typeid(tokenizer::token::EoL)) {
+  if (typeid(*peek()) != typeid(tokenizer::token::EoL)) {
     ok_ = false;
     error_msg_ =
         std::make_shared<ast_node::Invalid>("unexpected token after number");
@@ -276,7 +397,7 @@ void Parser::parse_if() {
     return;
   }
 
-  if (typeid(*tokens_[cursor_]) != typeid(tokenizer::token::Then)) {
+  if (typeid(*peek()) != typeid(tokenizer::token::Then)) {
     ok_ = false;
     error_msg_ = std::make_shared<ast_node::Invalid>(
         "unexpected token after expression");
@@ -284,7 +405,7 @@ void Parser::parse_if() {
   }
   shift();
 
-  if (typeid(*tokens_[cursor_]) != typeid(tokenizer::token::Integer)) {
+  if (typeid(*peek()) != typeid(tokenizer::token::Integer)) {
     ok_ = false;
     error_msg_ =
         std::make_shared<ast_node::Invalid>("unexpected token after then");
@@ -293,7 +414,7 @@ void Parser::parse_if() {
   }
   shift();
 
-  if (typeid(*tokens_[cursor_]) != typeid(tokenizer::token::EoL)) {
+  if (typeid(*peek()) != typeid(tokenizer::token::EoL)) {
     ok_ = false;
     error_msg_ =
         std::make_shared<ast_node::Invalid>("unexpected token after number");
@@ -313,7 +434,7 @@ void Parser::parse_if() {
 void Parser::parse_end() {
   shift();
 
-  if (typeid(*tokens_[cursor_]) != typeid(tokenizer::token::EoL)) {
+  if (typeid(*peek()) != typeid(tokenizer::token::EoL)) {
     ok_ = false;
     error_msg_ =
         std::make_shared<ast_node::Invalid>("unexpected token after end");
@@ -326,37 +447,301 @@ void Parser::parse_end() {
 
   stack_.push(std::make_shared<ast_node::End>(end));
 }
+void Parser::parse_for() {
+  shift();
+
+  if (typeid(*peek()) != typeid(tokenizer::token::Variant)) {
+    fail_variant("for requires variant");
+    return;
+  }
+  shift();
+
+  if (typeid(*peek()) != typeid(tokenizer::token::Equal)) {
+    ok_ = false;
+    error_msg_ = std::make_shared<ast_node::Invalid>("for requires \'=\'");
+    return;
+  }
+  shift();
+
+  parse_expr();
+  if (!ok_) {
+    return;
+  }
+
+  if (typeid(*peek()) != typeid(tokenizer::token::To)) {
+    ok_ = false;
+    error_msg_ = std::make_shared<ast_node::Invalid>("for requires to");
+    return;
+  }
+  shift();
+
+  parse_expr();
+  if (!ok_) {
+    return;
+  }
+
+  auto stepped = typeid(*peek()) == typeid(tokenizer::token::Step);
+  if (stepped) {
+    shift();
+    parse_expr();
+    if (!ok_) {
+      return;
+    }
+  }
+
+  if (typeid(*peek()) != typeid(tokenizer::token::EoL)) {
+    ok_ = false;
+    error_msg_ = std::make_shared<ast_node::Invalid>(
+        "unexpected token after expression");
+    return;
+  }
+  shift();
+
+  get_and_pop();
+  Rc<AstNode> step;
+  Rc<AstNode> step_token;
+  if (stepped) {
+    step = get_and_pop();
+    step_token = get_and_pop();
+  }
+  auto limit = get_and_pop();
+  auto to = get_and_pop();
+  auto start = get_and_pop();
+  auto equal = get_and_pop();
+  auto variant = get_and_pop();
+  auto _for = get_and_pop();
+
+  if (stepped) {
+    stack_.push(std::make_shared<ast_node::For>(_for, variant, equal, start, to,
+                                                limit, step_token, step));
+  } else {
+    stack_.push(std::make_shared<ast_node::For>(_for, variant, equal, start,
+                                                to, limit));
+  }
+}
+void Parser::parse_next() {
+  shift();
+
+  if (typeid(*peek()) != typeid(tokenizer::token::Variant)) {
+    fail_variant("next requires variant");
+    return;
+  }
+  shift();
+
+  if (typeid(*peek()) != typeid(tokenizer::token::EoL)) {
+    ok_ = false;
+    error_msg_ =
+        std::make_shared<ast_node::Invalid>("unexpected token after variant");
+    return;
+  }
+  shift();
+
+  get_and_pop();
+  auto variant = get_and_pop();
+  auto next = get_and_pop();
+
+  stack_.push(std::make_shared<ast_node::Next>(next, variant));
+}
+void Parser::parse_gosub() {
+  shift();
+
+  if (typeid(*peek()) != typeid(tokenizer::token::Integer)) {
+    ok_ = false;
+    error_msg_ =
+        std::make_shared<ast_node::Invalid>("unexpected token after gosub");
+    return;
+  }
+  shift();
+
+  if (typeid(*peek()) != typeid(tokenizer::token::EoL)) {
+    ok_ = false;
+    error_msg_ =
+        std::make_shared<ast_node::Invalid>("unexpected token after number");
+    return;
+  }
+  shift();
+
+  get_and_pop();
+  auto number = get_and_pop();
+  auto gosub = get_and_pop();
+
+  stack_.push(std::make_shared<ast_node::Gosub>(gosub, number));
+}
+void Parser::parse_return() {
+  shift();
+
+  if (typeid(*peek()) != typeid(tokenizer::token::EoL)) {
+    ok_ = false;
+    error_msg_ =
+        std::make_shared<ast_node::Invalid>("unexpected token after return");
+    return;
+  }
+  shift();
+
+  get_and_pop();
+  auto _return = get_and_pop();
+
+  stack_.push(std::make_shared<ast_node::Return>(_return));
+}
+void Parser::parse_dim() {
+  shift();
+
+  if (typeid(*peek()) != typeid(tokenizer::token::Variant)) {
+    fail_variant("dim requires variant");
+    return;
+  }
+  shift();
+
+  if (typeid(*peek()) != typeid(tokenizer::token::LeftParenthesis)) {
+    ok_ = false;
+    error_msg_ = std::make_shared<ast_node::Invalid>("dim requires bounds");
+    return;
+  }
+  auto count = parse_indices();
+  if (!ok_) {
+    return;
+  }
+
+  if (typeid(*peek()) != typeid(tokenizer::token::EoL)) {
+    ok_ = false;
+    error_msg_ =
+        std::make_shared<ast_node::Invalid>("unexpected token after bounds");
+    return;
+  }
+  shift();
+
+  get_and_pop();
+  auto bounds = Vec<Rc<ast_node::Expr>>(count);
+  for (auto i = count; i-- > 0;) {
+    bounds[i] = std::static_pointer_cast<ast_node::Expr>(get_and_pop());
+  }
+  auto variant = get_and_pop();
+  auto dim = get_and_pop();
+
+  stack_.push(std::make_shared<ast_node::Dim>(dim, variant, std::move(bounds)));
+}
+void Parser::parse_mat() {
+  shift();
+
+  if (typeid(*peek()) != typeid(tokenizer::token::Variant)) {
+    fail_variant("mat requires variant");
+    return;
+  }
+  shift();
+
+  if (typeid(*peek()) != typeid(tokenizer::token::Equal)) {
+    ok_ = false;
+    error_msg_ = std::make_shared<ast_node::Invalid>("mat requires \'=\'");
+    return;
+  }
+  shift();
+
+  if (typeid(*peek()) != typeid(tokenizer::token::Variant)) {
+    fail_variant("mat requires array");
+    return;
+  }
+  shift();
+
+  // b + c and b - c take a second array, b * k any expression
+  if (typeid(*peek()) == typeid(tokenizer::token::Plus) ||
+      typeid(*peek()) == typeid(tokenizer::token::Minus)) {
+    shift();
+    if (typeid(*peek()) != typeid(tokenizer::token::Variant)) {
+      fail_variant("mat requires array");
+      return;
+    }
+    shift();
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Multiply)) {
+    shift();
+    parse_expr();
+    if (!ok_) {
+      return;
+    }
+  } else {
+    ok_ = false;
+    error_msg_ =
+        std::make_shared<ast_node::Invalid>("mat requires +, - or *");
+    return;
+  }
+
+  if (typeid(*peek()) != typeid(tokenizer::token::EoL)) {
+    ok_ = false;
+    error_msg_ = std::make_shared<ast_node::Invalid>(
+        "unexpected token after expression");
+    return;
+  }
+  shift();
+
+  get_and_pop();
+  auto operand = get_and_pop();
+  auto op = get_and_pop();
+  auto left = get_and_pop();
+  auto equal = get_and_pop();
+  auto target = get_and_pop();
+  auto mat = get_and_pop();
+
+  stack_.push(
+      std::make_shared<ast_node::Mat>(mat, target, equal, left, op, operand));
+}
+void Parser::parse_sort() {
+  shift();
+
+  if (typeid(*peek()) != typeid(tokenizer::token::Variant)) {
+    fail_variant("sort requires variant");
+    return;
+  }
+  shift();
+
+  if (typeid(*peek()) != typeid(tokenizer::token::EoL)) {
+    ok_ = false;
+    error_msg_ =
+        std::make_shared<ast_node::Invalid>("unexpected token after sort");
+    return;
+  }
+  shift();
+
+  get_and_pop();
+  auto variant = get_and_pop();
+  auto sort = get_and_pop();
+
+  stack_.push(std::make_shared<ast_node::Sort>(sort, variant));
+}
+void Parser::fail_variant(const char* message) {
+  ok_ = false;
+  error_msg_ = std::make_shared<ast_node::Invalid>(
+      is_reserved(peek()) ? kReservedWord : message);
+}
 void Parser::parse_expr() {
-  if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::LeftParenthesis)) {
+  if (typeid(*peek()) == typeid(tokenizer::token::LeftParenthesis)) {
     parse_parenthesis_expr();
-  } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Variant)) {
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Variant)) {
     parse_variant_expr();
-  } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Integer)) {
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Integer)) {
     parse_integer_expr();
-  } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Plus) ||
-             typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Minus)) {
+  } else if (is_reduction(peek())) {
+    parse_reduce_expr();
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Plus) ||
+             typeid(*peek()) == typeid(tokenizer::token::Minus)) {
     parse_unary_op_expr();
   } else {
-    ok_ = false;
-    error_msg_ =
-        std::make_shared<ast_node::Invalid>("unexpected token in expression");
+    fail_variant("unexpected token in expression");
   }
 
   if (!ok_) {
     return;
   }
 
-  if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Greater) ||
-      typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Equal) ||
-      typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Less)) {
+  if (typeid(*peek()) == typeid(tokenizer::token::Greater) ||
+      typeid(*peek()) == typeid(tokenizer::token::Equal) ||
+      typeid(*peek()) == typeid(tokenizer::token::Less)) {
     parse_compare_expr();
-  } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Plus) ||
-             typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Minus)) {
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Plus) ||
+             typeid(*peek()) == typeid(tokenizer::token::Minus)) {
     parse_plus_or_minus_expr();
-  } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Multiply) ||
-             typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Divide)) {
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Multiply) ||
+             typeid(*peek()) == typeid(tokenizer::token::Divide)) {
     parse_multiply_or_divide_expr();
-  } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Power)) {
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Power)) {
     parse_power_expr();
   } else {
     return;
@@ -365,14 +750,95 @@ void Parser::parse_expr() {
 
 void Parser::parse_variant_expr() {
   shift();
+  if (typeid(*peek()) != typeid(tokenizer::token::LeftParenthesis)) {
+    auto variant = get_and_pop();
+    stack_.push(std::make_shared<ast_node::VariantExpr>(variant));
+    return;
+  }
+  parse_array_expr();
+}
+void Parser::parse_array_expr() {
+  auto count = parse_indices();
+  if (!ok_) {
+    return;
+  }
+  auto indices = Vec<Rc<ast_node::Expr>>(count);
+  for (auto i = count; i-- > 0;) {
+    indices[i] = std::static_pointer_cast<ast_node::Expr>(get_and_pop());
+  }
   auto variant = get_and_pop();
-  stack_.push(std::make_shared<ast_node::VariantExpr>(variant));
+  stack_.push(
+      std::make_shared<ast_node::ArrayExpr>(variant, std::move(indices)));
+}
+size_t Parser::parse_indices() {
+  shift();
+  get_and_pop();
+
+  size_t count{};
+  while (true) {
+    parse_expr();
+    if (!ok_) {
+      return 0;
+    }
+    ++count;
+    if (typeid(*peek()) != typeid(tokenizer::token::Comma)) {
+      break;
+    }
+    if (count == Array::kMaxRank) {
+      ok_ = false;
+      error_msg_ = std::make_shared<ast_node::Invalid>("too many indices");
+      return 0;
+    }
+    shift();
+    get_and_pop();
+  }
+
+  if (typeid(*peek()) != typeid(tokenizer::token::RightParenthesis)) {
+    ok_ = false;
+    error_msg_ =
+        std::make_shared<ast_node::Invalid>("unmatched left parenthesis");
+    return 0;
+  }
+  shift();
+  get_and_pop();
+  return count;
 }
 void Parser::parse_integer_expr() {
   shift();
   auto variant = get_and_pop();
   stack_.push(std::make_shared<ast_node::IntegerExpr>(variant));
 }
+void Parser::parse_reduce_expr() {
+  shift();
+
+  // Without an array the name is read as a variable
+  if (typeid(*peek()) != typeid(tokenizer::token::LeftParenthesis)) {
+    ok_ = false;
+    error_msg_ = std::make_shared<ast_node::Invalid>(kReservedWord);
+    return;
+  }
+  shift();
+  get_and_pop();
+
+  if (typeid(*peek()) != typeid(tokenizer::token::Variant)) {
+    fail_variant("reduction requires array");
+    return;
+  }
+  shift();
+
+  if (typeid(*peek()) != typeid(tokenizer::token::RightParenthesis)) {
+    ok_ = false;
+    error_msg_ =
+        std::make_shared<ast_node::Invalid>("unmatched left parenthesis");
+    return;
+  }
+  shift();
+  get_and_pop();
+
+  auto variant = get_and_pop();
+  auto op = get_and_pop();
+  stack_.push(std::make_shared<ast_node::ReduceExpr>(op, variant));
+}
 void Parser::parse_parenthesis_expr() {
   shift();
 
@@ -381,7 +847,7 @@ void Parser::parse_parenthesis_expr() {
     return;
   }
 
-  if (typeid(*tokens_[cursor_]) != typeid(tokenizer::token::RightParenthesis)) {
+  if (typeid(*peek()) != typeid(tokenizer::token::RightParenthesis)) {
     ok_ = false;
     error_msg_ =
         std::make_shared<ast_node::Invalid>("unmatched left parenthesis");
@@ -396,19 +862,19 @@ void Parser::parse_parenthesis_expr() {
 }
 void Parser::parse_unary_op_expr() {
   shift();
-  if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::LeftParenthesis)) {
+  if (typeid(*peek()) == typeid(tokenizer::token::LeftParenthesis)) {
     parse_parenthesis_expr();
-  } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Variant)) {
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Variant)) {
     parse_variant_expr();
-  } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Integer)) {
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Integer)) {
     parse_integer_expr();
-  } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Plus) ||
-             typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Minus)) {
+  } else if (is_reduction(peek())) {
+    parse_reduce_expr();
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Plus) ||
+             typeid(*peek()) == typeid(tokenizer::token::Minus)) {
     parse_unary_op_expr();
   } else {
-    ok_ = false;
-    error_msg_ = std::make_shared<ast_node::Invalid>(
-        "unexpected token in unary expression");
+    fail_variant("unexpected token in unary expression");
   }
   if (!ok_) {
     return;
@@ -417,9 +883,9 @@ void Parser::parse_unary_op_expr() {
   // S: * / **
   // R: + - < = > $
 
-  if (typeid(*tokens_[cursor_]) != typeid(tokenizer::token::Multiply) &&
-      typeid(*tokens_[cursor_]) != typeid(tokenizer::token::Divide) &&
-      typeid(*tokens_[cursor_]) != typeid(tokenizer::token::Power)) {
+  if (typeid(*peek()) != typeid(tokenizer::token::Multiply) &&
+      typeid(*peek()) != typeid(tokenizer::token::Divide) &&
+      typeid(*peek()) != typeid(tokenizer::token::Power)) {
     auto expr = get_and_pop();
     auto op = get_and_pop();
     if (typeid(*(std::static_pointer_cast<ast_node::Token>(op)->token())) ==
@@ -436,21 +902,21 @@ void Parser::parse_unary_op_expr() {
       return;
     }
 
-    if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Plus) ||
-        typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Minus)) {
+    if (typeid(*peek()) == typeid(tokenizer::token::Plus) ||
+        typeid(*peek()) == typeid(tokenizer::token::Minus)) {
       parse_plus_or_minus_expr();
-    } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Greater) ||
-               typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Equal) ||
-               typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Less)) {
+    } else if (typeid(*peek()) == typeid(tokenizer::token::Greater) ||
+               typeid(*peek()) == typeid(tokenizer::token::Equal) ||
+               typeid(*peek()) == typeid(tokenizer::token::Less)) {
       parse_compare_expr();
     }
     return;
   }
 
-  if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Multiply) ||
-      typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Divide)) {
+  if (typeid(*peek()) == typeid(tokenizer::token::Multiply) ||
+      typeid(*peek()) == typeid(tokenizer::token::Divide)) {
     parse_multiply_or_divide_expr();
-  } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Power)) {
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Power)) {
     parse_power_expr();
   }
   if (!ok_) {
@@ -475,19 +941,19 @@ void Parser::parse_unary_op_expr() {
 
 void Parser::parse_compare_expr() {
   shift();
-  if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::LeftParenthesis)) {
+  if (typeid(*peek()) == typeid(tokenizer::token::LeftParenthesis)) {
     parse_parenthesis_expr();
-  } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Variant)) {
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Variant)) {
     parse_variant_expr();
-  } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Integer)) {
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Integer)) {
     parse_integer_expr();
-  } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Plus) ||
-             typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Minus)) {
+  } else if (is_reduction(peek())) {
+    parse_reduce_expr();
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Plus) ||
+             typeid(*peek()) == typeid(tokenizer::token::Minus)) {
     parse_unary_op_expr();
   } else {
-    ok_ = false;
-    error_msg_ = std::make_shared<ast_node::Invalid>(
-        "unexpected token in binary expression");
+    fail_variant("unexpected token in binary expression");
   }
   if (!ok_) {
     return;
@@ -496,11 +962,11 @@ void Parser::parse_compare_expr() {
   // S: + - * / **
   // R: < = > $
 
-  if (typeid(*tokens_[cursor_]) != typeid(tokenizer::token::Plus) &&
-      typeid(*tokens_[cursor_]) != typeid(tokenizer::token::Minus) &&
-      typeid(*tokens_[cursor_]) != typeid(tokenizer::token::Multiply) &&
-      typeid(*tokens_[cursor_]) != typeid(tokenizer::token::Divide) &&
-      typeid(*tokens_[cursor_]) != typeid(tokenizer::token::Power)) {
+  if (typeid(*peek()) != typeid(tokenizer::token::Plus) &&
+      typeid(*peek()) != typeid(tokenizer::token::Minus) &&
+      typeid(*peek()) != typeid(tokenizer::token::Multiply) &&
+      typeid(*peek()) != typeid(tokenizer::token::Divide) &&
+      typeid(*peek()) != typeid(tokenizer::token::Power)) {
     auto right = get_and_pop();
     auto op = std::static_pointer_cast<ast_node::Token>(get_and_pop());
     auto left = get_and_pop();
@@ -520,13 +986,13 @@ void Parser::parse_compare_expr() {
     return;
   }
 
-  if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Plus) ||
-      typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Minus)) {
+  if (typeid(*peek()) == typeid(tokenizer::token::Plus) ||
+      typeid(*peek()) == typeid(tokenizer::token::Minus)) {
     parse_plus_or_minus_expr();
-  } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Multiply) ||
-             typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Divide)) {
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Multiply) ||
+             typeid(*peek()) == typeid(tokenizer::token::Divide)) {
     parse_multiply_or_divide_expr();
-  } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Power)) {
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Power)) {
     parse_power_expr();
   }
   if (!ok_) {
@@ -550,19 +1016,19 @@ void Parser::parse_compare_expr() {
 }
 void Parser::parse_plus_or_minus_expr() {
   shift();
-  if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::LeftParenthesis)) {
+  if (typeid(*peek()) == typeid(tokenizer::token::LeftParenthesis)) {
     parse_parenthesis_expr();
-  } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Variant)) {
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Variant)) {
     parse_variant_expr();
-  } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Integer)) {
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Integer)) {
     parse_integer_expr();
-  } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Plus) ||
-             typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Minus)) {
+  } else if (is_reduction(peek())) {
+    parse_reduce_expr();
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Plus) ||
+             typeid(*peek()) == typeid(tokenizer::token::Minus)) {
     parse_unary_op_expr();
   } else {
-    ok_ = false;
-    error_msg_ = std::make_shared<ast_node::Invalid>(
-        "unexpected token in binary expression");
+    fail_variant("unexpected token in binary expression");
   }
   if (!ok_) {
     return;
@@ -571,9 +1037,9 @@ void Parser::parse_plus_or_minus_expr() {
   // S: * / **
   // R: + - < = > $
 
-  if (typeid(*tokens_[cursor_]) != typeid(tokenizer::token::Multiply) &&
-      typeid(*tokens_[cursor_]) != typeid(tokenizer::token::Divide) &&
-      typeid(*tokens_[cursor_]) != typeid(tokenizer::token::Power)) {
+  if (typeid(*peek()) != typeid(tokenizer::token::Multiply) &&
+      typeid(*peek()) != typeid(tokenizer::token::Divide) &&
+      typeid(*peek()) != typeid(tokenizer::token::Power)) {
     auto right = get_and_pop();
     auto op = get_and_pop();
     auto left = get_and_pop();
@@ -591,21 +1057,21 @@ void Parser::parse_plus_or_minus_expr() {
       return;
     }
 
-    if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Plus) ||
-        typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Minus)) {
+    if (typeid(*peek()) == typeid(tokenizer::token::Plus) ||
+        typeid(*peek()) == typeid(tokenizer::token::Minus)) {
       parse_plus_or_minus_expr();
-    } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Greater) ||
-               typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Equal) ||
-               typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Less)) {
+    } else if (typeid(*peek()) == typeid(tokenizer::token::Greater) ||
+               typeid(*peek()) == typeid(tokenizer::token::Equal) ||
+               typeid(*peek()) == typeid(tokenizer::token::Less)) {
       parse_compare_expr();
     }
     return;
   }
 
-  if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Multiply) ||
-      typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Divide)) {
+  if (typeid(*peek()) == typeid(tokenizer::token::Multiply) ||
+      typeid(*peek()) == typeid(tokenizer::token::Divide)) {
     parse_multiply_or_divide_expr();
-  } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Power)) {
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Power)) {
     parse_power_expr();
   }
   if (!ok_) {
@@ -630,19 +1096,19 @@ void Parser::parse_plus_or_minus_expr() {
 }
 void Parser::parse_multiply_or_divide_expr() {
   shift();
-  if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::LeftParenthesis)) {
+  if (typeid(*peek()) == typeid(tokenizer::token::LeftParenthesis)) {
     parse_parenthesis_expr();
-  } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Variant)) {
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Variant)) {
     parse_variant_expr();
-  } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Integer)) {
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Integer)) {
     parse_integer_expr();
-  } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Plus) ||
-             typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Minus)) {
+  } else if (is_reduction(peek())) {
+    parse_reduce_expr();
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Plus) ||
+             typeid(*peek()) == typeid(tokenizer::token::Minus)) {
     parse_unary_op_expr();
   } else {
-    ok_ = false;
-    error_msg_ = std::make_shared<ast_node::Invalid>(
-        "unexpected token in binary expression");
+    fail_variant("unexpected token in binary expression");
   }
   if (!ok_) {
     return;
@@ -651,7 +1117,7 @@ void Parser::parse_multiply_or_divide_expr() {
   // S: **
   // R: + - * / < = > $
 
-  if (typeid(*tokens_[cursor_]) != typeid(tokenizer::token::Power)) {
+  if (typeid(*peek()) != typeid(tokenizer::token::Power)) {
     auto right = get_and_pop();
     auto op = std::static_pointer_cast<ast_node::Token>(get_and_pop());
     auto left = get_and_pop();
@@ -666,22 +1132,22 @@ void Parser::parse_multiply_or_divide_expr() {
       return;
     }
 
-    if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Plus) ||
-        typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Minus)) {
+    if (typeid(*peek()) == typeid(tokenizer::token::Plus) ||
+        typeid(*peek()) == typeid(tokenizer::token::Minus)) {
       parse_plus_or_minus_expr();
-    } else if (typeid(*tokens_[cursor_]) ==
+    } else if (typeid(*peek()) ==
                    typeid(tokenizer::token::Multiply) ||
-               typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Divide)) {
+               typeid(*peek()) == typeid(tokenizer::token::Divide)) {
       parse_multiply_or_divide_expr();
-    } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Greater) ||
-               typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Equal) ||
-               typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Less)) {
+    } else if (typeid(*peek()) == typeid(tokenizer::token::Greater) ||
+               typeid(*peek()) == typeid(tokenizer::token::Equal) ||
+               typeid(*peek()) == typeid(tokenizer::token::Less)) {
       parse_compare_expr();
     }
     return;
   }
 
-  if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Power)) {
+  if (typeid(*peek()) == typeid(tokenizer::token::Power)) {
     parse_power_expr();
   }
   if (!ok_) {
@@ -703,19 +1169,19 @@ void Parser::parse_multiply_or_divide_expr() {
 }
 void Parser::parse_power_expr() {
   shift();
-  if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::LeftParenthesis)) {
+  if (typeid(*peek()) == typeid(tokenizer::token::LeftParenthesis)) {
     parse_parenthesis_expr();
-  } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Variant)) {
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Variant)) {
     parse_variant_expr();
-  } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Integer)) {
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Integer)) {
     parse_integer_expr();
-  } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Plus) ||
-             typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Minus)) {
+  } else if (is_reduction(peek())) {
+    parse_reduce_expr();
+  } else if (typeid(*peek()) == typeid(tokenizer::token::Plus) ||
+             typeid(*peek()) == typeid(tokenizer::token::Minus)) {
     parse_unary_op_expr();
   } else {
-    ok_ = false;
-    error_msg_ = std::make_shared<ast_node::Invalid>(
-        "unexpected token in binary expression");
+    fail_variant("unexpected token in binary expression");
   }
   if (!ok_) {
     return;
@@ -724,7 +1190,7 @@ void Parser::parse_power_expr() {
   // S: **
   // R: + - * / < = > $
 
-  if (typeid(*tokens_[cursor_]) != typeid(tokenizer::token::Power)) {
+  if (typeid(*peek()) != typeid(tokenizer::token::Power)) {
     auto right = get_and_pop();
     auto op = std::static_pointer_cast<ast_node::Token>(get_and_pop());
     auto left = get_and_pop();
@@ -737,22 +1203,22 @@ void Parser::parse_power_expr() {
       return;
     }
 
-    if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Plus) ||
-        typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Minus)) {
+    if (typeid(*peek()) == typeid(tokenizer::token::Plus) ||
+        typeid(*peek()) == typeid(tokenizer::token::Minus)) {
       parse_plus_or_minus_expr();
-    } else if (typeid(*tokens_[cursor_]) ==
+    } else if (typeid(*peek()) ==
                    typeid(tokenizer::token::Multiply) ||
-               typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Divide)) {
+               typeid(*peek()) == typeid(tokenizer::token::Divide)) {
       parse_multiply_or_divide_expr();
-    } else if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Greater) ||
-               typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Equal) ||
-               typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Less)) {
+    } else if (typeid(*peek()) == typeid(tokenizer::token::Greater) ||
+               typeid(*peek()) == typeid(tokenizer::token::Equal) ||
+               typeid(*peek()) == typeid(tokenizer::token::Less)) {
       parse_compare_expr();
     }
     return;
   }
 
-  if (typeid(*tokens_[cursor_]) == typeid(tokenizer::token::Power)) {
+  if (typeid(*peek()) == typeid(tokenizer::token::Power)) {
     parse_power_expr();
   }
   if (!ok_) {
@@ -772,6 +1238,16 @@ void Parser::parse_power_expr() {
 }
 void Parser::parse_clear_line() { shift(); }
 
+Rc<AstNode> ParseContext::parse(const Str& line) {
+  switch (front_end_) {
+    case FrontEnd::Fused:
+      return parser_.parse(tokenizer_, line);
+    case FrontEnd::TwoPass:
+    default:
+      return parser_.parse(tokenizer_.lex_in_place(line));
+  }
+}
+
 }  // namespace parser
 
 #pragma clang diagnostic pop
\ No newline at end of file
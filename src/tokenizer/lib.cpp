@@ -1,37 +1,73 @@
 #include "tokenizer.h"
 
+#include <string_view>
+
 namespace {
 
 bool is_whitespace(char c) { return c == ' ' || c == '\t' || c == '\n'; }
 bool is_digit(char c) { return '0' <= c && c <= '9'; }
 bool is_letter(char c) { return 'a' <= c && c <= 'z' || 'A' <= c && c <= 'Z'; }
 
+// Tokens without payload are immutable, so every line can share one instance
+template <typename T>
+const Rc<tokenizer::Token> &shared_token() {
+  static const Rc<tokenizer::Token> token = std::make_shared<T>();
+  return token;
+}
+
 }  // namespace
 namespace tokenizer {
 
 Vec<Rc<Token>> Tokenizer::lex(const Str &source) {
+  lex_in_place(source);
+  return std::move(words_);
+}
+
+const Vec<Rc<Token>> &Tokenizer::lex_in_place(const Str &source) {
+  reset(source);
+
+  while (peek() != -1) {
+    lex_step();
+  }
+
+  words_.emplace_back(shared_token<token::EoL>());
+  return words_;
+}
+
+void Tokenizer::reset(const Str &source) {
   source_ = source;
-  words_ = Vec<Rc<Token>>();
+  words_.clear();
   begin_ = 0;
   current_ = 0;
+  status_ = Status::Normal;
+}
 
-  while (peek() != -1) {
-    switch (status_) {
-      case Status::Normal: {
-        lex_normal();
-      } break;
-      case Status::Rem: {
-        lex_rem();
-      } break;
-    }
+const Rc<Token> &Tokenizer::next() {
+  words_.clear();
+  while (peek() != -1 && words_.empty()) {
+    lex_step();
   }
+  if (words_.empty()) {
+    words_.emplace_back(shared_token<token::EoL>());
+  }
+  return words_.back();
+}
 
-  words_.emplace_back(std::make_shared<token::EoL>());
-  return std::move(words_);
+void Tokenizer::lex_step() {
+  switch (status_) {
+    case Status::Normal: {
+      lex_normal();
+    } break;
+    case Status::Rem: {
+      lex_rem();
+    } break;
+  }
 }
 
 void Tokenizer::lex_normal() {
-  while (peek() != -1 && status_ == Status::Normal) {
+  // Stop after one token so next() can pull tokens on demand
+  auto count = words_.size();
+  while (peek() != -1 && status_ == Status::Normal && words_.size() == count) {
     char c = static_cast<char>(peek());
 
     if (is_digit(c)) {
@@ -50,55 +86,61 @@ void Tokenizer::lex_normal() {
     }
 
     if (c == '+') {
-      words_.emplace_back(std::make_shared<token::Plus>());
+      words_.emplace_back(shared_token<token::Plus>());
       eat();
       align_begin();
       continue;
     }
 
     if (c == '-') {
-      words_.emplace_back(std::make_shared<token::Minus>());
+      words_.emplace_back(shared_token<token::Minus>());
       eat();
       align_begin();
       continue;
     }
 
     if (c == '/') {
-      words_.emplace_back(std::make_shared<token::Divide>());
+      words_.emplace_back(shared_token<token::Divide>());
       eat();
       align_begin();
       continue;
     }
 
     if (c == '>') {
-      words_.emplace_back(std::make_shared<token::Greater>());
+      words_.emplace_back(shared_token<token::Greater>());
       eat();
       align_begin();
       continue;
     }
 
     if (c == '=') {
-      words_.emplace_back(std::make_shared<token::Equal>());
+      words_.emplace_back(shared_token<token::Equal>());
       eat();
       align_begin();
       continue;
     }
 
     if (c == '<') {
-      words_.emplace_back(std::make_shared<token::Less>());
+      words_.emplace_back(shared_token<token::Less>());
       eat();
       align_begin();
       continue;
     }
 
     if (c == '(') {
-      words_.emplace_back(std::make_shared<token::LeftParenthesis>());
+      words_.emplace_back(shared_token<token::LeftParenthesis>());
       eat();
       align_begin();
       continue;
     }
     if (c == ')') {
-      words_.emplace_back(std::make_shared<token::RightParenthesis>());
+      words_.emplace_back(shared_token<token::RightParenthesis>());
+      eat();
+      align_begin();
+      continue;
+    }
+    if (c == ',') {
+      words_.emplace_back(shared_token<token::Comma>());
       eat();
       align_begin();
       continue;
@@ -118,10 +160,10 @@ void Tokenizer::lex_star() {
   eat();
   if (peek() == '*') {
     eat();
-    words_.emplace_back(std::make_shared<token::Power>());
+    words_.emplace_back(shared_token<token::Power>());
     align_begin();
   } else {
-    words_.emplace_back(std::make_shared<token::Multiply>());
+    words_.emplace_back(shared_token<token::Multiply>());
     align_begin();
   }
 }
@@ -157,74 +199,136 @@ void Tokenizer::lex_word() {
                           is_letter(static_cast<char>(peek())))) {
     eat();
   }
-  auto word = get_word();
+  // Keywords are matched in place; only variant names are copied out
+  auto word = std::string_view(source_).substr(begin_, current_ - begin_);
+  align_begin();
 
   // Keyword
 
   if (word == "REM") {
-    words_.emplace_back(std::make_shared<token::Rem>());
+    words_.emplace_back(shared_token<token::Rem>());
     status_ = Status::Rem;
     return;
   }
   if (word == "LET") {
-    words_.emplace_back(std::make_shared<token::Let>());
+    words_.emplace_back(shared_token<token::Let>());
     return;
   }
   if (word == "PRINT") {
-    words_.emplace_back(std::make_shared<token::Print>());
+    words_.emplace_back(shared_token<token::Print>());
     return;
   }
   if (word == "INPUT") {
-    words_.emplace_back(std::make_shared<token::Input>());
+    words_.emplace_back(shared_token<token::Input>());
     return;
   }
   if (word == "GOTO") {
-    words_.emplace_back(std::make_shared<token::Goto>());
+    words_.emplace_back(shared_token<token::Goto>());
     return;
   }
   if (word == "IF") {
-    words_.emplace_back(std::make_shared<token::If>());
+    words_.emplace_back(shared_token<token::If>());
     return;
   }
   if (word == "THEN") {
-    words_.emplace_back(std::make_shared<token::Then>());
+    words_.emplace_back(shared_token<token::Then>());
     return;
   }
   if (word == "END") {
-    words_.emplace_back(std::make_shared<token::End>());
+    words_.emplace_back(shared_token<token::End>());
+    return;
+  }
+  if (word == "FOR") {
+    words_.emplace_back(shared_token<token::For>());
+    return;
+  }
+  if (word == "TO") {
+    words_.emplace_back(shared_token<token::To>());
+    return;
+  }
+  if (word == "STEP") {
+    words_.emplace_back(shared_token<token::Step>());
+    return;
+  }
+  if (word == "NEXT") {
+    words_.emplace_back(shared_token<token::Next>());
+    return;
+  }
+  if (word == "GOSUB") {
+    words_.emplace_back(shared_token<token::Gosub>());
+    return;
+  }
+  if (word == "RETURN") {
+    words_.emplace_back(shared_token<token::Return>());
+    return;
+  }
+  if (word == "DIM") {
+    words_.emplace_back(shared_token<token::Dim>());
+    return;
+  }
+  if (word == "MAT") {
+    words_.emplace_back(shared_token<token::Mat>());
+    return;
+  }
+  if (word == "SORT") {
+    words_.emplace_back(shared_token<token::Sort>());
+    return;
+  }
+  if (word == "SUM") {
+    words_.emplace_back(shared_token<token::Sum>());
+    return;
+  }
+  if (word == "MIN") {
+    words_.emplace_back(shared_token<token::Min>());
+    return;
+  }
+  if (word == "MAX") {
+    words_.emplace_back(shared_token<token::Max>());
     return;
   }
 
   // Command
 
   if (word == "RUN") {
-    words_.emplace_back(std::make_shared<token::Run>());
+    words_.emplace_back(shared_token<token::Run>());
     return;
   }
   if (word == "LOAD") {
-    words_.emplace_back(std::make_shared<token::Load>());
+    words_.emplace_back(shared_token<token::Load>());
     return;
   }
   if (word == "LIST") {
-    words_.emplace_back(std::make_shared<token::List>());
+    words_.emplace_back(shared_token<token::List>());
     return;
   }
   if (word == "CLEAR") {
-    words_.emplace_back(std::make_shared<token::Clear>());
+    words_.emplace_back(shared_token<token::Clear>());
+    return;
+  }
+  if (word == "UNDO") {
+    words_.emplace_back(shared_token<token::Undo>());
+    return;
+  }
+  if (word == "REDO") {
+    words_.emplace_back(shared_token<token::Redo>());
+    return;
+  }
+  if (word == "CHECK") {
+    words_.emplace_back(shared_token<token::Check>());
     return;
   }
   if (word == "HELP") {
-    words_.emplace_back(std::make_shared<token::Help>());
+    words_.emplace_back(shared_token<token::Help>());
     return;
   }
   if (word == "QUIT") {
-    words_.emplace_back(std::make_shared<token::Quit>());
+    words_.emplace_back(shared_token<token::Quit>());
     return;
   }
 
   // Variant
 
-  words_.emplace_back(std::make_shared<token::Variant>(std::move(word)));
+  words_.emplace_back(std::make_shared<token::Variant>(Str(word)));
 }
 void Tokenizer::lex_rem() {
   while (is_whitespace(static_cast<char>(peek()))) {
@@ -0,0 +1,1601 @@
+#include <catch2/catch_all.hpp>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <thread>
+
+#include "engine.h"
+#include "scheduler.h"
+namespace {
+void load(engine::MiniBasic& engine, const Str& source) {
+  std::stringstream ss(source);
+  engine.load_source(ss);
+}
+}  // namespace
+
+SCENARIO("engine caches parsed statements", "[engine]") {
+  auto engine = engine::MiniBasic();
+  auto program = Str(
+      "10 LET a = 1\n"
+      "20 PRINT a\n"
+      "30 LET a = a + 1\n"
+      "40 PRINT a\n"
+      "50 IF a < 3 THEN 30\n");
+
+  GIVEN("a program loaded twice") {
+    load(engine, program);
+    auto first = engine.get_ast_copy();
+    REQUIRE(engine.parse_cache().misses() == 4);
+    REQUIRE(engine.parse_cache().hits() == 1);
+
+    load(engine, program);
+    REQUIRE(engine.get_ast_copy() == first);
+    REQUIRE(engine.parse_cache().misses() == 4);
+    REQUIRE(engine.parse_cache().hits() == 6);
+  }
+
+  GIVEN("identical statements on different lines") {
+    load(engine, "10 PRINT a\n20 PRINT a\n30  PRINT a\n");
+    REQUIRE(engine.parse_cache().misses() == 1);
+    REQUIRE(engine.parse_cache().hits() == 2);
+    REQUIRE(engine.get_ast_copy() ==
+            "10\n\tPRINT\n\t\ta\n"
+            "20\n\tPRINT\n\t\ta\n"
+            "30\n\tPRINT\n\t\ta\n");
+  }
+
+  GIVEN("a small cache") {
+    engine.set_parse_cache_capacity(2);
+    load(engine, "10 PRINT a\n20 PRINT b\n30 PRINT c\n");
+    REQUIRE(engine.parse_cache().size() == 2);
+
+    load(engine, "10 PRINT b\n20 PRINT c\n30 PRINT a\n");
+    REQUIRE(engine.parse_cache().hits() == 2);
+    REQUIRE(engine.parse_cache().misses() == 4);
+  }
+
+  GIVEN("invalid lines") {
+    load(engine, "10 LET = 1\n10 LET = 1\n");
+    REQUIRE(engine.parse_cache().size() == 0);
+    REQUIRE(engine.get_ast_copy().empty());
+  }
+}
+
+SCENARIO("engine reports line changes", "[engine]") {
+  auto engine = engine::MiniBasic();
+  Str output;
+
+  GIVEN("a loaded program") {
+    load(engine, "10 PRINT a\n20 PRINT b\n");
+    auto changes = engine.take_changes();
+    REQUIRE(changes.size() == 1);
+    REQUIRE(changes[0].kind == engine::LineChange::Kind::Reset);
+    REQUIRE(engine.take_changes().empty());
+
+    WHEN("lines are edited") {
+      engine.handle_command("15 PRINT c", output);
+      engine.handle_command("20 PRINT d", output);
+      engine.handle_command("10", output);
+      engine.handle_command("30", output);
+      engine.handle_command("PRINT 1", output);
+
+      changes = engine.take_changes();
+      REQUIRE(changes.size() == 3);
+      REQUIRE(changes[0].kind == engine::LineChange::Kind::Inserted);
+      REQUIRE(changes[0].line == 15);
+      REQUIRE(changes[1].kind == engine::LineChange::Kind::Replaced);
+      REQUIRE(changes[1].line == 20);
+      REQUIRE(changes[2].kind == engine::LineChange::Kind::Deleted);
+      REQUIRE(changes[2].line == 10);
+
+      REQUIRE(engine.get_line_numbers() == Vec<int64_t>{15, 20});
+      REQUIRE(engine.get_source_line(20) == "20 PRINT d");
+      REQUIRE(engine.get_line_ast_copy(15) == "15\n\tPRINT\n\t\tc\n");
+    }
+  }
+
+  GIVEN("a comment holding a tab") {
+    auto engine = engine::MiniBasic();
+    load(engine, "10 REM \tnot nested\n20 PRINT -a\n");
+    auto rem = engine.get_line_ast_rows(10);
+    REQUIRE(rem.size() == 3);
+    REQUIRE(rem[1].depth == 1);
+    REQUIRE(rem[1].label == "REM");
+    REQUIRE(rem[2].depth == 2);
+    REQUIRE(rem[2].label.find("not nested") != Str::npos);
+
+    auto print = engine.get_line_ast_rows(20);
+    REQUIRE(print.size() == 4);
+    REQUIRE(print[0].label == "20");
+    REQUIRE(print[3].depth == 3);
+    REQUIRE(print[3].label == "a");
+    REQUIRE(engine.get_line_ast_rows(30).empty());
+  }
+}
+
+SCENARIO("engine streams output to a sink", "[engine]") {
+  auto engine = engine::MiniBasic();
+  std::stringstream sink;
+  engine.set_output_sink(&sink);
+
+  GIVEN("a program that prints") {
+    load(engine,
+         "10 LET a = 1\n"
+         "20 PRINT a\n"
+         "30 LET a = a + 1\n"
+         "40 IF a < 4 THEN 20\n"
+         "50 PRINT b\n");
+    Str output;
+    engine.reset_pc();
+    while (engine.step_run(output) != UIBehavior::FinishRun) {
+    }
+    REQUIRE(sink.str() == "1\n2\n3\nWARNING: Unknown variable b\n0\n");
+
+    WHEN("the sink is detached") {
+      engine.set_output_sink(nullptr);
+      engine.handle_command("PRINT 5", output);
+      REQUIRE(sink.str() == "1\n2\n3\nWARNING: Unknown variable b\n0\n");
+    }
+  }
+}
+
+namespace {
+// Runs a program to completion, answering INPUT from `inputs`
+Str run_with(engine::Tier tier, const Str& source,
+             const Vec<Str>& inputs = {}) {
+  auto engine = engine::MiniBasic();
+  engine.set_tier(tier);
+  load(engine, source);
+  engine.reset_pc();
+
+  Str output;
+  auto input = inputs.begin();
+  while (engine.run(output) == UIBehavior::Input) {
+    REQUIRE(input != inputs.end());
+    engine.handle_input(*input++);
+  }
+  return output;
+}
+
+const Vec<Str> programs = {
+    "10 LET a = 1\n"
+    "20 PRINT a\n"
+    "30 LET a = a + 1\n"
+    "40 IF a < 10 THEN 20\n"
+    "50 PRINT a * a - 3 / 2 ** 1\n",
+
+    "10 LET n = 0\n"
+    "20 LET f1 = 0\n"
+    "30 LET f2 = 1\n"
+    "40 LET t = f1 + f2\n"
+    "50 LET f1 = f2\n"
+    "60 LET f2 = t\n"
+    "70 LET n = n + 1\n"
+    "80 IF 30 > n THEN 40\n"
+    "90 PRINT f1\n"
+    "100 END\n"
+    "110 PRINT 1\n",
+
+    "10 REM unknown variables and missing lines\n"
+    "20 PRINT x + y\n"
+    "30 LET x = -x\n"
+    "40 IF x = 0 THEN 60\n"
+    "50 PRINT 1\n"
+    "60 GOTO 999\n"
+    "70 PRINT 2\n",
+
+    "10 INPUT n\n"
+    "20 LET s = 0\n"
+    "30 LET s = s + n\n"
+    "40 LET n = n - 1\n"
+    "50 IF n > 0 THEN 30\n"
+    "60 PRINT s\n"
+    "70 INPUT n\n"
+    "80 PRINT (n + 1) * -2\n",
+};
+}  // namespace
+
+SCENARIO("execution tiers agree with the tree walker", "[engine]") {
+  auto inputs = Vec<Str>{"100", "7"};
+  for (const auto& program : programs) {
+    CAPTURE(program);
+    auto expected = run_with(engine::Tier::TreeWalker, program, inputs);
+    REQUIRE(run_with(engine::Tier::Closure, program, inputs) == expected);
+    REQUIRE(run_with(engine::Tier::Bytecode, program, inputs) == expected);
+    REQUIRE(run_with(engine::Tier::BytecodeSwitch, program, inputs) ==
+            expected);
+    REQUIRE(run_with(engine::Tier::Jit, program, inputs) == expected);
+  }
+
+  GIVEN("the closure tier") {
+    REQUIRE(run_with(engine::Tier::Closure, programs[0]) ==
+            "1\n2\n3\n4\n5\n6\n7\n8\n9\n99\n");
+    REQUIRE(run_with(engine::Tier::Closure, programs[2]) ==
+            "WARNING: Unknown variable x\n"
+            "WARNING: Unknown variable y\n"
+            "0\n"
+            "WARNING: Unknown variable x\n");
+  }
+}
+
+SCENARIO("the JIT compiles hot loops and leaves the rest to the interpreter",
+         "[engine]") {
+  auto hot = Str(
+      "10 LET i = 0\n"
+      "20 LET s = 0\n"
+      "30 LET i = i + 1\n"
+      "40 LET s = s + i * 3 - i / 7\n"
+      "50 IF i - i / 500 * 500 = 0 THEN 80\n"
+      "60 IF i < 5000 THEN 30\n"
+      "70 GOTO 100\n"
+      "80 PRINT s\n"
+      "90 GOTO 60\n"
+      "100 LET j = 0 - 5000\n"
+      "110 LET n = 0\n"
+      "120 LET j = j + 3\n"
+      "130 IF 0 > j THEN 120\n"
+      "140 LET n = n + 1\n"
+      "150 IF n < i THEN 140\n"
+      "160 PRINT j\n"
+      "170 PRINT -s\n");
+
+  GIVEN("loops that run past the hot threshold") {
+    auto engine = engine::MiniBasic();
+    engine.set_tier(engine::Tier::Jit);
+    load(engine, hot);
+    engine.reset_pc();
+    Str output;
+    REQUIRE(engine.run(output) == UIBehavior::FinishRun);
+    REQUIRE(output == run_with(engine::Tier::TreeWalker, hot));
+#if ENGINE_JIT_AVAILABLE
+    REQUIRE(engine.jit_compiled_loops() == 4);
+#endif
+
+    WHEN("a line of the loop is edited") {
+      Str ignore;
+      engine.handle_command("40 LET s = s + i", ignore);
+
+      THEN("the native code is dropped and rebuilt for the new program") {
+        REQUIRE(engine.jit_compiled_loops() == 0);
+        auto edited = hot;
+        auto removed = Str(" * 3 - i / 7");
+        edited.erase(edited.find(removed), removed.size());
+        engine.reset_pc();
+        output.clear();
+        engine.run(output);
+        REQUIRE(output == run_with(engine::Tier::TreeWalker, edited));
+      }
+    }
+  }
+
+  GIVEN("a hot loop reading a variable that is never assigned") {
+    auto program = Str(
+        "10 LET i = 0\n"
+        "20 LET i = i + 1\n"
+        "30 LET s = i + q\n"
+        "40 IF i < 1200 THEN 20\n"
+        "50 PRINT s\n");
+    REQUIRE(run_with(engine::Tier::Jit, program) ==
+            run_with(engine::Tier::TreeWalker, program));
+  }
+}
+
+SCENARIO("FOR loops step, nest and end on every tier", "[engine]") {
+  auto tiers = {engine::Tier::TreeWalker, engine::Tier::Closure,
+                engine::Tier::Bytecode, engine::Tier::BytecodeSwitch,
+                engine::Tier::Jit};
+  auto nested = Str(
+      "10 LET t = 0\n"
+      "20 FOR i = 1 TO 3\n"
+      "30 FOR j = i TO 1 STEP -1\n"
+      "40 LET t = t + i * j\n"
+      "50 NEXT j\n"
+      "60 NEXT i\n"
+      "70 PRINT t\n"
+      "80 PRINT i\n"
+      "90 PRINT j\n");
+  auto hot = Str(
+      "10 LET s = 0\n"
+      "20 FOR i = 1 TO 30\n"
+      "30 FOR j = 1 TO 200\n"
+      "40 LET s = s + j\n"
+      "50 NEXT j\n"
+      "60 NEXT i\n"
+      "70 PRINT s\n");
+  auto left = Str(
+      "10 FOR i = 1 TO 10\n"
+      "20 IF i = 3 THEN 40\n"
+      "30 NEXT i\n"
+      "40 PRINT i\n"
+      "50 FOR i = 5 TO 1 STEP -2\n"
+      "60 PRINT i\n"
+      "70 NEXT i\n");
+  auto input = Str(
+      "10 LET s = 0\n"
+      "20 FOR i = 1 TO 3\n"
+      "30 INPUT x\n"
+      "40 LET s = s + x * i\n"
+      "50 NEXT i\n"
+      "60 PRINT s\n");
+  auto deep = Str();
+  for (int i{}; i <= 256; ++i) {
+    deep += std::to_string(10 + i) + " FOR v" + std::to_string(i) +
+            " = 1 TO 1\n";
+  }
+
+  for (auto tier : tiers) {
+    CAPTURE(static_cast<int>(tier));
+    REQUIRE(run_with(tier, nested) == "25\n4\n0\n");
+    REQUIRE(run_with(tier, hot) == "603000\n");
+    REQUIRE(run_with(tier, left) == "3\n5\n3\n1\n");
+    REQUIRE(run_with(tier, input, {"1", "2", "3"}) ==
+            "INPUT x\nINPUT x\nINPUT x\n14\n");
+    REQUIRE(run_with(tier, "10 PRINT 1\n20 NEXT k\n30 PRINT 2\n") ==
+            "1\nERROR: NEXT k without FOR\n");
+    REQUIRE(run_with(tier, deep) == "ERROR: FOR loops nested too deeply\n");
+
+    GIVEN("a run paused inside a loop") {
+      auto engine = engine::MiniBasic();
+      engine.set_tier(tier);
+      load(engine, nested);
+      engine.reset_pc();
+      Str output;
+      while (engine.run_for(output, 2) == UIBehavior::Yield) {
+      }
+      REQUIRE(output == "25\n4\n0\n");
+    }
+    GIVEN("a loop that never ends") {
+      auto engine = engine::MiniBasic();
+      engine.set_tier(tier);
+      auto quota = engine::Quota{};
+      quota.max_steps = 10000;
+      quota.check_period = 100;
+      engine.set_quota(quota);
+      load(engine, "10 FOR i = 1 TO 2 STEP 0\n20 NEXT i\n");
+      engine.reset_pc();
+      Str output;
+      REQUIRE(engine.run(output) == UIBehavior::FinishRun);
+      REQUIRE(engine.termination() == engine::Termination::StepQuota);
+    }
+  }
+
+  GIVEN("a snapshot taken inside a loop") {
+    auto engine = engine::MiniBasic();
+    load(engine, input);
+    engine.reset_pc();
+    Str output;
+    REQUIRE(engine.run(output) == UIBehavior::Input);
+    engine.handle_input("1");
+    REQUIRE(engine.run(output) == UIBehavior::Input);
+    auto decoded = engine::Snapshot();
+    REQUIRE(engine::Snapshot::decode(engine.snapshot().encode(), decoded));
+    REQUIRE(decoded.loops == Vec<parser::Loop>{{"i", 3, 1, 30}});
+
+    auto resumed = engine::MiniBasic();
+    resumed.set_tier(engine::Tier::Bytecode);
+    load(resumed, input);
+    REQUIRE(resumed.restore(decoded));
+    resumed.handle_input("2");
+    output.clear();
+    REQUIRE(resumed.run(output) == UIBehavior::Input);
+    resumed.handle_input("3");
+    REQUIRE(resumed.run(output) == UIBehavior::FinishRun);
+    REQUIRE(output == "INPUT x\n14\n");
+  }
+}
+
+SCENARIO("GOSUB and RETURN call subroutines on every tier", "[engine]") {
+  auto tiers = {engine::Tier::TreeWalker, engine::Tier::Closure,
+                engine::Tier::Bytecode, engine::Tier::BytecodeSwitch,
+                engine::Tier::Jit};
+  auto squares = Str(
+      "10 LET s = 0\n"
+      "20 FOR i = 1 TO 300\n"
+      "30 GOSUB 100\n"
+      "40 NEXT i\n"
+      "50 PRINT s\n"
+      "60 GOSUB 200\n"
+      "70 END\n"
+      "100 LET s = s + i * i\n"
+      "110 RETURN\n"
+      "200 PRINT i\n"
+      "210 GOSUB 100\n"
+      "220 PRINT s\n"
+      "230 RETURN\n");
+  auto recursive = Str(
+      "10 LET n = 10\n"
+      "20 LET f = 1\n"
+      "30 GOSUB 100\n"
+      "40 PRINT f\n"
+      "50 END\n"
+      "100 IF n < 2 THEN 140\n"
+      "110 LET f = f * n\n"
+      "120 LET n = n - 1\n"
+      "130 GOSUB 100\n"
+      "140 RETURN\n");
+  auto input = Str(
+      "5 LET s = 0\n"
+      "10 GOSUB 100\n"
+      "20 GOSUB 100\n"
+      "30 PRINT s\n"
+      "40 END\n"
+      "100 INPUT x\n"
+      "110 LET s = s + x\n"
+      "120 RETURN\n");
+  auto overflow = Str();
+  for (size_t i{}; i <= parser::CallStack::kDefaultDepth; ++i) {
+    overflow += "1\n";
+  }
+
+  for (auto tier : tiers) {
+    CAPTURE(static_cast<int>(tier));
+    REQUIRE(run_with(tier, squares) == "9045050\n301\n9135651\n");
+    REQUIRE(run_with(tier, recursive) == "3628800\n");
+    REQUIRE(run_with(tier, "10 GOSUB 30\n20 PRINT 2\n30 PRINT 3\n40 RETURN\n") ==
+            "3\n2\n3\nERROR: RETURN without GOSUB\n");
+    // A GOSUB on the last line returns past the end
+    REQUIRE(run_with(tier, "10 PRINT 1\n20 GOTO 40\n30 RETURN\n40 GOSUB 30\n") ==
+            "1\n");
+    REQUIRE(run_with(tier, "10 PRINT 1\n20 GOSUB 10\n") ==
+            overflow + "ERROR: GOSUB nested deeper than 1024\n");
+
+    GIVEN("a lower call depth limit") {
+      auto engine = engine::MiniBasic();
+      engine.set_tier(tier);
+      engine.set_max_call_depth(4);
+      load(engine, recursive);
+      engine.reset_pc();
+      Str output;
+      REQUIRE(engine.run(output) == UIBehavior::FinishRun);
+      REQUIRE(output == "ERROR: GOSUB nested deeper than 4\n");
+    }
+    GIVEN("a run paused inside a subroutine") {
+      auto engine = engine::MiniBasic();
+      engine.set_tier(tier);
+      load(engine, squares);
+      engine.reset_pc();
+      Str output;
+      while (engine.run_for(output, 2) == UIBehavior::Yield) {
+      }
+      REQUIRE(output == "9045050\n301\n9135651\n");
+    }
+  }
+
+  GIVEN("a snapshot taken inside a subroutine") {
+    auto engine = engine::MiniBasic();
+    load(engine, input);
+    engine.reset_pc();
+    Str output;
+    REQUIRE(engine.run(output) == UIBehavior::Input);
+    auto decoded = engine::Snapshot();
+    REQUIRE(engine::Snapshot::decode(engine.snapshot().encode(), decoded));
+    REQUIRE(decoded.calls == Vec<int64_t>{20});
+
+    auto resumed = engine::MiniBasic();
+    resumed.set_tier(engine::Tier::Closure);
+    load(resumed, input);
+    REQUIRE(resumed.restore(decoded));
+    resumed.handle_input("4");
+    output.clear();
+    REQUIRE(resumed.run(output) == UIBehavior::Input);
+    resumed.handle_input("5");
+    REQUIRE(resumed.run(output) == UIBehavior::FinishRun);
+    REQUIRE(output == "INPUT x\n9\n");
+
+    resumed.set_max_call_depth(0);
+    REQUIRE_FALSE(resumed.restore(decoded));
+  }
+
+  GIVEN("a call depth limit past the maximum") {
+    auto engine = engine::MiniBasic();
+    engine.set_max_call_depth(SIZE_MAX);
+    REQUIRE(engine.max_call_depth() == parser::CallStack::kMaxDepth);
+  }
+}
+
+SCENARIO("DIM arrays are indexed and bounds checked on every tier",
+         "[engine]") {
+  auto tiers = {engine::Tier::TreeWalker, engine::Tier::Closure,
+                engine::Tier::Bytecode, engine::Tier::BytecodeSwitch,
+                engine::Tier::Jit};
+  auto sieve = Str(
+      "10 DIM f(2000)\n"
+      "20 LET c = 0\n"
+      "30 FOR i = 2 TO 2000\n"
+      "40 IF f(i) = 1 THEN 90\n"
+      "50 LET c = c + 1\n"
+      "55 IF i > 1000 THEN 90\n"
+      "60 FOR j = i + i TO 2000 STEP i\n"
+      "70 LET f(j) = 1\n"
+      "80 NEXT j\n"
+      "90 NEXT i\n"
+      "100 PRINT c\n");
+  auto matrix = Str(
+      "10 DIM a(3, 3)\n"
+      "20 FOR i = 0 TO 3\n"
+      "30 FOR j = 0 TO 3\n"
+      "40 LET a(i, j) = i * 10 + j\n"
+      "50 NEXT j\n"
+      "60 NEXT i\n"
+      "70 LET s = 0\n"
+      "80 FOR k = 0 TO 3\n"
+      "90 LET s = s + a(k, 3 - k)\n"
+      "100 NEXT k\n"
+      "110 PRINT s\n"
+      "120 PRINT a(2, 1)\n");
+  // Indices from INPUT cannot be proven, so every access stays checked
+  auto unproven = Str(
+      "10 DIM v(9)\n"
+      "20 INPUT n\n"
+      "30 FOR i = 0 TO n\n"
+      "40 LET v(i) = i * i\n"
+      "50 NEXT i\n"
+      "60 PRINT v(n)\n");
+
+  for (auto tier : tiers) {
+    CAPTURE(static_cast<int>(tier));
+    REQUIRE(run_with(tier, sieve) == "303\n");
+    REQUIRE(run_with(tier, matrix) == "66\n21\n");
+    REQUIRE(run_with(tier, unproven, {"9"}) == "INPUT n\n81\n");
+    REQUIRE(run_with(tier, unproven, {"10"}) ==
+            "INPUT n\nERROR: index v(10) out of range\n");
+    REQUIRE(run_with(tier, "10 PRINT 1\n20 LET v(1) = 2\n30 PRINT 3\n") ==
+            "1\nERROR: array v used before DIM\n");
+    REQUIRE(run_with(tier, "10 DIM v(2)\n20 PRINT v(1, 1)\n") ==
+            "ERROR: wrong number of indices for v\n");
+    REQUIRE(run_with(tier, "10 DIM v(2)\n20 PRINT 1 + v(0 - 1) + w\n") ==
+            "ERROR: index v(-1) out of range\n");
+    REQUIRE(run_with(tier, "10 DIM v(0 - 1)\n") ==
+            "ERROR: DIM v(-1) out of range\n");
+    // DIM again clears the array and may change its shape
+    REQUIRE(run_with(tier,
+                     "10 DIM v(2)\n"
+                     "20 LET v(1) = 5\n"
+                     "30 DIM v(1, 1)\n"
+                     "40 PRINT v(1, 1)\n") == "0\n");
+
+    GIVEN("a run paused inside the loops") {
+      auto engine = engine::MiniBasic();
+      engine.set_tier(tier);
+      load(engine, sieve);
+      engine.reset_pc();
+      Str output;
+      while (engine.run_for(output, 3) == UIBehavior::Yield) {
+      }
+      REQUIRE(output == "303\n");
+    }
+  }
+
+  GIVEN("the sieve's bounds") {
+    auto context = parser::ParseContext();
+    auto ast = engine::FlatMap<int64_t, Rc<parser::ast_node::LineNoStmt>>();
+    std::stringstream lines(sieve);
+    for (Str line; std::getline(lines, line);) {
+      auto node = std::static_pointer_cast<parser::ast_node::LineNoStmt>(
+          context.parse(line));
+      ast.emplace(node->number()->value(), node);
+    }
+    auto bounds = engine::BoundsCheck(ast);
+    auto store = std::static_pointer_cast<parser::ast_node::LetElement>(
+        ast.at(70)->stmt());
+    REQUIRE(bounds.uses_arrays());
+    REQUIRE(bounds.in_bounds(70, *store->element()));
+    REQUIRE(bounds.range(40, "i") == engine::BoundsCheck::Range{2, 2000});
+    REQUIRE(bounds.range(70, "j").lo == 4);
+    REQUIRE(bounds.range(70, "j").hi == 2000);
+
+    THEN("a loop that runs one past the end is not proven") {
+      ast[60] = std::static_pointer_cast<parser::ast_node::LineNoStmt>(
+          context.parse("60 FOR j = i + i TO 2001 STEP i"));
+      REQUIRE_FALSE(engine::BoundsCheck(ast).in_bounds(70, *store->element()));
+    }
+  }
+
+  GIVEN("an array beside many variables") {
+    auto context = parser::ParseContext();
+    auto ast = engine::FlatMap<int64_t, Rc<parser::ast_node::LineNoStmt>>();
+    auto add = [&](const Str& line) {
+      auto node = std::static_pointer_cast<parser::ast_node::LineNoStmt>(
+          context.parse(line));
+      ast.emplace(node->number()->value(), node);
+    };
+    add("10 DIM a(9)");
+    add("20 LET n = 3");
+    add("30 LET i = n * 3");
+    for (int64_t v{}; v < 5000; ++v) {
+      add(std::to_string(40 + v) + " LET v" + std::to_string(v) + " = " +
+          std::to_string(v));
+    }
+    add("10000 LET a(i) = v1");
+    auto store = std::static_pointer_cast<parser::ast_node::LetElement>(
+        ast.at(10000)->stmt());
+    auto bounds = engine::BoundsCheck(ast);
+    REQUIRE(bounds.tracked() == 2);
+    REQUIRE(bounds.in_bounds(10000, *store->element()));
+    REQUIRE(bounds.range(10000, "i") == engine::BoundsCheck::Range{9, 9});
+
+    THEN("without the array nothing is analyzed") {
+      ast.erase(10);
+      ast.erase(10000);
+      auto plain = engine::BoundsCheck(ast);
+      REQUIRE_FALSE(plain.uses_arrays());
+      REQUIRE(plain.tracked() == 0);
+    }
+  }
+
+  GIVEN("a snapshot taken with arrays") {
+    auto program = Str(
+        "10 DIM v(3)\n"
+        "20 FOR i = 0 TO 3\n"
+        "30 LET v(i) = i + 1\n"
+        "40 NEXT i\n"
+        "50 INPUT k\n"
+        "60 PRINT v(k)\n");
+    auto engine = engine::MiniBasic();
+    load(engine, program);
+    engine.reset_pc();
+    Str output;
+    REQUIRE(engine.run(output) == UIBehavior::Input);
+    auto decoded = engine::Snapshot();
+    REQUIRE(engine::Snapshot::decode(engine.snapshot().encode(), decoded));
+    REQUIRE(decoded.arrays.at("v").values == Vec<int64_t>{1, 2, 3, 4});
+
+    for (auto tier : tiers) {
+      CAPTURE(static_cast<int>(tier));
+      auto resumed = engine::MiniBasic();
+      resumed.set_tier(tier);
+      load(resumed, program);
+      REQUIRE(resumed.restore(decoded));
+      resumed.handle_input("2");
+      output.clear();
+      REQUIRE(resumed.run(output) == UIBehavior::FinishRun);
+      REQUIRE(output == "3\n");
+    }
+
+    WHEN("the elements are missing") {
+      auto encoded = engine.snapshot().encode();
+      auto copy = engine::Snapshot();
+      REQUIRE_FALSE(engine::Snapshot::decode(
+          encoded.substr(0, encoded.size() - 8), copy));
+      // Bounds claiming the largest array with nothing after them
+      auto hostile = decoded;
+      hostile.arrays.at("v").extents = {parser::Array::kMaxElements};
+      REQUIRE_FALSE(engine::Snapshot::decode(hostile.encode(), copy));
+    }
+
+    WHEN("the array is resized behind the program's back") {
+      decoded.arrays.at("v").values.resize(2);
+      decoded.arrays.at("v").extents = {2};
+      auto resumed = engine::MiniBasic();
+      resumed.set_tier(engine::Tier::Bytecode);
+      load(resumed, program);
+      REQUIRE(resumed.restore(decoded));
+      resumed.handle_input("3");
+      output.clear();
+      resumed.run(output);
+      REQUIRE(output == "ERROR: index v(3) out of range\n");
+    }
+  }
+
+  GIVEN("elements assigned directly") {
+    auto engine = engine::MiniBasic();
+    engine.set_tier(engine::Tier::Bytecode);
+    load(engine, "10 PRINT v(1) + v(2)\n");
+    Str output;
+    engine.handle_command("DIM v(2)", output);
+    engine.handle_command("LET v(2) = 40", output);
+    engine.handle_command("LET v(1) = 2", output);
+    engine.reset_pc();
+    engine.run(output);
+    REQUIRE(output == "42\n");
+  }
+}
+
+SCENARIO("whole-array statements and reductions agree on every tier",
+         "[engine]") {
+  auto tiers = {engine::Tier::TreeWalker, engine::Tier::Closure,
+                engine::Tier::Bytecode, engine::Tier::BytecodeSwitch,
+                engine::Tier::Jit};
+  auto program = Str(
+      "10 DIM a(9)\n"
+      "20 DIM b(9)\n"
+      "30 FOR i = 0 TO 9\n"
+      "40 LET a(i) = (i * 7) - (i / 3) * 20\n"
+      "50 LET b(i) = i\n"
+      "60 NEXT i\n"
+      "70 MAT c = a + b\n"
+      "80 MAT c = c * (0 - 2)\n"
+      "90 MAT d = c - a\n"
+      "100 PRINT SUM(a)\n"
+      "110 PRINT MIN(c) + MAX(d)\n"
+      "120 SORT a\n"
+      "130 PRINT a(0) * 100 + a(9)\n"
+      "140 PRINT SUM(d)\n");
+  auto grid = Str(
+      "10 DIM g(2, 3)\n"
+      "20 LET g(1, 2) = 5\n"
+      "30 LET g(2, 0) = 0 - 4\n"
+      "40 MAT h = g * 3\n"
+      "50 PRINT h(1, 2) + MAX(h) - MIN(h)\n");
+
+  for (auto tier : tiers) {
+    CAPTURE(static_cast<int>(tier));
+    REQUIRE(run_with(tier, program) == "75\n-48\n16\n-315\n");
+    REQUIRE(run_with(tier, grid) == "42\n");
+    REQUIRE(run_with(tier, "10 DIM a(1)\n20 MAT c = a + b\n") ==
+            "ERROR: array b used before DIM\n");
+    REQUIRE(run_with(tier, "10 DIM a(1)\n20 DIM b(2)\n30 MAT a = a - b\n") ==
+            "ERROR: MAT a and b differ in shape\n");
+    REQUIRE(run_with(tier, "10 SORT a\n") ==
+            "ERROR: array a used before DIM\n");
+    REQUIRE(run_with(tier, "10 PRINT 1\n20 PRINT 1 + SUM(a) + w\n") ==
+            "1\nERROR: array a used before DIM\n");
+    // The factor is evaluated before the arrays are checked
+    REQUIRE(run_with(tier, "10 MAT c = a * w\n") ==
+            "WARNING: Unknown variable w\n"
+            "ERROR: array a used before DIM\n");
+  }
+
+  GIVEN("MAT in direct mode") {
+    auto engine = engine::MiniBasic();
+    load(engine, "10 PRINT SUM(b)\n");
+    Str output;
+    engine.handle_command("DIM a(3)", output);
+    engine.handle_command("LET a(3) = 7", output);
+    engine.handle_command("MAT b = a * 6", output);
+    engine.handle_command("SORT b", output);
+    engine.reset_pc();
+    engine.run(output);
+    REQUIRE(output == "42\n");
+  }
+
+  GIVEN("the shapes MAT leaves") {
+    auto context = parser::ParseContext();
+    auto ast = engine::FlatMap<int64_t, Rc<parser::ast_node::LineNoStmt>>();
+    for (const auto* line : {"10 DIM a(9)", "20 MAT b = a * 2",
+                             "30 LET b(9) = 1", "40 SORT b",
+                             "50 LET b(10) = SUM(b)"}) {
+      auto node = std::static_pointer_cast<parser::ast_node::LineNoStmt>(
+          context.parse(line));
+      ast.emplace(node->number()->value(), node);
+    }
+    auto bounds = engine::BoundsCheck(ast);
+    auto element = [&ast](int64_t line) {
+      return std::static_pointer_cast<parser::ast_node::LetElement>(
+                 ast.at(line)->stmt())
+          ->element();
+    };
+    REQUIRE(bounds.uses_arrays());
+    REQUIRE(bounds.in_bounds(30, *element(30)));
+    REQUIRE_FALSE(bounds.in_bounds(50, *element(50)));
+  }
+
+  GIVEN("random arrays of awkward sizes") {
+    auto random = std::mt19937_64(50);
+    auto policies = Vec<parser::ArrayPolicy>();
+    for (auto simd : {parser::Simd::Scalar, parser::Simd::Sse2,
+                      parser::Simd::Avx2}) {
+      policies.push_back(parser::ArrayPolicy{simd});
+      policies.push_back(parser::ArrayPolicy{simd, 4, 1});
+    }
+    for (size_t n : {1, 3, 4, 7, 17, 1000, 4099}) {
+      CAPTURE(n);
+      auto left = Vec<int64_t>(n);
+      auto right = Vec<int64_t>(n);
+      for (size_t i{}; i < n; ++i) {
+        // Some near the ends of the range, so arithmetic wraps
+        left[i] = i % 5 == 0 ? static_cast<int64_t>(random())
+                             : static_cast<int64_t>(random() % 2001) - 1000;
+        right[i] = static_cast<int64_t>(random());
+      }
+      auto factor = static_cast<int64_t>(random());
+
+      auto sum = uint64_t{};
+      for (auto value : left) {
+        sum += static_cast<uint64_t>(value);
+      }
+      auto sorted = left;
+      std::sort(sorted.begin(), sorted.end());
+
+      for (const auto& policy : policies) {
+        CAPTURE(static_cast<int>(policy.simd), policy.threads);
+        auto out = Vec<int64_t>(n);
+        parser::kernels::mat(policy, parser::MatOp::Add, left.data(),
+                             right.data(), 0, out.data(), n);
+        for (size_t i{}; i < n; ++i) {
+          REQUIRE(out[i] == static_cast<int64_t>(
+                                static_cast<uint64_t>(left[i]) +
+                                static_cast<uint64_t>(right[i])));
+        }
+        parser::kernels::mat(policy, parser::MatOp::Subtract, left.data(),
+                             right.data(), 0, out.data(), n);
+        for (size_t i{}; i < n; ++i) {
+          REQUIRE(out[i] == static_cast<int64_t>(
+                                static_cast<uint64_t>(left[i]) -
+                                static_cast<uint64_t>(right[i])));
+        }
+        parser::kernels::mat(policy, parser::MatOp::Scale, left.data(),
+                             nullptr, factor, out.data(), n);
+        for (size_t i{}; i < n; ++i) {
+          REQUIRE(out[i] == static_cast<int64_t>(
+                                static_cast<uint64_t>(left[i]) *
+                                static_cast<uint64_t>(factor)));
+        }
+
+        REQUIRE(parser::kernels::reduce(policy, parser::Reduction::Sum,
+                                        left.data(), n) ==
+                static_cast<int64_t>(sum));
+        REQUIRE(parser::kernels::reduce(policy, parser::Reduction::Min,
+                                        left.data(), n) == sorted.front());
+        REQUIRE(parser::kernels::reduce(policy, parser::Reduction::Max,
+                                        left.data(), n) == sorted.back());
+
+        out = left;
+        parser::kernels::sort(policy, out.data(), n);
+        REQUIRE(out == sorted);
+      }
+    }
+  }
+}
+
+namespace {
+// Builds a transpiled program with the system compiler and returns what the
+// executable prints when fed `input`
+Str run_native(const Str& cpp, const Str& name, const Str& input) {
+  auto dir = std::filesystem::temp_directory_path() / "mini_basic_cc";
+  std::filesystem::create_directories(dir);
+  auto quoted = [&dir](const Str& file) {
+    return "\"" + (dir / file).string() + "\"";
+  };
+  std::ofstream(dir / (name + ".cpp")) << cpp;
+  std::ofstream(dir / (name + ".in")) << input;
+
+  auto build = Str(MINI_BASIC_CXX_COMPILER) + " -O2 -std=c++17 -o " +
+               quoted(name) + " " + quoted(name + ".cpp");
+  REQUIRE(std::system(build.c_str()) == 0);
+  auto run = quoted(name) + " < " + quoted(name + ".in") + " > " +
+             quoted(name + ".out");
+  REQUIRE(std::system(run.c_str()) == 0);
+
+  std::ifstream out(dir / (name + ".out"));
+  return {std::istreambuf_iterator<char>(out), {}};
+}
+}  // namespace
+
+SCENARIO("transpiled programs agree with the interpreter", "[engine]") {
+  GIVEN("the benchmark corpus") {
+    for (const auto& entry :
+         std::filesystem::directory_iterator(BENCH_PROGRAM_DIR)) {
+      if (entry.path().extension() != ".bas") {
+        continue;
+      }
+      CAPTURE(entry.path().string());
+      auto engine = engine::MiniBasic();
+      std::fstream in(entry.path(), std::ios::in);
+      engine.load_source(in);
+      engine.reset_pc();
+      Str expected;
+      REQUIRE(engine.run(expected) == UIBehavior::FinishRun);
+
+      auto cpp = engine.get_cpp_copy();
+      REQUIRE_FALSE(cpp.empty());
+      REQUIRE(run_native(cpp, entry.path().stem().string(), "") == expected);
+    }
+  }
+
+  GIVEN("programs with INPUT, warnings and missing lines") {
+    auto inputs = Vec<Str>{"100", "7"};
+    for (size_t i{}; i < programs.size(); ++i) {
+      CAPTURE(programs[i]);
+      auto engine = engine::MiniBasic();
+      load(engine, programs[i]);
+      REQUIRE(run_native(engine.get_cpp_copy(), "program" + std::to_string(i),
+                         "100\nnot a number\n7\n") ==
+              run_with(engine::Tier::TreeWalker, programs[i], inputs));
+    }
+  }
+}
+
+SCENARIO("jumps are threaded and unreachable lines skipped", "[engine]") {
+  GIVEN("chains of GOTO and REM lines") {
+    auto source = Str(
+        "10 GOTO 20\n"
+        "20 GOTO 30\n"
+        "30 REM start\n"
+        "40 LET a = 1\n"
+        "50 IF a < 5 THEN 80\n"
+        "60 PRINT a\n"
+        "70 END\n"
+        "80 REM bump\n"
+        "90 GOTO 100\n"
+        "100 LET a = a + 1\n"
+        "110 GOTO 50\n"
+        "120 PRINT 999\n");
+    auto engine = engine::MiniBasic();
+    std::stringstream report;
+    engine.set_analysis_report(&report);
+    load(engine, source);
+    auto ast = engine.get_ast_copy();
+
+    THEN("every tier runs the threaded program") {
+      for (auto tier : {engine::Tier::TreeWalker, engine::Tier::Closure,
+                        engine::Tier::Bytecode, engine::Tier::Jit}) {
+        engine.set_tier(tier);
+        engine.reset_pc();
+        Str output;
+        REQUIRE(engine.run(output) == UIBehavior::FinishRun);
+        REQUIRE(output == "5\n");
+      }
+      REQUIRE(report.str() ==
+              "line 10: jump to 20 forwarded to 40\n"
+              "line 20: unreachable\n"
+              "line 30: unreachable\n"
+              "line 50: jump to 80 forwarded to 100\n"
+              "line 80: unreachable\n"
+              "line 90: unreachable\n"
+              "line 120: unreachable\n");
+    }
+    THEN("the source and the syntax tree are left as written") {
+      engine.reset_pc();
+      Str output;
+      engine.run(output);
+      REQUIRE(engine.get_source_copy() == source);
+      REQUIRE(engine.get_ast_copy() == ast);
+    }
+  }
+
+  GIVEN("jumps that cannot be forwarded") {
+    auto engine = engine::MiniBasic();
+    std::stringstream report;
+    engine.set_analysis_report(&report);
+    load(engine,
+         "10 LET a = 0\n"
+         "20 IF a > 0 THEN 100\n"
+         "30 IF a > 0 THEN 999\n"
+         "40 PRINT a\n"
+         "50 END\n"
+         "100 GOTO 110\n"
+         "110 GOTO 100\n");
+    engine.reset_pc();
+    Str output;
+    engine.run(output);
+    REQUIRE(output == "0\n");
+    REQUIRE(report.str() ==
+            "line 20: jumps into a GOTO loop at line 100\n"
+            "line 30: jumps to missing line 999\n"
+            "line 100: jumps into a GOTO loop at line 110\n"
+            "line 110: jumps into a GOTO loop at line 100\n");
+  }
+}
+
+SCENARIO("reads are only checked where a variable may be unassigned",
+         "[engine]") {
+  auto source = Str(
+      "10 INPUT n\n"
+      "20 IF n > 5 THEN 40\n"
+      "30 LET y = 1\n"
+      "40 PRINT n + y\n"
+      "50 LET n = n - 1\n"
+      "60 IF n > 0 THEN 50\n");
+  auto tiers = {engine::Tier::TreeWalker, engine::Tier::Closure,
+                engine::Tier::Bytecode, engine::Tier::BytecodeSwitch,
+                engine::Tier::Jit};
+
+  GIVEN("a variable assigned on only one path") {
+    auto engine = engine::MiniBasic();
+    std::stringstream report;
+    engine.set_analysis_report(&report);
+    load(engine, source);
+    engine.reset_pc();
+    Str output;
+    engine.run(output);
+    REQUIRE(report.str() == "line 40: y may be read before it is assigned\n");
+
+    THEN("every tier still warns on the path that skips it") {
+      for (auto tier : tiers) {
+        CAPTURE(static_cast<int>(tier));
+        REQUIRE(run_with(tier, source, {"3000"}) ==
+                "INPUT n\nWARNING: Unknown variable y\n3000\n");
+        REQUIRE(run_with(tier, source, {"3"}) == "INPUT n\n4\n");
+      }
+    }
+  }
+
+  GIVEN("a run paused on INPUT while an assignment is added before it") {
+    for (auto tier : tiers) {
+      CAPTURE(static_cast<int>(tier));
+      auto engine = engine::MiniBasic();
+      engine.set_tier(tier);
+      load(engine,
+           "10 INPUT n\n"
+           "20 PRINT n + y\n");
+      engine.reset_pc();
+      Str output;
+      REQUIRE(engine.run(output) == UIBehavior::Input);
+      Str ignore;
+      engine.handle_command("5 LET y = 2", ignore);
+      engine.handle_input("1");
+
+      THEN("the run that skipped it still warns") {
+        REQUIRE(engine.run(output) == UIBehavior::FinishRun);
+        REQUIRE(output == "INPUT n\nWARNING: Unknown variable y\n1\n");
+      }
+    }
+  }
+}
+
+SCENARIO("runs that need no input are memoized", "[engine]") {
+  auto engine = engine::MiniBasic();
+  engine.set_memoize(true);
+
+  GIVEN("a deterministic program") {
+    load(engine,
+         "10 LET a = 0\n"
+         "20 LET a = a + 3\n"
+         "30 IF a < 300 THEN 20\n"
+         "40 PRINT a\n"
+         "50 PRINT b\n");
+    auto run = [&engine]() {
+      engine.reset_pc();
+      Str output;
+      REQUIRE(engine.run(output) == UIBehavior::FinishRun);
+      return output;
+    };
+    auto expected = Str("300\nWARNING: Unknown variable b\n0\n");
+    REQUIRE(run() == expected);
+    REQUIRE(engine.run_cache().misses() == 1);
+
+    THEN("running it again replays the output and the variables") {
+      engine.set_tier(engine::Tier::Bytecode);
+      REQUIRE(run() == expected);
+      REQUIRE(engine.run_cache().hits() == 1);
+      Str output;
+      engine.handle_command("PRINT a", output);
+      REQUIRE(output == "300");
+    }
+    WHEN("the starting variables differ") {
+      Str ignore;
+      engine.handle_command("LET b = 7", ignore);
+
+      THEN("the program runs again") {
+        REQUIRE(run() == "300\n7\n");
+        REQUIRE(engine.run_cache().hits() == 0);
+      }
+    }
+    WHEN("the program is edited") {
+      Str ignore;
+      engine.handle_command("20 LET a = a + 100", ignore);
+
+      THEN("the program runs again") {
+        REQUIRE(run() == "300\nWARNING: Unknown variable b\n0\n");
+        REQUIRE(engine.run_cache().hits() == 0);
+        REQUIRE(engine.run_cache().size() == 2);
+      }
+    }
+  }
+
+  GIVEN("a program whose suffix after the last INPUT is deterministic") {
+    load(engine,
+         "10 INPUT n\n"
+         "20 LET s = 0\n"
+         "30 LET s = s + n\n"
+         "40 LET n = n - 1\n"
+         "50 IF n > 0 THEN 30\n"
+         "60 PRINT s\n");
+    auto run = [&engine](const Str& input) {
+      engine.reset_pc();
+      Str output;
+      REQUIRE(engine.run(output) == UIBehavior::Input);
+      engine.handle_input(input);
+      REQUIRE(engine.run(output) == UIBehavior::FinishRun);
+      return output;
+    };
+    REQUIRE(run("100") == "INPUT n\n5050\n");
+    REQUIRE(run("100") == "INPUT n\n5050\n");
+    REQUIRE(run("10") == "INPUT n\n55\n");
+    REQUIRE(engine.run_cache().hits() == 1);
+    REQUIRE(engine.run_cache().misses() == 2);
+  }
+}
+
+SCENARIO("runs that repeat a state are stopped", "[engine]") {
+  auto tiers = {engine::Tier::TreeWalker, engine::Tier::Closure,
+                engine::Tier::Bytecode, engine::Tier::BytecodeSwitch,
+                engine::Tier::Jit};
+  auto run = [](engine::Tier tier, const Str& source) {
+    auto engine = engine::MiniBasic();
+    engine.set_tier(tier);
+    engine.set_detect_cycles(true, 16);
+    load(engine, source);
+    engine.reset_pc();
+    Str output;
+    REQUIRE(engine.run(output) == UIBehavior::FinishRun);
+    return output;
+  };
+
+  for (auto tier : tiers) {
+    CAPTURE(static_cast<int>(tier));
+    REQUIRE(run(tier, "10 PRINT 1\n20 GOTO 20\n") ==
+            "1\nERROR: endless loop at line 20, the same state repeats\n");
+    REQUIRE(run(tier,
+                "10 LET a = 0\n"
+                "20 LET a = 1 - a\n"
+                "30 IF a < 2 THEN 20\n") ==
+            "ERROR: endless loop at line 20, the same state repeats\n");
+
+    // Long but finite loops run to the end
+    auto count = Str(
+        "10 LET i = 0\n"
+        "20 LET i = i + 1\n"
+        "30 IF i < 100000 THEN 20\n"
+        "40 PRINT i\n");
+    REQUIRE(run(tier, count) == "100000\n");
+
+    // A subroutine called twice repeats its states under another caller
+    auto twice = Str(
+        "10 GOSUB 100\n"
+        "20 GOSUB 100\n"
+        "30 PRINT i\n"
+        "40 END\n"
+        "100 LET i = 0\n"
+        "110 LET i = i + 1\n"
+        "120 IF i < 1024 THEN 110\n"
+        "130 RETURN\n");
+    REQUIRE(run(tier, twice) == "1024\n");
+  }
+}
+
+SCENARIO("runs end within their quotas", "[engine]") {
+  auto tiers = {engine::Tier::TreeWalker, engine::Tier::Closure,
+                engine::Tier::Bytecode, engine::Tier::Jit};
+  auto endless = Str(
+      "10 LET i = 0\n"
+      "20 LET i = i + 1\n"
+      "30 GOTO 20\n");
+  auto run = [](engine::Tier tier, const Str& source,
+                const engine::Quota& quota, Str& output) {
+    auto engine = engine::MiniBasic();
+    engine.set_tier(tier);
+    engine.set_quota(quota);
+    load(engine, source);
+    engine.reset_pc();
+    REQUIRE(engine.run(output) == UIBehavior::FinishRun);
+    return engine.termination();
+  };
+
+  for (auto tier : tiers) {
+    CAPTURE(static_cast<int>(tier));
+    Str output;
+    auto quota = engine::Quota{};
+    quota.max_steps = 100000;
+    quota.check_period = 1000;
+    REQUIRE(run(tier, endless, quota, output) ==
+            engine::Termination::StepQuota);
+    REQUIRE(output == "ERROR: step quota exceeded\n");
+
+    output.clear();
+    quota = engine::Quota{};
+    quota.max_time = std::chrono::milliseconds(20);
+    REQUIRE(run(tier, endless, quota, output) ==
+            engine::Termination::TimeQuota);
+
+    output.clear();
+    quota = engine::Quota{};
+    quota.max_output = 10;
+    REQUIRE(run(tier, "10 PRINT 12345\n20 GOTO 10\n", quota, output) ==
+            engine::Termination::OutputQuota);
+    REQUIRE(output == "12345\n1234\nERROR: output quota exceeded\n");
+
+    output.clear();
+    quota = engine::Quota{};
+    quota.max_variables = 2;
+    REQUIRE(run(tier, "10 LET a = 1\n20 LET b = 2\n30 LET c = 3\n", quota,
+                output) == engine::Termination::VariableQuota);
+    REQUIRE(output == "ERROR: variable quota exceeded\n");
+
+    output.clear();
+    REQUIRE(run(tier, "10 PRINT 1\n", quota, output) ==
+            engine::Termination::Finished);
+    REQUIRE(output == "1\n");
+  }
+
+  GIVEN("a run memoized before a quota was set") {
+    auto engine = engine::MiniBasic();
+    engine.set_memoize(true);
+    load(engine, "10 PRINT 12345\n20 PRINT 67890\n");
+    Str output;
+    engine.reset_pc();
+    engine.run(output);
+    REQUIRE(engine.run_cache().size() == 1);
+
+    auto quota = engine::Quota{};
+    quota.max_output = 8;
+    engine.set_quota(quota);
+    output.clear();
+    engine.reset_pc();
+    engine.run(output);
+    REQUIRE(engine.termination() == engine::Termination::OutputQuota);
+    REQUIRE(output == "12345\n67\nERROR: output quota exceeded\n");
+  }
+}
+
+SCENARIO("a scheduler time-slices programs on one thread", "[engine]") {
+  auto count = [](int64_t to) {
+    return "10 LET i = 0\n"
+           "20 LET i = i + 1\n"
+           "30 IF i < " +
+           std::to_string(to) +
+           " THEN 20\n"
+           "40 PRINT i\n";
+  };
+  auto engines = Vec<engine::MiniBasic>(3);
+  auto outputs = Vec<Str>(3);
+  auto scheduler = engine::Scheduler(100);
+  for (size_t i{}; i < engines.size(); ++i) {
+    engines[i].set_tier(i == 0 ? engine::Tier::TreeWalker
+                               : engine::Tier::Bytecode);
+    load(engines[i], i == 2 ? "10 INPUT n\n20 PRINT n\n" : count(1000));
+    engines[i].reset_pc();
+    scheduler.add(engines[i], outputs[i]);
+  }
+
+  REQUIRE(scheduler.turn());
+  REQUIRE(scheduler.state(0) == UIBehavior::Yield);
+  REQUIRE(engines[0].termination() == engine::Termination::Yielded);
+  REQUIRE(outputs[0].empty());
+
+  scheduler.run();
+  REQUIRE(outputs[0] == "1000\n");
+  REQUIRE(outputs[1] == "1000\n");
+  REQUIRE(scheduler.state(2) == UIBehavior::Input);
+
+  engines[2].handle_input("7");
+  scheduler.resume(2);
+  scheduler.run();
+  REQUIRE(outputs[2] == "INPUT n\n7\n");
+  REQUIRE(scheduler.state(2) == UIBehavior::FinishRun);
+  REQUIRE(engines[2].termination() == engine::Termination::Finished);
+}
+
+SCENARIO("a paused run is snapshotted and restored", "[engine]") {
+  auto program = Str(
+      "10 LET a = 5\n"
+      "20 INPUT b\n"
+      "30 PRINT a + b\n");
+  auto engine = engine::MiniBasic();
+  load(engine, program);
+  engine.reset_pc();
+  Str output;
+  REQUIRE(engine.run(output) == UIBehavior::Input);
+  auto snapshot = engine.snapshot();
+  REQUIRE(snapshot.pc == 30);
+  REQUIRE(snapshot.need_input == "b");
+
+  auto data = snapshot.encode();
+  auto decoded = engine::Snapshot();
+  REQUIRE(engine::Snapshot::decode(data, decoded));
+  REQUIRE(decoded == snapshot);
+  REQUIRE_FALSE(engine::Snapshot::decode(data.substr(0, data.size() - 1),
+                                         decoded));
+
+  GIVEN("a fresh engine that loaded the same program") {
+    auto tier = GENERATE(engine::Tier::TreeWalker, engine::Tier::Bytecode);
+    auto resumed = engine::MiniBasic();
+    resumed.set_tier(tier);
+    load(resumed, program);
+    REQUIRE(resumed.restore(decoded));
+
+    REQUIRE(resumed.handle_input("3"));
+    output.clear();
+    REQUIRE(resumed.run(output) == UIBehavior::FinishRun);
+    REQUIRE(output == "8\n");
+  }
+  GIVEN("an engine with a different program") {
+    auto other = engine::MiniBasic();
+    load(other, "10 LET a = 6\n20 INPUT b\n30 PRINT a + b\n");
+    REQUIRE_FALSE(other.restore(decoded));
+  }
+  GIVEN("a snapshot missing a variable the program has assigned") {
+    decoded.variants.clear();
+    auto resumed = engine::MiniBasic();
+    resumed.set_tier(engine::Tier::Bytecode);
+    load(resumed, program);
+    REQUIRE(resumed.restore(decoded));
+    resumed.handle_input("3");
+    output.clear();
+    resumed.run(output);
+    REQUIRE(output == "WARNING: Unknown variable a\n3\n");
+  }
+}
+
+SCENARIO("persistent maps keep every version", "[engine]") {
+  auto map = engine::PersistentMap<int64_t, int64_t>();
+  auto expected = Map<int64_t, int64_t>();
+  auto versions = Vec<std::pair<engine::PersistentMap<int64_t, int64_t>,
+                                Map<int64_t, int64_t>>>();
+  auto same = [](const engine::PersistentMap<int64_t, int64_t>& map,
+                 const Map<int64_t, int64_t>& expected) {
+    return map.size() == expected.size() &&
+           std::equal(map.begin(), map.end(), expected.begin(),
+                      [](const auto& a, const auto& b) {
+                        return a.first == b.first && a.second == b.second;
+                      });
+  };
+
+  // Deterministic mix of inserts, overwrites and erases that grows and
+  // shrinks the tree through several levels
+  uint64_t state = 42;
+  for (int64_t i{}; i < 20000; ++i) {
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    auto key = static_cast<int64_t>(state >> 33) % 3000;
+    if (i % 3 == 0 || i > 15000) {
+      REQUIRE(map.erase(key) == (expected.erase(key) != 0));
+    } else {
+      REQUIRE(map.insert_or_assign(key, i) == !expected.count(key));
+      expected[key] = i;
+    }
+    if (i % 1000 == 0) {
+      versions.emplace_back(map, expected);
+    }
+  }
+  REQUIRE(same(map, expected));
+  for (const auto& [version, contents] : versions) {
+    REQUIRE(same(version, contents));
+  }
+
+  auto copy = map;
+  REQUIRE(copy.shares(map));
+  auto it = copy.begin();
+  copy.insert_or_assign(-1, 0);
+  REQUIRE(map.find(-1) == nullptr);
+  REQUIRE(*copy.find(-1) == 0);
+  REQUIRE(!copy.shares(map));
+  // The iterator goes on walking the version it started on
+  REQUIRE(same(map, Map<int64_t, int64_t>(it, copy.end())));
+
+  if (!expected.empty()) {
+    auto key = expected.begin()->first + 1;
+    auto bound = map.lower_bound(key);
+    auto want = expected.lower_bound(key);
+    REQUIRE((bound == map.end()) == (want == expected.end()));
+    if (want != expected.end()) {
+      REQUIRE(bound->first == want->first);
+    }
+  }
+}
+
+SCENARIO("edits can be undone and redone", "[engine]") {
+  auto engine = engine::MiniBasic();
+  load(engine, "10 PRINT 1\n20 PRINT 2\n");
+  engine.take_changes();
+  Str output;
+  engine.handle_command("20 PRINT 3", output);
+  engine.handle_command("30 PRINT 4", output);
+  engine.handle_command("10", output);
+  auto edited = engine.listing();
+  REQUIRE(engine.get_source_copy() == "20 PRINT 3\n30 PRINT 4\n");
+  engine.take_changes();
+
+  REQUIRE(engine.handle_command("UNDO", output) == UIBehavior::None);
+  REQUIRE(engine.get_source_copy() == "10 PRINT 1\n20 PRINT 3\n30 PRINT 4\n");
+  engine.handle_command("UNDO", output);
+  engine.handle_command("UNDO", output);
+  REQUIRE(engine.get_source_copy() == "10 PRINT 1\n20 PRINT 2\n");
+  auto changes = engine.take_changes();
+  REQUIRE(changes.size() == 3);
+  REQUIRE(changes[0].kind == engine::LineChange::Kind::Inserted);
+  REQUIRE(changes[1].kind == engine::LineChange::Kind::Deleted);
+  REQUIRE(changes[1].line == 30);
+  REQUIRE(changes[2].kind == engine::LineChange::Kind::Replaced);
+  REQUIRE(edited.size() == 2);
+
+  engine.reset_pc();
+  engine.run(output);
+  REQUIRE(output == "1\n2\n");
+
+  output.clear();
+  engine.handle_command("REDO", output);
+  REQUIRE(engine.get_source_copy() == "10 PRINT 1\n20 PRINT 3\n");
+
+  WHEN("a new edit is made") {
+    engine.handle_command("40 PRINT 5", output);
+    THEN("the undone edits cannot be redone") {
+      engine.handle_command("REDO", output);
+      REQUIRE(output == "WARNING: nothing to redo\n");
+    }
+  }
+  WHEN("everything is undone, LOAD included") {
+    for (auto i = 0; i < 3; ++i) {
+      engine.handle_command("UNDO", output);
+    }
+    REQUIRE(engine.get_source_copy().empty());
+    REQUIRE(output == "WARNING: nothing to undo\n");
+  }
+}
+
+SCENARIO("batches of line edits are applied at once", "[engine]") {
+  auto edits = Vec<Str>();
+  for (int64_t i = 1; i <= 2000; ++i) {
+    edits.push_back(std::to_string(i * 10) + " LET v" + std::to_string(i) +
+                    " = " + std::to_string(i) + " * 3");
+  }
+  edits.push_back("30");
+  edits.push_back("40 PRINT v1 + v2");
+  edits.push_back("PRINT 1");
+
+  auto one_by_one = engine::MiniBasic();
+  load(one_by_one, "5 PRINT 0\n");
+  for (const auto& edit : edits) {
+    if (edit != "PRINT 1") {
+      Str ignore;
+      one_by_one.handle_command(edit, ignore);
+    }
+  }
+
+  for (auto threads : {1U, 4U}) {
+    CAPTURE(threads);
+    auto engine = engine::MiniBasic();
+    load(engine, "5 PRINT 0\n");
+    engine.take_changes();
+    Str output;
+    REQUIRE(engine.apply_edits(edits, output, threads) == 2002);
+    REQUIRE(output == "WARNING: not a line edit: PRINT 1\n");
+    REQUIRE(engine.get_line_numbers().size() == 2000);
+    REQUIRE(engine.get_source_line(40) == "40 PRINT v1 + v2");
+    REQUIRE(engine.get_ast_copy() == one_by_one.get_ast_copy());
+
+    auto changes = engine.take_changes();
+    REQUIRE(changes.size() == 2002);
+    REQUIRE(changes[2000].kind == engine::LineChange::Kind::Deleted);
+    REQUIRE(changes[2001].kind == engine::LineChange::Kind::Replaced);
+
+    output.clear();
+    engine.handle_command("UNDO", output);
+    REQUIRE(engine.get_source_copy() == "5 PRINT 0\n");
+  }
+}
+
+SCENARIO("lazily loaded lines are parsed when first needed", "[engine]") {
+  auto program = Str(
+      "10 PRINT 1\n"
+      "20 LET = 5\n"
+      "30 PRINT 2\n"
+      "40 END\n"
+      "50 PRINT\n");
+  auto eager = engine::MiniBasic();
+  load(eager, program);
+  auto engine = engine::MiniBasic();
+  engine.set_lazy_load(true);
+  load(engine, program);
+  REQUIRE(engine.get_line_numbers() == Vec<int64_t>{10, 20, 30, 40, 50});
+  REQUIRE(engine.parse_cache().misses() == 0);
+  REQUIRE(engine.get_line_ast_copy(20) ==
+          "INVALID\n\tlet requires variant\n");
+  REQUIRE(engine.get_line_ast_copy(30) == eager.get_line_ast_copy(30));
+
+  GIVEN("the tree walker") {
+    engine.reset_pc();
+    Str output;
+    REQUIRE(engine.run(output) == UIBehavior::FinishRun);
+    REQUIRE(output == "1\nERROR: line 20: let requires variant\n2\n");
+    THEN("only the lines it reached were parsed") {
+      REQUIRE(engine.parse_cache().misses() == 4);
+      REQUIRE(!engine.has_line(20));
+      REQUIRE(engine.has_line(50));
+
+      output.clear();
+      engine.handle_command("CHECK", output);
+      REQUIRE(output == "ERROR: line 50: unexpected token in expression\n");
+      REQUIRE(engine.get_ast_copy() == eager.get_ast_copy());
+    }
+  }
+  GIVEN("a compiled tier") {
+    engine.set_tier(engine::Tier::Bytecode);
+    engine.reset_pc();
+    Str output;
+    REQUIRE(engine.run(output) == UIBehavior::FinishRun);
+    REQUIRE(output ==
+            "ERROR: line 20: let requires variant\n"
+            "ERROR: line 50: unexpected token in expression\n"
+            "1\n2\n");
+  }
+}
+
+SCENARIO("a lazily loaded run ends where an eager one does", "[engine]") {
+  auto run = [](const Str& program, bool lazy) {
+    auto engine = engine::MiniBasic();
+    engine.set_lazy_load(lazy);
+    load(engine, program);
+    engine.reset_pc();
+    Str output;
+    REQUIRE(engine.run(output) == UIBehavior::FinishRun);
+    return output;
+  };
+
+  GIVEN("a GOSUB into a pure GOTO the analysis drops") {
+    auto program = Str(
+        "10 GOSUB 20\n"
+        "20 GOTO 30\n"
+        "30 GOSUB 20\n");
+    REQUIRE(run(program, false) == "ERROR: GOSUB nested deeper than 1024\n");
+    REQUIRE(run(program, true) == run(program, false));
+  }
+  GIVEN("a jump to a line that fails to parse") {
+    auto program = Str(
+        "10 GOTO 30\n"
+        "20 PRINT 1\n"
+        "30 LET = 5\n"
+        "40 PRINT 2\n");
+    REQUIRE(run(program, false).empty());
+    REQUIRE(run(program, true) == "ERROR: line 30: let requires variant\n");
+  }
+  GIVEN("a GOTO to the next line when it fails to parse") {
+    auto program = Str(
+        "10 GOTO 20\n"
+        "20 LET = 5\n"
+        "30 PRINT 2\n");
+    REQUIRE(run(program, false).empty());
+    REQUIRE(run(program, true) == "ERROR: line 20: let requires variant\n");
+  }
+}
+
+SCENARIO("a background load parses while the program is usable", "[engine]") {
+  auto program = Str();
+  for (int i = 1; i <= 2000; ++i) {
+    program += std::to_string(i * 10) + " PRINT " + std::to_string(i) + "\n";
+  }
+  program += "20005 LET = 5\n";
+  auto eager = engine::MiniBasic();
+  load(eager, program);
+  auto engine = engine::MiniBasic();
+  std::stringstream in(program);
+  engine.begin_load(in);
+  REQUIRE(engine.get_source_copy() == program);
+
+  GIVEN("the load polled until it completes") {
+    Str output;
+    while (engine.poll_load(output) != 0) {
+      std::this_thread::yield();
+    }
+    REQUIRE(!engine.loading());
+    REQUIRE(output == "ERROR: line 20005: let requires variant\n");
+    REQUIRE(engine.get_ast_copy() == eager.get_ast_copy());
+    THEN("loading it again installs it from the parse cache") {
+      std::stringstream again(program);
+      engine.begin_load(again);
+      REQUIRE(engine.load_progress().total == 1);
+    }
+  }
+  GIVEN("a line edited during the load") {
+    Str output;
+    engine.handle_command("10 PRINT 0", output);
+    while (engine.poll_load(output) != 0) {
+      std::this_thread::yield();
+    }
+    REQUIRE(engine.get_source_line(10) == "10 PRINT 0");
+    engine.reset_pc();
+    output.clear();
+    engine.run(output);
+    REQUIRE(output.substr(0, 4) == "0\n2\n");
+  }
+  GIVEN("a compiled run started during the load") {
+    engine.set_tier(engine::Tier::Bytecode);
+    engine.reset_pc();
+    Str output;
+    REQUIRE(engine.run(output) == UIBehavior::FinishRun);
+    REQUIRE(!engine.loading());
+    REQUIRE(output.substr(0, 40) ==
+            "ERROR: line 20005: let requires variant\n");
+  }
+  GIVEN("a cancelled load") {
+    engine.cancel_load();
+    REQUIRE(!engine.loading());
+    REQUIRE(engine.load_progress().total == 0);
+    REQUIRE(engine.get_source_copy() == program);
+    Str output;
+    engine.handle_command("CHECK", output);
+    REQUIRE(output == "ERROR: line 20005: let requires variant\n");
+    REQUIRE(engine.get_ast_copy() == eager.get_ast_copy());
+  }
+}
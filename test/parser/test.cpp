@@ -30,6 +30,18 @@ SCENARIO("parser can parse command", "[parser]") {
     REQUIRE(parser_result_into_str(parser.parse(tokenizer.lex("CLEAR"))) ==
             "CLEAR\n");
   }
+  GIVEN("UNDO") {
+    REQUIRE(parser_result_into_str(parser.parse(tokenizer.lex("UNDO"))) ==
+            "UNDO\n");
+  }
+  GIVEN("REDO") {
+    REQUIRE(parser_result_into_str(parser.parse(tokenizer.lex("REDO"))) ==
+            "REDO\n");
+  }
+  GIVEN("CHECK") {
+    REQUIRE(parser_result_into_str(parser.parse(tokenizer.lex("CHECK"))) ==
+            "CHECK\n");
+  }
   GIVEN("HELP") {
     REQUIRE(parser_result_into_str(parser.parse(tokenizer.lex("HELP"))) ==
             "HELP\n");
@@ -110,6 +122,184 @@ SCENARIO("parser can parse script with simple expression", "[parser]") {
             "190\n"
             "\tEND\n");
   }
+  GIVEN("FOR") {
+    REQUIRE(parser_result_into_str(
+                parser.parse(tokenizer.lex("200 FOR i = 1 TO n + 1"))) ==
+            "200\n"
+            "\tFOR\n"
+            "\t\t=\n"
+            "\t\t\ti\n"
+            "\t\t\t1\n"
+            "\t\tTO\n"
+            "\t\t\t+\n"
+            "\t\t\t\tn\n"
+            "\t\t\t\t1\n");
+  }
+  GIVEN("FOR with STEP") {
+    REQUIRE(parser_result_into_str(
+                parser.parse(tokenizer.lex("210 FOR i = n TO 0 STEP -2"))) ==
+            "210\n"
+            "\tFOR\n"
+            "\t\t=\n"
+            "\t\t\ti\n"
+            "\t\t\tn\n"
+            "\t\tTO\n"
+            "\t\t\t0\n"
+            "\t\tSTEP\n"
+            "\t\t\t-\n"
+            "\t\t\t\t2\n");
+  }
+  GIVEN("NEXT") {
+    REQUIRE(parser_result_into_str(parser.parse(tokenizer.lex("220 NEXT i"))) ==
+            "220\n"
+            "\tNEXT\n"
+            "\t\ti\n");
+  }
+  GIVEN("GOSUB") {
+    REQUIRE(parser_result_into_str(parser.parse(tokenizer.lex("230 GOSUB 500"))) ==
+            "230\n"
+            "\tGOSUB\n"
+            "\t\t500\n");
+  }
+  GIVEN("RETURN") {
+    REQUIRE(parser_result_into_str(parser.parse(tokenizer.lex("240 RETURN"))) ==
+            "240\n"
+            "\tRETURN\n");
+  }
+  GIVEN("DIM") {
+    REQUIRE(parser_result_into_str(
+                parser.parse(tokenizer.lex("250 DIM a(n, 2 * m)"))) ==
+            "250\n"
+            "\tDIM\n"
+            "\t\ta\n"
+            "\t\t\tn\n"
+            "\t\t\t*\n"
+            "\t\t\t\t2\n"
+            "\t\t\t\tm\n");
+  }
+  GIVEN("DIM as a command") {
+    REQUIRE(parser_result_into_str(parser.parse(tokenizer.lex("DIM a(3)"))) ==
+            "DIM\n"
+            "\ta\n"
+            "\t\t3\n");
+  }
+  GIVEN("DIM without bounds") {
+    REQUIRE(parser_result_into_str(parser.parse(tokenizer.lex("260 DIM a"))) ==
+            "INVALID\n"
+            "\tdim requires bounds\n");
+  }
+}
+
+SCENARIO("parser can parse whole-array statements", "[parser]") {
+  auto tokenizer = tokenizer::Tokenizer();
+  auto parser = parser::Parser();
+  GIVEN("MAT adding two arrays") {
+    REQUIRE(parser_result_into_str(
+                parser.parse(tokenizer.lex("10 MAT a = b + c"))) ==
+            "10\n"
+            "\tMAT\n"
+            "\t\t=\n"
+            "\t\t\ta\n"
+            "\t\t\t+\n"
+            "\t\t\t\tb\n"
+            "\t\t\t\tc\n");
+  }
+  GIVEN("MAT scaling by an expression") {
+    REQUIRE(parser_result_into_str(
+                parser.parse(tokenizer.lex("20 MAT a = a * (k + 1)"))) ==
+            "20\n"
+            "\tMAT\n"
+            "\t\t=\n"
+            "\t\t\ta\n"
+            "\t\t\t*\n"
+            "\t\t\t\ta\n"
+            "\t\t\t\t+\n"
+            "\t\t\t\t\tk\n"
+            "\t\t\t\t\t1\n");
+  }
+  GIVEN("MAT dividing") {
+    REQUIRE(parser_result_into_str(
+                parser.parse(tokenizer.lex("30 MAT a = b / c"))) ==
+            "INVALID\n"
+            "\tmat requires +, - or *\n");
+  }
+  GIVEN("SORT") {
+    REQUIRE(parser_result_into_str(parser.parse(tokenizer.lex("40 SORT a"))) ==
+            "40\n"
+            "\tSORT\n"
+            "\t\ta\n");
+  }
+  GIVEN("reductions inside expressions") {
+    REQUIRE(parser_result_into_str(parser.parse(
+                tokenizer.lex("50 PRINT SUM(a) - MAX(a) * MIN(b)"))) ==
+            "50\n"
+            "\tPRINT\n"
+            "\t\t-\n"
+            "\t\t\tSUM\n"
+            "\t\t\t\ta\n"
+            "\t\t\t*\n"
+            "\t\t\t\tMAX\n"
+            "\t\t\t\t\ta\n"
+            "\t\t\t\tMIN\n"
+            "\t\t\t\t\tb\n");
+  }
+  GIVEN("a reduction of an element") {
+    REQUIRE(parser_result_into_str(
+                parser.parse(tokenizer.lex("60 PRINT SUM(a(1))"))) ==
+            "INVALID\n"
+            "\tunmatched left parenthesis\n");
+  }
+}
+
+SCENARIO("parser can parse array elements", "[parser]") {
+  auto tokenizer = tokenizer::Tokenizer();
+  auto parser = parser::Parser();
+  GIVEN("an element read") {
+    REQUIRE(parser_result_into_str(
+                parser.parse(tokenizer.lex("10 PRINT a(i + 1) * 2"))) ==
+            "10\n"
+            "\tPRINT\n"
+            "\t\t*\n"
+            "\t\t\ta\n"
+            "\t\t\t\t+\n"
+            "\t\t\t\t\ti\n"
+            "\t\t\t\t\t1\n"
+            "\t\t\t2\n");
+  }
+  GIVEN("an element assignment") {
+    REQUIRE(parser_result_into_str(
+                parser.parse(tokenizer.lex("20 LET a(i, j) = a(j, i)"))) ==
+            "20\n"
+            "\tLET\n"
+            "\t\t=\n"
+            "\t\t\ta\n"
+            "\t\t\t\ti\n"
+            "\t\t\t\tj\n"
+            "\t\t\ta\n"
+            "\t\t\t\tj\n"
+            "\t\t\t\ti\n");
+  }
+  GIVEN("an element assignment in direct mode") {
+    REQUIRE(parser_result_into_str(
+                parser.parse(tokenizer.lex("LET a(0) = 1"))) ==
+            "LET\n"
+            "\t=\n"
+            "\t\ta\n"
+            "\t\t\t0\n"
+            "\t\t1\n");
+  }
+  GIVEN("three indices") {
+    REQUIRE(parser_result_into_str(
+                parser.parse(tokenizer.lex("30 PRINT a(1, 2, 3)"))) ==
+            "INVALID\n"
+            "\ttoo many indices\n");
+  }
+  GIVEN("an unclosed index") {
+    REQUIRE(parser_result_into_str(
+                parser.parse(tokenizer.lex("40 PRINT a(1"))) ==
+            "INVALID\n"
+            "\tunmatched left parenthesis\n");
+  }
 }
 
 SCENARIO("parser can parse complex expression", "[parser]") {
@@ -198,4 +388,115 @@ SCENARIO("parser can parse complex expression", "[parser]") {
             "\t\t\t\t\t\t\t\t\t2\n"
             "\t\t\t\t\t\t\t\t\t3\n");
   }
-}
\ No newline at end of file
+}
+SCENARIO("parse context can be reused across lines", "[parser]") {
+  auto context = parser::ParseContext();
+
+  GIVEN("several lines parsed in a row") {
+    auto let = context.parse("10 LET n = (1+2)*3");
+    auto run = context.parse("RUN");
+    auto invalid = context.parse("20 LET = 1");
+    auto rem = context.parse("30 REM");
+
+    REQUIRE(parser_result_into_str(let) ==
+            "10\n"
+            "\tLET\n"
+            "\t\t=\n"
+            "\t\t\tn\n"
+            "\t\t\t*\n"
+            "\t\t\t\t+\n"
+            "\t\t\t\t\t1\n"
+            "\t\t\t\t\t2\n"
+            "\t\t\t\t3\n");
+    REQUIRE(parser_result_into_str(run) == "RUN\n");
+    REQUIRE(parser_result_into_str(invalid) ==
+            "INVALID\n"
+            "\tlet requires variant\n");
+    REQUIRE(parser_result_into_str(rem) ==
+            "30\n"
+            "\tREM\n"
+            "\t\t\n");
+    REQUIRE(parser_result_into_str(context.parse("10 LET n = (1+2)*3")) ==
+            parser_result_into_str(let));
+  }
+}
+
+SCENARIO("reserved words cannot name variables", "[parser]") {
+  auto tokenizer = tokenizer::Tokenizer();
+  auto two_pass = parser::Parser();
+  auto fused = parser::Parser();
+
+  GIVEN("keywords, reductions and commands where a variable belongs") {
+    for (const auto* line :
+         {"10 LET SUM = 1", "10 INPUT TO", "10 FOR STEP = 1 TO 2",
+          "10 NEXT MAX", "10 DIM GOSUB(3)", "10 SORT CHECK",
+          "10 MAT RUN = a + b", "10 MAT a = b - UNDO", "10 PRINT SUM + 1",
+          "10 PRINT 1 + MIN", "10 LET a = -REDO", "10 IF RETURN > 1 THEN 20",
+          "10 PRINT MAX(DIM)"}) {
+      CAPTURE(line);
+      REQUIRE(parser_result_into_str(two_pass.parse(tokenizer.lex(line))) ==
+              "INVALID\n"
+              "\treserved word used as variable\n");
+      REQUIRE(parser_result_into_str(fused.parse(tokenizer, line)) ==
+              "INVALID\n"
+              "\treserved word used as variable\n");
+    }
+  }
+  GIVEN("the same names in lower case") {
+    REQUIRE(parser_result_into_str(
+                two_pass.parse(tokenizer.lex("10 LET sum = max + 1"))) ==
+            "10\n"
+            "\tLET\n"
+            "\t\t=\n"
+            "\t\t\tsum\n"
+            "\t\t\t+\n"
+            "\t\t\t\tmax\n"
+            "\t\t\t\t1\n");
+  }
+  GIVEN("no variable at all") {
+    auto invalid = two_pass.parse(tokenizer.lex("10 LET = 1"));
+    REQUIRE(parser_result_into_str(invalid) ==
+            "INVALID\n"
+            "\tlet requires variant\n");
+  }
+}
+
+SCENARIO("fused front end produces the same result as two passes",
+         "[parser]") {
+  auto tokenizer = tokenizer::Tokenizer();
+  auto two_pass = parser::Parser();
+  auto fused = parser::Parser();
+
+  auto lines = Vec<Str>{
+      "100 REM Program to print the Fibonacci sequence",
+      "110 REM",
+      "120 LET max = 10000",
+      "130 LET n1 = --++1**2**3",
+      "140 IF n1 > max THEN 190",
+      "150 PRINT (n1 + 2) * 3 - 4 / 5",
+      "160 INPUT abc123",
+      "170 GOTO 140",
+      "175 DIM t(max, 2)",
+      "176 LET t(n1 - 1, 2) = t(0, 1) + 1",
+      "180 END",
+      "190",
+      "",
+      "RUN",
+      "LET x = 1 < 2",
+      "RUN 123",
+      "HELL",
+      "100 LET = 1",
+      "100 LET a = (1 + 2",
+      "100 LET a = 1 + ;",
+      "100 LET = 1 ]",
+      "[100 PRINT a",
+  };
+
+  GIVEN("valid and invalid lines") {
+    for (const auto& line : lines) {
+      CAPTURE(line);
+      REQUIRE(parser_result_into_str(fused.parse(tokenizer, line)) ==
+              parser_result_into_str(two_pass.parse(tokenizer.lex(line))));
+    }
+  }
+}
@@ -23,6 +23,7 @@ SCENARIO("tokenizer can lex single character tokens", "[tokenizer]") {
     WHEN("=") { REQUIRE(lex_result_into_string(tokenizer.lex("=")) == "="); }
     WHEN("(") { REQUIRE(lex_result_into_string(tokenizer.lex("(")) == "("); }
     WHEN(")") { REQUIRE(lex_result_into_string(tokenizer.lex(")")) == ")"); }
+    WHEN(",") { REQUIRE(lex_result_into_string(tokenizer.lex(",")) == ","); }
     WHEN("invalid characters") {
       REQUIRE(lex_result_into_string(tokenizer.lex("[];")) == "[];");
     }
@@ -111,6 +112,40 @@ SCENARIO("tokenizer can lex key words (except for REM)", "[tokenizer]") {
     WHEN("END") {
       REQUIRE(lex_result_into_string(tokenizer.lex("END")) == "END");
     }
+    WHEN("FOR") {
+      REQUIRE(lex_result_into_string(tokenizer.lex("FOR")) == "FOR");
+    }
+    WHEN("TO") { REQUIRE(lex_result_into_string(tokenizer.lex("TO")) == "TO"); }
+    WHEN("STEP") {
+      REQUIRE(lex_result_into_string(tokenizer.lex("STEP")) == "STEP");
+    }
+    WHEN("NEXT") {
+      REQUIRE(lex_result_into_string(tokenizer.lex("NEXT")) == "NEXT");
+    }
+    WHEN("GOSUB") {
+      REQUIRE(lex_result_into_string(tokenizer.lex("GOSUB")) == "GOSUB");
+    }
+    WHEN("RETURN") {
+      REQUIRE(lex_result_into_string(tokenizer.lex("RETURN")) == "RETURN");
+    }
+    WHEN("DIM") {
+      REQUIRE(lex_result_into_string(tokenizer.lex("DIM")) == "DIM");
+    }
+    WHEN("MAT") {
+      REQUIRE(lex_result_into_string(tokenizer.lex("MAT")) == "MAT");
+    }
+    WHEN("SORT") {
+      REQUIRE(lex_result_into_string(tokenizer.lex("SORT")) == "SORT");
+    }
+    WHEN("SUM") {
+      REQUIRE(lex_result_into_string(tokenizer.lex("SUM")) == "SUM");
+    }
+    WHEN("MIN") {
+      REQUIRE(lex_result_into_string(tokenizer.lex("MIN")) == "MIN");
+    }
+    WHEN("MAX") {
+      REQUIRE(lex_result_into_string(tokenizer.lex("MAX")) == "MAX");
+    }
   }
   GIVEN("single command") {
     WHEN("RUN") {
@@ -125,6 +160,15 @@ SCENARIO("tokenizer can lex key words (except for REM)", "[tokenizer]") {
     WHEN("CLEAR") {
       REQUIRE(lex_result_into_string(tokenizer.lex("CLEAR")) == "CLEAR");
     }
+    WHEN("UNDO") {
+      REQUIRE(lex_result_into_string(tokenizer.lex("UNDO")) == "UNDO");
+    }
+    WHEN("REDO") {
+      REQUIRE(lex_result_into_string(tokenizer.lex("REDO")) == "REDO");
+    }
+    WHEN("CHECK") {
+      REQUIRE(lex_result_into_string(tokenizer.lex("CHECK")) == "CHECK");
+    }
     WHEN("HELP") {
       REQUIRE(lex_result_into_string(tokenizer.lex("HELP")) == "HELP");
     }
@@ -140,8 +184,45 @@ SCENARIO("tokenizer can lex key words (except for REM)", "[tokenizer]") {
               "THEN"
               "30");
     }
+    WHEN("DIM a(n, 2)") {
+      REQUIRE(lex_result_into_string(tokenizer.lex("DIM a(n, 2)")) ==
+              "DIM"
+              "a"
+              "("
+              "n"
+              ","
+              "2"
+              ")");
+    }
+    WHEN("MAT a = b * MAX(c)") {
+      REQUIRE(lex_result_into_string(tokenizer.lex("MAT a = b * MAX(c)")) ==
+              "MAT"
+              "a"
+              "="
+              "b"
+              "*"
+              "MAX"
+              "("
+              "c"
+              ")");
+    }
   }
 }
+SCENARIO("tokenizer reserves key words", "[tokenizer]") {
+  auto tokenizer = tokenizer::Tokenizer();
+  GIVEN("a key word and a variable spelled alike") {
+    auto tokens = tokenizer.lex("SUM sum");
+    REQUIRE(dynamic_cast<const tokenizer::token::Word*>(tokens[0].get()) !=
+            nullptr);
+    REQUIRE(typeid(*tokens[1]) == typeid(tokenizer::token::Variant));
+  }
+  GIVEN("a command") {
+    auto tokens = tokenizer.lex("UNDO");
+    REQUIRE(dynamic_cast<const tokenizer::token::Word*>(tokens[0].get()) !=
+            nullptr);
+  }
+}
+
 SCENARIO("tokenizer can lex REM", "[tokenizer]") {
   auto tokenizer = tokenizer::Tokenizer();
   GIVEN("simple REM") {
@@ -159,3 +240,28 @@ SCENARIO("tokenizer can lex REM", "[tokenizer]") {
     }
   }
 }
+
+SCENARIO("tokenizer can hand out tokens on demand", "[tokenizer]") {
+  auto tokenizer = tokenizer::Tokenizer();
+  GIVEN("a statement") {
+    tokenizer.reset("10 IF a < 2 THEN 30");
+    Vec<Rc<tokenizer::Token>> tokens;
+    do {
+      tokens.push_back(tokenizer.next());
+    } while (typeid(*tokens.back()) != typeid(tokenizer::token::EoL));
+    REQUIRE(lex_result_into_string(tokens) ==
+            lex_result_into_string(tokenizer.lex("10 IF a < 2 THEN 30")));
+  }
+  GIVEN("REM after a line number") {
+    tokenizer.reset("100 REM hello world");
+    Vec<Rc<tokenizer::Token>> tokens;
+    do {
+      tokens.push_back(tokenizer.next());
+    } while (typeid(*tokens.back()) != typeid(tokenizer::token::EoL));
+    REQUIRE(tokens.size() == 4);
+    REQUIRE(lex_result_into_string(tokens) ==
+            "100"
+            "REM"
+            "hello world");
+  }
+}
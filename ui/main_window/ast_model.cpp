@@ -0,0 +1,132 @@
+#include "ast_model.h"
+
+#include <algorithm>
+
+AstModel::AstModel(const engine::MiniBasic *engine, QObject *parent)
+    : QAbstractItemModel(parent), engine_(engine) {}
+
+AstModel::~AstModel() = default;
+
+void AstModel::apply_change(const engine::LineChange &change) {
+  if (change.kind == engine::LineChange::Kind::Reset) {
+    beginResetModel();
+    lines_ = engine_->get_line_numbers();
+    subtrees_.clear();
+    endResetModel();
+    return;
+  }
+
+  // Later changes may have superseded this one, so follow the engine state
+  auto at = std::lower_bound(lines_.begin(), lines_.end(), change.line);
+  auto row = static_cast<int>(at - lines_.begin());
+  auto shown = at != lines_.end() && *at == change.line;
+  auto exists = engine_->has_line(change.line);
+
+  if (shown) {
+    beginRemoveRows(QModelIndex(), row, row);
+    lines_.erase(at);
+    subtrees_.erase(change.line);
+    endRemoveRows();
+  }
+  if (exists) {
+    beginInsertRows(QModelIndex(), row, row);
+    lines_.insert(lines_.begin() + row, change.line);
+    endInsertRows();
+  }
+}
+
+QModelIndex AstModel::index(int row, int column,
+                            const QModelIndex &parent) const {
+  if (!hasIndex(row, column, parent)) {
+    return {};
+  }
+  if (!parent.isValid()) {
+    return createIndex(row, column, nullptr);
+  }
+  auto *node = parent.internalPointer() == nullptr
+                   ? subtree(lines_[parent.row()])
+                   : static_cast<Node *>(parent.internalPointer());
+  return createIndex(row, column, node->children[row].get());
+}
+
+QModelIndex AstModel::parent(const QModelIndex &child) const {
+  if (!child.isValid() || child.internalPointer() == nullptr) {
+    return {};
+  }
+  auto *parent = static_cast<Node *>(child.internalPointer())->parent;
+  if (parent->parent == nullptr) {
+    // Root of a line subtree, shown as the top-level row
+    return createIndex(line_row(parent->label.toLongLong()), 0, nullptr);
+  }
+  return createIndex(parent->row, 0, parent);
+}
+
+int AstModel::rowCount(const QModelIndex &parent) const {
+  if (!parent.isValid()) {
+    return static_cast<int>(lines_.size());
+  }
+  if (parent.column() != 0) {
+    return 0;
+  }
+  auto *node = parent.internalPointer() == nullptr
+                   ? subtree(lines_[parent.row()])
+                   : static_cast<Node *>(parent.internalPointer());
+  return static_cast<int>(node->children.size());
+}
+
+int AstModel::columnCount(const QModelIndex &parent) const { return 1; }
+
+bool AstModel::hasChildren(const QModelIndex &parent) const {
+  if (!parent.isValid()) {
+    return !lines_.empty();
+  }
+  // Every line has a statement below it; avoid building it just to say so
+  if (parent.internalPointer() == nullptr) {
+    return true;
+  }
+  return !static_cast<Node *>(parent.internalPointer())->children.empty();
+}
+
+QVariant AstModel::data(const QModelIndex &index, int role) const {
+  if (!index.isValid() || role != Qt::DisplayRole) {
+    return {};
+  }
+  if (index.internalPointer() == nullptr) {
+    return QString::number(lines_[index.row()]);
+  }
+  return static_cast<Node *>(index.internalPointer())->label;
+}
+
+AstModel::Node *AstModel::subtree(int64_t line) const {
+  auto found = subtrees_.find(line);
+  if (found != subtrees_.end()) {
+    return found->second.get();
+  }
+
+  // Rows after the line number nest by depth
+  auto root = std::make_unique<Node>();
+  root->label = QString::number(line);
+  auto rows = engine_->get_line_ast_rows(line);
+
+  Vec<std::pair<uint32_t, Node *>> path{{0, root.get()}};
+  for (size_t i = 1; i < rows.size(); ++i) {
+    const auto &row = rows[i];
+    while (path.size() > 1 && path.back().first >= row.depth) {
+      path.pop_back();
+    }
+    auto *parent = path.back().second;
+    auto node = std::make_unique<Node>();
+    node->label = QString::fromStdString(row.label);
+    node->parent = parent;
+    node->row = static_cast<int>(parent->children.size());
+    path.emplace_back(row.depth, node.get());
+    parent->children.push_back(std::move(node));
+  }
+
+  return subtrees_.emplace(line, std::move(root)).first->second.get();
+}
+
+int AstModel::line_row(int64_t line) const {
+  return static_cast<int>(
+      std::lower_bound(lines_.begin(), lines_.end(), line) - lines_.begin());
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <QAbstractItemModel>
+#include <memory>
+#include <unordered_map>
+
+#include "engine.h"
+
+// Syntax tree of the loaded program for a QTreeView. Top-level rows are
+// the program lines and cost nothing until a line is expanded, at which
+// point that line's subtree is built from its dump and kept until the line
+// changes.
+class AstModel : public QAbstractItemModel {
+  Q_OBJECT
+
+ public:
+  explicit AstModel(const engine::MiniBasic *engine,
+                    QObject *parent = nullptr);
+  ~AstModel() override;
+
+  void apply_change(const engine::LineChange &change);
+
+  [[nodiscard]] QModelIndex index(
+      int row, int column, const QModelIndex &parent) const override;
+  [[nodiscard]] QModelIndex parent(const QModelIndex &child) const override;
+  [[nodiscard]] int rowCount(const QModelIndex &parent) const override;
+  [[nodiscard]] int columnCount(const QModelIndex &parent) const override;
+  [[nodiscard]] bool hasChildren(const QModelIndex &parent) const override;
+  [[nodiscard]] QVariant data(const QModelIndex &index,
+                              int role) const override;
+
+ private:
+  struct Node {
+    QString label;
+    Node *parent{};
+    int row{};
+    Vec<std::unique_ptr<Node>> children;
+  };
+
+  const engine::MiniBasic *engine_;
+
+  // Line numbers in order, one top-level row each
+  Vec<int64_t> lines_;
+  // Subtrees of expanded lines, built on first use
+  mutable std::unordered_map<int64_t, std::unique_ptr<Node>> subtrees_;
+
+  Node *subtree(int64_t line) const;
+  [[nodiscard]] int line_row(int64_t line) const;
+};
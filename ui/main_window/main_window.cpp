@@ -1,19 +1,99 @@
 #include "main_window.h"
 
 #include <QFileDialog>
+#include <QListView>
 #include <QObject>
+#include <QTextBlock>
+#include <QTextCursor>
+#include <QTextDocument>
+#include <QTimer>
+#include <algorithm>
 #include <fstream>
 
 #include "ui_main_window.h"
 
+namespace {
+
+// Replaces `count` blocks starting at block `first` of a document that shows
+// `total` blocks with `text`, which may span several blocks. An empty text
+// removes the blocks together with their separator.
+void splice_blocks(QTextDocument *document, int total, int first, int count,
+                   const QString &text) {
+  QTextCursor cursor(document);
+  if (count == 0) {
+    if (text.isEmpty()) {
+      return;
+    }
+    if (total == 0) {
+      cursor.insertText(text);
+    } else if (first < total) {
+      cursor.setPosition(document->findBlockByNumber(first).position());
+      cursor.insertText(text + '\n');
+    } else {
+      cursor.movePosition(QTextCursor::End);
+      cursor.insertText('\n' + text);
+    }
+    return;
+  }
+
+  auto last = document->findBlockByNumber(first + count - 1);
+  auto from = document->findBlockByNumber(first).position();
+  auto to = last.position() + last.length() - 1;
+  if (text.isEmpty()) {
+    if (first + count < total) {
+      ++to;
+    } else if (first > 0) {
+      --from;
+    }
+  }
+  cursor.setPosition(from);
+  cursor.setPosition(to, QTextCursor::KeepAnchor);
+  if (text.isEmpty()) {
+    cursor.removeSelectedText();
+  } else {
+    cursor.insertText(text);
+  }
+}
+
+// Source lines end with a newline; blocks are separated instead
+QString into_blocks(const Str &lines) {
+  auto text = QString::fromStdString(lines);
+  if (text.endsWith('\n')) {
+    text.chop(1);
+  }
+  return text;
+}
+
+}  // namespace
+
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent),
       ui(new Ui::MainWindow),
-      engine(new engine::MiniBasic) {
+      engine(new engine::MiniBasic),
+      ast_model(new AstModel(engine, this)),
+      output_model(new OutputModel(kScrollback, this)),
+      load_progress_(new QProgressBar(this)),
+      load_cancel_(new QPushButton(QObject::tr("Cancel"), this)),
+      load_poll_(new QTimer(this)) {
   ui->setupUi(this);
+  ui->treeDisplay->setModel(ast_model);
+  ui->resultDisplay->setModel(output_model);
+  connect(output_model, &OutputModel::rowsInserted, ui->resultDisplay,
+          &QListView::scrollToBottom);
+
+  load_progress_->setRange(0, 100);
+  ui->statusbar->addPermanentWidget(load_progress_);
+  ui->statusbar->addPermanentWidget(load_cancel_);
+  load_progress_->hide();
+  load_cancel_->hide();
+  load_poll_->setInterval(kLoadPollMs);
+  connect(load_poll_, &QTimer::timeout, this, &MainWindow::poll_load);
+  connect(load_cancel_, &QPushButton::released, this,
+          &MainWindow::cancel_load);
 }
 
 MainWindow::~MainWindow() {
+  engine->set_output_sink(nullptr);
   delete engine;
   delete ui;
 }
@@ -21,7 +101,7 @@ MainWindow::~MainWindow() {
 void MainWindow::on_cmdLineEdit_editingFinished() {
   QString cmd = ui->cmdLineEdit->text();
   ui->cmdLineEdit->setText("");
-  ui->resultDisplay->append(QString::fromStdString("> " + cmd.toStdString()));
+  output_model->append(QString::fromStdString("> " + cmd.toStdString()));
 
   if (redirect_to_engine_input_) {
     redirect_to_engine_input_ = !engine->handle_input(cmd.toStdString());
@@ -53,39 +133,102 @@ void MainWindow::on_cmdLineEdit_editingFinished() {
         redirect_to_engine_input_ = true;
         break;
       case UIBehavior::FinishRun:
+      case UIBehavior::Yield:
       case UIBehavior::None:
         break;
     }
     if (!output.empty()) {
-      ui->resultDisplay->append(QString::fromStdString(output));
+      output_model->append(QString::fromStdString(output));
       output.clear();
-      refresh();
     }
+    refresh();
   }
 }
 
 void MainWindow::on_btnLoadCode_released() {
-  ui->resultDisplay->append(QString::fromStdString("> LOAD"));
+  output_model->append(QString::fromStdString("> LOAD"));
   load();
 }
 
 void MainWindow::on_btnRunCode_released() {
-  ui->resultDisplay->append(QString::fromStdString("> RUN"));
+  output_model->append(QString::fromStdString("> RUN"));
   run();
 }
 
 void MainWindow::on_btnClearCode_released() {
-  ui->resultDisplay->append(QString::fromStdString("> CLEAR"));
+  output_model->append(QString::fromStdString("> CLEAR"));
   clear();
 }
+void MainWindow::on_btnSaveOutput_toggled(bool checked) {
+  engine->set_output_sink(nullptr);
+  output_file_.close();
+  if (!checked) {
+    return;
+  }
+
+  QString filename = QFileDialog::getSaveFileName(
+      nullptr, QObject::tr("Save Output"), QDir::currentPath());
+  if (filename.length() != 0) {
+    output_file_.open(filename.toStdString(), std::ios::out);
+  }
+  if (!output_file_.is_open()) {
+    ui->btnSaveOutput->setChecked(false);
+    return;
+  }
+  // Streams straight from the engine, so nothing is lost to the scrollback
+  engine->set_output_sink(&output_file_);
+}
 void MainWindow::refresh() {
-  ui->CodeDisplay->setText(QString::fromStdString(engine->get_source_copy()));
-  ui->treeDisplay->setText(QString::fromStdString(engine->get_ast_copy()));
+  auto changes = engine->take_changes();
+  if (changes.empty()) {
+    return;
+  }
+  for (const auto &change : changes) {
+    apply_change(change);
+    ast_model->apply_change(change);
+  }
   update();
 }
+void MainWindow::rebuild_views() {
+  shown_lines_ = engine->get_line_numbers();
+  ui->CodeDisplay->setPlainText(into_blocks(engine->get_source_copy()));
+}
+void MainWindow::apply_change(const engine::LineChange &change) {
+  if (change.kind == engine::LineChange::Kind::Reset) {
+    rebuild_views();
+    return;
+  }
+
+  // Later changes may have superseded this one, so render what the engine
+  // holds now rather than trusting the kind
+  auto at = std::lower_bound(shown_lines_.begin(), shown_lines_.end(),
+                             change.line);
+  auto index = static_cast<int>(at - shown_lines_.begin());
+  auto shown = at != shown_lines_.end() && *at == change.line;
+  auto exists = engine->has_line(change.line);
+  if (!shown && !exists) {
+    return;
+  }
+
+  auto code = exists ? QString::fromStdString(engine->get_source_line(
+                           change.line))
+                     : QString();
+  splice_blocks(ui->CodeDisplay->document(),
+                static_cast<int>(shown_lines_.size()), index, shown ? 1 : 0,
+                code);
+
+  if (!shown) {
+    shown_lines_.insert(at, change.line);
+  } else if (!exists) {
+    shown_lines_.erase(at);
+  }
+}
 void MainWindow::run() {
   engine->reset_pc();
-  continue_run();
+  // A run still going picks up the reset at its next slice
+  if (!slice_pending_) {
+    continue_run();
+  }
 }
 void MainWindow::load() {
   QString filename = QFileDialog::getOpenFileName(
@@ -98,33 +241,69 @@ void MainWindow::load() {
   if (!in.good()) {
     return;
   }
-  engine->load_source(in);
+  // The source shows at once; statements arrive as the engine's worker
+  // parses them, and RUN parses what it reaches meanwhile
+  engine->begin_load(in);
   in.close();
-
   refresh();
+  if (engine->loading()) {
+    load_progress_->setValue(0);
+    load_progress_->show();
+    load_cancel_->show();
+    load_poll_->start();
+  }
+}
+void MainWindow::poll_load() {
+  Str output;
+  auto left = engine->poll_load(output);
+  auto progress = engine->load_progress();
+  if (progress.total != 0) {
+    load_progress_->setValue(
+        static_cast<int>(progress.parsed * 100 / progress.total));
+  }
+  if (!output.empty()) {
+    output_model->append(QString::fromStdString(output));
+  }
+  refresh();
+  if (left == 0) {
+    end_load();
+  }
+}
+void MainWindow::cancel_load() {
+  // Install what is done; the rest is parsed when a run reaches it
+  poll_load();
+  engine->cancel_load();
+  end_load();
+}
+void MainWindow::end_load() {
+  load_poll_->stop();
+  load_progress_->hide();
+  load_cancel_->hide();
 }
 void MainWindow::list() {}
 void MainWindow::clear() {
+  end_load();
   engine->clear();
   refresh();
 }
 void MainWindow::help() {}
 void MainWindow::quit() {}
 void MainWindow::continue_run() {
-  UIBehavior behavior;
+  // Run in slices and let the event loop breathe in between, so a long
+  // program keeps the window responsive
   Str output;
-  while (true) {
-    behavior = engine->step_run(output);
-    if (behavior == UIBehavior::Input) {
-      redirect_to_engine_input_ = true;
-    }
-    if (!output.empty()) {
-      ui->resultDisplay->append(QString::fromStdString(output));
-      output.clear();
-      refresh();
-    }
-    if (behavior == UIBehavior::Input || behavior == UIBehavior::FinishRun) {
-      return;
-    }
+  auto behavior = engine->run_for(output, kRunSlice);
+  if (behavior == UIBehavior::Input) {
+    redirect_to_engine_input_ = true;
+  } else if (behavior == UIBehavior::Yield && !slice_pending_) {
+    slice_pending_ = true;
+    QTimer::singleShot(0, this, [this]() {
+      slice_pending_ = false;
+      continue_run();
+    });
+  }
+  if (!output.empty()) {
+    output_model->append(QString::fromStdString(output));
   }
+  refresh();
 }
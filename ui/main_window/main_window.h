@@ -1,7 +1,13 @@
 #pragma once
 #include <QMainWindow>
+#include <QProgressBar>
+#include <QPushButton>
+#include <QTimer>
+#include <fstream>
 
+#include "ast_model.h"
 #include "engine.h"
+#include "output_model.h"
 
 QT_BEGIN_NAMESPACE
 namespace Ui {
@@ -21,19 +27,44 @@ class MainWindow : public QMainWindow {
   void on_btnLoadCode_released();
   void on_btnRunCode_released();
   void on_btnClearCode_released();
+  void on_btnSaveOutput_toggled(bool checked);
 
  private:
   Ui::MainWindow *ui;
   engine::MiniBasic *engine;
+  AstModel *ast_model;
+  OutputModel *output_model;
+
+  // Shown in the status bar while a LOAD is parsed in the background
+  QProgressBar *load_progress_;
+  QPushButton *load_cancel_;
+  QTimer *load_poll_;
+
+  static constexpr int kScrollback = 100000;
+  // How often a background LOAD is checked for parsed lines
+  static constexpr int kLoadPollMs = 50;
+  // Loop iterations a run gets before the window handles events again
+  static constexpr uint64_t kRunSlice = 1 << 16;
+  std::ofstream output_file_;
 
   bool redirect_to_engine_input_{false};
+  // A continue_run() is queued behind the event loop
+  bool slice_pending_{false};
+
+  // Line numbers shown in the code view, one block each
+  Vec<int64_t> shown_lines_;
 
   void run();
   void continue_run();
   void load();
+  void poll_load();
+  void cancel_load();
+  void end_load();
   void list();
   void clear();
   void help();
   void quit();
   void refresh();
+  void rebuild_views();
+  void apply_change(const engine::LineChange &change);
 };
@@ -0,0 +1,96 @@
+#include "output_model.h"
+
+#include <algorithm>
+
+OutputModel::OutputModel(int scrollback, QObject *parent)
+    : QAbstractListModel(parent), scrollback_(std::max(scrollback, 1)) {
+  frame_.setSingleShot(true);
+  frame_.setInterval(16);
+  connect(&frame_, &QTimer::timeout, this, &OutputModel::flush);
+}
+
+void OutputModel::append(const QString &text) {
+  auto lines = text.split('\n');
+  if (lines.size() > 1 && lines.back().isEmpty()) {
+    lines.pop_back();
+  }
+  pending_.append(lines);
+
+  // Only the last `scrollback_` pending lines can ever be shown
+  if (pending_.size() > scrollback_) {
+    pending_.erase(pending_.begin(), pending_.end() - scrollback_);
+  }
+  if (!frame_.isActive()) {
+    frame_.start();
+  }
+}
+
+void OutputModel::flush() {
+  frame_.stop();
+  if (pending_.isEmpty()) {
+    return;
+  }
+  auto incoming = static_cast<int>(pending_.size());
+  drop_front(std::max(0, size_ + incoming - scrollback_));
+
+  if (lines_.size() != static_cast<size_t>(scrollback_)) {
+    lines_.resize(scrollback_);
+  }
+  beginInsertRows(QModelIndex(), size_, size_ + incoming - 1);
+  for (auto &line : pending_) {
+    lines_[(head_ + size_) % scrollback_] = std::move(line);
+    ++size_;
+  }
+  endInsertRows();
+  pending_.clear();
+}
+
+void OutputModel::clear() {
+  frame_.stop();
+  pending_.clear();
+  beginResetModel();
+  lines_.clear();
+  head_ = 0;
+  size_ = 0;
+  endResetModel();
+}
+
+void OutputModel::set_scrollback(int scrollback) {
+  flush();
+  scrollback = std::max(scrollback, 1);
+  drop_front(std::max(0, size_ - scrollback));
+
+  // Unroll the ring into the new capacity
+  Vec<QString> lines(scrollback);
+  for (int i = 0; i < size_; ++i) {
+    lines[i] = std::move(lines_[(head_ + i) % lines_.size()]);
+  }
+  lines_ = std::move(lines);
+  head_ = 0;
+  scrollback_ = scrollback;
+}
+
+int OutputModel::rowCount(const QModelIndex &parent) const {
+  return parent.isValid() ? 0 : size_;
+}
+
+QVariant OutputModel::data(const QModelIndex &index, int role) const {
+  if (!index.isValid() || role != Qt::DisplayRole || index.row() >= size_) {
+    return {};
+  }
+  return lines_[(head_ + index.row()) % lines_.size()];
+}
+
+void OutputModel::drop_front(int count) {
+  count = std::min(count, size_);
+  if (count == 0) {
+    return;
+  }
+  beginRemoveRows(QModelIndex(), 0, count - 1);
+  for (int i = 0; i < count; ++i) {
+    lines_[(head_ + i) % lines_.size()].clear();
+  }
+  head_ = static_cast<int>((head_ + count) % lines_.size());
+  size_ -= count;
+  endRemoveRows();
+}
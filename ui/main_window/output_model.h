@@ -0,0 +1,41 @@
+#pragma once
+#include <QAbstractListModel>
+#include <QStringList>
+#include <QTimer>
+
+#include "type.h"
+
+// Console lines for a QListView. Keeps at most `scrollback` lines in a ring
+// buffer and coalesces appends until the next frame, so printing many lines
+// costs one model update per frame and the view only draws visible rows.
+class OutputModel : public QAbstractListModel {
+  Q_OBJECT
+
+ public:
+  explicit OutputModel(int scrollback = 100000, QObject *parent = nullptr);
+
+  // Each call starts a new line, like QTextEdit::append
+  void append(const QString &text);
+  void flush();
+  void clear();
+
+  void set_scrollback(int scrollback);
+  [[nodiscard]] int scrollback() const { return scrollback_; }
+
+  [[nodiscard]] int rowCount(const QModelIndex &parent) const override;
+  [[nodiscard]] QVariant data(const QModelIndex &index,
+                              int role) const override;
+
+ private:
+  int scrollback_;
+
+  // Ring buffer: row r lives at (head_ + r) % lines_.size()
+  Vec<QString> lines_;
+  int head_{};
+  int size_{};
+
+  QStringList pending_;
+  QTimer frame_;
+
+  void drop_front(int count);
+};